@@ -0,0 +1,776 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fnmatch.h>
+#include <fcntl.h>
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Scaling of the path operations, for the linear scan over the raw
+// headers and for the mounted index, plus the entry table walk and the
+// hex kernels that parse the newc and crc headers. The walk case
+// nests cpiofs_dir_read, the ftw case is the same tree in cpiofs_walk.
+// The glob case finds GLOB_PATTERN with cpiofs_glob, glob/list with
+// listings filtered by fnmatch. The verify case checks the whole archive
+// with one thread and with one per core, the sum case times the byte
+// sum kernels of the crc checksum. The mount/threads cases find the
+// header chain with cpiofs_mount_threads. The stat/phf case looks the
+// paths up through the perfect hash that cpioembed compiles in. The aio cases read the first
+// READ_CHUNK bytes of the sampled files from the archive file, one
+// pread at a time and AIO_DEPTH at once through cpiofs_file_read_async.
+// The send cases write the sampled files to /dev/null through a buffer,
+// or with cpiofs_file_sendfile from memory and from the kept file.
+// The extract cases write the whole archive under /tmp with
+// cpiofs_extract, out of memory and with copy_file_range from the kept
+// file, with one thread and one per core; extract/KiB is the throughput.
+//
+// usage: bench1 [--csv] [-r repeat] [-n ops] <archive.cpio>...
+//   --csv            one "archive,case,mode,ops,ns_per_op,headers_per_op"
+//                    line per measure, headers_per_op is empty unless the
+//                    library is built with CPIO_STATS
+//   -r <repeat>      passes over the index and table cases (10)
+//   -n <ops>         sampled files for stat, open, read and seek (1000)
+//
+// The scan is linear per lookup, its cases run a single pass over a
+// sample of at most SCAN_OPS files, and the recursive walk is skipped
+// past SCAN_WALK_MAX entries.
+
+#define SCAN_OPS        200U
+#define SCAN_WALK_MAX   20000U
+#define READ_CHUNK      65536U
+#define SEEK_CHUNK      4096U
+#define GLOB_PATTERN    "d*/d*/f1*"     // cpiogen names directories d* and files f*
+
+static int csv = 0;
+static const char *archive = "";
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t headers_now(void) {
+#ifdef CPIO_STATS
+    return cpio_stat_headers;
+#else
+    return 0;
+#endif
+}
+
+static void report(const char *name, const char *mode, uint64_t ns, uint64_t ops, uint64_t headers) {
+    double per_op = (double)ns / (double)(ops ? ops : 1);
+    double hdr_op = (double)headers / (double)(ops ? ops : 1);
+#ifdef CPIO_STATS
+    const int stats = 1;
+#else
+    const int stats = 0;
+#endif
+    if (csv) {
+        if (stats) {
+            printf("%s,%s,%s,%" PRIu64 ",%.1f,%.2f\n", archive, name, mode, ops, per_op, hdr_op);
+        } else {
+            printf("%s,%s,%s,%" PRIu64 ",%.1f,\n", archive, name, mode, ops, per_op);
+        }
+    } else if (stats) {
+        printf("%-12s %-8s %10" PRIu64 " ops %12.1f ns/op %10.2f hdr/op\n", name, mode, ops, per_op, hdr_op);
+    } else {
+        printf("%-12s %-8s %10" PRIu64 " ops %12.1f ns/op\n", name, mode, ops, per_op);
+    }
+}
+
+// keeps the compiler from dropping the measured loops
+static volatile uint64_t sink;
+
+static uint64_t rnd_state = 1;
+
+static uint32_t rnd(void) {
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return (uint32_t)((rnd_state * 2685821657736338717ULL) >> 32);
+}
+
+static void bench_walk_raw(const cpiofs_t *fs, unsigned int repeat) {
+    uint64_t sum = 0;
+    uint64_t ops = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        unsigned long dsize = fs->size;
+        for (const struct header_old_cpio* pdata = cpio_init_iter(fs->head, dsize);
+             pdata != NULL;
+             pdata = cpio_goto_next(pdata, &dsize)) {
+            if ((cpio_get_mode(pdata) & CPIO_FILE_TYPE_MASK) != 0) {
+                sum += cpio_get_filesize(pdata);
+            }
+            ops ++;
+        }
+    }
+    report("headers", "raw", now_ns() - start, ops, headers_now() - hdr);
+    sink = sum;
+}
+
+static void bench_walk_table(const cpiofs_t *fs, unsigned int repeat) {
+    const cpiofs_index_t *index = &fs->index;
+    uint64_t sum = 0;
+    uint64_t ops = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        for (uint32_t e = 0; e < index->count; e++) {
+            if ((index->mode[e] & CPIO_FILE_TYPE_MASK) != 0) {
+                sum += index->fsize[e];
+            }
+            ops ++;
+        }
+    }
+    report("headers", "table", now_ns() - start, ops, headers_now() - hdr);
+    sink = sum;
+}
+
+static void bench_stat(const char *mode, const cpiofs_t *fs, char **paths, uint32_t npaths, unsigned int repeat) {
+    cpio_info_t info;
+    uint64_t found = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        for (uint32_t i = 0; i < npaths; i++) {
+            if (cpiofs_stat(fs, paths[i], &info) == CPIO_ERR_OK) {
+                found ++;
+            }
+        }
+    }
+    report("stat", mode, now_ns() - start, (uint64_t)npaths * repeat, headers_now() - hdr);
+    sink = found;
+}
+
+static void bench_open(const char *mode, cpiofs_t *fs, char **paths, uint32_t npaths, unsigned int repeat) {
+    cpio_file_t file;
+    uint64_t found = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        for (uint32_t i = 0; i < npaths; i++) {
+            if (cpiofs_file_open(fs, &file, paths[i]) == CPIO_ERR_OK) {
+                found ++;
+                cpiofs_file_close(&file);
+            }
+        }
+    }
+    report("open", mode, now_ns() - start, (uint64_t)npaths * repeat, headers_now() - hdr);
+    sink = found;
+}
+
+// open and read every sampled file from start to end
+static void bench_read(const char *mode, cpiofs_t *fs, char **paths, uint32_t npaths, unsigned int repeat,
+                       uint8_t *buffer) {
+    cpio_file_t file;
+    uint64_t bytes = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        for (uint32_t i = 0; i < npaths; i++) {
+            if (cpiofs_file_open(fs, &file, paths[i]) != CPIO_ERR_OK) {
+                continue;
+            }
+            cpio_ssize_t n;
+            while ((n = cpiofs_file_read(&file, buffer, READ_CHUNK)) > 0) {
+                bytes += (uint64_t)n;
+            }
+            cpiofs_file_close(&file);
+        }
+    }
+    report("read", mode, now_ns() - start, (uint64_t)npaths * repeat, headers_now() - hdr);
+    sink = bytes;
+}
+
+// the files are opened up front, only the seek and the read are measured
+static void bench_seek(const char *mode, cpiofs_t *fs, char **paths, uint32_t npaths, uint64_t ops,
+                       uint8_t *buffer) {
+    cpio_file_t *files = calloc(npaths ? npaths : 1U, sizeof(cpio_file_t));
+    if (files == NULL) {
+        return;
+    }
+    uint32_t nfiles = 0;
+    for (uint32_t i = 0; i < npaths; i++) {
+        if (cpiofs_file_open(fs, &files[nfiles], paths[i]) == CPIO_ERR_OK) {
+            nfiles ++;
+        }
+    }
+    uint64_t bytes = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; (nfiles > 0) && (i < ops); i++) {
+        cpio_file_t *file = &files[rnd() % nfiles];
+        cpio_soff_t size = cpiofs_file_size(file);
+        cpio_soff_t off = (size > 0) ? (cpio_soff_t)(rnd() % (uint32_t)size) : 0;
+        cpiofs_file_seek(file, off, CPIO_SEEK_SET);
+        cpio_ssize_t n = cpiofs_file_read(file, buffer, SEEK_CHUNK);
+        if (n > 0) {
+            bytes += (uint64_t)n;
+        }
+    }
+    report("seek+read", mode, now_ns() - start, nfiles ? ops : 0, headers_now() - hdr);
+    for (uint32_t i = 0; i < nfiles; i++) {
+        cpiofs_file_close(&files[i]);
+    }
+    free(files);
+    sink = bytes;
+}
+
+static void bench_list(const char *mode, cpiofs_t *fs, const char *path, unsigned int repeat) {
+    cpio_dir_t dir;
+    cpio_info_t info;
+    uint64_t ops = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        if (cpiofs_dir_open(fs, &dir, path) != CPIO_ERR_OK) {
+            break;
+        }
+        while (cpiofs_dir_read(&dir, &info) > 0) {
+            ops ++;
+        }
+        cpiofs_dir_close(&dir);
+    }
+    report("list", mode, now_ns() - start, ops, headers_now() - hdr);
+}
+
+// What user code does without cpiofs_glob: list every directory the
+// pattern goes through and match the names one component at a time
+static uint64_t glob_list(cpiofs_t *fs, const char *path, const char *pattern) {
+    cpio_dir_t dir;
+    cpio_info_t info;
+    uint64_t ops = 0;
+    const char *rest = strchr(pattern, '/');
+    char comp[256];
+    size_t clen = (rest != NULL) ? (size_t)(rest - pattern) : strlen(pattern);
+    if ((clen >= sizeof(comp)) || (cpiofs_dir_open(fs, &dir, path) != CPIO_ERR_OK)) {
+        return 0;
+    }
+    memcpy(comp, pattern, clen);
+    comp[clen] = '\0';
+    while (cpiofs_dir_read(&dir, &info) > 0) {
+        char name[256];
+        if (info.filenames >= sizeof(name)) {
+            continue;
+        }
+        memcpy(name, info.filename, info.filenames);
+        name[info.filenames] = '\0';
+        if (fnmatch(comp, name, 0) != 0) {
+            continue;
+        }
+        if (rest == NULL) {
+            ops ++;
+        } else if (info.type == CPIO_DIR_TYPE_MASK) {
+            char sub[CPIO_NAME_MAX];
+            if (info.filepaths < sizeof(sub)) {
+                memcpy(sub, info.filepath, info.filepaths);
+                sub[info.filepaths] = '\0';
+                ops += glob_list(fs, sub, rest + 1);
+            }
+        }
+    }
+    cpiofs_dir_close(&dir);
+    return ops;
+}
+
+static int count_match(const cpio_info_t *info, void *ctx) {
+    (void)info;
+    (*(uint64_t*)ctx) ++;
+    return 0;
+}
+
+static void bench_glob(const char *mode, cpiofs_t *fs, const char *pattern, unsigned int repeat) {
+    uint64_t ops = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        ops += glob_list(fs, "./", pattern);
+    }
+    report("glob/list", mode, now_ns() - start, ops, headers_now() - hdr);
+    ops = 0;
+    hdr = headers_now();
+    start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        cpiofs_glob(fs, pattern, count_match, &ops);
+    }
+    report("glob", mode, now_ns() - start, ops, headers_now() - hdr);
+}
+
+static uint64_t walk(cpiofs_t *fs, const char *path) {
+    cpio_dir_t dir;
+    cpio_info_t info;
+    uint64_t ops = 0;
+    if (cpiofs_dir_open(fs, &dir, path) != CPIO_ERR_OK) {
+        return 0;
+    }
+    while (cpiofs_dir_read(&dir, &info) > 0) {
+        ops ++;
+        if (info.type == CPIO_DIR_TYPE_MASK) {
+            char sub[CPIO_NAME_MAX];
+            if (info.filepaths < sizeof(sub)) {
+                memcpy(sub, info.filepath, info.filepaths);
+                sub[info.filepaths] = '\0';
+                ops += walk(fs, sub);
+            }
+        }
+    }
+    cpiofs_dir_close(&dir);
+    return ops;
+}
+
+static void bench_walk(const char *mode, cpiofs_t *fs, unsigned int repeat) {
+    uint64_t ops = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        ops += walk(fs, "./");
+    }
+    report("walk", mode, now_ns() - start, ops, headers_now() - hdr);
+}
+
+static int count_entry(const cpio_info_t *info, unsigned int depth, cpiofs_walk_event_t event, void *ctx) {
+    (void)info;
+    (void)depth;
+    (void)event;
+    (void)ctx;
+    return CPIOFS_WALK_CONTINUE;
+}
+
+// The same tree in one cpiofs_walk, which indexes a raw archive first
+static void bench_ftw(const char *mode, cpiofs_t *fs, unsigned int repeat) {
+    uint64_t ops = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        int n = cpiofs_walk(fs, "./", count_entry, NULL, CPIOFS_WALK_POSTORDER);
+        // the root is not counted by the nested walk
+        ops += (n > 0) ? (uint64_t)n - 1U : 0;
+    }
+    report("ftw", mode, now_ns() - start, ops, headers_now() - hdr);
+}
+
+static void bench_mount(const uint8_t *data, long size, unsigned int repeat) {
+    cpiofs_t fs;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        cpiofs_mount(&fs, data, size);
+        cpiofs_unmount(&fs);
+    }
+    report("mount", "index", now_ns() - start, repeat, headers_now() - hdr);
+}
+
+// the header chain found by 1, 2, 4... threads, up to one per core, 1
+// being the serial walk of cpiofs_mount
+static void bench_mount_threads(const uint8_t *data, long size, unsigned int repeat) {
+    cpiofs_t fs;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    for (unsigned int nthread = 1; nthread <= ((cores > 1) ? (unsigned int)cores : 2U); nthread *= 2U) {
+        char mode[32];
+        snprintf(mode, sizeof(mode), "threads/%u", nthread);
+        uint64_t hdr = headers_now();
+        uint64_t start = now_ns();
+        for (unsigned int r = 0; r < repeat; r++) {
+            cpiofs_mount_threads(&fs, data, size, nthread);
+            cpiofs_unmount(&fs);
+        }
+        report("mount", mode, now_ns() - start, repeat, headers_now() - hdr);
+    }
+}
+
+static void bench_verify(const char *mode, const cpiofs_t *fs, unsigned int nthread, unsigned int repeat) {
+    uint64_t ops = 0;
+    uint64_t hdr = headers_now();
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        int n = cpiofs_verify(fs, nthread, NULL);
+        ops += (n > 0) ? (uint64_t)n : 0;
+    }
+    report("verify", mode, now_ns() - start, ops, headers_now() - hdr);
+}
+
+#define AIO_DEPTH       32U
+
+static void aio_count(cpio_ssize_t result, void *ctx) {
+    *(uint64_t*)ctx += (result > 0) ? (uint64_t)result : 0;
+}
+
+static void bench_aio(const char *mode, cpiofs_t *fs, int fd, unsigned int flags, char **paths, uint32_t npaths,
+                      unsigned int repeat) {
+    cpiofs_aio_t *aio = NULL;
+    uint8_t *buffer = malloc((size_t)AIO_DEPTH * READ_CHUNK);
+    if ((buffer == NULL) || (cpiofs_aio_open(&aio, fs, fd, AIO_DEPTH, flags) != CPIO_ERR_OK)) {
+        free(buffer);
+        return;
+    }
+    uint64_t bytes = 0;
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        for (uint32_t i = 0; i < npaths; i++) {
+            cpio_file_t file;
+            if (cpiofs_file_open(fs, &file, paths[i]) != CPIO_ERR_OK) {
+                continue;
+            }
+            uint8_t *slot = &buffer[(size_t)(i % AIO_DEPTH) * READ_CHUNK];
+            while (cpiofs_file_read_async(aio, &file, slot, READ_CHUNK, 0, aio_count, &bytes) == CPIO_ERR_BUSY) {
+                cpiofs_aio_poll(aio, 1);
+            }
+            cpiofs_file_close(&file);
+        }
+        cpiofs_aio_poll(aio, AIO_DEPTH);
+    }
+    report("aio", mode, now_ns() - start, (uint64_t)npaths * repeat, 0);
+    sink = bytes;
+    cpiofs_aio_close(aio);
+    free(buffer);
+}
+
+static void bench_pread_fd(cpiofs_t *fs, int fd, char **paths, uint32_t npaths, unsigned int repeat, uint8_t *buffer) {
+    uint64_t bytes = 0;
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        for (uint32_t i = 0; i < npaths; i++) {
+            cpio_file_t file;
+            if (cpiofs_file_open(fs, &file, paths[i]) != CPIO_ERR_OK) {
+                continue;
+            }
+            cpio_size_t n = (file.size < READ_CHUNK) ? file.size : READ_CHUNK;
+            cpio_ssize_t got = cpiofs_read_fd(&fd, file.data, buffer, n);
+            bytes += (got > 0) ? (uint64_t)got : 0;
+            cpiofs_file_close(&file);
+        }
+    }
+    report("aio", "pread", now_ns() - start, (uint64_t)npaths * repeat, 0);
+    sink = bytes;
+}
+
+// The sampled files, whole, to /dev/null: through a buffer or without a copy
+static void bench_send(const char *mode, cpiofs_t *fs, int copy, char **paths, uint32_t npaths, unsigned int repeat,
+                       uint8_t *buffer) {
+    int out = open("/dev/null", O_WRONLY);
+    if (out < 0) {
+        return;
+    }
+    uint64_t bytes = 0;
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        for (uint32_t i = 0; i < npaths; i++) {
+            cpio_file_t file;
+            if (cpiofs_file_open(fs, &file, paths[i]) != CPIO_ERR_OK) {
+                continue;
+            }
+            cpio_ssize_t n;
+            if (copy) {
+                while ((n = cpiofs_file_read(&file, buffer, READ_CHUNK)) > 0) {
+                    bytes += (uint64_t)write(out, buffer, (size_t)n);
+                }
+            } else {
+                while ((n = cpiofs_file_sendfile(&file, out, file.size)) > 0) {
+                    bytes += (uint64_t)n;
+                }
+            }
+            cpiofs_file_close(&file);
+        }
+    }
+    report("send", mode, now_ns() - start, (uint64_t)npaths * repeat, 0);
+    sink = bytes;
+    close(out);
+}
+
+// Extract the whole archive to a temporary directory, once, and remove
+// it; reported per file and per KiB of data
+static void bench_extract(const char *mode, const cpiofs_t *fs, unsigned int nthread, unsigned int flags) {
+    char root[] = "/tmp/bench1_XXXXXX";
+    if (mkdtemp(root) == NULL) {
+        return;
+    }
+    cpiofs_extract_stats_t stats;
+    uint64_t start = now_ns();
+    int ret = cpiofs_extract(fs, root, nthread, flags, &stats);
+    uint64_t ns = now_ns() - start;
+    if (ret == CPIO_ERR_OK) {
+        report("extract", mode, ns, stats.files, 0);
+        report("extract/KiB", mode, ns, (stats.bytes + 1023U) / 1024U, 0);
+    }
+    const cpiofs_index_t *index = &fs->index;
+    char path[CPIO_NAME_MAX + 32U];
+    for (uint32_t r = index->count; r > 0; r--) {
+        uint32_t e = index->sorted[r - 1U];
+        snprintf(path, sizeof(path), "%s/%.*s", root, (int)index->name_len[e], &index->strings[index->name[e]]);
+        remove(path);
+    }
+    rmdir(root);
+}
+
+typedef int (*hex_decode_t)(const char *s, uint32_t *out, unsigned int n);
+
+#define HEX_HEADERS     4096U
+#define HEX_FIELDS      13U
+
+static void bench_hex(const char *mode, hex_decode_t decode, const char *fields, unsigned int repeat) {
+    uint32_t out[HEX_FIELDS];
+    uint64_t sum = 0;
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        for (uint32_t i = 0; i < HEX_HEADERS; i++) {
+            decode(&fields[i * HEX_FIELDS * 8U], out, HEX_FIELDS);
+            sum += out[i % HEX_FIELDS];
+        }
+    }
+    report("hex", mode, now_ns() - start, (uint64_t)HEX_HEADERS * repeat, 0);
+    sink = sum;
+}
+
+static void bench_hex_kernels(unsigned int repeat) {
+    static const char digits[] = "0123456789abcdefABCDEF";
+    char *fields = malloc(HEX_HEADERS * HEX_FIELDS * 8U);
+    if (fields == NULL) {
+        return;
+    }
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < HEX_HEADERS * HEX_FIELDS * 8U; i++) {
+        seed = seed * 1103515245U + 12345U;
+        fields[i] = digits[(seed >> 16) % (sizeof(digits) - 1U)];
+    }
+    bench_hex("scalar", cpio_hex_decode_scalar, fields, repeat * 100U);
+#ifdef CPIO_HEX_X86
+    bench_hex("sse2", cpio_hex_decode_sse2, fields, repeat * 100U);
+    if (__builtin_cpu_supports("avx2")) {
+        bench_hex("avx2", cpio_hex_decode_avx2, fields, repeat * 100U);
+    }
+#endif
+    free(fields);
+}
+
+typedef uint32_t (*sum_t)(const uint8_t *p, size_t n);
+
+#define SUM_BYTES       (1U << 20)
+
+// ops are KiB
+static void bench_sum(const char *mode, sum_t sum, const uint8_t *bytes, unsigned int repeat) {
+    uint64_t total = 0;
+    uint64_t start = now_ns();
+    for (unsigned int r = 0; r < repeat; r++) {
+        total += sum(bytes, SUM_BYTES);
+    }
+    report("sum", mode, now_ns() - start, (uint64_t)repeat * (SUM_BYTES / 1024U), 0);
+    sink = total;
+}
+
+static void bench_sum_kernels(unsigned int repeat) {
+    uint8_t *bytes = malloc(SUM_BYTES);
+    if (bytes == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < SUM_BYTES; i++) {
+        bytes[i] = (uint8_t)(i * 2654435761U >> 24);
+    }
+    bench_sum("scalar", cpio_sum_scalar, bytes, repeat * 10U);
+#ifdef CPIO_HEX_X86
+    bench_sum("sse2", cpio_sum_sse2, bytes, repeat * 10U);
+    if (__builtin_cpu_supports("avx2")) {
+        bench_sum("avx2", cpio_sum_avx2, bytes, repeat * 10U);
+    }
+#endif
+    free(bytes);
+}
+
+static int bench_archive(const char *path, unsigned int repeat, uint32_t nops) {
+    int result = 0;
+    uint8_t *data = NULL;
+    uint8_t *buffer = NULL;
+    char **paths = NULL;
+    uint32_t npaths = 0;
+    cpiofs_t mounted = { 0 };
+
+    FILE *fp = fopen(path, "rb");
+    if (NULL == fp) {
+        fprintf(stderr, "impossible to read file: %s\n", path);
+        return -2;
+    }
+    fseek(fp, 0, SEEK_END);
+    long fsize = ftell(fp);
+    rewind(fp);
+    data = (fsize > 0) ? malloc(fsize) : NULL;
+    if ((NULL == data) || (fread(data, 1, fsize, fp) != (size_t)fsize)) {
+        result = -3;
+        fprintf(stderr, "impossible to load: %s\n", path);
+        goto end;
+    }
+
+    cpiofs_t raw = {
+        .head = (const struct header_old_cpio *)data,
+        .size = fsize,
+        .resource_count = 0,
+    };
+    if (cpiofs_mount(&mounted, data, fsize) != CPIO_ERR_OK) {
+        result = -4;
+        fprintf(stderr, "impossible to mount: %s\n", path);
+        goto end;
+    }
+    const cpiofs_index_t *index = &mounted.index;
+
+    // random sample of the regular files, and the largest directory
+    uint32_t nfiles = 0;
+    uint32_t largest = CPIO_INDEX_NONE;
+    uint32_t largest_size = 0;
+    for (uint32_t e = 0; e < index->count; e++) {
+        if ((index->mode[e] & CPIO_TYPE_MASK) == CPIO_FILE_TYPE_MASK) {
+            nfiles ++;
+        }
+        uint32_t n = index->child_first[e + 1U] - index->child_first[e];
+        if ((largest == CPIO_INDEX_NONE) || (n > largest_size)) {
+            largest = e;
+            largest_size = n;
+        }
+    }
+    paths = calloc(nops ? nops : 1U, sizeof(char*));
+    buffer = malloc(READ_CHUNK);
+    if ((paths == NULL) || (buffer == NULL)) {
+        result = -5;
+        goto end;
+    }
+    rnd_state = 1;
+    for (uint32_t i = 0; (nfiles > 0) && (i < nops); i++) {
+        uint32_t e;
+        do {
+            e = rnd() % index->count;
+        } while ((index->mode[e] & CPIO_TYPE_MASK) != CPIO_FILE_TYPE_MASK);
+        paths[i] = calloc(1, index->name_len[e] + 1U);
+        if (paths[i] == NULL) {
+            result = -5;
+            goto end;
+        }
+        memcpy(paths[i], &index->strings[index->name[e]], index->name_len[e]);
+        npaths ++;
+    }
+    char dirpath[CPIO_NAME_MAX] = "./";
+    if ((largest != CPIO_INDEX_NONE) && (index->name_len[largest] > 0)) {
+        memcpy(dirpath, &index->strings[index->name[largest]], index->name_len[largest]);
+        dirpath[index->name_len[largest]] = '\0';
+    }
+    uint32_t nscan = npaths < SCAN_OPS ? npaths : SCAN_OPS;
+
+    archive = path;
+    if (!csv) {
+        printf("%s: %" PRIu32 " entries, %" PRIu32 " files, %ld bytes, largest directory %s (%" PRIu32 ")\n",
+               path, index->count, nfiles, fsize, dirpath, largest_size);
+    }
+    bench_walk_raw(&raw, repeat);
+    bench_walk_table(&mounted, repeat);
+    bench_stat("scan", &raw, paths, nscan, 1);
+    bench_stat("index", &mounted, paths, npaths, repeat);
+    uint32_t *pilot = NULL;
+    if (cpiofs_index_phf(index, &pilot, &mounted.index.nbucket, &mounted.index.nphf) == CPIO_ERR_OK) {
+        mounted.index.pilot = pilot;
+        mounted.index.phf = &pilot[mounted.index.nbucket];
+        bench_stat("phf", &mounted, paths, npaths, repeat);
+        mounted.index.pilot = NULL;
+        mounted.index.phf = NULL;
+        free(pilot);
+    }
+    bench_open("scan", &raw, paths, nscan, 1);
+    bench_open("index", &mounted, paths, npaths, repeat);
+    bench_read("scan", &raw, paths, nscan, 1, buffer);
+    bench_read("index", &mounted, paths, npaths, repeat, buffer);
+    bench_seek("scan", &raw, paths, nscan, (uint64_t)npaths * repeat, buffer);
+    bench_seek("index", &mounted, paths, npaths, (uint64_t)npaths * repeat, buffer);
+    bench_list("scan", &raw, dirpath, 1);
+    bench_list("index", &mounted, dirpath, repeat);
+    if (index->count <= SCAN_WALK_MAX) {
+        bench_walk("scan", &raw, 1);
+    }
+    bench_walk("index", &mounted, repeat);
+    bench_ftw("scan", &raw, 1);
+    bench_ftw("index", &mounted, repeat);
+    if (index->count <= SCAN_WALK_MAX) {
+        bench_glob("scan", &raw, GLOB_PATTERN, 1);
+    }
+    bench_glob("index", &mounted, GLOB_PATTERN, repeat);
+    bench_mount(data, fsize, repeat);
+    bench_mount_threads(data, fsize, repeat);
+    bench_verify("1", &mounted, 1, repeat);
+    bench_verify("cores", &mounted, 0, repeat);
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        bench_pread_fd(&mounted, fd, paths, npaths, repeat, buffer);
+        bench_aio("uring", &mounted, fd, 0, paths, npaths, repeat);
+        bench_aio("threads", &mounted, fd, CPIOFS_AIO_THREADS, paths, npaths, repeat);
+        close(fd);
+    }
+    bench_send("copy", &mounted, 1, paths, npaths, repeat, buffer);
+    bench_send("splice", &mounted, 0, paths, npaths, repeat, buffer);
+    bench_extract("write", &mounted, 0, 0);
+    cpiofs_t kept;
+    if (cpiofs_mount_path(&kept, path, CPIOFS_MAP_KEEP_FD) == CPIO_ERR_OK) {
+        bench_send("sendfile", &kept, 0, paths, npaths, repeat, buffer);
+        bench_extract("range/1", &kept, 1, 0);
+        bench_extract("range", &kept, 0, 0);
+        cpiofs_unmount(&kept);
+    }
+
+end:
+    if (paths != NULL) {
+        for (uint32_t i = 0; i < npaths; i++) {
+            free(paths[i]);
+        }
+        free(paths);
+    }
+    free(buffer);
+    cpiofs_unmount(&mounted);
+    free(data);
+    fclose(fp);
+    return result;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [--csv] [-r repeat] [-n ops] <archive.cpio>...\n", prog);
+}
+
+int main(int argc, char** argv) {
+    unsigned int repeat = 10;
+    uint32_t nops = 1000;
+    int first = 1;
+
+    for (; first < argc; first++) {
+        if (strcmp(argv[first], "--csv") == 0) {
+            csv = 1;
+        } else if ((strcmp(argv[first], "-r") == 0) && (first + 1 < argc)) {
+            repeat = (unsigned int)strtoul(argv[++first], NULL, 0);
+        } else if ((strcmp(argv[first], "-n") == 0) && (first + 1 < argc)) {
+            nops = (uint32_t)strtoul(argv[++first], NULL, 0);
+        } else if (argv[first][0] == '-') {
+            usage(argv[0]);
+            return -1;
+        } else {
+            break;
+        }
+    }
+    if ((first >= argc) || (repeat == 0)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (csv) {
+        printf("archive,case,mode,ops,ns_per_op,headers_per_op\n");
+    }
+    for (int i = first; i < argc; i++) {
+        int result = bench_archive(argv[i], repeat, nops);
+        if (result != 0) {
+            return result;
+        }
+    }
+    archive = "";
+    bench_hex_kernels(repeat);
+    bench_sum_kernels(repeat);
+    return 0;
+}
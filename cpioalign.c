@@ -0,0 +1,126 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Rewrite an archive with the data of every file aligned
+//
+// usage: cpioalign [-a align] [-F format] <archive.cpio> <output.cpio>
+//   -a <align>       alignment of the file data, a power of two (4096)
+//   -F <format>      newc, crc, odc or bin (newc)
+//
+// The entries are copied in archive order through cpiofs_writer, with
+// their modes, modification times, owners, inodes and devices, so that
+// hard links keep their data on the last link; the "." entries added by
+// an earlier alignment and a saved index (see cpioindex) are dropped,
+// the offsets being about to change, and the ones added take the mode
+// and time of the root. Mounted from a mapping, the output gets
+// cpiofs_data_align of at least align. From an archive made by
+// cpio: find . | cpio -o -H newc > plain.cpio && cpioalign plain.cpio out.cpio
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-a align] [-F newc|crc|odc|bin] <archive.cpio> <output.cpio>\n", prog);
+}
+
+int main(int argc, char** argv) {
+    static const char *const formats[] = { "newc", "crc", "odc", "bin" };
+    int result = 0;
+    cpio_size_t align = 4096;
+    unsigned int format = CPIOFS_WRITE_NEWC;
+    cpiofs_t fs;
+    cpiofs_writer_t w;
+    int first = 1;
+
+    for (; (first + 1 < argc) && (argv[first][0] == '-'); first += 2) {
+        if (argv[first][1] == 'a') {
+            align = (cpio_size_t)strtoul(argv[first + 1], NULL, 0);
+        } else if (argv[first][1] == 'F') {
+            for (format = 0; (format < 4U) && (strcmp(argv[first + 1], formats[format]) != 0); format++) {
+            }
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if ((first + 2 != argc) || (format >= 4U)) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (cpiofs_mount_path(&fs, argv[first], 0) != CPIO_ERR_OK) {
+        fprintf(stderr, "impossible to mount: %s\n", argv[first]);
+        return -4;
+    }
+    int fd = open(argv[first + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cpiofs_unmount(&fs);
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+        return -5;
+    }
+    int ret = cpiofs_writer_init(&w, cpiofs_write_fd, &fd, format, align);
+    if (ret != CPIO_ERR_OK) {
+        result = -1;
+        usage(argv[0]);
+        goto end;
+    }
+
+    const cpiofs_index_t *index = &fs.index;
+    // the "." entries added look like the root, wherever it comes
+    for (uint32_t e = 0; e < index->count; e++) {
+        struct cpio_entry ent;
+        if ((index->name_len[e] <= 1U) && ((index->name_len[e] == 0) || (index->strings[index->name[e]] == '.')) &&
+            ((index->mode[e] & CPIO_TYPE_MASK) == CPIO_DIR_TYPE_MASK) &&
+            (cpiofs_header_at(&fs, index->entry[e], &ent, NULL) != NULL)) {
+            w.fill_mode = ent.mode & CPIO_MODE_MASK;
+            w.fill_mtime = ent.mtime;
+            break;
+        }
+    }
+    int root = 0;
+    for (uint32_t e = 0; (e < index->count) && (ret == CPIO_ERR_OK); e++) {
+        struct cpio_entry ent;
+        const struct header_old_cpio *d = cpiofs_header_at(&fs, index->entry[e], &ent, NULL);
+        const char *name = (const char*)d + ent.name;
+        const char *path = &index->strings[index->name[e]];
+        uint16_t len = index->name_len[e];
+        if (((len == 1U) && (path[0] == '.') && (root ++ > 0)) ||
+            ((len == sizeof(CPIOFS_INDEX_NAME) - 1U) && (memcmp(path, CPIOFS_INDEX_NAME, len) == 0))) {
+            continue;
+        }
+        const cpiofs_writer_meta_t meta = {
+            .uid = ent.uid,
+            .gid = ent.gid,
+            .nlink = ent.nlink,
+            .ino = ent.ino,
+            .dev = ent.dev,
+            .rdev = ent.rdev,
+        };
+        ret = cpiofs_writer_add_meta(&w, name, ent.mode, ent.mtime, &meta, (const uint8_t*)fs.head + index->data[e],
+                                     index->fsize[e]);
+    }
+    if (ret == CPIO_ERR_OK) {
+        ret = cpiofs_writer_finish(&w);
+    }
+    if (ret != CPIO_ERR_OK) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s (%d)\n", argv[first + 1], ret);
+        goto end;
+    }
+    fprintf(stderr, "%s: %" PRIu32 " entries, %" PRIu32 " added for the alignment, %" PRIu64 " bytes, data aligned to %"
+            PRIu64 "\n", argv[first + 1], w.ino - 1U, w.fillers, (uint64_t)w.pos, (uint64_t)align);
+
+end:
+    if ((close(fd) != 0) && (result == 0)) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+    }
+    cpiofs_unmount(&fs);
+    return result;
+}
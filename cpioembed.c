@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Compile an archive into a program
+//
+// usage: cpioembed [-n name] <archive.cpio> <output.c>
+//   -n <name>        name of the cpiofs_embedded_t to define (cpio_archive)
+//
+// Writes a C source with the image and every table of its index as
+// const data, a minimal perfect hash of the paths included, that
+// cpiofs_mount_embedded mounts without scanning nor allocating. From
+// meson:
+//
+//   assets_c = custom_target('assets.c', input : 'assets.cpio', output : 'assets.c',
+//       command : [cpioembed, '-n', 'assets', '@INPUT@', '@OUTPUT@'])
+//
+// and declare "extern const cpiofs_embedded_t assets;" where it is mounted.
+// cpioembed is built for the build machine, so a cross build for the
+// firmware runs it as is:
+//
+//   meson setup --cross-file arm-none-eabi.txt build && ninja -C build
+//
+// The tables are written as numbers, the same for any target byte order,
+// but cpio_off_t has to have the same size on both sides: the largefile
+// option holds for the native build too.
+
+static int put_u64(FILE *out, const char *name, const char *field, const char *type, const void *table,
+                   size_t width, uint32_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    fprintf(out, "\nstatic const %s %s_%s[%" PRIu32 "] = {", type, name, field, n);
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t v;
+        if (width == sizeof(uint64_t)) {
+            v = ((const uint64_t*)table)[i];
+        } else if (width == sizeof(uint32_t)) {
+            v = ((const uint32_t*)table)[i];
+        } else {
+            v = ((const uint16_t*)table)[i];
+        }
+        fprintf(out, "%s%" PRIu64 "%s,", (i % 12U == 0) ? "\n   " : "", v, (v > UINT32_MAX) ? "ULL" : "U");
+    }
+    return fprintf(out, "\n};\n") < 0;
+}
+
+// Pointer to a table written by put_u64, NULL if it is empty
+static void put_ref(FILE *out, const char *name, const char *field, uint32_t n) {
+    if (n == 0) {
+        fprintf(out, "        .%s = NULL,\n", field);
+    } else {
+        fprintf(out, "        .%s = %s_%s,\n", field, name, field);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n name] <archive.cpio> <output.c>\n", prog);
+}
+
+int main(int argc, char** argv) {
+    int result = 0;
+    const char *name = "cpio_archive";
+    uint8_t *data = NULL;
+    uint32_t *pilot = NULL;
+    uint32_t nbucket = 0;
+    uint32_t nphf = 0;
+    cpiofs_t fs = { 0 };
+    FILE *out = NULL;
+    int first = 1;
+
+    if ((argc > 2) && (strcmp(argv[1], "-n") == 0)) {
+        name = argv[2];
+        first += 2;
+    }
+    if (first + 2 != argc) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    FILE *fp = fopen(argv[first], "rb");
+    if (NULL == fp) {
+        fprintf(stderr, "impossible to read file: %s\n", argv[first]);
+        return -2;
+    }
+    fseek(fp, 0, SEEK_END);
+    long fsize = ftell(fp);
+    rewind(fp);
+    data = (fsize > 0) ? malloc(fsize) : NULL;
+    if ((NULL == data) || (fread(data, 1, fsize, fp) != (size_t)fsize)) {
+        result = -3;
+        fprintf(stderr, "impossible to load: %s\n", argv[first]);
+        goto end;
+    }
+    if (cpiofs_mount(&fs, data, (cpio_size_t)fsize) != CPIO_ERR_OK) {
+        result = -4;
+        fprintf(stderr, "impossible to mount: %s\n", argv[first]);
+        goto end;
+    }
+    const cpiofs_index_t *index = &fs.index;
+    // without a perfect hash the lookups probe the slots
+    int ret = cpiofs_index_phf(index, &pilot, &nbucket, &nphf);
+    if ((ret != CPIO_ERR_OK) && (ret != CPIO_ERR_NOTSUP)) {
+        result = -6;
+        fprintf(stderr, "impossible to hash the paths of: %s\n", argv[first]);
+        goto end;
+    }
+
+    out = fopen(argv[first + 1], "w");
+    if (NULL == out) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+        goto end;
+    }
+
+    uint32_t count = index->count;
+    uint32_t nslot = index->mask + 1U;
+    fprintf(out, "// Generated by cpioembed from %s, do not edit\n\n", argv[first]);
+    fprintf(out, "#include <stddef.h>\n#include <stdint.h>\n#include \"cpiofs.h\"\n\n");
+    if ((uint64_t)fsize > UINT32_MAX) {
+        fprintf(out, "#ifndef CPIO_LARGEFILE\n#error \"%s needs CPIO_LARGEFILE\"\n#endif\n\n", name);
+    }
+    fprintf(out, "static const uint8_t %s_image[%ld] __attribute__((aligned(8))) = {", name, fsize);
+    for (long i = 0; i < fsize; i++) {
+        fprintf(out, "%s%u,", (i % 20 == 0) ? "\n   " : "", (unsigned int)data[i]);
+    }
+    fprintf(out, "\n};\n");
+
+    if (put_u64(out, name, "entry", "cpio_off_t", index->entry, sizeof(cpio_off_t), count) ||
+        put_u64(out, name, "name", "cpio_off_t", index->name, sizeof(cpio_off_t), count) ||
+        put_u64(out, name, "data", "cpio_off_t", index->data, sizeof(cpio_off_t), count) ||
+        put_u64(out, name, "fsize", "cpio_size_t", index->fsize, sizeof(cpio_size_t), count) ||
+        put_u64(out, name, "name_len", "uint16_t", index->name_len, sizeof(uint16_t), count) ||
+        put_u64(out, name, "mode", "uint16_t", index->mode, sizeof(uint16_t), count) ||
+        put_u64(out, name, "hash", "uint32_t", index->hash, sizeof(uint32_t), count) ||
+        put_u64(out, name, "slot", "uint32_t", index->slot, sizeof(uint32_t), nslot) ||
+        put_u64(out, name, "parent", "uint32_t", index->parent, sizeof(uint32_t), count) ||
+        put_u64(out, name, "child_first", "uint32_t", index->child_first, sizeof(uint32_t), count + 1U) ||
+        put_u64(out, name, "child", "uint32_t", index->child, sizeof(uint32_t), count) ||
+        put_u64(out, name, "sorted", "uint32_t", index->sorted, sizeof(uint32_t), count) ||
+        put_u64(out, name, "pilot", "uint32_t", pilot, sizeof(uint32_t), nbucket) ||
+        put_u64(out, name, "phf", "uint32_t", (pilot != NULL) ? &pilot[nbucket] : NULL, sizeof(uint32_t), nphf)) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+        goto end;
+    }
+
+    fprintf(out, "\nconst cpiofs_embedded_t %s = {\n", name);
+    fprintf(out, "    .image = %s_image,\n    .size = %ldU,\n    .index = {\n", name, fsize);
+    fprintf(out, "        .count = %" PRIu32 "U,\n        .mask = %" PRIu32 "U,\n", count, index->mask);
+    fprintf(out, "        .strings = (const char*)%s_image,\n", name);
+    put_ref(out, name, "entry", count);
+    put_ref(out, name, "name", count);
+    put_ref(out, name, "data", count);
+    put_ref(out, name, "fsize", count);
+    put_ref(out, name, "name_len", count);
+    put_ref(out, name, "mode", count);
+    put_ref(out, name, "hash", count);
+    put_ref(out, name, "slot", nslot);
+    put_ref(out, name, "parent", count);
+    put_ref(out, name, "child_first", count + 1U);
+    put_ref(out, name, "child", count);
+    put_ref(out, name, "sorted", count);
+    fprintf(out, "        .trailer = %" PRIu64 "U,\n        .mem = NULL,\n", (uint64_t)index->trailer);
+    fprintf(out, "        .nbucket = %" PRIu32 "U,\n        .nphf = %" PRIu32 "U,\n", nbucket, nphf);
+    put_ref(out, name, "pilot", nbucket);
+    put_ref(out, name, "phf", nphf);
+    fprintf(out, "    },\n};\n");
+    fprintf(stderr, "%s: %" PRIu32 " entries, %" PRIu32 " distinct paths in %" PRIu32 " buckets\n",
+            argv[first + 1], count, nphf, nbucket);
+
+end:
+    if ((out != NULL) && (fclose(out) != 0) && (result == 0)) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+    }
+    free(pilot);
+    cpiofs_unmount(&fs);
+    free(data);
+    fclose(fp);
+    return result;
+}
@@ -0,0 +1,74 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include "cpiofs.h"
+
+// Extract an archive, the files being written by many threads
+//
+// usage: cpioextract [-j threads] [-w] [-T] <archive.cpio> [directory]
+//   -j <threads>     threads writing the files, 0 for one per core (0)
+//   -w               write out of the mapped archive instead of
+//                    copy_file_range from the archive file
+//   -T               leave the modification times, as cpio does without -m
+//
+// The archive is mapped and extracted by cpiofs_extract to the current
+// directory, or to directory which is created if needed. The modes and
+// modification times of the headers are restored. Prints the throughput.
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-j threads] [-w] [-T] <archive.cpio> [directory]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    unsigned int nthread = 0;
+    unsigned int flags = 0;
+    cpiofs_t fs;
+    int first = 1;
+
+    for (; (first < argc) && (argv[first][0] == '-'); first++) {
+        if ((strcmp(argv[first], "-j") == 0) && (first + 1 < argc)) {
+            nthread = (unsigned int)strtoul(argv[++ first], NULL, 0);
+        } else if (strcmp(argv[first], "-w") == 0) {
+            flags |= CPIOFS_EXTRACT_WRITE;
+        } else if (strcmp(argv[first], "-T") == 0) {
+            flags |= CPIOFS_EXTRACT_NO_TIMES;
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if ((first + 1 != argc) && (first + 2 != argc)) {
+        usage(argv[0]);
+        return -1;
+    }
+    const char *dest = (first + 2 == argc) ? argv[first + 1] : ".";
+
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int ret = cpiofs_mount_path(&fs, argv[first], CPIOFS_MAP_KEEP_FD);
+    if (ret != CPIO_ERR_OK) {
+        fprintf(stderr, "impossible to mount: %s (%d)\n", argv[first], ret);
+        return -4;
+    }
+    cpiofs_extract_stats_t stats;
+    ret = cpiofs_extract(&fs, dest, nthread, flags, &stats);
+    cpiofs_unmount(&fs);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (ret != CPIO_ERR_OK) {
+        fprintf(stderr, "impossible to extract: %s to %s (%d)\n", argv[first], dest, ret);
+        return -5;
+    }
+
+    double s = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    fprintf(stderr, "%s: %" PRIu32 " files, %" PRIu32 " directories, %" PRIu32 " links, %" PRIu32
+            " skipped, %" PRIu64 " bytes in %.3f s, %.1f MB/s, %.0f files/s\n",
+            dest, stats.files, stats.dirs, stats.links, stats.skipped, stats.bytes, s,
+            (double)stats.bytes / 1e6 / ((s > 0) ? s : 1e-9), (double)stats.files / ((s > 0) ? s : 1e-9));
+    return 0;
+}
@@ -1,9 +1,11 @@
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include <byteswap.h>
 
 #include "cpiofs.h"
+#include "cpiofs_priv.h"
 
 // #define CPIO_DEBUG
 
@@ -30,81 +32,327 @@ struct header_old_cpio {
 } __attribute__((packed));
 
 
+#ifdef CPIO_STATS
+unsigned long cpio_stat_headers = 0;
+#endif
+
 #define C_MAGIC 070707
 
-#define IMP_GETTER16(x) \
+#define C_ODC_HEADER_SIZE   76U
+#define C_NEWC_HEADER_SIZE  110U
+
+int cpio_format(const void *d, unsigned long dsize) {
+    const uint8_t *p = (const uint8_t*)d;
+    if (dsize >= sizeof(uint16_t)) {
+        uint16_t magic;
+        memcpy(&magic, p, sizeof(magic));
+        if (magic == C_MAGIC) {
+            return CPIO_FORMAT_BIN;
+        }
+        if (magic == bswap_16(C_MAGIC)) {
+            return CPIO_FORMAT_BIN_SWAP;
+        }
+    }
+    if ((dsize >= 6U) && (memcmp(p, "07070", 5) == 0)) {
+        switch (p[5]) {
+            case '7':
+                return CPIO_FORMAT_ODC;
+            case '1':
+                return CPIO_FORMAT_NEWC;
+            case '2':
+                return CPIO_FORMAT_CRC;
+            default:
+                break;
+        }
+    }
+    return CPIO_FORMAT_NONE;
+}
+
+// Fields of the ASCII headers
+enum cpio_field {
+    CPIO_FIELD_MAGIC,
+    CPIO_FIELD_DEV,
+    CPIO_FIELD_INO,
+    CPIO_FIELD_MODE,
+    CPIO_FIELD_UID,
+    CPIO_FIELD_GID,
+    CPIO_FIELD_NLINK,
+    CPIO_FIELD_RDEV,
+    CPIO_FIELD_MTIME,
+    CPIO_FIELD_NAMESIZE,
+    CPIO_FIELD_FILESIZE,
+    CPIO_FIELD_CHECK,
+    CPIO_FIELD_COUNT,
+};
+
+// offset and width of the octal fields of the odc header
+static const uint8_t odc_field[CPIO_FIELD_COUNT][2] = {
+    [CPIO_FIELD_MAGIC]    = {  0,  6 },
+    [CPIO_FIELD_DEV]      = {  6,  6 },
+    [CPIO_FIELD_INO]      = { 12,  6 },
+    [CPIO_FIELD_MODE]     = { 18,  6 },
+    [CPIO_FIELD_UID]      = { 24,  6 },
+    [CPIO_FIELD_GID]      = { 30,  6 },
+    [CPIO_FIELD_NLINK]    = { 36,  6 },
+    [CPIO_FIELD_RDEV]     = { 42,  6 },
+    [CPIO_FIELD_MTIME]    = { 48, 11 },
+    [CPIO_FIELD_NAMESIZE] = { 59,  6 },
+    [CPIO_FIELD_FILESIZE] = { 65, 11 },
+    [CPIO_FIELD_CHECK]    = {  0,  0 },
+};
+
+// position of the hex fields of the newc and crc headers, after the magic
+enum newc_field {
+    NEWC_INO,
+    NEWC_MODE,
+    NEWC_UID,
+    NEWC_GID,
+    NEWC_NLINK,
+    NEWC_MTIME,
+    NEWC_FILESIZE,
+    NEWC_DEVMAJOR,
+    NEWC_DEVMINOR,
+    NEWC_RDEVMAJOR,
+    NEWC_RDEVMINOR,
+    NEWC_NAMESIZE,
+    NEWC_CHECK,
+    NEWC_FIELD_COUNT,
+};
+
+static const uint8_t newc_field[CPIO_FIELD_COUNT] = {
+    [CPIO_FIELD_MAGIC]    = NEWC_FIELD_COUNT,
+    [CPIO_FIELD_DEV]      = NEWC_DEVMAJOR,
+    [CPIO_FIELD_INO]      = NEWC_INO,
+    [CPIO_FIELD_MODE]     = NEWC_MODE,
+    [CPIO_FIELD_UID]      = NEWC_UID,
+    [CPIO_FIELD_GID]      = NEWC_GID,
+    [CPIO_FIELD_NLINK]    = NEWC_NLINK,
+    [CPIO_FIELD_RDEV]     = NEWC_RDEVMAJOR,
+    [CPIO_FIELD_MTIME]    = NEWC_MTIME,
+    [CPIO_FIELD_NAMESIZE] = NEWC_NAMESIZE,
+    [CPIO_FIELD_FILESIZE] = NEWC_FILESIZE,
+    [CPIO_FIELD_CHECK]    = NEWC_CHECK,
+};
+
+static int octal_decode(const char *s, unsigned int width, uint32_t *value) {
+    uint32_t v = 0;
+    for (unsigned int i = 0; i < width; i++) {
+        if ((uint8_t)(s[i] - '0') >= 8U) {
+            return 0;
+        }
+        v = (v << 3) | (uint32_t)(s[i] - '0');
+    }
+    *value = v;
+    return 1;
+}
+
+static uint32_t ascii_field(const struct header_old_cpio* d, enum cpio_field field) {
+    const char *p = (const char*)d;
+    uint32_t v[2] = { 0, 0 };
+    switch (cpio_format(d, C_NEWC_HEADER_SIZE)) {
+        case CPIO_FORMAT_ODC:
+            octal_decode(&p[odc_field[field][0]], odc_field[field][1], &v[0]);
+            return v[0];
+        case CPIO_FORMAT_NEWC:
+        case CPIO_FORMAT_CRC:
+            if (field == CPIO_FIELD_MAGIC) {
+                octal_decode(p, 6, &v[0]);
+                return v[0];
+            }
+            if ((field == CPIO_FIELD_DEV) || (field == CPIO_FIELD_RDEV)) {
+                // major and minor packed the way the old formats store them
+                cpio_hex_decode_scalar(&p[6U + 8U * newc_field[field]], v, 2);
+                return (v[0] << 8) | (v[1] & 0xFFU);
+            }
+            cpio_hex_decode_scalar(&p[6U + 8U * newc_field[field]], v, 1);
+            return v[0];
+        default:
+            return 0;
+    }
+}
+
+#define IMP_GETTER16(x, f) \
     uint16_t cpio_get_ ## x (const struct header_old_cpio* d) { \
         if (d->c_magic == C_MAGIC) {                            \
             return d->c_ ## x;                                  \
         }                                                       \
-        return bswap_16(d->c_ ## x);                            \
+        if (d->c_magic == bswap_16(C_MAGIC)) {                  \
+            return bswap_16(d->c_ ## x);                        \
+        }                                                       \
+        return (uint16_t)ascii_field(d, f);                     \
     }
 
-#define IMP_GETTER32(x) \
+#define IMP_GETTER32(x, f) \
     uint32_t cpio_get_ ## x (const struct header_old_cpio* d) { \
         uint16_t l;                                             \
         uint16_t h;                                             \
         if (d->c_magic == C_MAGIC) {                            \
             l = d->c_ ## x[1] ;                                 \
             h = d->c_ ## x[0] ;                                 \
-        } else {                                                \
+        } else if (d->c_magic == bswap_16(C_MAGIC)) {           \
             l = bswap_16(d->c_ ## x[1]) ;                       \
             h = bswap_16(d->c_ ## x[0]) ;                       \
+        } else {                                                \
+            return ascii_field(d, f);                           \
         }                                                       \
         return ((uint32_t)h << 16) + l;                         \
     }
 
-IMP_GETTER16(magic)
-IMP_GETTER16(dev)
-IMP_GETTER16(ino)
-IMP_GETTER16(mode)
-IMP_GETTER16(uid)
-IMP_GETTER16(gid)
-IMP_GETTER16(nlink)
-IMP_GETTER16(rdev)
-IMP_GETTER32(mtime)
-IMP_GETTER16(namesize)
-IMP_GETTER32(filesize)
+IMP_GETTER16(magic, CPIO_FIELD_MAGIC)
+IMP_GETTER16(dev, CPIO_FIELD_DEV)
+IMP_GETTER16(ino, CPIO_FIELD_INO)
+IMP_GETTER16(mode, CPIO_FIELD_MODE)
+IMP_GETTER16(uid, CPIO_FIELD_UID)
+IMP_GETTER16(gid, CPIO_FIELD_GID)
+IMP_GETTER16(nlink, CPIO_FIELD_NLINK)
+IMP_GETTER16(rdev, CPIO_FIELD_RDEV)
+IMP_GETTER32(mtime, CPIO_FIELD_MTIME)
+IMP_GETTER16(namesize, CPIO_FIELD_NAMESIZE)
+IMP_GETTER32(filesize, CPIO_FIELD_FILESIZE)
 
 #undef IMP_GETTER16
 #undef IMP_GETTER32
 
-const char* get_filename(const struct header_old_cpio* data, uint16_t *len) {
-    const char * ret = (const char*)data + sizeof(struct header_old_cpio);
-    if (NULL != len) {
-        *len = cpio_get_namesize(data);
+uint32_t cpio_get_check(const struct header_old_cpio* d) {
+    if (cpio_format(d, C_NEWC_HEADER_SIZE) == CPIO_FORMAT_CRC) {
+        return ascii_field(d, CPIO_FIELD_CHECK);
     }
-    return ret;
+    return 0;
 }
 
-int cpio_valid(const struct header_old_cpio* d, unsigned long dsize) {
-    if ((d != NULL) && (dsize > sizeof(struct header_old_cpio))) {
-        dsize -= sizeof(struct header_old_cpio);
-        uint16_t namelen = cpio_get_namesize(d);
-        if (namelen % 2U == 1U) {
-            namelen ++;
-        }
-        if (dsize >= namelen) {
-            dsize -= namelen;
+static inline unsigned long align_up(unsigned long v, unsigned long align) {
+    return (v + align - 1U) & ~(align - 1U);
+}
+
+// Device of the old formats, major << 8 | minor, split
+static inline uint64_t cpio_old_dev(uint32_t dev) {
+    return ((uint64_t)(dev >> 8) << 32) | (dev & 0xFFU);
+}
 
-            uint32_t datalen = cpio_get_filesize(d);
-            if (datalen % 2 == 1) {
-                datalen ++;
+int cpio_decode(const struct header_old_cpio* d, unsigned long dsize, struct cpio_entry *ent) {
+    unsigned long hsize;
+    unsigned long align;
+    if (d == NULL) {
+        return 0;
+    }
+    ent->format = (uint8_t)cpio_format(d, dsize);
+    switch (ent->format) {
+        case CPIO_FORMAT_BIN:
+        case CPIO_FORMAT_BIN_SWAP:
+            hsize = sizeof(struct header_old_cpio);
+            align = 2U;
+            if (dsize <= hsize) {
+                return 0;
             }
-            if (dsize >= datalen) {
-                return 1;
+            ent->mode = cpio_get_mode(d);
+            ent->mtime = cpio_get_mtime(d);
+            ent->namesize = cpio_get_namesize(d);
+            ent->filesize = cpio_get_filesize(d);
+            ent->check = 0;
+            ent->dev = cpio_old_dev(cpio_get_dev(d));
+            ent->ino = cpio_get_ino(d);
+            ent->nlink = cpio_get_nlink(d);
+            ent->uid = cpio_get_uid(d);
+            ent->gid = cpio_get_gid(d);
+            ent->rdev = cpio_old_dev(cpio_get_rdev(d));
+            break;
+        case CPIO_FORMAT_ODC: {
+            const char *p = (const char*)d;
+            uint32_t dev;
+            uint32_t rdev;
+            hsize = C_ODC_HEADER_SIZE;
+            align = 1U;
+            if ((dsize <= hsize) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_MODE][0]], odc_field[CPIO_FIELD_MODE][1], &ent->mode) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_MTIME][0]], odc_field[CPIO_FIELD_MTIME][1], &ent->mtime) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_NAMESIZE][0]], odc_field[CPIO_FIELD_NAMESIZE][1], &ent->namesize) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_FILESIZE][0]], odc_field[CPIO_FIELD_FILESIZE][1], &ent->filesize) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_DEV][0]], odc_field[CPIO_FIELD_DEV][1], &dev) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_INO][0]], odc_field[CPIO_FIELD_INO][1], &ent->ino) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_NLINK][0]], odc_field[CPIO_FIELD_NLINK][1], &ent->nlink) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_UID][0]], odc_field[CPIO_FIELD_UID][1], &ent->uid) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_GID][0]], odc_field[CPIO_FIELD_GID][1], &ent->gid) ||
+                !octal_decode(&p[odc_field[CPIO_FIELD_RDEV][0]], odc_field[CPIO_FIELD_RDEV][1], &rdev)) {
+                return 0;
+            }
+            ent->check = 0;
+            ent->dev = cpio_old_dev(dev);
+            ent->rdev = cpio_old_dev(rdev);
+            break;
+        }
+        case CPIO_FORMAT_NEWC:
+        case CPIO_FORMAT_CRC: {
+            uint32_t f[NEWC_FIELD_COUNT];
+            hsize = C_NEWC_HEADER_SIZE;
+            align = 4U;
+            if ((dsize <= hsize) || !cpio_hex_decode((const char*)d + 6, f, NEWC_FIELD_COUNT)) {
+                return 0;
             }
+            ent->mode = f[NEWC_MODE];
+            ent->mtime = f[NEWC_MTIME];
+            ent->namesize = f[NEWC_NAMESIZE];
+            ent->filesize = f[NEWC_FILESIZE];
+            ent->check = f[NEWC_CHECK];
+            ent->dev = ((uint64_t)f[NEWC_DEVMAJOR] << 32) | f[NEWC_DEVMINOR];
+            ent->ino = f[NEWC_INO];
+            ent->nlink = f[NEWC_NLINK];
+            ent->uid = f[NEWC_UID];
+            ent->gid = f[NEWC_GID];
+            ent->rdev = ((uint64_t)f[NEWC_RDEVMAJOR] << 32) | f[NEWC_RDEVMINOR];
+            break;
         }
+        default:
+            return 0;
     }
-    return 0;
+    // the sizes come from the archive: do the math wide enough not to wrap;
+    // path lengths are 16 bits in the index, a longer name is not cut
+    uint64_t data = align_up(hsize + (uint64_t)ent->namesize, align);
+    uint64_t next = data + align_up((uint64_t)ent->filesize, align);
+    if ((next > dsize) || (next > (cpio_size_t)~(cpio_size_t)0) || (data > UINT32_MAX) ||
+        (ent->namesize > UINT16_MAX)) {
+        return 0;
+    }
+    ent->name = (uint32_t)hsize;
+    ent->data = (uint32_t)data;
+    ent->next = (cpio_size_t)next;
+    return 1;
+}
+
+int cpio_is_trailer(const struct header_old_cpio* d, const struct cpio_entry *ent) {
+    return (ent->namesize == 11U) && (memcmp((const char*)d + ent->name, "TRAILER!!!", 11) == 0);
+}
+
+const char* get_filename(const struct header_old_cpio* data, uint16_t *len) {
+    unsigned long hsize;
+    switch (cpio_format(data, C_NEWC_HEADER_SIZE)) {
+        case CPIO_FORMAT_ODC:
+            hsize = C_ODC_HEADER_SIZE;
+            break;
+        case CPIO_FORMAT_NEWC:
+        case CPIO_FORMAT_CRC:
+            hsize = C_NEWC_HEADER_SIZE;
+            break;
+        default:
+            hsize = sizeof(struct header_old_cpio);
+            break;
+    }
+    const char * ret = (const char*)data + hsize;
+    if (NULL != len) {
+        *len = cpio_get_namesize(data);
+    }
+    return ret;
+}
+
+int cpio_valid(const struct header_old_cpio* d, unsigned long dsize) {
+    struct cpio_entry ent;
+    return cpio_decode(d, dsize, &ent);
 }
 
 const struct header_old_cpio* cpio_init_iter(const void *d, long dsize) {
-    if (cpio_valid((const struct header_old_cpio*) d, dsize)) {
-        uint16_t filename_size;
-        const char * filename;
-        filename = get_filename(d, &filename_size);
-        if ((filename_size != 11) || (strncmp(filename, "TRAILER!!!", filename_size) != 0)) {
+    struct cpio_entry ent;
+    if ((dsize > 0) && cpio_decode((const struct header_old_cpio*) d, (unsigned long)dsize, &ent)) {
+        if (!cpio_is_trailer(d, &ent)) {
+            CPIO_STAT_HEADER();
             return (const struct header_old_cpio*)d;
         }
     }
@@ -112,33 +360,15 @@ const struct header_old_cpio* cpio_init_iter(const void *d, long dsize) {
 }
 
 const struct header_old_cpio* cpio_goto_next(const struct header_old_cpio* d, unsigned long *pdsize) {
+    struct cpio_entry ent;
     unsigned long dsize = *pdsize;
-    const uint8_t *dnext = (uint8_t *)d;
-    if (dsize > sizeof(struct header_old_cpio)) {
-        dsize -= sizeof(struct header_old_cpio);
-        dnext += sizeof(struct header_old_cpio);
-        uint16_t namelen = cpio_get_namesize(d);
-        if (namelen % 2U == 1U) {
-            namelen ++;
-        }
-        if (dsize >= namelen) {
-            dsize -= namelen;
-            dnext += namelen;
-
-            uint32_t datalen = cpio_get_filesize(d);
-            if (datalen % 2U == 1U) {
-                datalen ++;
-            }
-            if (dsize >= datalen) {
-                dsize -= datalen;
-                dnext += datalen;
-                if (dsize > 0) {
-                    const struct header_old_cpio* retval = cpio_init_iter(dnext, dsize);
-                    if (NULL != retval) {
-                        *pdsize = dsize;
-                        return retval;
-                    }
-                }
+    if (cpio_decode(d, dsize, &ent)) {
+        dsize -= ent.next;
+        if (dsize > 0) {
+            const struct header_old_cpio* retval = cpio_init_iter((const uint8_t *)d + ent.next, dsize);
+            if (NULL != retval) {
+                *pdsize = dsize;
+                return retval;
             }
         }
     }
@@ -147,27 +377,63 @@ const struct header_old_cpio* cpio_goto_next(const struct header_old_cpio* d, un
 }
 
 const uint8_t* get_filedata(const struct header_old_cpio* d, uint32_t *len) {
-    const uint8_t * ret = (const uint8_t*)d + sizeof(struct header_old_cpio);
-    uint16_t nlen = cpio_get_namesize(d);
-    if (nlen % 2 == 1) {
-        nlen ++;
+    struct cpio_entry ent;
+    if (!cpio_decode(d, ~0UL, &ent)) {
+        if (NULL != len) {
+            *len = 0;
+        }
+        return NULL;
     }
-    ret += nlen;
     if (NULL != len) {
-        *len = cpio_get_filesize(d);
+        *len = ent.filesize;
     }
-    return ret;
+    return (const uint8_t*)d + ent.data;
 }
 
 /* ** */
-typedef int (*strncmp_t) (const char *s1, const char *s2, size_t n);
-
-static const struct header_old_cpio* cpiofs_find(const cpiofs_t *fs, const char *path, uint16_t mask, strncmp_t cmp, unsigned long *pdsize) {
+const char* cpio_path_skip_root(const char *path) {
     if ((path[0] == '.') && (path[1] == '/')) {
         path += 2;
     } else if (path[0] == '/') {
         path += 1;
     }
+    return path;
+}
+
+const char* cpio_entry_path(const struct header_old_cpio* d, size_t *len) {
+    uint16_t filename_size;
+    const char* filename = get_filename(d, &filename_size);
+    return cpio_name_path(filename, filename_size, len);
+}
+
+const char* cpio_name_path(const char *filename, size_t filename_size, size_t *len) {
+    if ((filename_size >= 2) && (filename[0] == '.') && (filename[1] == '/')) {
+        filename += 2;
+        filename_size -= 2;
+    } else if ((filename_size >= 2) && (filename[0] == '/')) {
+        filename += 1;
+        filename_size -= 1;
+    }
+    size_t n = 0;
+    while ((n < filename_size) && (filename[n] != '\0')) {
+        n ++;
+    }
+    *len = n;
+    return filename;
+}
+
+typedef int (*strncmp_t) (const char *s1, const char *s2, size_t n);
+
+static const struct header_old_cpio* cpiofs_find(const cpiofs_t *fs, const char *path, uint16_t mask, strncmp_t cmp, unsigned long *pdsize) {
+    if ((cmp == strncmp) && cpiofs_indexed(fs)) {
+        uint32_t e = cpiofs_index_lookup(fs, path, mask);
+        const struct header_old_cpio* pdata = (e != CPIO_INDEX_NONE) ? cpiofs_index_head(fs, e) : NULL;
+        if (pdsize != NULL) {
+            *pdsize = (pdata != NULL) ? fs->size - (unsigned long)((const uint8_t*)pdata - (const uint8_t*)fs->head) : 0;
+        }
+        return pdata;
+    }
+    path = cpio_path_skip_root(path);
     unsigned long fsize = fs->size;
     for (const struct header_old_cpio* pdata = cpio_init_iter(fs->head, fsize); 
          pdata != NULL; 
@@ -204,71 +470,405 @@ static const struct header_old_cpio* cpiofs_find(const cpiofs_t *fs, const char
 }
 
 
+static void stat_info(cpio_info_t *info, uint16_t mode, cpio_size_t size) {
+    if (NULL != info) {
+        info->type = mode & CPIO_TYPE_MASK;
+        info->mode = mode & (CPIO_MODE_MASK);
+        info->size = size;
+        info->filename = NULL;
+        info->filenames = 0;
+        info->filepath = NULL;
+        info->filepaths = 0;
+    }
+}
+
 int cpiofs_stat(const cpiofs_t *fs, const char *path, cpio_info_t *info) {
-    const struct header_old_cpio* pdata = cpiofs_find(fs, path, CPIO_FILEDIR_TYPE, strncmp, NULL);
-    if (pdata != NULL) {
-        if (NULL != info) {
-            uint16_t mode = cpio_get_mode(pdata);
-            info->type = mode & CPIO_TYPE_MASK;
-            info->mode = mode & (CPIO_MODE_MASK);
-            info->size = cpio_get_filesize(pdata);
-            info->filename = NULL;
-            info->filenames = 0;
-            info->filepath = NULL;
-            info->filepaths = 0;
+    if (fs->overlay != NULL) {
+        uint32_t m = cpiofs_overlay_lookup(fs, path, CPIO_FILEDIR_TYPE);
+        if (m == CPIO_INDEX_NONE) {
+            return (int)CPIO_ERR_NEXIST;
         }
-        return (int)CPIO_ERR_OK;
+        const cpiofs_t *layer = fs->overlay->layer[fs->overlay->from[m]];
+        stat_info(info, fs->overlay->mode[m], layer->index.fsize[fs->overlay->entry[m]]);
+    } else if (cpiofs_indexed(fs)) {
+        uint32_t e = cpiofs_index_lookup(fs, path, CPIO_FILEDIR_TYPE);
+        if (e == CPIO_INDEX_NONE) {
+            return (int)CPIO_ERR_NEXIST;
+        }
+        stat_info(info, fs->index.mode[e], fs->index.fsize[e]);
+    } else {
+        const struct header_old_cpio* pdata = cpiofs_find(fs, path, CPIO_FILEDIR_TYPE, strncmp, NULL);
+        if (pdata == NULL) {
+            return (int)CPIO_ERR_NEXIST;
+        }
+        stat_info(info, cpio_get_mode(pdata), cpio_get_filesize(pdata));
     }
-    return (int)CPIO_ERR_NEXIST;
+    return (int)CPIO_ERR_OK;
+}
+
+static void file_bind_entry(cpiofs_t *fs, cpio_file_t *file, uint32_t e) {
+    file->head = (fs->store == NULL) ? cpiofs_index_head(fs, e) : NULL;
+    file->data = fs->index.data[e];
+    file->size = fs->index.fsize[e];
+    file->fs = fs;
+    file->pos = 0;
+    cpiofs_hold(fs);
+}
+
+static void file_bind_header(cpiofs_t *fs, cpio_file_t *file, const struct header_old_cpio* pdata) {
+    uint32_t fsize;
+    file->head = pdata;
+    file->data = (cpio_off_t)(get_filedata(pdata, &fsize) - (const uint8_t*)fs->head);
+    file->size = fsize;
+    file->fs = fs;
+    file->pos = 0;
+    cpiofs_hold(fs);
 }
 
 int cpiofs_file_open(cpiofs_t *fs, cpio_file_t *file, const char *path) {
-    const struct header_old_cpio* pdata = cpiofs_find(fs, path, CPIO_FILE_TYPE_MASK, strncmp, NULL);
-    if (pdata != NULL) {
-        file->fs = fs;
-        file->head = pdata;
-        file->pos = 0;
-        fs->resource_count ++;
-        return (int)CPIO_ERR_OK;
+    if (fs->overlay != NULL) {
+        // the file belongs to its layer
+        uint32_t m = cpiofs_overlay_lookup(fs, path, CPIO_FILE_TYPE_MASK);
+        if (m == CPIO_INDEX_NONE) {
+            return (int)CPIO_ERR_NEXIST;
+        }
+        file_bind_entry(fs->overlay->layer[fs->overlay->from[m]], file, fs->overlay->entry[m]);
+    } else if (cpiofs_indexed(fs)) {
+        uint32_t e = cpiofs_index_lookup(fs, path, CPIO_FILE_TYPE_MASK);
+        if (e == CPIO_INDEX_NONE) {
+            return (int)CPIO_ERR_NEXIST;
+        }
+        file_bind_entry(fs, file, e);
+    } else {
+        const struct header_old_cpio* pdata = cpiofs_find(fs, path, CPIO_FILE_TYPE_MASK, strncmp, NULL);
+        if (pdata == NULL) {
+            return (int)CPIO_ERR_NEXIST;
+        }
+        file_bind_header(fs, file, pdata);
+    }
+    return (int)CPIO_ERR_OK;
+}
+
+// Batched lookups
+
+#define BATCH_PROBE     16U
+
+// Probe the index for every path, BATCH_PROBE paths at a time: the
+// hashes are computed and the slots prefetched before any probe waits
+// on memory
+static void index_lookup_many(const cpiofs_t *fs, const char *const *paths, uint32_t n, uint16_t mask,
+                              uint32_t *entries) {
+    const cpiofs_index_t *index = &fs->index;
+    for (uint32_t first = 0; first < n; first += BATCH_PROBE) {
+        const char *path[BATCH_PROBE];
+        size_t len[BATCH_PROBE];
+        uint32_t h[BATCH_PROBE];
+        uint32_t count = (n - first < BATCH_PROBE) ? n - first : BATCH_PROBE;
+        for (uint32_t i = 0; i < count; i++) {
+            path[i] = cpio_path_skip_root(paths[first + i]);
+            len[i] = strlen(path[i]);
+            h[i] = cpio_path_hash(path[i], len[i]);
+            if (index->pilot != NULL) {
+                __builtin_prefetch(&index->pilot[cpio_phf_bucket(h[i], index->nbucket)]);
+            } else {
+                __builtin_prefetch(&index->slot[h[i] & index->mask]);
+            }
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            entries[first + i] = cpiofs_index_probe(index, path[i], len[i], h[i], mask);
+        }
     }
-    return (int)CPIO_ERR_NEXIST;
+}
+
+// Resolve every path in a single walk of the header chain
+//
+// The requested paths go in a small hash table, every header is then
+// hashed once and looked up there; requests for the same path are
+// chained. The walk stops as soon as every path is found.
+// Returns a negative error code on failure.
+static int find_many(const cpiofs_t *fs, const char *const *paths, uint32_t n, uint16_t mask,
+                     const struct header_old_cpio **heads) {
+    uint32_t nslot = 2;
+    while (nslot < 2U * n) {
+        nslot <<= 1;
+    }
+    uint32_t *mem = malloc(((size_t)nslot + 3U * (size_t)n) * sizeof(uint32_t));
+    if (mem == NULL) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    uint32_t *slot = mem;               // first request of a path + 1, 0 if free
+    uint32_t *next = &slot[nslot];      // next request of the same path, CPIO_INDEX_NONE at the end
+    uint32_t *hash = &next[n];
+    uint32_t *len = &hash[n];
+    memset(slot, 0, nslot * sizeof(uint32_t));
+
+    uint32_t left = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        const char *path = cpio_path_skip_root(paths[i]);
+        heads[i] = NULL;
+        next[i] = CPIO_INDEX_NONE;
+        len[i] = (uint32_t)strlen(path);
+        hash[i] = cpio_path_hash(path, len[i]);
+        uint32_t s = hash[i] & (nslot - 1U);
+        for (; slot[s] != 0; s = (s + 1U) & (nslot - 1U)) {
+            uint32_t r = slot[s] - 1U;
+            if ((hash[r] == hash[i]) && (len[r] == len[i]) &&
+                (memcmp(cpio_path_skip_root(paths[r]), path, len[i]) == 0)) {
+                break;
+            }
+        }
+        if (slot[s] == 0) {
+            slot[s] = i + 1U;
+            left ++;
+        } else {
+            // keep the chain in request order
+            uint32_t r = slot[s] - 1U;
+            while (next[r] != CPIO_INDEX_NONE) {
+                r = next[r];
+            }
+            next[r] = i;
+        }
+    }
+
+    unsigned long fsize = fs->size;
+    for (const struct header_old_cpio* pdata = cpio_init_iter(fs->head, fsize);
+         (pdata != NULL) && (left > 0);
+         pdata = cpio_goto_next(pdata, &fsize)) {
+        if ((cpio_get_mode(pdata) & mask) == 0) {
+            continue;
+        }
+        uint16_t filename_size;
+        const char *filename = get_filename(pdata, &filename_size);
+        size_t plen;
+        const char *path = cpio_name_path(filename, filename_size, &plen);
+        uint32_t h = cpio_path_hash(path, plen);
+        for (uint32_t s = h & (nslot - 1U); slot[s] != 0; s = (s + 1U) & (nslot - 1U)) {
+            uint32_t r = slot[s] - 1U;
+            if ((hash[r] == h) && (len[r] == plen) && (heads[r] == NULL) &&
+                (memcmp(cpio_path_skip_root(paths[r]), path, plen) == 0)) {
+                // the first matching header wins, like cpiofs_find
+                for (; r != CPIO_INDEX_NONE; r = next[r]) {
+                    heads[r] = pdata;
+                }
+                left --;
+                break;
+            }
+        }
+    }
+    free(mem);
+    return (int)CPIO_ERR_OK;
+}
+
+// Lookups shared by cpiofs_stat_many and cpiofs_open_many: entry
+// numbers on a mounted archive, headers otherwise
+static void* lookup_many(const cpiofs_t *fs, const char *const *paths, uint32_t n, uint16_t mask, int *ret) {
+    void *found;
+    if (cpiofs_indexed(fs)) {
+        found = malloc((n ? n : 1U) * sizeof(uint32_t));
+        if (found != NULL) {
+            index_lookup_many(fs, paths, n, mask, found);
+        }
+        *ret = (found != NULL) ? (int)CPIO_ERR_OK : (int)CPIO_ERR_NOMEM;
+        return found;
+    }
+    found = malloc((n ? n : 1U) * sizeof(const struct header_old_cpio*));
+    *ret = (found != NULL) ? find_many(fs, paths, n, mask, found) : (int)CPIO_ERR_NOMEM;
+    if (*ret != CPIO_ERR_OK) {
+        free(found);
+        found = NULL;
+    }
+    return found;
+}
+
+int cpiofs_stat_many(const cpiofs_t *fs, const char *const *paths, uint32_t n, cpio_info_t *infos, int *results) {
+    int ret;
+    int count = 0;
+    if ((fs == NULL) || (paths == NULL) || (infos == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fs->overlay != NULL) {
+        // one probe of the merged index a path already
+        for (uint32_t i = 0; i < n; i++) {
+            ret = cpiofs_stat(fs, paths[i], &infos[i]);
+            count += (ret == CPIO_ERR_OK);
+            if (results != NULL) {
+                results[i] = ret;
+            }
+        }
+        return count;
+    }
+    void *found = lookup_many(fs, paths, n, CPIO_FILEDIR_TYPE, &ret);
+    if (found == NULL) {
+        return ret;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        ret = (int)CPIO_ERR_NEXIST;
+        if (cpiofs_indexed(fs)) {
+            uint32_t e = ((const uint32_t*)found)[i];
+            if (e != CPIO_INDEX_NONE) {
+                stat_info(&infos[i], fs->index.mode[e], fs->index.fsize[e]);
+                ret = (int)CPIO_ERR_OK;
+            }
+        } else {
+            const struct header_old_cpio* pdata = ((const struct header_old_cpio**)found)[i];
+            if (pdata != NULL) {
+                stat_info(&infos[i], cpio_get_mode(pdata), cpio_get_filesize(pdata));
+                ret = (int)CPIO_ERR_OK;
+            }
+        }
+        if (ret == CPIO_ERR_OK) {
+            count ++;
+        }
+        if (results != NULL) {
+            results[i] = ret;
+        }
+    }
+    free(found);
+    return count;
+}
+
+int cpiofs_open_many(cpiofs_t *fs, const char *const *paths, uint32_t n, cpio_file_t *files, int *results) {
+    int ret;
+    int count = 0;
+    if ((fs == NULL) || (paths == NULL) || (files == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fs->overlay != NULL) {
+        for (uint32_t i = 0; i < n; i++) {
+            files[i].fs = NULL;
+            ret = cpiofs_file_open(fs, &files[i], paths[i]);
+            count += (ret == CPIO_ERR_OK);
+            if (results != NULL) {
+                results[i] = ret;
+            }
+        }
+        return count;
+    }
+    void *found = lookup_many(fs, paths, n, CPIO_FILE_TYPE_MASK, &ret);
+    if (found == NULL) {
+        return ret;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        ret = (int)CPIO_ERR_NEXIST;
+        files[i].fs = NULL;
+        if (cpiofs_indexed(fs)) {
+            uint32_t e = ((const uint32_t*)found)[i];
+            if (e != CPIO_INDEX_NONE) {
+                file_bind_entry(fs, &files[i], e);
+                ret = (int)CPIO_ERR_OK;
+            }
+        } else {
+            const struct header_old_cpio* pdata = ((const struct header_old_cpio**)found)[i];
+            if (pdata != NULL) {
+                file_bind_header(fs, &files[i], pdata);
+                ret = (int)CPIO_ERR_OK;
+            }
+        }
+        if (ret == CPIO_ERR_OK) {
+            count ++;
+        }
+        if (results != NULL) {
+            results[i] = ret;
+        }
+    }
+    free(found);
+    return count;
 }
 
 int cpiofs_file_close(cpio_file_t *file) {
     if (file->fs != NULL) {
-        // todo add assert if file->fs->resource_count == 0
-        file->fs->resource_count --;
+        cpiofs_release(file->fs);
         file->fs = NULL;
         file->head = NULL;
         file->pos = 0;
+        file->data = 0;
+        file->size = 0;
         return (int)CPIO_ERR_OK;
     }
     return (int)CPIO_ERR_NEXIST;
 }
 
+static inline const uint8_t* file_data(const cpio_file_t *file) {
+    return (const uint8_t*)file->fs->head + file->data;
+}
+
+// Copy up to size bytes of the file data at off, the file is not changed
+static cpio_ssize_t file_copy(const cpio_file_t *file, void *buffer, cpio_size_t size, cpio_off_t off) {
+    cpio_size_t data_read = file->size - off;
+    if (size < data_read) {
+        data_read = size;
+    }
+    if (file->fs->store != NULL) {
+        cpio_ssize_t ret = cpiofs_store_read(file->fs, file->data + off, buffer, data_read);
+        if (ret < 0) {
+            return ret;
+        }
+    } else {
+        memcpy(buffer, &file_data(file)[off], data_read);
+    }
+    return (cpio_ssize_t)data_read;
+}
+
 cpio_ssize_t cpiofs_file_read(cpio_file_t *file, void *buffer, cpio_size_t size) {
-    if (file->head != NULL) {
+    if (file->fs != NULL) {
         if (size > 0) {
-            uint32_t fsize;
-            const uint8_t* data = get_filedata(file->head, &fsize);
-            if (file->pos > fsize) {
+            if (file->pos > file->size) {
                 return CPIO_ERR_UNKNOWN;
             }
-            cpio_size_t data_read = fsize - file->pos;
-            if (size < data_read) {
-                data_read = size;
+            cpio_ssize_t ret = file_copy(file, buffer, size, file->pos);
+            if (ret > 0) {
+                file->pos += (cpio_off_t)ret;
             }
-            memcpy(buffer, &data[file->pos], data_read);
-            file->pos += data_read;
-            return data_read;
+            return ret;
+        }
+    }
+    return (cpio_ssize_t)CPIO_ERR_NEXIST;
+}
+
+cpio_ssize_t cpiofs_file_pread(const cpio_file_t *file, void *buffer, cpio_size_t size, cpio_off_t off) {
+    if (file->fs != NULL) {
+        if (off > file->size) {
+            return (cpio_ssize_t)CPIO_ERR_SEEK_OUT;
+        }
+        return file_copy(file, buffer, size, off);
+    }
+    return (cpio_ssize_t)CPIO_ERR_NEXIST;
+}
+
+int cpiofs_file_view(cpio_file_t *file, const void **data, cpio_size_t *size) {
+    if (file->fs != NULL) {
+        if (file->fs->store != NULL) {
+            return (int)CPIO_ERR_NOTSUP;
+        }
+        *data = file_data(file);
+        *size = file->size;
+        return (int)CPIO_ERR_OK;
+    }
+    return (int)CPIO_ERR_NEXIST;
+}
+
+cpio_ssize_t cpiofs_file_view_read(cpio_file_t *file, const void **data, cpio_size_t size) {
+    if (file->fs != NULL) {
+        if (file->fs->store != NULL) {
+            return (cpio_ssize_t)CPIO_ERR_NOTSUP;
+        }
+        if (file->pos > file->size) {
+            return CPIO_ERR_UNKNOWN;
+        }
+        cpio_size_t data_read = file->size - file->pos;
+        if (size < data_read) {
+            data_read = size;
         }
+        *data = &file_data(file)[file->pos];
+        file->pos += data_read;
+        return data_read;
     }
     return (cpio_ssize_t)CPIO_ERR_NEXIST;
 }
 
 cpio_soff_t cpiofs_file_seek(cpio_file_t *file, cpio_soff_t off, cpio_whence_flags_t whence) {
-    if (file->head != NULL) {
-        uint32_t fsize = cpio_get_filesize(file->head);
+    if (file->fs != NULL) {
+        cpio_size_t fsize = file->size;
         switch (whence) {
             case CPIO_SEEK_END:
                 file->pos = (cpio_off_t)fsize;
@@ -292,13 +892,43 @@ cpio_soff_t cpiofs_file_seek(cpio_file_t *file, cpio_soff_t off, cpio_whence_fla
 }
 
 int cpiofs_dir_open(cpiofs_t *fs, cpio_dir_t *dir, const char *path) {
+    if (fs->overlay != NULL) {
+        uint32_t m = cpiofs_overlay_lookup(fs, path, CPIO_DIR_TYPE_MASK);
+        if (m != CPIO_INDEX_NONE) {
+            dir->fs = fs;
+            dir->head = NULL;
+            dir->pos = NULL;
+            dir->size = 0;
+            dir->next = fs->overlay->child_first[m];
+            dir->end = fs->overlay->child_first[m + 1U];
+            cpiofs_hold(fs);
+            return (int)CPIO_ERR_OK;
+        }
+        return (int)CPIO_ERR_NEXIST;
+    }
+    if (cpiofs_indexed(fs)) {
+        uint32_t e = cpiofs_index_lookup(fs, path, CPIO_DIR_TYPE_MASK);
+        if (e != CPIO_INDEX_NONE) {
+            dir->fs = fs;
+            dir->head = (fs->store == NULL) ? cpiofs_index_head(fs, e) : NULL;
+            dir->pos = NULL;
+            dir->size = 0;
+            dir->next = fs->index.child_first[e];
+            dir->end = fs->index.child_first[e + 1U];
+            cpiofs_hold(fs);
+            return (int)CPIO_ERR_OK;
+        }
+        return (int)CPIO_ERR_NEXIST;
+    }
     const struct header_old_cpio* pdata = cpiofs_find(fs, path, CPIO_DIR_TYPE_MASK, strncmp, NULL);
     if (pdata != NULL) {
         dir->fs = fs;
         dir->head = pdata;
         dir->pos = fs->head;
         dir->size = fs->size;
-        fs->resource_count ++;
+        dir->next = 0;
+        dir->end = 0;
+        cpiofs_hold(fs);
         return (int)CPIO_ERR_OK;
     }
     return (int)CPIO_ERR_NEXIST;
@@ -306,8 +936,7 @@ int cpiofs_dir_open(cpiofs_t *fs, cpio_dir_t *dir, const char *path) {
 
 int cpiofs_dir_close(cpio_dir_t *dir) {
     if (dir->fs != NULL) {
-        // todo add assert if file->fs->resource_count == 0
-        dir->fs->resource_count --;
+        cpiofs_release(dir->fs);
         dir->fs = NULL;
         dir->head = NULL;
         dir->pos = NULL;
@@ -338,8 +967,78 @@ static int nprefix_nosub(const char *s1, const char *s2, size_t n) {
     return 0;
 }
 
+static void dir_entry_info(const struct header_old_cpio* pdata, cpio_info_t *info) {
+    uint16_t mode = cpio_get_mode(pdata);
+    info->type = mode & CPIO_TYPE_MASK;
+    info->mode = mode & (CPIO_MODE_MASK);
+    info->size = cpio_get_filesize(pdata);
+    info->filepath = get_filename(pdata, &info->filepaths);
+    // the name field of an aligned archive is padded with NULs
+    while ((info->filepaths > 1U) && (info->filepath[info->filepaths - 2U] == '\0')) {
+        info->filepaths --;
+    }
+
+    info->filename = &info->filepath[info->filepaths - 1];
+    info->filenames = 0;
+    while ((info->filename != info->filepath) && (info->filename[0] != '/')) {
+        info->filename --;
+        info->filenames ++;
+    }
+    if (info->filename[0] == '/') {
+        info->filename ++;
+        info->filenames --;
+    }
+}
+
+void cpiofs_index_info(const cpiofs_t *fs, uint32_t e, cpio_info_t *info) {
+    const cpiofs_index_t *index = &fs->index;
+    const char *path = &index->strings[index->name[e]];
+    uint16_t len = index->name_len[e];
+    info->type = index->mode[e] & CPIO_TYPE_MASK;
+    info->mode = index->mode[e] & (CPIO_MODE_MASK);
+    info->size = index->fsize[e];
+    if (fs->store == NULL) {
+        info->filepath = get_filename(cpiofs_index_head(fs, e), NULL);
+    } else {
+        // the copied names are NUL separated, walk back over the root prefix
+        info->filepath = path;
+        while ((info->filepath != index->strings) && (info->filepath[-1] != '\0')) {
+            info->filepath --;
+        }
+    }
+    info->filepaths = (uint16_t)(path - info->filepath) + len + 1U;
+
+    info->filenames = 0;
+    while ((info->filenames < len) && (path[len - info->filenames - 1U] != '/')) {
+        info->filenames ++;
+    }
+    info->filename = &path[len - info->filenames];
+}
+
 int cpiofs_dir_read(cpio_dir_t *dir, cpio_info_t *info) {
     if (dir->fs != NULL) {
+        const struct cpiofs_overlay *ov = dir->fs->overlay;
+        if (ov != NULL) {
+            if (dir->next >= dir->end) {
+                return 0;
+            }
+            if (info != NULL) {
+                uint32_t m = ov->child[dir->next];
+                cpiofs_index_info(ov->layer[ov->from[m]], ov->entry[m], info);
+            }
+            dir->next ++;
+            return 1;
+        }
+        if (cpiofs_indexed(dir->fs)) {
+            if (dir->next >= dir->end) {
+                return 0;
+            }
+            if (info != NULL) {
+                cpiofs_index_info(dir->fs, dir->fs->index.child[dir->next], info);
+            }
+            dir->next ++;
+            return 1;
+        }
         if (NULL == dir->pos) {
             return 0;
         }
@@ -360,31 +1059,148 @@ int cpiofs_dir_read(cpio_dir_t *dir, cpio_info_t *info) {
         }
         if (pdata != NULL) {
             if (info != NULL) {
-                uint16_t mode = cpio_get_mode(pdata);
-                info->type = mode & CPIO_TYPE_MASK;
-                info->mode = mode & (CPIO_MODE_MASK);
-                info->size = cpio_get_filesize(pdata);
-                info->filepath = get_filename(pdata, &info->filepaths);
-
-                info->filename = &info->filepath[info->filepaths - 1];
-                info->filenames = 0;
-                while ((info->filename != info->filepath) && (info->filename[0] != '/')) {
-                    info->filename --;
-                    info->filenames ++;
-                }
-                if (info->filename[0] == '/') {
-                    info->filename ++;
-                    info->filenames --;
-                }
-            }
-            pdata = cpio_goto_next(pdata, &dsize);
-            if (pdata != NULL) {
-                dir->pos = pdata;
-                dir->size = dsize;
+                dir_entry_info(pdata, info);
             }
+            // NULL past the last header, the next read ends the listing
+            dir->pos = cpio_goto_next(pdata, &dsize);
+            dir->size = dsize;
             return 1;
         }
         return 0;
     }
     return (int)CPIO_ERR_NEXIST;
 }
+
+// Recursive walk
+
+struct walk_frame {
+    uint32_t e;         // directory being walked
+    uint32_t next;      // next child slot
+};
+
+struct walk {
+    const cpiofs_t *fs;
+    cpiofs_walk_t callback;
+    void *ctx;
+    unsigned int flags;
+    struct walk_frame *stack;
+    uint32_t room;      // frames allocated
+    int count;          // entries reported
+};
+
+// Walk the subtree of entry root, which is at depth level, with a stack
+// of the directories being walked instead of recursion
+// Returns 1 at the end of the subtree, 0 if the callback stopped the
+// walk, or a negative error code on failure.
+static int walk_tree(struct walk *w, uint32_t root, unsigned int level) {
+    const cpiofs_index_t *index = &w->fs->index;
+    cpio_info_t info;
+    uint32_t depth = 0;
+    uint32_t e = root;
+    for (;;) {
+        if (e != CPIO_INDEX_NONE) {
+            int dir = (index->mode[e] & CPIO_TYPE_MASK) == CPIO_DIR_TYPE_MASK;
+            cpiofs_index_info(w->fs, e, &info);
+            int action = w->callback(&info, level + depth, dir ? CPIOFS_WALK_DIR : CPIOFS_WALK_FILE, w->ctx);
+            w->count ++;
+            if (action == CPIOFS_WALK_STOP) {
+                return 0;
+            }
+            if (dir && (action != CPIOFS_WALK_PRUNE)) {
+                if (depth == w->room) {
+                    // a tree is never deeper than its entries, a saved
+                    // index with a loop is
+                    if (w->room >= index->count) {
+                        return (int)CPIO_ERR_UNKNOWN;
+                    }
+                    uint32_t room = (w->room != 0) ? 2U * w->room : 16U;
+                    struct walk_frame *stack = realloc(w->stack, room * sizeof(struct walk_frame));
+                    if (stack == NULL) {
+                        return (int)CPIO_ERR_NOMEM;
+                    }
+                    w->stack = stack;
+                    w->room = room;
+                }
+                w->stack[depth].e = e;
+                w->stack[depth].next = index->child_first[e];
+                depth ++;
+            }
+        }
+        if (depth == 0) {
+            return 1;
+        }
+        struct walk_frame *top = &w->stack[depth - 1U];
+        if (top->next < index->child_first[top->e + 1U]) {
+            e = index->child[top->next ++];
+        } else {
+            depth --;
+            e = CPIO_INDEX_NONE;
+            if ((w->flags & CPIOFS_WALK_POSTORDER) != 0) {
+                cpiofs_index_info(w->fs, top->e, &info);
+                if (w->callback(&info, level + depth, CPIOFS_WALK_DIR_POST, w->ctx) == CPIOFS_WALK_STOP) {
+                    return 0;
+                }
+            }
+        }
+    }
+}
+
+int cpiofs_walk(const cpiofs_t *fs, const char *root, cpiofs_walk_t callback, void *ctx, unsigned int flags) {
+    if ((fs == NULL) || (root == NULL) || (callback == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fs->overlay != NULL) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    if (!cpiofs_indexed(fs)) {
+        cpiofs_t view = {
+            .head = fs->head,
+            .size = fs->size,
+        };
+        int ret = cpiofs_index_build(&view, 1, &view.index);
+        if (ret == CPIO_ERR_OK) {
+            ret = cpiofs_walk(&view, root, callback, ctx, flags);
+            free(view.index.mem);
+        }
+        return ret;
+    }
+
+    const cpiofs_index_t *index = &fs->index;
+    struct walk w = {
+        .fs = fs,
+        .callback = callback,
+        .ctx = ctx,
+        .flags = flags,
+    };
+    root = cpio_path_skip_root(root);
+    size_t len = strlen(root);
+    while ((len > 0) && (root[len - 1U] == '/')) {
+        len --;
+    }
+    int ret;
+    uint32_t e = cpiofs_index_probe(index, root, len, cpio_path_hash(root, len), CPIO_FILEDIR_TYPE);
+    if (e != CPIO_INDEX_NONE) {
+        ret = walk_tree(&w, e, 0);
+    } else {
+        // no entry for root, start from the orphans under it
+        ret = (int)CPIO_ERR_NEXIST;
+        for (e = 0; e < index->count; e++) {
+            const char *path = &index->strings[index->name[e]];
+            size_t plen = index->name_len[e];
+            if ((index->parent[e] != CPIO_INDEX_NONE) || ((index->mode[e] & CPIO_FILEDIR_TYPE) == 0) ||
+                (plen <= len) || ((len > 0) && ((path[len] != '/') || (memcmp(path, root, len) != 0)))) {
+                continue;
+            }
+            unsigned int level = 1;
+            for (size_t i = (len > 0) ? len + 1U : 0; i < plen; i++) {
+                level += (path[i] == '/');
+            }
+            ret = walk_tree(&w, e, level);
+            if (ret <= 0) {
+                break;
+            }
+        }
+    }
+    free(w.stack);
+    return (ret < 0) ? ret : w.count;
+}
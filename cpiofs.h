@@ -4,6 +4,19 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#if !defined(__STDC_NO_ATOMICS__) && !defined(__cplusplus)
+#include <stdatomic.h>
+#define CPIO_HAVE_ATOMICS
+#define CPIO_ATOMIC _Atomic
+#else
+#define CPIO_ATOMIC
+#endif
+
+// Headers in the old binary format (either byte order), in the portable
+// ASCII format (odc) and in the new ASCII formats (newc and crc) are
+// accepted, also mixed in the same archive. The getters decode the field
+// from whatever format the header is in; cpio_get_magic returns 070707
+// for the binary and odc headers, 070701 for newc and 070702 for crc.
 struct header_old_cpio;
 
 #define DEF_GETTER16(x) \
@@ -23,6 +36,7 @@ DEF_GETTER16(rdev);
 DEF_GETTER32(mtime);
 DEF_GETTER16(namesize);
 DEF_GETTER32(filesize);
+DEF_GETTER32(check);    // data checksum of the crc format, 0 otherwise
 
 #undef DEF_GETTER16
 #undef DEF_GETTER32
@@ -63,19 +77,102 @@ enum cpio_error {
     CPIO_ERR_SEEK_OUT    = -2,   // seek command is out of the file
     CPIO_ERR_PARAM       = -3,   // parameter error
     CPIO_ERR_UNKNOWN     = -4,   // general error
+    CPIO_ERR_NOMEM       = -5,   // no memory available for the index
+    CPIO_ERR_BUSY        = -6,   // files or directories are still open
+    CPIO_ERR_NOTSUP      = -7,   // not supported by the way the archive is mounted
+    CPIO_ERR_IO          = -8,   // the backing store failed to read
+    CPIO_ERR_CORRUPT     = -9,   // a header or a data checksum is wrong
 };
 
+// Archive sizes and offsets, file positions and seeks
+//
+// 32 bits by default, which caps an archive at 4 GB and a seek at 2 GB.
+// CPIO_LARGEFILE makes them 64 bits, for archives past 4 GB; a file
+// stays under 4 GB, the limit of the header fields. The setting changes
+// the API: the library and its users have to be built with the same.
+#ifdef CPIO_LARGEFILE
+typedef uint64_t cpio_size_t;
+typedef int64_t cpio_ssize_t;
+typedef int64_t cpio_soff_t;
+typedef uint64_t cpio_off_t;
+#else
 typedef uint32_t cpio_size_t;
 typedef int32_t cpio_ssize_t;
 typedef int32_t cpio_soff_t;
 typedef uint32_t cpio_off_t;
+#endif
+
+// Path index built by cpiofs_mount
+//
+// The fields are private to the library. An all zero index means that
+// the archive is not indexed and every lookup scans the header chain.
+// Every header is decoded once at mount into the entry table below,
+// one array per field, in host byte order.
+typedef struct cpiofs_index {
+    uint32_t count;             // number of indexed entries
+    uint32_t mask;              // number of hash slots - 1
+    const char *strings;        // base of the path offsets: the image, or a copy of the names
+    const cpio_off_t *entry;    // header offset in the archive, in archive order
+    const cpio_off_t *name;     // path offset from strings, without root prefix
+    const cpio_off_t *data;     // file data offset in the archive
+    const cpio_size_t *fsize;   // file data size
+    const uint16_t *name_len;   // path length, without the terminating NUL
+    const uint16_t *mode;       // type and mode bits
+    const uint32_t *hash;       // path hash of every entry
+    const uint32_t *slot;       // hash slots: entry number + 1, 0 if free
+    const uint32_t *parent;     // entry number of the parent directory
+    const uint32_t *child_first;// children of entry e are child[child_first[e]..child_first[e+1]-1]
+    const uint32_t *child;      // entry numbers grouped by parent directory
+    const uint32_t *sorted;     // entry numbers in bytewise path order
+    cpio_off_t trailer;         // offset of the trailer header
+    void *mem;                  // memory owned by the index, NULL if the tables are in a saved index or an arena
+    uint32_t nbucket;           // buckets of the perfect hash, 0 if there is none
+    uint32_t nphf;              // distinct paths, slots of the perfect hash
+    const uint32_t *pilot;      // perfect hash: displacement of every bucket
+    const uint32_t *phf;        // perfect hash: first entry of the path in every slot
+} cpiofs_index_t;
+
+// Read callback of a backing store
+//
+// Reads size bytes at offset off of the archive into buffer.
+// Returns the number of bytes read, or a negative error code on failure.
+typedef cpio_ssize_t (*cpiofs_read_t)(void *ctx, cpio_off_t off, void *buffer, cpio_size_t size);
+
+struct cpiofs_store;
+struct cpiofs_zchunk;
+struct cpiofs_overlay;
 
 typedef struct cpiofs {
     const struct header_old_cpio *head;
     cpio_size_t size;
-    unsigned int resource_count;
+    CPIO_ATOMIC unsigned int resource_count;   // open files and directories
+    cpiofs_index_t index;
+    struct cpiofs_store *store; // backing store, NULL if the image is in memory
+    void *map;                  // mapping owned by cpiofs_mount_path/fd, NULL otherwise
+    size_t map_size;
+    int map_fd;                 // file kept by CPIOFS_MAP_KEEP_FD + 1, 0 otherwise
+    struct cpiofs_zchunk *zchunk; // chunk table of a compressed archive, NULL otherwise
+    struct cpiofs_overlay *overlay; // merged index of cpiofs_mount_overlay, NULL otherwise
 } cpiofs_t;
 
+// Archive compiled into the program by cpioembed
+//
+// The image and every table of its index are const data, so they stay
+// in flash or .rodata; the index carries a minimal perfect hash of the
+// paths, a lookup hashes the path twice and compares one entry.
+typedef struct cpiofs_embedded {
+    const void *image;
+    cpio_size_t size;
+    cpiofs_index_t index;
+} cpiofs_embedded_t;
+
+typedef struct cpiofs_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint32_t blocks;
+    cpio_size_t block_size;
+} cpiofs_cache_stats_t;
+
 typedef struct cpio_info {
     uint16_t type;
     uint16_t mode;
@@ -90,6 +187,8 @@ typedef struct cpio_file {
     cpiofs_t *fs;
     const struct header_old_cpio *head;
     cpio_off_t pos;
+    cpio_off_t data;    // data offset in the archive
+    cpio_size_t size;   // data size
 } cpio_file_t;
 
 typedef struct cpio_dir {
@@ -97,6 +196,8 @@ typedef struct cpio_dir {
     const struct header_old_cpio *head;
     const struct header_old_cpio *pos;
     long size;
+    uint32_t next;      // next child slot, mounted archives only
+    uint32_t end;       // end of the children slice, mounted archives only
 } cpio_dir_t;
 
 // File seek flags
@@ -106,17 +207,204 @@ typedef enum cpio_whence_flags {
     CPIO_SEEK_END = 2,   // Seek relative to the end of the file
 } cpio_whence_flags_t;
 
+// A mounted archive is read only: any number of threads can stat, open
+// and read through the same cpiofs_t without locking, as long as every
+// cpio_file_t and cpio_dir_t is used by one thread at a time, or only
+// through cpiofs_file_pread. Backing store mounts serialize the reads
+// that go to the store. A cpiofs_aio_t is one thread's, like a file.
+
+// Mount an archive
+//
+// Binds the image to fs and builds the path index once, so that
+// stat and open no longer scan the whole header chain. An index saved
+// in the archive by cpioindex is used as is when it still matches. A
+// cpiofs_t filled by hand keeps working without the index.
+// Returns a negative error code on failure.
+int cpiofs_mount(cpiofs_t *fs, const void *image, cpio_size_t size);
+
+// Mount a large archive with many threads
+//
+// Like cpiofs_mount, but the header chain is found by nthread threads,
+// 0 for one per core, each guessing the headers of a slice of the image
+// before the slices are stitched along the true chain. The index is the
+// same as the one cpiofs_mount builds. Worth it from a few hundreds of
+// MB on; small images are scanned by fewer threads.
+// Returns a negative error code on failure.
+int cpiofs_mount_threads(cpiofs_t *fs, const void *image, cpio_size_t size, unsigned int nthread);
+
+// Bytes of arena that cpiofs_mount_arena needs for an image
+//
+// A dry run of the mount: the header chain is walked once and nothing
+// is allocated nor written. *need is 0 when the image holds a saved
+// index that is used in place.
+// Returns a negative error code on failure.
+int cpiofs_mount_arena_size(const void *image, cpio_size_t size, cpio_size_t *need);
+
+// Mount an archive with the index in memory of the caller
+//
+// Like cpiofs_mount with no heap at all: the tables of the index, which
+// hold offsets from the image and no pointers, are carved from arena.
+// arena is aligned on 8 bytes, holds the bytes given by
+// cpiofs_mount_arena_size and stays valid until unmount, which leaves
+// it alone.
+// Returns CPIO_ERR_NOMEM if arena is too small, or another negative
+// error code on failure.
+int cpiofs_mount_arena(cpiofs_t *fs, const void *image, cpio_size_t size, void *arena, cpio_size_t arena_size);
+
+// Name of the entry holding a saved index
+//
+// The entry is left out of the index: it is only seen by the functions
+// that scan a cpiofs_t filled by hand.
+#define CPIOFS_INDEX_NAME   ".cpiofs.index"
+
+// Mount an archive compiled in by cpioembed
+//
+// Nothing is scanned nor allocated: fs points to the const image and
+// index. Returns a negative error code on failure.
+int cpiofs_mount_embedded(cpiofs_t *fs, const cpiofs_embedded_t *embedded);
+
+// Names of the whiteout entries of an overlay layer
+//
+// An entry named CPIOFS_WHITEOUT_PREFIX "name" hides the entry "name"
+// of the same directory, with its subtree, in the layers below; an
+// entry named CPIOFS_WHITEOUT_OPAQUE hides everything the layers below
+// have in its directory. Whiteouts are not seen in the overlay.
+#define CPIOFS_WHITEOUT_PREFIX  ".wh."
+#define CPIOFS_WHITEOUT_OPAQUE  ".wh..wh..opq"
+
+// Mount a union of archives
+//
+// layers are nlayer mounted archives, the lowest first, each one
+// patching the ones below: a path is taken from the highest layer that
+// has it, a file or a whiteout hides whatever the layers below have
+// under its path, and directories are merged. The merged path and
+// children index is built once, so cpiofs_stat, cpiofs_file_open and
+// cpiofs_dir_open/read probe it once whatever the number of layers.
+// Files opened through fs belong to their layer. The layers have to be
+// indexed, and cannot be unmounted before fs. cpiofs_walk, cpiofs_glob,
+// cpiofs_verify and cpiofs_extract go to the layers themselves.
+// Returns a negative error code on failure.
+int cpiofs_mount_overlay(cpiofs_t *fs, cpiofs_t *const *layers, uint32_t nlayer);
+
+// Mount an archive with a saved index
+//
+// Uses the index saved in blob by cpiofs_index_save(fs, 0, ...) as a
+// sidecar file, and falls back to building the index if the blob does
+// not match the image. cpiofs_mount does the same with an index saved
+// in the archive itself. The blob has to stay valid until unmount.
+// Returns a negative error code on failure.
+int cpiofs_mount_index(cpiofs_t *fs, const void *image, cpio_size_t size, const void *blob, cpio_size_t blob_size);
+
+// Save the index of a mounted archive
+//
+// The blob holds the tables of the index, with offsets only, and the
+// few headers it relies on are checked again at mount. With at = 0 the
+// blob is a sidecar for cpiofs_mount_index. Otherwise at is the archive
+// offset where the blob goes as the data of a CPIOFS_INDEX_NAME entry
+// that replaces the trailer, the trailer following the blob right away;
+// cpiofs_mount then finds it. On success *blob is to be released with
+// free(). Not available for backing store mounts.
+// Returns a negative error code on failure.
+int cpiofs_index_save(const cpiofs_t *fs, cpio_off_t at, void **blob, cpio_size_t *size);
+
+// Mount an archive from a backing store
+//
+// For archives that do not fit in memory: headers and data are read on
+// demand through read and kept in an LRU cache of nblock blocks of
+// block_size bytes (a power of two). The index is built at mount and
+// keeps a copy of the entry names, so lookups and directory listings
+// never go to the store. cpiofs_file_view is not available.
+// Returns a negative error code on failure.
+int cpiofs_mount_store(cpiofs_t *fs, cpiofs_read_t read, void *ctx, cpio_size_t size,
+                       cpio_size_t block_size, uint32_t nblock);
+
+// Flags of cpiofs_mount_path and cpiofs_mount_fd
+typedef enum cpiofs_map_flags {
+    CPIOFS_MAP_POPULATE   = 1,  // fault the whole image in up front (MAP_POPULATE)
+    CPIOFS_MAP_ADVISE     = 2,  // MADV_SEQUENTIAL while indexing, MADV_RANDOM afterwards
+    CPIOFS_MAP_KEEP_FD    = 4,  // keep the file open until unmount, for cpiofs_file_sendfile
+} cpiofs_map_flags_t;
+
+// Mount an archive file
+//
+// Maps the file read-only and mounts the mapping, so the image is paged
+// in on demand and shared by all the processes mounting the same file.
+// The mapping is released by cpiofs_unmount. Only on POSIX systems.
+// Returns a negative error code on failure.
+int cpiofs_mount_path(cpiofs_t *fs, const char *path, unsigned int flags);
+
+// Mount an archive from an open file descriptor
+//
+// Like cpiofs_mount_path; the descriptor can be closed once mounted.
+// Returns a negative error code on failure.
+int cpiofs_mount_fd(cpiofs_t *fs, int fd, unsigned int flags);
+
+// Read callback for a file descriptor, ctx points to the int descriptor
+cpio_ssize_t cpiofs_read_fd(void *ctx, cpio_off_t off, void *buffer, cpio_size_t size);
+
+// Codecs of the compressed archives
+typedef enum cpiofs_codec {
+    CPIOFS_CODEC_ZLIB     = 1,
+} cpiofs_codec_t;
+
+// Mount a compressed archive
+//
+// The container read through read holds the archive cut in chunks that
+// are compressed one by one (see cpiofs_pack). It is mounted as a
+// backing store whose blocks are the chunks, so a read inflates only
+// the chunks it touches and the last nblock chunks stay cached.
+// Needs zlib, CPIO_ERR_NOTSUP otherwise.
+// Returns a negative error code on failure.
+int cpiofs_mount_compressed(cpiofs_t *fs, cpiofs_read_t read, void *ctx, uint32_t nblock);
+
+// Pack a plain archive into a compressed one
+//
+// Compresses every chunk of chunk_size bytes (a power of two, 16 MiB
+// at most) at the zlib level. On success *out holds the container, to
+// be released with free(), and *out_size its size.
+// Returns a negative error code on failure.
+int cpiofs_pack(const void *image, cpio_size_t size, cpio_size_t chunk_size, int level,
+                void **out, cpio_size_t *out_size);
+
+// Get the block cache counters of a backing store mount
+//
+// Returns a negative error code on failure.
+int cpiofs_cache_stats(const cpiofs_t *fs, cpiofs_cache_stats_t *stats);
+
+// Unmount an archive
+//
+// Releases the index and the backing store cache. Fails if files or
+// directories are still open.
+// Returns a negative error code on failure.
+int cpiofs_unmount(cpiofs_t *fs);
+
 // Find info about a file or directory
 //
 // Fills out the info structure, based on the specified file or directory.
 // Returns a negative error code on failure.
 int cpiofs_stat(const cpiofs_t *fs, const char *path, cpio_info_t *info);
 
+// Find info about many files or directories
+//
+// Resolves the n paths at once: a batch of hash probes on a mounted
+// archive, a single walk of the header chain otherwise, instead of one
+// scan per path. results[i], if results is not NULL, gets what
+// cpiofs_stat returns for paths[i]; infos[i] is filled on success.
+// Returns the number of paths found, or a negative error code on failure.
+int cpiofs_stat_many(const cpiofs_t *fs, const char *const *paths, uint32_t n, cpio_info_t *infos, int *results);
+
 // Open a file
 //
 // Returns a negative error code on failure.
 int cpiofs_file_open(cpiofs_t *fs, cpio_file_t *file, const char *path);
 
+// Open many files
+//
+// Like cpiofs_stat_many for cpiofs_file_open: files[i] is opened when
+// paths[i] is found, and has to be closed like any other file.
+// Returns the number of files opened, or a negative error code on failure.
+int cpiofs_open_many(cpiofs_t *fs, const char *const *paths, uint32_t n, cpio_file_t *files, int *results);
+
 // Close a file
 //
 // Returns a negative error code on failure.
@@ -128,6 +416,43 @@ int cpiofs_file_close(cpio_file_t *file);
 // Returns the number of bytes read, or a negative error code on failure.
 cpio_ssize_t cpiofs_file_read(cpio_file_t *file, void *buffer, cpio_size_t size);
 
+// Read data from file at an offset
+//
+// Like cpiofs_file_read, but reads at off and leaves the file position
+// alone, so that many threads can read the same open file at once.
+// Returns the number of bytes read, 0 at the end of the file, or a
+// negative error code on failure.
+cpio_ssize_t cpiofs_file_pread(const cpio_file_t *file, void *buffer, cpio_size_t size, cpio_off_t off);
+
+// Send file data to a descriptor
+//
+// Sends up to count bytes from the file position to out_fd, a socket,
+// a pipe or a file, and moves the position past them. The data is not
+// copied in user space: sendfile from the archive file of a mount with
+// CPIOFS_MAP_KEEP_FD, vmsplice and splice from an image in memory,
+// which has to stay unchanged while the kernel still holds its pages.
+// Backing store mounts and systems without these calls go through a
+// small buffer instead.
+// Returns the number of bytes sent, 0 at the end of the file,
+// CPIO_ERR_BUSY if a non blocking out_fd takes nothing, or another
+// negative error code on failure.
+cpio_ssize_t cpiofs_file_sendfile(cpio_file_t *file, int out_fd, cpio_size_t count);
+
+// Get a view of the whole file
+//
+// Points data at the file contents inside the archive image, nothing
+// is copied. The view stays valid while the file is open.
+// Returns a negative error code on failure.
+int cpiofs_file_view(cpio_file_t *file, const void **data, cpio_size_t *size);
+
+// Get a view of the file from the current position
+//
+// Like cpiofs_file_read, but instead of copying up to size bytes it
+// points data at them inside the archive image and advances the
+// position. The view stays valid while the file is open.
+// Returns the number of bytes in the view, or a negative error code on failure.
+cpio_ssize_t cpiofs_file_view_read(cpio_file_t *file, const void **data, cpio_size_t size);
+
 // Change the position of the file
 //
 // The change in position is determined by the offset and whence flag.
@@ -174,4 +499,303 @@ int cpiofs_dir_close(cpio_dir_t *dir);
 // or a negative error code on failure.
 int cpiofs_dir_read(cpio_dir_t *dir, cpio_info_t *info);
 
+// Events of cpiofs_walk
+typedef enum cpiofs_walk_event {
+    CPIOFS_WALK_FILE      = 0,  // anything but a directory
+    CPIOFS_WALK_DIR       = 1,  // a directory, before its contents
+    CPIOFS_WALK_DIR_POST  = 2,  // a directory, after its contents
+} cpiofs_walk_event_t;
+
+// What the callback of cpiofs_walk returns
+typedef enum cpiofs_walk_action {
+    CPIOFS_WALK_CONTINUE  = 0,
+    CPIOFS_WALK_PRUNE     = 1,  // skip the contents of the directory just reported
+    CPIOFS_WALK_STOP      = 2,  // end the walk
+} cpiofs_walk_action_t;
+
+// Flags of cpiofs_walk
+typedef enum cpiofs_walk_flags {
+    CPIOFS_WALK_POSTORDER = 1,  // report every directory after its contents too
+} cpiofs_walk_flags_t;
+
+// Callback of cpiofs_walk
+//
+// depth is 0 for root, 1 for its contents and so on. info is only valid
+// during the call.
+typedef int (*cpiofs_walk_t)(const cpio_info_t *info, unsigned int depth, cpiofs_walk_event_t event, void *ctx);
+
+// Walk the tree under a directory
+//
+// Reports root and everything under it depth first, the contents of a
+// directory in archive order, like nested cpiofs_dir_read would but in
+// a single pass over the index. A cpiofs_t filled by hand gets a
+// temporary index, built with one scan of the archive; mount it to walk
+// it many times. When root has no entry of its own, the walk starts
+// from the entries under it whose directory is missing too.
+// Returns the number of entries reported before the end or the stop,
+// or a negative error code on failure.
+int cpiofs_walk(const cpiofs_t *fs, const char *root, cpiofs_walk_t callback, void *ctx, unsigned int flags);
+
+// Callback of cpiofs_glob, returns non zero to stop the query
+typedef int (*cpiofs_glob_t)(const cpio_info_t *info, void *ctx);
+
+// Find the paths matching a pattern
+//
+// '*' matches any run of characters but '/', '?' any one of them and
+// "[a-z]" or "[!a-z]" one out of a class; '\' quotes the next
+// character. A whole component "**" matches any number of components,
+// none included, and a trailing '/' keeps the directories only. The
+// paths are reported once each, in bytewise order: the literal head of
+// the pattern is a range of the sorted paths of the index, not a scan.
+// A cpiofs_t filled by hand gets a temporary index, like cpiofs_walk.
+// Returns the number of paths reported, or a negative error code on failure.
+int cpiofs_glob(const cpiofs_t *fs, const char *pattern, cpiofs_glob_t callback, void *ctx);
+
+// Verify a whole archive
+//
+// Decodes the header chain up to the trailer and checks the data of
+// every crc entry against its checksum; the other formats carry none
+// and only get the header checks. The data is summed by nthread threads,
+// 0 for one per core, in pieces, so that a big file is shared by all of
+// them. On CPIO_ERR_CORRUPT *bad, if not NULL, gets the offset of the
+// first header that is wrong or whose data is.
+// Returns the number of entries checked, or a negative error code on failure.
+int cpiofs_verify(const cpiofs_t *fs, unsigned int nthread, cpio_off_t *bad);
+
+// What cpiofs_extract created
+typedef struct cpiofs_extract_stats {
+    uint32_t files;             // regular files
+    uint32_t dirs;
+    uint32_t links;             // symbolic links
+    uint32_t skipped;           // devices, pipes, sockets and paths out of the destination
+    uint64_t bytes;             // file data written
+} cpiofs_extract_stats_t;
+
+// Flags of cpiofs_extract
+typedef enum cpiofs_extract_flags {
+    CPIOFS_EXTRACT_WRITE    = 1,    // write out of the image even from a mount with CPIOFS_MAP_KEEP_FD
+    CPIOFS_EXTRACT_NO_TIMES = 2,    // leave the modification times as the extraction sets them
+} cpiofs_extract_flags_t;
+
+// Extract a whole archive to a directory
+//
+// Creates dest if needed, then the directories, then writes the regular
+// files with nthread threads, 0 for one per core, and restores the
+// modes and modification times of the headers. Where a path is in the
+// archive more than once the last entry wins. The data of a mount with
+// CPIOFS_MAP_KEEP_FD is copied with copy_file_range where the systems
+// allow it, and written out of the image otherwise. Symbolic links are
+// made last; devices, pipes, sockets and the paths with a ".." are
+// skipped. The hard links of a file, which share its device and inode,
+// are linked to the one with the data, or copied where the destination
+// has no hard links. stats, if not NULL, gets what was created, also
+// on failure.
+// Returns a negative error code on failure.
+int cpiofs_extract(const cpiofs_t *fs, const char *dest, unsigned int nthread, unsigned int flags,
+                   cpiofs_extract_stats_t *stats);
+
+// Write callback of cpiofs_writer
+//
+// Writes the size bytes of data at the end of the archive.
+// Returns size, or a negative error code on failure.
+typedef cpio_ssize_t (*cpiofs_write_t)(void *ctx, const void *data, cpio_size_t size);
+
+// Formats of cpiofs_writer
+typedef enum cpiofs_write_format {
+    CPIOFS_WRITE_NEWC     = 0,  // new ASCII
+    CPIOFS_WRITE_CRC      = 1,  // new ASCII with data checksum
+    CPIOFS_WRITE_ODC      = 2,  // portable ASCII
+    CPIOFS_WRITE_BIN      = 3,  // old binary, host byte order
+} cpiofs_write_format_t;
+
+// Archive writer
+//
+// Writes a standard archive through a callback, entry by entry, with
+// the data of every regular file at an offset that is a multiple of
+// align, a power of two: 64 for cache lines or SIMD loads, 4096 to
+// mmap the files. The name fields are padded with NULs to get there,
+// and where that is not enough "." directory entries are added in
+// between. cpio -i applies every one of them to the directory it
+// extracts to, so they take fill_mode and fill_mtime, 0755 and 0 after
+// cpiofs_writer_init: set them to the ones of the root of the archive.
+// Entries are owned by root and every one is its own inode, unless
+// added with cpiofs_writer_add_meta.
+typedef struct cpiofs_writer {
+    cpiofs_write_t write;
+    void *ctx;
+    unsigned int format;
+    cpio_size_t align;
+    cpio_off_t pos;             // bytes written so far
+    uint32_t ino;               // inode number of the last entry
+    uint32_t fillers;           // "." entries added for the alignment
+    uint32_t fill_mode;         // permission bits of the "." entries
+    uint32_t fill_mtime;        // modification time of the "." entries
+    int error;                  // first error, every later call returns it
+} cpiofs_writer_t;
+
+// Start an archive in format whose file data is aligned to align
+//
+// The archive starts at offset 0 of what write writes to.
+// Returns a negative error code on failure.
+int cpiofs_writer_init(cpiofs_writer_t *w, cpiofs_write_t write, void *ctx, unsigned int format, cpio_size_t align);
+
+// Add an entry
+//
+// mode holds the type and the permission bits, data the contents of a
+// regular file or the target of a symbolic link, NULL if size is 0.
+// Returns a negative error code on failure.
+int cpiofs_writer_add(cpiofs_writer_t *w, const char *path, uint32_t mode, uint32_t mtime,
+                      const void *data, cpio_size_t size);
+
+// Owner and identity of an entry
+//
+// Devices are major << 32 | minor; the old formats keep 8 bits of
+// minor and the low bits of the rest. Regular files with the same dev
+// and ino and an nlink above 1 are hard links: cpio puts their data on
+// the last one, the others having size 0.
+typedef struct cpiofs_writer_meta {
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t nlink;
+    uint32_t ino;
+    uint64_t dev;               // device of the file system the entry was on
+    uint64_t rdev;              // device of a device node
+} cpiofs_writer_meta_t;
+
+// Add an entry with its owner and identity
+//
+// cpiofs_writer_add with the fields of meta in the header, for copies
+// of an archive that keep its hard links, owners and device nodes.
+// Returns a negative error code on failure.
+int cpiofs_writer_add_meta(cpiofs_writer_t *w, const char *path, uint32_t mode, uint32_t mtime,
+                           const cpiofs_writer_meta_t *meta, const void *data, cpio_size_t size);
+
+// End the archive with the trailer, padded to a 512 bytes block
+//
+// Returns a negative error code on failure.
+int cpiofs_writer_finish(cpiofs_writer_t *w);
+
+// Write callback for a file descriptor, ctx points to the int descriptor
+cpio_ssize_t cpiofs_write_fd(void *ctx, const void *data, cpio_size_t size);
+
+// Alignment of the file data of a mounted archive
+//
+// The largest power of two that divides the address of the data of
+// every regular file, in the image of a mount in memory, or its offset
+// in the archive of a backing store mount. An archive written by
+// cpiofs_writer with align and mounted from an image aligned as much
+// gets at least align.
+// Returns the alignment, 0 if no file has data.
+cpio_size_t cpiofs_data_align(const cpiofs_t *fs);
+
+
+typedef struct cpiofs_stream cpiofs_stream_t;
+
+// Entry callback of cpiofs_stream, as soon as the header and the name
+// of an entry have arrived
+//
+// info and its names are valid during the call only.
+// Returns 0 to get the data of the entry, CPIOFS_STREAM_SKIP to skip
+// it, or a negative error code to stop the stream.
+typedef int (*cpiofs_stream_entry_t)(const cpio_info_t *info, void *ctx);
+
+// Data callback of cpiofs_stream, for every slice of the data of the
+// last entry: size bytes at offset off of the file
+//
+// data points into the chunk being fed, it is valid during the call only.
+// Returns 0, or a negative error code to stop the stream.
+typedef int (*cpiofs_stream_data_t)(const void *data, cpio_size_t size, cpio_off_t off, void *ctx);
+
+#define CPIOFS_STREAM_SKIP  1
+
+// Open a parser of an archive that arrives in chunks
+//
+// For archives read from a pipe, a socket or a decompressor, which
+// cannot be mounted: the chunks are fed as they come, of any size, and
+// the callbacks run from cpiofs_stream_feed. Headers and names split
+// between chunks are put together in a buffer of the parser, the file
+// data is never buffered, so the memory used does not depend on the
+// archive. The data of the crc format is checked as it goes by.
+// Returns a negative error code on failure.
+int cpiofs_stream_open(cpiofs_stream_t **stream, cpiofs_stream_entry_t entry, cpiofs_stream_data_t data, void *ctx);
+
+// Feed the next size bytes of the archive
+//
+// Whatever follows the trailer is ignored.
+// Returns a negative error code if the archive is not valid, or the one
+// a callback returned; every later call returns it again.
+int cpiofs_stream_feed(cpiofs_stream_t *stream, const void *chunk, cpio_size_t size);
+
+// Free the parser
+//
+// Returns the error that stopped the stream, CPIO_ERR_CORRUPT if the
+// archive ended before its trailer, 0 otherwise.
+int cpiofs_stream_close(cpiofs_stream_t *stream);
+
+typedef struct cpiofs_aio cpiofs_aio_t;
+
+// Completion callback of cpiofs_file_read_async
+//
+// Runs from cpiofs_aio_poll, in the polling thread, once the read is
+// over; result is the number of bytes read, or a negative error code.
+typedef void (*cpiofs_aio_done_t)(cpio_ssize_t result, void *ctx);
+
+typedef enum cpiofs_aio_flags {
+    CPIOFS_AIO_THREADS  = 1,    // pread on a thread pool even where io_uring is there
+} cpiofs_aio_flags_t;
+
+// Open an asynchronous reader of a mounted archive
+//
+// fd is the archive file the mount was made of, read at the offsets of
+// the index; it stays the caller's and has to outlive the reader. The
+// files of an overlay are read from the files kept by their layers,
+// mounted with CPIOFS_MAP_KEEP_FD, and fd can then be -1. At most depth
+// reads are in flight. On Linux the reads go through io_uring, set up
+// with raw system calls, and a thread pool otherwise or when it fails.
+// A reader belongs to the thread that opens it: its calls take no lock,
+// so threads sharing a mount open one reader each.
+// Returns a negative error code on failure, CPIO_ERR_NOTSUP for a
+// compressed mount.
+int cpiofs_aio_open(cpiofs_aio_t **aio, cpiofs_t *fs, int fd, unsigned int depth, unsigned int flags);
+
+// Close an asynchronous reader
+//
+// Waits for the reads in flight, running their callbacks, then frees
+// the reader.
+// Returns the error of a failed poll, 0 otherwise.
+int cpiofs_aio_close(cpiofs_aio_t *aio);
+
+// Whether a reader runs on io_uring
+//
+// Returns 1 on io_uring, 0 on the thread pool.
+int cpiofs_aio_uring(const cpiofs_aio_t *aio);
+
+// Queue a read of a file
+//
+// size bytes at off in the file, clamped like cpiofs_file_pread; done
+// runs from cpiofs_aio_poll with the result. The buffer is the
+// kernel's, or a thread's, until then. file has to be opened through
+// the mount of the reader, or for an overlay through one of its layers
+// that keeps its file. Only the thread of the reader can queue.
+// Returns a negative error code on failure, CPIO_ERR_BUSY with depth
+// reads in flight.
+int cpiofs_file_read_async(cpiofs_aio_t *aio, const cpio_file_t *file, void *buffer, cpio_size_t size,
+                           cpio_off_t off, cpiofs_aio_done_t done, void *ctx);
+
+// Open a file and read ahead of it
+//
+// cpiofs_file_open on the mount of the reader, then readahead of the
+// first readahead bytes of the file so that the first reads find them
+// in the page cache. The hint is left out when every slot is taken.
+// Returns a negative error code on failure.
+int cpiofs_file_open_async(cpiofs_aio_t *aio, cpio_file_t *file, const char *path, cpio_size_t readahead);
+
+// Run the reads of a reader
+//
+// Submits the queued reads and runs the callbacks of the finished ones,
+// waiting until at least wait of them have run or nothing is in flight.
+// The callbacks can queue new reads.
+// Returns the number of callbacks run, or a negative error code on failure.
+int cpiofs_aio_poll(cpiofs_aio_t *aio, unsigned int wait);
+
 #endif
\ No newline at end of file
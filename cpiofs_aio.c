@@ -0,0 +1,602 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#define CPIO_HAVE_AIO
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#define CPIO_HAVE_URING
+#endif
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Asynchronous reads of an archive file
+//
+// Every read takes one of depth slots until its callback has run. On
+// io_uring the slots are filled in as submission entries, handed to the
+// kernel in one system call by the next poll, which reaps the
+// completions too; the rings are set up with raw system calls, no
+// library needed. Without io_uring a few threads pread the queued slots
+// and put them on a done list for the poll. Either way the callbacks
+// run in the polling thread, the only one to use the reader: the free
+// slots take no lock. The files of an overlay are read from the
+// archive file kept by their layer.
+
+#ifdef CPIO_HAVE_AIO
+
+#define AIO_DEPTH_MAX       4096U
+#define AIO_THREADS         8U
+#define AIO_NONE            UINT32_MAX
+
+enum aio_op {
+    AIO_READ = 0,
+    AIO_ADVISE,             // readahead, no callback
+};
+
+struct aio_req {
+    uint8_t op;
+    int fd;                 // archive file
+    uint8_t *buffer;
+    cpio_size_t size;
+    cpio_size_t got;        // bytes read so far, a short read goes on from there
+    cpio_off_t off;         // archive offset
+    cpiofs_aio_done_t done;
+    void *ctx;
+    cpio_ssize_t result;
+    uint32_t next;          // link of the free, queued or done list
+#ifdef CPIO_HAVE_URING
+    struct iovec iov;
+#endif
+};
+
+struct cpiofs_aio {
+    cpiofs_t *fs;
+    int fd;
+    uint32_t depth;
+    uint32_t inflight;      // slots taken
+    uint32_t free;          // free slots, only touched by the polling thread
+    struct aio_req *req;
+#ifdef CPIO_HAVE_URING
+    int ring;               // io_uring descriptor, -1 on the threads
+    unsigned int pending;   // entries filled in but not submitted
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+#endif
+    pthread_mutex_t lock;   // the queue and done lists
+    pthread_cond_t work;
+    pthread_cond_t ready;
+    uint32_t queue_head;
+    uint32_t queue_tail;
+    uint32_t done_head;
+    uint32_t done_tail;
+    int stop;
+    unsigned int nthread;
+    pthread_t thread[AIO_THREADS];
+};
+
+static uint32_t aio_take(cpiofs_aio_t *aio) {
+    uint32_t k = aio->free;
+    if (k != AIO_NONE) {
+        aio->free = aio->req[k].next;
+        aio->inflight ++;
+    }
+    return k;
+}
+
+static void aio_give(cpiofs_aio_t *aio, uint32_t k) {
+    aio->req[k].next = aio->free;
+    aio->free = k;
+    aio->inflight --;
+}
+
+// Threads
+
+static void list_push(struct aio_req *req, uint32_t *head, uint32_t *tail, uint32_t k) {
+    req[k].next = AIO_NONE;
+    if (*head == AIO_NONE) {
+        *head = k;
+    } else {
+        req[*tail].next = k;
+    }
+    *tail = k;
+}
+
+static void* aio_worker(void *arg) {
+    cpiofs_aio_t *aio = arg;
+    pthread_mutex_lock(&aio->lock);
+    for (;;) {
+        while (!aio->stop && (aio->queue_head == AIO_NONE)) {
+            pthread_cond_wait(&aio->work, &aio->lock);
+        }
+        if (aio->queue_head == AIO_NONE) {
+            break;
+        }
+        uint32_t k = aio->queue_head;
+        struct aio_req *r = &aio->req[k];
+        aio->queue_head = r->next;
+        pthread_mutex_unlock(&aio->lock);
+
+        if (r->op == AIO_READ) {
+            r->result = cpiofs_read_fd(&r->fd, r->off, r->buffer, r->size);
+        } else {
+#ifdef POSIX_FADV_WILLNEED
+            posix_fadvise(r->fd, (off_t)r->off, (off_t)r->size, POSIX_FADV_WILLNEED);
+#endif
+            r->result = 0;
+        }
+
+        pthread_mutex_lock(&aio->lock);
+        list_push(aio->req, &aio->done_head, &aio->done_tail, k);
+        pthread_cond_signal(&aio->ready);
+    }
+    pthread_mutex_unlock(&aio->lock);
+    return NULL;
+}
+
+static int threads_start(cpiofs_aio_t *aio) {
+    unsigned int n = (aio->depth < AIO_THREADS) ? aio->depth : AIO_THREADS;
+    for (aio->nthread = 0; aio->nthread < n; aio->nthread++) {
+        if (pthread_create(&aio->thread[aio->nthread], NULL, aio_worker, aio) != 0) {
+            break;
+        }
+    }
+    return (aio->nthread > 0) ? (int)CPIO_ERR_OK : (int)CPIO_ERR_NOMEM;
+}
+
+static void threads_stop(cpiofs_aio_t *aio) {
+    pthread_mutex_lock(&aio->lock);
+    aio->stop = 1;
+    pthread_cond_broadcast(&aio->work);
+    pthread_mutex_unlock(&aio->lock);
+    for (unsigned int t = 0; t < aio->nthread; t++) {
+        pthread_join(aio->thread[t], NULL);
+    }
+}
+
+// io_uring
+
+#ifdef CPIO_HAVE_URING
+
+static inline unsigned int load_acquire(const unsigned int *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void store_release(unsigned int *p, unsigned int v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static void uring_release(cpiofs_aio_t *aio) {
+    if (aio->sqes != NULL) {
+        munmap(aio->sqes, aio->sqes_size);
+    }
+    if ((aio->cq_map != NULL) && (aio->cq_map != aio->sq_map)) {
+        munmap(aio->cq_map, aio->cq_map_size);
+    }
+    if (aio->sq_map != NULL) {
+        munmap(aio->sq_map, aio->sq_map_size);
+    }
+    if (aio->ring >= 0) {
+        close(aio->ring);
+    }
+    aio->ring = -1;
+}
+
+static int uring_setup(cpiofs_aio_t *aio) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    aio->ring = (int)syscall(__NR_io_uring_setup, aio->depth, &p);
+    if (aio->ring < 0) {
+        // no io_uring in the kernel, or not allowed in this process
+        aio->ring = -1;
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    aio->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    aio->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        if (aio->cq_map_size > aio->sq_map_size) {
+            aio->sq_map_size = aio->cq_map_size;
+        }
+        aio->cq_map_size = aio->sq_map_size;
+    }
+    aio->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sq = mmap(NULL, aio->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, aio->ring, IORING_OFF_SQ_RING);
+    aio->sq_map = (sq != MAP_FAILED) ? sq : NULL;
+    void *cq = sq;
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+        cq = mmap(NULL, aio->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, aio->ring, IORING_OFF_CQ_RING);
+    }
+    aio->cq_map = (cq != MAP_FAILED) ? cq : NULL;
+    void *sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, aio->ring, IORING_OFF_SQES);
+    aio->sqes = (sqes != MAP_FAILED) ? sqes : NULL;
+    if ((aio->sq_map == NULL) || (aio->cq_map == NULL) || (aio->sqes == NULL)) {
+        uring_release(aio);
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    uint8_t *s = aio->sq_map;
+    uint8_t *c = aio->cq_map;
+    aio->sq_head = (unsigned int*)&s[p.sq_off.head];
+    aio->sq_tail = (unsigned int*)&s[p.sq_off.tail];
+    aio->sq_mask = (unsigned int*)&s[p.sq_off.ring_mask];
+    aio->sq_array = (unsigned int*)&s[p.sq_off.array];
+    aio->cq_head = (unsigned int*)&c[p.cq_off.head];
+    aio->cq_tail = (unsigned int*)&c[p.cq_off.tail];
+    aio->cq_mask = (unsigned int*)&c[p.cq_off.ring_mask];
+    aio->cqes = (struct io_uring_cqe*)&c[p.cq_off.cqes];
+    aio->pending = 0;
+    return (int)CPIO_ERR_OK;
+}
+
+// Fill in the submission entry of slot k, the ring has room for every
+// slot so it is never full
+static void uring_queue(cpiofs_aio_t *aio, uint32_t k) {
+    struct aio_req *r = &aio->req[k];
+    unsigned int tail = *aio->sq_tail;
+    unsigned int i = tail & *aio->sq_mask;
+    struct io_uring_sqe *sqe = &aio->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = r->fd;
+    sqe->off = (uint64_t)r->off + r->got;
+    sqe->user_data = (uint64_t)k + 1U;
+    if (r->op == AIO_READ) {
+        r->iov.iov_base = r->buffer + r->got;
+        r->iov.iov_len = r->size - r->got;
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (uint64_t)(uintptr_t)&r->iov;
+        sqe->len = 1;
+    } else {
+        sqe->opcode = IORING_OP_FADVISE;
+        sqe->len = (r->size > UINT32_MAX) ? UINT32_MAX : (uint32_t)r->size;
+        sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+    }
+    aio->sq_array[i] = i;
+    store_release(aio->sq_tail, tail + 1U);
+    aio->pending ++;
+}
+
+// Submit what is pending and wait for wait completions at most
+static int uring_enter(cpiofs_aio_t *aio, unsigned int wait) {
+    while ((aio->pending > 0) || (wait > 0)) {
+        long n = syscall(__NR_io_uring_enter, aio->ring, aio->pending, wait,
+                         (wait > 0) ? IORING_ENTER_GETEVENTS : 0U, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (int)CPIO_ERR_IO;
+        }
+        aio->pending -= (unsigned int)n;
+        break;
+    }
+    return (int)CPIO_ERR_OK;
+}
+
+// Move the completions to the done list, resubmitting the short reads
+static void uring_reap(cpiofs_aio_t *aio) {
+    unsigned int head = *aio->cq_head;
+    unsigned int tail = load_acquire(aio->cq_tail);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &aio->cqes[head & *aio->cq_mask];
+        uint32_t k = (uint32_t)(cqe->user_data - 1U);
+        struct aio_req *r = &aio->req[k];
+        if (r->op == AIO_READ) {
+            if ((cqe->res == -EINTR) || (cqe->res == -EAGAIN)) {
+                uring_queue(aio, k);
+                continue;
+            }
+            if (cqe->res < 0) {
+                r->result = CPIO_ERR_IO;
+            } else {
+                r->got += (cpio_size_t)cqe->res;
+                if ((cqe->res > 0) && (r->got < r->size)) {
+                    uring_queue(aio, k);
+                    continue;
+                }
+                r->result = (cpio_ssize_t)r->got;
+            }
+        }
+        list_push(aio->req, &aio->done_head, &aio->done_tail, k);
+    }
+    store_release(aio->cq_head, head);
+}
+
+#endif
+
+static void aio_submit(cpiofs_aio_t *aio, uint32_t k) {
+#ifdef CPIO_HAVE_URING
+    if (aio->ring >= 0) {
+        uring_queue(aio, k);
+        return;
+    }
+#endif
+    pthread_mutex_lock(&aio->lock);
+    list_push(aio->req, &aio->queue_head, &aio->queue_tail, k);
+    pthread_cond_signal(&aio->work);
+    pthread_mutex_unlock(&aio->lock);
+}
+
+// Wait for a completion if block is set, and take the done list
+static int aio_collect(cpiofs_aio_t *aio, int block, uint32_t *done) {
+#ifdef CPIO_HAVE_URING
+    if (aio->ring >= 0) {
+        int ret = uring_enter(aio, block ? 1U : 0U);
+        if (ret != CPIO_ERR_OK) {
+            return ret;
+        }
+        uring_reap(aio);
+        *done = aio->done_head;
+        aio->done_head = AIO_NONE;
+        return (int)CPIO_ERR_OK;
+    }
+#endif
+    pthread_mutex_lock(&aio->lock);
+    while (block && (aio->done_head == AIO_NONE)) {
+        pthread_cond_wait(&aio->ready, &aio->lock);
+    }
+    *done = aio->done_head;
+    aio->done_head = AIO_NONE;
+    pthread_mutex_unlock(&aio->lock);
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_aio_open(cpiofs_aio_t **paio, cpiofs_t *fs, int fd, unsigned int depth, unsigned int flags) {
+    if ((paio == NULL) || (fs == NULL) || ((fd < 0) && (fs->overlay == NULL)) || (depth == 0) ||
+        (depth > AIO_DEPTH_MAX)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    // the offsets of a compressed archive are not the ones of the file
+    if (fs->zchunk != NULL) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    cpiofs_aio_t *aio = calloc(1, sizeof(cpiofs_aio_t) + depth * sizeof(struct aio_req));
+    if (aio == NULL) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    aio->fs = fs;
+    aio->fd = fd;
+    aio->depth = depth;
+    aio->req = (struct aio_req*)&aio[1];
+    for (uint32_t k = 0; k < depth; k++) {
+        aio->req[k].next = (k + 1U < depth) ? k + 1U : AIO_NONE;
+    }
+    aio->free = 0;
+    aio->queue_head = AIO_NONE;
+    aio->done_head = AIO_NONE;
+    if ((pthread_mutex_init(&aio->lock, NULL) != 0) || (pthread_cond_init(&aio->work, NULL) != 0) ||
+        (pthread_cond_init(&aio->ready, NULL) != 0)) {
+        free(aio);
+        return (int)CPIO_ERR_NOMEM;
+    }
+    int ret = (int)CPIO_ERR_NOTSUP;
+#ifdef CPIO_HAVE_URING
+    aio->ring = -1;
+    if ((flags & CPIOFS_AIO_THREADS) == 0) {
+        ret = uring_setup(aio);
+    }
+#else
+    (void)flags;
+#endif
+    if (ret != CPIO_ERR_OK) {
+        ret = threads_start(aio);
+    }
+    if (ret != CPIO_ERR_OK) {
+        threads_stop(aio);
+        pthread_cond_destroy(&aio->ready);
+        pthread_cond_destroy(&aio->work);
+        pthread_mutex_destroy(&aio->lock);
+        free(aio);
+        return ret;
+    }
+    *paio = aio;
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_aio_close(cpiofs_aio_t *aio) {
+    if (aio == NULL) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    int ret = (int)CPIO_ERR_OK;
+    while ((aio->inflight > 0) && (ret >= 0)) {
+        ret = cpiofs_aio_poll(aio, aio->inflight);
+    }
+#ifdef CPIO_HAVE_URING
+    if (aio->ring >= 0) {
+        uring_release(aio);
+    }
+#endif
+    threads_stop(aio);
+    pthread_cond_destroy(&aio->ready);
+    pthread_cond_destroy(&aio->work);
+    pthread_mutex_destroy(&aio->lock);
+    free(aio);
+    return (ret < 0) ? ret : (int)CPIO_ERR_OK;
+}
+
+int cpiofs_aio_uring(const cpiofs_aio_t *aio) {
+#ifdef CPIO_HAVE_URING
+    return (aio != NULL) && (aio->ring >= 0);
+#else
+    (void)aio;
+    return 0;
+#endif
+}
+
+// Archive file holding the data of a file opened through the mount of
+// aio: the one of aio, or the one kept by a layer of an overlay
+// Returns a negative error code if there is none.
+static int aio_file_fd(const cpiofs_aio_t *aio, const cpiofs_t *fs) {
+    if (fs == aio->fs) {
+        return aio->fd;
+    }
+    const struct cpiofs_overlay *o = aio->fs->overlay;
+    for (uint32_t l = 0; (o != NULL) && (l < o->nlayer); l++) {
+        if (o->layer[l] == fs) {
+            // the offsets of a compressed layer are not the ones of its file
+            return ((fs->map_fd > 0) && (fs->zchunk == NULL)) ? fs->map_fd - 1 : (int)CPIO_ERR_NOTSUP;
+        }
+    }
+    return (int)CPIO_ERR_NEXIST;
+}
+
+int cpiofs_file_read_async(cpiofs_aio_t *aio, const cpio_file_t *file, void *buffer, cpio_size_t size,
+                           cpio_off_t off, cpiofs_aio_done_t done, void *ctx) {
+    if ((aio == NULL) || (file == NULL) || (done == NULL) || ((buffer == NULL) && (size > 0))) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    int fd = aio_file_fd(aio, file->fs);
+    if (fd < 0) {
+        return fd;
+    }
+    if (off > file->size) {
+        return (int)CPIO_ERR_SEEK_OUT;
+    }
+    uint32_t k = aio_take(aio);
+    if (k == AIO_NONE) {
+        return (int)CPIO_ERR_BUSY;
+    }
+    struct aio_req *r = &aio->req[k];
+    r->op = AIO_READ;
+    r->fd = fd;
+    r->buffer = buffer;
+    r->size = (size < file->size - off) ? size : file->size - off;
+    r->got = 0;
+    r->off = file->data + off;
+    r->done = done;
+    r->ctx = ctx;
+    aio_submit(aio, k);
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_file_open_async(cpiofs_aio_t *aio, cpio_file_t *file, const char *path, cpio_size_t readahead) {
+    if (aio == NULL) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    int ret = cpiofs_file_open(aio->fs, file, path);
+    if ((ret != CPIO_ERR_OK) || (readahead == 0) || (file->size == 0)) {
+        return ret;
+    }
+    // readahead is a hint: with every slot taken, or no file to read
+    // from, it is left out
+    int fd = aio_file_fd(aio, file->fs);
+    uint32_t k = (fd >= 0) ? aio_take(aio) : AIO_NONE;
+    if (k != AIO_NONE) {
+        struct aio_req *r = &aio->req[k];
+        r->op = AIO_ADVISE;
+        r->fd = fd;
+        r->size = (readahead < file->size) ? readahead : file->size;
+        r->got = 0;
+        r->off = file->data;
+        r->done = NULL;
+        aio_submit(aio, k);
+    }
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_aio_poll(cpiofs_aio_t *aio, unsigned int wait) {
+    if (aio == NULL) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    int count = 0;
+    for (;;) {
+        int block = ((unsigned int)count < wait) && (aio->inflight > 0);
+        uint32_t k;
+        int ret = aio_collect(aio, block, &k);
+        if (ret != CPIO_ERR_OK) {
+            return ret;
+        }
+        while (k != AIO_NONE) {
+            struct aio_req *r = &aio->req[k];
+            uint32_t next = r->next;
+            cpiofs_aio_done_t done = r->done;
+            void *ctx = r->ctx;
+            cpio_ssize_t result = r->result;
+            // the slot is free again when the callback runs, which can
+            // queue the next read right away
+            aio_give(aio, k);
+            if (done != NULL) {
+                done(result, ctx);
+                count ++;
+            }
+            k = next;
+        }
+        if (!block || ((unsigned int)count >= wait) || (aio->inflight == 0)) {
+            break;
+        }
+    }
+    return count;
+}
+
+#else
+
+int cpiofs_aio_open(cpiofs_aio_t **paio, cpiofs_t *fs, int fd, unsigned int depth, unsigned int flags) {
+    (void)paio;
+    (void)fs;
+    (void)fd;
+    (void)depth;
+    (void)flags;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+int cpiofs_aio_close(cpiofs_aio_t *aio) {
+    (void)aio;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+int cpiofs_aio_uring(const cpiofs_aio_t *aio) {
+    (void)aio;
+    return 0;
+}
+
+int cpiofs_file_read_async(cpiofs_aio_t *aio, const cpio_file_t *file, void *buffer, cpio_size_t size,
+                           cpio_off_t off, cpiofs_aio_done_t done, void *ctx) {
+    (void)aio;
+    (void)file;
+    (void)buffer;
+    (void)size;
+    (void)off;
+    (void)done;
+    (void)ctx;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+int cpiofs_file_open_async(cpiofs_aio_t *aio, cpio_file_t *file, const char *path, cpio_size_t readahead) {
+    (void)aio;
+    (void)file;
+    (void)path;
+    (void)readahead;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+int cpiofs_aio_poll(cpiofs_aio_t *aio, unsigned int wait) {
+    (void)aio;
+    (void)wait;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+#endif
@@ -0,0 +1,235 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+#include <pthread.h>
+#define CPIO_HAVE_PTHREAD
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Header chain of an in-memory image, scanned by many threads
+//
+// Header n + 1 is only known once header n is decoded, so the chain is
+// serial. Each thread takes a slice of the image instead, guesses the
+// first header in it and follows the chain from there to the end of
+// the slice. The slices are then stitched in order from the true chain:
+// the true header entering slice k is looked up in the chain of slice
+// k, and once a chain goes through a true header the rest of it is true
+// as well, every header following from the one before. A slice whose
+// guess went wrong is walked again from the true header, so the result
+// is always the serial chain, only sooner.
+
+#define CHAIN_SLICE_MIN     (1U << 20)
+#define CHAIN_THREADS       64U
+
+struct chain_slice {
+    const cpiofs_t *fs;
+    cpio_off_t begin;       // [begin, end) of the image
+    cpio_off_t end;
+    cpio_off_t *off;        // headers followed in the slice
+    uint32_t count;
+    uint32_t alloc;
+    cpio_off_t next;        // header after the last one
+    int stop;               // the chain ends at next, trailer or bad header
+    int error;
+};
+
+static int chain_push(struct chain_slice *s, cpio_off_t off) {
+    if (s->count == s->alloc) {
+        uint32_t alloc = (s->alloc != 0) ? s->alloc * 2U : 1024U;
+        cpio_off_t *grown = realloc(s->off, alloc * sizeof(cpio_off_t));
+        if (grown == NULL) {
+            s->error = CPIO_ERR_NOMEM;
+            return 0;
+        }
+        s->off = grown;
+        s->alloc = alloc;
+    }
+    s->off[s->count ++] = off;
+    return 1;
+}
+
+// Follow the chain from off up to the end of the slice
+static void chain_follow(struct chain_slice *s, cpio_off_t off) {
+    const uint8_t *image = (const uint8_t*)s->fs->head;
+    struct cpio_entry ent;
+    while (off < s->end) {
+        const struct header_old_cpio* d = (const struct header_old_cpio*)&image[off];
+        if (!cpio_decode(d, s->fs->size - off, &ent) || cpio_is_trailer(d, &ent)) {
+            s->stop = 1;
+            break;
+        }
+        if (!chain_push(s, off)) {
+            return;
+        }
+        off += ent.next;
+    }
+    s->next = off;
+}
+
+// Whether a header at off looks like one a writer made: a magic, sizes
+// that fit, a name with a single NUL at its end and zeros up to the data
+static int chain_plausible(const cpiofs_t *fs, cpio_off_t off) {
+    const uint8_t *p = (const uint8_t*)fs->head + off;
+    struct cpio_entry ent;
+    // '0' starts the ASCII magics, 0x71 and 0xc7 the binary ones
+    if (((p[0] != '0') && (p[0] != 0x71U) && (p[0] != 0xc7U)) ||
+        !cpio_decode((const struct header_old_cpio*)p, fs->size - off, &ent) || (ent.namesize < 2U)) {
+        return 0;
+    }
+    const char *name = (const char*)p + ent.name;
+    if ((name[ent.namesize - 1U] != '\0') || (memchr(name, '\0', ent.namesize - 1U) != NULL)) {
+        return 0;
+    }
+    for (uint32_t i = ent.name + ent.namesize; i < ent.data; i++) {
+        if (p[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void* chain_guess(void *arg) {
+    struct chain_slice *s = arg;
+    cpio_off_t off = s->begin;
+    while ((off < s->end) && !chain_plausible(s->fs, off)) {
+        off ++;
+    }
+    chain_follow(s, off);
+    return NULL;
+}
+
+// First position of off in the chain of s, s->count if it is not there
+static uint32_t chain_find(const struct chain_slice *s, cpio_off_t off) {
+    uint32_t lo = 0;
+    uint32_t hi = s->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2U;
+        if (s->off[mid] < off) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    return ((lo < s->count) && (s->off[lo] == off)) ? lo : s->count;
+}
+
+int cpiofs_chain(const cpiofs_t *fs, unsigned int nthread, cpio_off_t **chain, uint32_t *count) {
+    if ((fs->store != NULL) || (fs->size == 0)) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+#ifdef CPIO_HAVE_PTHREAD
+    if (nthread == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        nthread = (cores > 0) ? (unsigned int)cores : 1U;
+    }
+#else
+    nthread = 1;
+#endif
+    if (nthread > CHAIN_THREADS) {
+        nthread = CHAIN_THREADS;
+    }
+    if (nthread > fs->size / CHAIN_SLICE_MIN) {
+        nthread = fs->size / CHAIN_SLICE_MIN;
+    }
+    if (nthread == 0) {
+        nthread = 1;
+    }
+
+    struct chain_slice slice[CHAIN_THREADS];
+    cpio_size_t step = fs->size / nthread;
+    for (unsigned int k = 0; k < nthread; k++) {
+        slice[k] = (struct chain_slice){
+            .fs = fs,
+            .begin = k * step,
+            .end = (k + 1U < nthread) ? (k + 1U) * step : fs->size,
+        };
+    }
+
+    // the first slice starts on a true header, the others guess
+#ifdef CPIO_HAVE_PTHREAD
+    pthread_t threads[CHAIN_THREADS];
+    int started[CHAIN_THREADS] = { 0 };
+    for (unsigned int k = 1; k < nthread; k++) {
+        started[k] = (pthread_create(&threads[k], NULL, chain_guess, &slice[k]) == 0);
+    }
+#endif
+    chain_follow(&slice[0], 0);
+#ifdef CPIO_HAVE_PTHREAD
+    for (unsigned int k = 1; k < nthread; k++) {
+        if (started[k]) {
+            pthread_join(threads[k], NULL);
+        } else {
+            // left to the stitch, which walks the slice from its true header
+            slice[k].count = 0;
+        }
+    }
+#endif
+
+    // stitch the slices along the true chain
+    int ret = CPIO_ERR_OK;
+    cpio_off_t *out = NULL;
+    uint32_t n = 0;
+    uint32_t alloc = 0;
+    struct chain_slice *prev = NULL;
+    for (unsigned int k = 0; k < nthread; k++) {
+        struct chain_slice *s = &slice[k];
+        uint32_t j = 0;
+        if (prev != NULL) {
+            if (prev->stop || (prev->next >= s->end)) {
+                // no header of the chain in this slice
+                s->count = 0;
+                s->stop = prev->stop;
+                s->next = prev->next;
+                prev = s;
+                continue;
+            }
+            j = chain_find(s, prev->next);
+            if (j == s->count) {
+                // the guess was wrong, walk the slice from the true header
+                s->count = 0;
+                s->stop = 0;
+                s->error = CPIO_ERR_OK;
+                chain_follow(s, prev->next);
+                j = 0;
+            }
+        }
+        if (s->error != CPIO_ERR_OK) {
+            ret = s->error;
+            break;
+        }
+        if (n + (s->count - j) + 1U > alloc) {
+            alloc = n + (s->count - j) + 1U;
+            alloc += alloc / 2U;
+            cpio_off_t *grown = realloc(out, (size_t)alloc * sizeof(cpio_off_t));
+            if (grown == NULL) {
+                ret = CPIO_ERR_NOMEM;
+                break;
+            }
+            out = grown;
+        }
+        if (s->count > j) {
+            memcpy(&out[n], &s->off[j], (s->count - j) * sizeof(cpio_off_t));
+            n += s->count - j;
+        }
+        prev = s;
+    }
+    for (unsigned int k = 0; k < nthread; k++) {
+        free(slice[k].off);
+    }
+    if (ret != CPIO_ERR_OK) {
+        free(out);
+        return ret;
+    }
+    // where the chain stops, the trailer of a sound archive
+    out[n] = prev->next;
+    *chain = out;
+    *count = n;
+    return (int)CPIO_ERR_OK;
+}
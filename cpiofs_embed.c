@@ -0,0 +1,169 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Archives compiled into the program
+//
+// cpioembed writes the image and the tables of its index as const
+// arrays, with a minimal perfect hash of the paths on top of the slots:
+// the distinct paths are spread over buckets by cpio_path_hash, and every
+// bucket has the pilot that sends its paths through cpio_path_hash2 to
+// slots no other path has. The buckets with the most paths are placed
+// first, while most slots are free. A lookup is then one pilot and one
+// entry to compare, whatever the load, and the slots are only left for
+// a path that is duplicated with another type.
+
+#define PHF_LOAD            4U      // paths per bucket on average
+#define PHF_TRIES           64U     // pilots tried per slot before giving up
+
+int cpiofs_index_phf(const cpiofs_index_t *index, uint32_t **ppilot, uint32_t *pnbucket, uint32_t *pnphf) {
+    if ((index == NULL) || (ppilot == NULL) || (pnbucket == NULL) || (pnphf == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if ((index->sorted == NULL) || (index->count == 0)) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+
+    // the first entry of every path, path order keeps the duplicates
+    // together and in archive order
+    uint32_t count = index->count;
+    uint32_t *key = malloc((size_t)count * sizeof(uint32_t));
+    if (key == NULL) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    uint32_t n = 0;
+    for (uint32_t r = 0; r < count; r++) {
+        if ((r == 0) || (cpiofs_index_order(index, index->sorted[r - 1U], index->sorted[r]) != 0)) {
+            key[n ++] = index->sorted[r];
+        }
+    }
+    uint32_t nbucket = n / PHF_LOAD + 1U;
+
+    int ret = CPIO_ERR_NOMEM;
+    uint32_t *pilot = malloc(((size_t)nbucket + n) * sizeof(uint32_t));
+    uint32_t *first = calloc((size_t)nbucket + 1U, sizeof(uint32_t));
+    uint32_t *member = malloc((size_t)n * sizeof(uint32_t));   // h2 of the paths, by bucket
+    uint32_t *order = malloc((size_t)nbucket * sizeof(uint32_t));
+    uint8_t *taken = calloc(((size_t)n + 7U) / 8U, 1);
+    uint32_t *phf = (pilot != NULL) ? &pilot[nbucket] : NULL;
+    uint32_t *entry = NULL;
+    if ((pilot == NULL) || (first == NULL) || (member == NULL) || (order == NULL) || (taken == NULL) ||
+        ((entry = malloc((size_t)n * sizeof(uint32_t))) == NULL)) {
+        goto end;
+    }
+
+    // group the paths by bucket
+    for (uint32_t k = 0; k < n; k++) {
+        first[cpio_phf_bucket(index->hash[key[k]], nbucket) + 1U] ++;
+    }
+    uint32_t most = 0;
+    for (uint32_t b = 0; b < nbucket; b++) {
+        most = (first[b + 1U] > most) ? first[b + 1U] : most;
+        first[b + 1U] += first[b];
+    }
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t e = key[k];
+        uint32_t b = cpio_phf_bucket(index->hash[e], nbucket);
+        uint32_t at = first[b] ++;
+        member[at] = cpio_path_hash2(&index->strings[index->name[e]], index->name_len[e]);
+        entry[at] = e;
+    }
+    for (uint32_t b = nbucket; b > 0; b--) {
+        first[b] = first[b - 1U];
+    }
+    first[0] = 0;
+
+    // biggest buckets first, a counting sort on the size
+    uint32_t at = 0;
+    for (uint32_t size = most; size > 0; size--) {
+        for (uint32_t b = 0; b < nbucket; b++) {
+            if (first[b + 1U] - first[b] == size) {
+                order[at ++] = b;
+            }
+        }
+    }
+    memset(pilot, 0, (size_t)nbucket * sizeof(uint32_t));
+
+    uint32_t slot[64];
+    for (uint32_t i = 0; i < at; i++) {
+        uint32_t b = order[i];
+        uint32_t lo = first[b];
+        uint32_t size = first[b + 1U] - lo;
+        if (size > sizeof(slot) / sizeof(slot[0])) {
+            ret = CPIO_ERR_NOTSUP;
+            goto end;
+        }
+        uint64_t tries = (uint64_t)PHF_TRIES * n;
+        if (tries > UINT32_MAX) {
+            tries = UINT32_MAX;
+        }
+        uint32_t p = 0;
+        for (;; p++) {
+            if (p == tries) {
+                // two paths of the bucket share their second hash
+                ret = CPIO_ERR_NOTSUP;
+                goto end;
+            }
+            uint32_t j = 0;
+            for (; j < size; j++) {
+                uint32_t s = cpio_phf_slot(member[lo + j], p, n);
+                if ((taken[s / 8U] & (1U << (s % 8U))) != 0) {
+                    break;
+                }
+                uint32_t q = 0;
+                while ((q < j) && (slot[q] != s)) {
+                    q ++;
+                }
+                if (q < j) {
+                    break;
+                }
+                slot[j] = s;
+            }
+            if (j == size) {
+                break;
+            }
+        }
+        pilot[b] = p;
+        for (uint32_t j = 0; j < size; j++) {
+            taken[slot[j] / 8U] |= (uint8_t)(1U << (slot[j] % 8U));
+            phf[slot[j]] = entry[lo + j];
+        }
+    }
+
+    *ppilot = pilot;
+    *pnbucket = nbucket;
+    *pnphf = n;
+    pilot = NULL;
+    ret = CPIO_ERR_OK;
+
+end:
+    free(entry);
+    free(taken);
+    free(order);
+    free(member);
+    free(first);
+    free(pilot);
+    free(key);
+    return ret;
+}
+
+int cpiofs_mount_embedded(cpiofs_t *fs, const cpiofs_embedded_t *embedded) {
+    if ((fs == NULL) || (embedded == NULL) || (embedded->image == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    const cpiofs_index_t *index = &embedded->index;
+    // tables written for another image
+    if ((index->slot == NULL) || (index->mem != NULL) || (index->strings != (const char*)embedded->image) ||
+        (index->trailer >= embedded->size) || ((index->pilot != NULL) && (index->nphf == 0))) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    memset(fs, 0, sizeof(*fs));
+    fs->head = (const struct header_old_cpio*)embedded->image;
+    fs->size = embedded->size;
+    fs->index = *index;
+    return (int)CPIO_ERR_OK;
+}
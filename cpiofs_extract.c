@@ -0,0 +1,542 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#elif defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#define CPIO_HAVE_EXTRACT
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Extraction of a whole archive
+//
+// The calling thread goes through the paths of the index in bytewise
+// order, which puts every directory before what it holds, keeps the
+// last of the entries that share a path, as cpio does, and creates the
+// directories on the way. The regular files are then written by the
+// threads, taking them in turn in archive order: copy_file_range from
+// the kept file of the mount moves the data inside the kernel, and the
+// other mounts write straight out of the image, or through a buffer
+// from a backing store. The symbolic links come last, so that no file
+// is written through one of them, and the directories get their mode
+// and time once nothing is created in them any more, the deepest first.
+// The hard links of a file, the entries that share a device and an
+// inode, are linked to the one that carries the data once the files
+// are written: newc archives store the data on the last link only.
+
+#define EXTRACT_THREADS     64U
+#define EXTRACT_BUFFER      (256U * 1024U)  // reads from a backing store
+#define EXTRACT_MAX         (1U << 30)      // per write or copy_file_range call
+
+#if defined(CPIO_HAVE_EXTRACT)
+
+#if defined(__linux__) && defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 27))
+#define CPIO_HAVE_COPY_RANGE
+#endif
+
+#if defined(CPIO_HAVE_ATOMICS)
+#define CPIO_EXTRACT_THREADS
+#endif
+
+// An entry to create, with what its header says
+struct extract_job {
+    uint32_t e;
+    uint32_t data;      // entry with the data of the file, e unless it is a hard link
+    uint32_t mtime;
+    uint32_t ino;
+    uint64_t dev;
+    uint32_t nlink;
+};
+
+struct extract {
+    const cpiofs_t *fs;
+    int dir;                    // destination
+    int in_fd;                  // kept file of the mount, -1 if none or not to be used
+    unsigned int flags;
+    const struct extract_job *job;
+    uint32_t count;
+    CPIO_ATOMIC uint32_t next;  // next file to take
+    CPIO_ATOMIC int error;      // first error of a thread
+};
+
+static uint32_t extract_take(struct extract *x) {
+#ifdef CPIO_HAVE_ATOMICS
+    return atomic_fetch_add_explicit(&x->next, 1U, memory_order_relaxed);
+#else
+    return x->next ++;
+#endif
+}
+
+static void extract_fail(struct extract *x, int error) {
+#ifdef CPIO_HAVE_ATOMICS
+    int ok = CPIO_ERR_OK;
+    atomic_compare_exchange_strong_explicit(&x->error, &ok, error, memory_order_relaxed, memory_order_relaxed);
+#else
+    x->error = error;
+#endif
+}
+
+// Path of entry e into path, NUL terminated
+//
+// Returns 0 for the root, for the paths that would land out of the
+// destination and for the ones too long.
+static int extract_path(const cpiofs_index_t *index, uint32_t e, char *path) {
+    size_t len = index->name_len[e];
+    const char *p = &index->strings[index->name[e]];
+    if ((len == 0) || (len >= CPIO_NAME_MAX) || (p[0] == '/')) {
+        return 0;
+    }
+    // no empty, "." or ".." component
+    for (size_t i = 0; i < len; ) {
+        size_t j = i;
+        while ((j < len) && (p[j] != '/')) {
+            j ++;
+        }
+        if ((j == i) || ((j - i == 1U) && (p[i] == '.')) || ((j - i == 2U) && (p[i] == '.') && (p[i + 1U] == '.'))) {
+            return 0;
+        }
+        i = j + 1U;
+        if ((j < len) && (i == len)) {
+            return 0;
+        }
+    }
+    memcpy(path, p, len);
+    path[len] = '\0';
+    return 1;
+}
+
+// Create the directories leading to path, for archives without their
+// entries
+static void extract_parents(int dir, char *path) {
+    for (char *s = strchr(path, '/'); s != NULL; s = strchr(s + 1, '/')) {
+        *s = '\0';
+        mkdirat(dir, path, 0755);
+        *s = '/';
+    }
+}
+
+static void extract_times(struct timespec ts[2], uint32_t mtime) {
+    ts[0].tv_sec = (time_t)mtime;
+    ts[0].tv_nsec = 0;
+    ts[1] = ts[0];
+}
+
+// Data of entry e to out
+static int extract_data(struct extract *x, uint32_t e, int out, uint8_t *buffer) {
+    const cpiofs_t *fs = x->fs;
+    cpio_off_t off = fs->index.data[e];
+    cpio_size_t size = fs->index.fsize[e];
+    cpio_size_t done = 0;
+#ifdef CPIO_HAVE_COPY_RANGE
+    if (x->in_fd >= 0) {
+        loff_t in = (loff_t)off;
+        while (done < size) {
+            size_t n = (size - done < EXTRACT_MAX) ? (size_t)(size - done) : EXTRACT_MAX;
+            ssize_t w = copy_file_range(x->in_fd, &in, out, NULL, n, 0);
+            if ((w < 0) && (errno == EINTR)) {
+                continue;
+            }
+            if (w <= 0) {
+                // not between these file systems, the writes do the rest
+                break;
+            }
+            done += (cpio_size_t)w;
+        }
+    }
+#endif
+    while (done < size) {
+        size_t n = (size - done < EXTRACT_MAX) ? (size_t)(size - done) : EXTRACT_MAX;
+        const uint8_t *p = (const uint8_t*)fs->head + off + done;
+        if (buffer != NULL) {
+            n = (n < EXTRACT_BUFFER) ? n : EXTRACT_BUFFER;
+            if (cpiofs_store_read(fs, off + done, buffer, (cpio_size_t)n) != (cpio_ssize_t)n) {
+                return (int)CPIO_ERR_IO;
+            }
+            p = buffer;
+        }
+        ssize_t w = write(out, p, n);
+        if ((w < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (w <= 0) {
+            return (int)CPIO_ERR_IO;
+        }
+        done += (cpio_size_t)w;
+    }
+    return (int)CPIO_ERR_OK;
+}
+
+static int extract_file(struct extract *x, const struct extract_job *job, char *path, uint8_t *buffer) {
+    const cpiofs_index_t *index = &x->fs->index;
+    extract_path(index, job->e, path);
+    const int oflags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC;
+    int fd = openat(x->dir, path, oflags, 0600);
+    if (fd < 0) {
+        // a missing directory, or something else in the way
+        if (errno == ENOENT) {
+            extract_parents(x->dir, path);
+        } else {
+            unlinkat(x->dir, path, 0);
+        }
+        fd = openat(x->dir, path, oflags, 0600);
+        if (fd < 0) {
+            return (int)CPIO_ERR_IO;
+        }
+    }
+    int ret = extract_data(x, job->data, fd, buffer);
+    if ((ret == CPIO_ERR_OK) && (fchmod(fd, (mode_t)(index->mode[job->e] & 07777U)) != 0)) {
+        ret = CPIO_ERR_IO;
+    }
+    if ((ret == CPIO_ERR_OK) && ((x->flags & CPIOFS_EXTRACT_NO_TIMES) == 0)) {
+        struct timespec ts[2];
+        extract_times(ts, job->mtime);
+        ret = (futimens(fd, ts) == 0) ? CPIO_ERR_OK : CPIO_ERR_IO;
+    }
+    if ((close(fd) != 0) && (ret == CPIO_ERR_OK)) {
+        ret = CPIO_ERR_IO;
+    }
+    return ret;
+}
+
+static void* extract_worker(void *arg) {
+    struct extract *x = arg;
+    char *path = malloc(CPIO_NAME_MAX);
+    uint8_t *buffer = NULL;
+    if ((path == NULL) || ((x->fs->store != NULL) && ((buffer = malloc(EXTRACT_BUFFER)) == NULL))) {
+        extract_fail(x, (int)CPIO_ERR_NOMEM);
+        free(path);
+        return NULL;
+    }
+    for (uint32_t k = extract_take(x); k < x->count; k = extract_take(x)) {
+        int ret = extract_file(x, &x->job[k], path, buffer);
+        if (ret != CPIO_ERR_OK) {
+            extract_fail(x, ret);
+        }
+    }
+    free(buffer);
+    free(path);
+    return NULL;
+}
+
+// Write every file with nthread threads, the calling one included
+static int extract_run(struct extract *x, unsigned int nthread) {
+#ifdef CPIO_EXTRACT_THREADS
+    pthread_t threads[EXTRACT_THREADS];
+    unsigned int started = 0;
+    // a thread that does not start leaves its share to the others
+    while ((started + 1U < nthread) && (pthread_create(&threads[started], NULL, extract_worker, x) == 0)) {
+        started ++;
+    }
+    extract_worker(x);
+    for (unsigned int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+#else
+    (void)nthread;
+    extract_worker(x);
+#endif
+#ifdef CPIO_HAVE_ATOMICS
+    return atomic_load_explicit(&x->error, memory_order_relaxed);
+#else
+    return x->error;
+#endif
+}
+
+static unsigned int extract_threads(const cpiofs_t *fs, unsigned int nthread, uint32_t nfile) {
+    if (nthread == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        nthread = (cores > 0) ? (unsigned int)cores : 1U;
+    }
+    // the reads through a backing store take its lock one at a time
+    if (fs->store != NULL) {
+        nthread = 1;
+    }
+    if (nthread > EXTRACT_THREADS) {
+        nthread = EXTRACT_THREADS;
+    }
+    return (nthread > nfile) ? ((nfile > 0) ? nfile : 1U) : nthread;
+}
+
+// Archive order, the hard links to another entry last
+static int extract_order(const void *a, const void *b) {
+    const struct extract_job *ja = a;
+    const struct extract_job *jb = b;
+    int la = ja->data != ja->e;
+    int lb = jb->data != jb->e;
+    if (la != lb) {
+        return la - lb;
+    }
+    return (ja->e > jb->e) - (ja->e < jb->e);
+}
+
+// The files with more than one link first, grouped by inode
+static int extract_inode_order(const void *a, const void *b) {
+    const struct extract_job *ja = a;
+    const struct extract_job *jb = b;
+    int sa = ja->nlink < 2U;
+    int sb = jb->nlink < 2U;
+    if (sa != sb) {
+        return sa - sb;
+    }
+    if (ja->dev != jb->dev) {
+        return (ja->dev > jb->dev) ? 1 : -1;
+    }
+    if (ja->ino != jb->ino) {
+        return (ja->ino > jb->ino) ? 1 : -1;
+    }
+    return (ja->e > jb->e) - (ja->e < jb->e);
+}
+
+// Point every hard link of a group to the link with the data, the
+// biggest one and the last in archive order among them; the links end
+// up after the other files, in archive order
+// Returns the number of links.
+static uint32_t extract_hard_links(const cpiofs_index_t *index, struct extract_job *job, uint32_t nfile) {
+    uint32_t links = 0;
+    qsort(job, nfile, sizeof(*job), extract_inode_order);
+    for (uint32_t k = 0; (k < nfile) && (job[k].nlink >= 2U); ) {
+        uint32_t end = k + 1U;
+        while ((end < nfile) && (job[end].nlink >= 2U) && (job[end].dev == job[k].dev) &&
+               (job[end].ino == job[k].ino)) {
+            end ++;
+        }
+        uint32_t carrier = k;
+        for (uint32_t i = k + 1U; i < end; i++) {
+            if (index->fsize[job[i].e] >= index->fsize[job[carrier].e]) {
+                carrier = i;
+            }
+        }
+        for (uint32_t i = k; i < end; i++) {
+            if (i != carrier) {
+                job[i].data = job[carrier].e;
+                links ++;
+            }
+        }
+        k = end;
+    }
+    qsort(job, nfile, sizeof(*job), extract_order);
+    return links;
+}
+
+// Hard link of job at path to the file at to, or a copy of its data
+// where the file system has no hard links
+static int extract_hard_link(struct extract *x, const struct extract_job *job, char *path, char *to) {
+    extract_path(&x->fs->index, job->e, path);
+    extract_path(&x->fs->index, job->data, to);
+    unlinkat(x->dir, path, 0);
+    if (linkat(x->dir, to, x->dir, path, 0) == 0) {
+        return (int)CPIO_ERR_OK;
+    }
+    if (errno == ENOENT) {
+        // a missing directory
+        extract_parents(x->dir, path);
+        if (linkat(x->dir, to, x->dir, path, 0) == 0) {
+            return (int)CPIO_ERR_OK;
+        }
+    }
+    uint8_t *buffer = NULL;
+    if ((x->fs->store != NULL) && ((buffer = malloc(EXTRACT_BUFFER)) == NULL)) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    int ret = extract_file(x, job, path, buffer);
+    free(buffer);
+    return ret;
+}
+
+// Symbolic link of entry e at path, its target is the file data
+static int extract_link(const cpiofs_t *fs, int dir, uint32_t e, const char *path) {
+    cpio_size_t size = fs->index.fsize[e];
+    if (size >= CPIO_NAME_MAX) {
+        return (int)CPIO_ERR_CORRUPT;
+    }
+    char target[CPIO_NAME_MAX];
+    if (fs->store != NULL) {
+        if (cpiofs_store_read(fs, fs->index.data[e], target, size) != (cpio_ssize_t)size) {
+            return (int)CPIO_ERR_IO;
+        }
+    } else {
+        memcpy(target, (const uint8_t*)fs->head + fs->index.data[e], size);
+    }
+    target[size] = '\0';
+    unlinkat(dir, path, 0);
+    return (symlinkat(target, dir, path) == 0) ? (int)CPIO_ERR_OK : (int)CPIO_ERR_IO;
+}
+
+static int extract_dir(int dir, char *path) {
+    if ((mkdirat(dir, path, 0700) != 0) && (errno == ENOENT)) {
+        extract_parents(dir, path);
+        mkdirat(dir, path, 0700);
+    }
+    // an existing directory is kept as it is
+    struct stat st;
+    return ((fstatat(dir, path, &st, AT_SYMLINK_NOFOLLOW) == 0) && S_ISDIR(st.st_mode)) ?
+           (int)CPIO_ERR_OK : (int)CPIO_ERR_IO;
+}
+
+int cpiofs_extract(const cpiofs_t *fs, const char *dest, unsigned int nthread, unsigned int flags,
+                   cpiofs_extract_stats_t *stats) {
+    if ((fs == NULL) || (dest == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fs->overlay != NULL) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    if (!cpiofs_indexed(fs)) {
+        cpiofs_t view = {
+            .head = fs->head,
+            .size = fs->size,
+            .map_fd = fs->map_fd,
+        };
+        int ret = cpiofs_index_build(&view, 0, &view.index);
+        if (ret == CPIO_ERR_OK) {
+            ret = cpiofs_extract(&view, dest, nthread, flags, stats);
+            free(view.index.mem);
+        }
+        return ret;
+    }
+    const cpiofs_index_t *index = &fs->index;
+    if (index->sorted == NULL) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+
+    cpiofs_extract_stats_t st = { 0 };
+    uint32_t count = index->count;
+    struct extract_job *job = malloc(((size_t)count + 1U) * sizeof(*job));
+    char *path = malloc(2U * CPIO_NAME_MAX);
+    uint8_t hdr[CPIO_ENTRY_BUFFER];
+    int dir = -1;
+    int ret = CPIO_ERR_NOMEM;
+    if ((job == NULL) || (path == NULL)) {
+        goto end;
+    }
+    ret = CPIO_ERR_IO;
+    mkdir(dest, 0755);
+    dir = open(dest, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir < 0) {
+        goto end;
+    }
+
+    // the files from the front of job, in archive order once sorted back,
+    // the directories and the links from the back, deepest first
+    uint32_t nfile = 0;
+    uint32_t late = count;
+    for (uint32_t r = 0; r < count; r++) {
+        uint32_t e = index->sorted[r];
+        if ((r + 1U < count) && (cpiofs_index_order(index, e, index->sorted[r + 1U]) == 0)) {
+            // a later entry of the same path wins
+            continue;
+        }
+        uint16_t type = index->mode[e] & CPIO_TYPE_MASK;
+        if (!extract_path(index, e, path) ||
+            ((type != CPIO_DIR_TYPE_MASK) && (type != CPIO_FILE_TYPE_MASK) && (type != CPIO_SYMLINK_TYPE_MASK))) {
+            // the root, "", "." or "/" before the prefix goes, is not counted
+            st.skipped += (index->name_len[e] > 1U) ||
+                          ((index->name_len[e] == 1U) && (index->strings[index->name[e]] != '.'));
+            continue;
+        }
+        struct cpio_entry ent;
+        if (cpiofs_header_at(fs, index->entry[e], &ent, hdr) == NULL) {
+            ret = CPIO_ERR_CORRUPT;
+            goto end;
+        }
+        if ((type == CPIO_DIR_TYPE_MASK) && (extract_dir(dir, path) != CPIO_ERR_OK)) {
+            goto end;
+        }
+        struct extract_job *to = (type == CPIO_FILE_TYPE_MASK) ? &job[nfile ++] : &job[-- late];
+        to->e = e;
+        to->data = e;
+        to->mtime = ent.mtime;
+        to->dev = ent.dev;
+        to->ino = ent.ino;
+        to->nlink = ent.nlink;
+    }
+    // archive order reads the archive file forward
+    uint32_t links = extract_hard_links(index, job, nfile);
+
+    struct extract x = {
+        .fs = fs,
+        .dir = dir,
+        .in_fd = ((fs->map_fd > 0) && ((flags & CPIOFS_EXTRACT_WRITE) == 0)) ? fs->map_fd - 1 : -1,
+        .flags = flags,
+        .job = job,
+        .count = nfile - links,
+        .next = 0,
+        .error = CPIO_ERR_OK,
+    };
+    ret = extract_run(&x, extract_threads(fs, nthread, nfile - links));
+    if (ret != CPIO_ERR_OK) {
+        goto end;
+    }
+    st.files = nfile - links;
+    for (uint32_t k = 0; k < nfile - links; k++) {
+        st.bytes += index->fsize[job[k].e];
+    }
+    for (uint32_t k = nfile - links; k < nfile; k++) {
+        ret = extract_hard_link(&x, &job[k], path, &path[CPIO_NAME_MAX]);
+        if (ret != CPIO_ERR_OK) {
+            goto end;
+        }
+        st.files ++;
+    }
+
+    for (uint32_t k = late; k < count; k++) {
+        uint32_t e = job[k].e;
+        struct timespec ts[2];
+        extract_times(ts, job[k].mtime);
+        extract_path(index, e, path);
+        if ((index->mode[e] & CPIO_TYPE_MASK) == CPIO_SYMLINK_TYPE_MASK) {
+            ret = extract_link(fs, dir, e, path);
+            st.links ++;
+        } else {
+            ret = (fchmodat(dir, path, (mode_t)(index->mode[e] & 07777U), 0) == 0) ? CPIO_ERR_OK : CPIO_ERR_IO;
+            st.dirs ++;
+        }
+        if ((ret == CPIO_ERR_OK) && ((flags & CPIOFS_EXTRACT_NO_TIMES) == 0) &&
+            (utimensat(dir, path, ts, AT_SYMLINK_NOFOLLOW) != 0)) {
+            ret = CPIO_ERR_IO;
+        }
+        if (ret != CPIO_ERR_OK) {
+            goto end;
+        }
+    }
+    ret = CPIO_ERR_OK;
+
+end:
+    if (stats != NULL) {
+        *stats = st;
+    }
+    if (dir >= 0) {
+        close(dir);
+    }
+    free(path);
+    free(job);
+    return ret;
+}
+
+#else
+
+int cpiofs_extract(const cpiofs_t *fs, const char *dest, unsigned int nthread, unsigned int flags,
+                   cpiofs_extract_stats_t *stats) {
+    (void)fs;
+    (void)dest;
+    (void)nthread;
+    (void)flags;
+    (void)stats;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+#endif
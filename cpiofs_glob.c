@@ -0,0 +1,322 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Glob queries over the path order of the index
+//
+// The literal head of the pattern, up to the first wildcard, is a range
+// of the sorted paths found by binary search. Inside the range a path
+// whose leading components already fail the pattern skips every path
+// under them, which are contiguous in path order too, so a pattern like
+// "locale/*/messages.bin" visits the locales, not what they hold.
+
+// End of the class opened by the '[' at p[i], 0 if it is not closed
+static size_t class_end(const char *p, size_t pn, size_t i) {
+    size_t k = i + 1U;
+    if ((k < pn) && ((p[k] == '!') || (p[k] == '^'))) {
+        k ++;
+    }
+    // a ']' right away is part of the class
+    if ((k < pn) && (p[k] == ']')) {
+        k ++;
+    }
+    while ((k < pn) && (p[k] != ']')) {
+        k ++;
+    }
+    return (k < pn) ? k : 0;
+}
+
+static int class_match(const char *c, size_t n, char ch) {
+    size_t k = 0;
+    int neg = (n > 0) && ((c[0] == '!') || (c[0] == '^'));
+    int match = 0;
+    for (k = neg ? 1U : 0; k < n; k++) {
+        if ((k + 2U < n) && (c[k + 1U] == '-')) {
+            match |= ((uint8_t)ch >= (uint8_t)c[k]) && ((uint8_t)ch <= (uint8_t)c[k + 2U]);
+            k += 2U;
+        } else {
+            match |= (ch == c[k]);
+        }
+    }
+    return match != neg;
+}
+
+// Match the path s against the pattern p, pn and sn bytes long
+static int glob_match(const char *p, size_t pn, const char *s, size_t sn) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < pn) {
+        char c = p[i];
+        if ((c == '*') && (i + 1U < pn) && (p[i + 1U] == '*') && ((i == 0) || (p[i - 1U] == '/')) &&
+            ((i + 2U == pn) || (p[i + 2U] == '/'))) {
+            // "**" spans whole components: everything at the end, any
+            // number of them, none included, before a '/'
+            if (i + 2U == pn) {
+                return 1;
+            }
+            for (size_t k = j; k <= sn; k++) {
+                if (((k == j) || (s[k - 1U] == '/')) && glob_match(&p[i + 3U], pn - i - 3U, &s[k], sn - k)) {
+                    return 1;
+                }
+            }
+            return 0;
+        }
+        if (c == '*') {
+            while ((i < pn) && (p[i] == '*')) {
+                i ++;
+            }
+            if ((i == pn) || (p[i] == '/')) {
+                // the star takes the rest of the component
+                while ((j < sn) && (s[j] != '/')) {
+                    j ++;
+                }
+                continue;
+            }
+            // only try where the literal after the star is
+            char next = (strchr("?[\\", p[i]) == NULL) ? p[i] : '\0';
+            for (size_t k = j; ; k++) {
+                if (((next == '\0') || ((k < sn) && (s[k] == next))) && glob_match(&p[i], pn - i, &s[k], sn - k)) {
+                    return 1;
+                }
+                if ((k == sn) || (s[k] == '/')) {
+                    return 0;
+                }
+            }
+        }
+        // '?' and a class never match a '/', a quoted character is literal
+        size_t end = 0;
+        int any = 0;
+        if ((c == '\\') && (i + 1U < pn)) {
+            c = p[++ i];
+        } else if (c == '?') {
+            any = 1;
+        } else if (c == '[') {
+            end = class_end(p, pn, i);
+        }
+        if ((j == sn) || ((s[j] == '/') && (any || (end != 0) || (c != '/')))) {
+            return 0;
+        }
+        if (end != 0) {
+            if (!class_match(&p[i + 1U], end - i - 1U, s[j])) {
+                return 0;
+            }
+            i = end;
+        } else if (!any && (s[j] != c)) {
+            return 0;
+        }
+        i ++;
+        j ++;
+    }
+    return j == sn;
+}
+
+// Length of the first n components of p, a pattern if quoted is set
+static size_t components(const char *p, size_t pn, uint32_t n, int quoted) {
+    for (size_t i = 0; i < pn; i++) {
+        if (quoted && (p[i] == '\\') && (i + 1U < pn)) {
+            // a quoted '/' still ends the component
+            if ((p[++ i] == '/') && (-- n == 0)) {
+                return i - 1U;
+            }
+        } else if ((p[i] == '/') && (-- n == 0)) {
+            return i;
+        }
+    }
+    return pn;
+}
+
+// Compare the path of e with key, a path that starts with key is equal
+static int prefix_cmp(const cpiofs_index_t *index, uint32_t e, const char *key, size_t klen) {
+    size_t len = index->name_len[e];
+    int c = memcmp(&index->strings[index->name[e]], key, (len < klen) ? len : klen);
+    return (c != 0) ? c : (len < klen) ? -1 : 0;
+}
+
+// First sorted position in [lo, hi) whose path is not before key, or
+// past key and every path starting with it if after is set
+static uint32_t prefix_bound(const cpiofs_index_t *index, uint32_t lo, uint32_t hi, const char *key, size_t klen,
+                             int after) {
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2U;
+        int c = prefix_cmp(index, index->sorted[mid], key, klen);
+        if ((c < 0) || (after && (c == 0))) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Whether the directory a holds e, at any depth
+static int holds(const cpiofs_index_t *index, uint32_t a, uint32_t e) {
+    // a loop in a damaged saved index ends like a missing directory
+    for (unsigned int n = 0; (e != CPIO_INDEX_NONE) && (n < CPIO_NAME_MAX); n++) {
+        e = index->parent[e];
+        if (e == a) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// First sorted position in [lo, hi) past the paths under the directory
+// a, the path at lo - 1 being one of them
+//
+// The parent links find the end without touching the names, which are
+// all over the image. A path under a with a missing directory of its
+// own ends the block early, never late.
+static uint32_t block_end(const cpiofs_index_t *index, uint32_t lo, uint32_t hi, uint32_t a) {
+    uint32_t step = 1;
+    while ((hi - lo > step) && holds(index, a, index->sorted[lo + step - 1U])) {
+        lo += step;
+        step *= 2U;
+    }
+    if (hi - lo > step) {
+        hi = lo + step;
+    }
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2U;
+        if (holds(index, a, index->sorted[mid])) {
+            lo = mid + 1U;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Skip the paths under the directory levels up from the path at r,
+// which is its first klen bytes and a '/'; the names are compared when
+// that directory has no entry
+static uint32_t skip_block(const cpiofs_index_t *index, uint32_t r, uint32_t hi, uint32_t levels, size_t klen) {
+    uint32_t e = index->sorted[r];
+    uint32_t a = e;
+    for (uint32_t n = 0; (n < levels) && (a != CPIO_INDEX_NONE); n++) {
+        a = index->parent[a];
+    }
+    if (a == CPIO_INDEX_NONE) {
+        return prefix_bound(index, r + 1U, hi, &index->strings[index->name[e]], klen, 1);
+    }
+    return block_end(index, r + 1U, hi, a);
+}
+
+int cpiofs_glob(const cpiofs_t *fs, const char *pattern, cpiofs_glob_t callback, void *ctx) {
+    if ((fs == NULL) || (pattern == NULL) || (callback == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fs->overlay != NULL) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    if (!cpiofs_indexed(fs)) {
+        cpiofs_t view = {
+            .head = fs->head,
+            .size = fs->size,
+        };
+        int ret = cpiofs_index_build(&view, 1, &view.index);
+        if (ret == CPIO_ERR_OK) {
+            ret = cpiofs_glob(&view, pattern, callback, ctx);
+            free(view.index.mem);
+        }
+        return ret;
+    }
+
+    const cpiofs_index_t *index = &fs->index;
+    const char *p = cpio_path_skip_root(pattern);
+    size_t pn = strlen(p);
+    // a trailing '/' keeps the directories only
+    uint16_t mask = CPIO_FILEDIR_TYPE;
+    if ((pn > 0) && (p[pn - 1U] == '/')) {
+        mask = CPIO_DIR_TYPE_MASK;
+        while ((pn > 0) && (p[pn - 1U] == '/')) {
+            pn --;
+        }
+    }
+    size_t head = 0;
+    while ((head < pn) && (strchr("*?[\\", p[head]) == NULL)) {
+        head ++;
+    }
+    // the components before the first "**" fail or match on their own,
+    // all of them if there is no "**"
+    uint32_t fixed = 1;
+    int globstar = 0;
+    for (size_t i = 0; i < pn; i++) {
+        if ((p[i] == '*') && (i + 1U < pn) && (p[i + 1U] == '*') && ((i == 0) || (p[i - 1U] == '/')) &&
+            ((i + 2U == pn) || (p[i + 2U] == '/'))) {
+            globstar = 1;
+            fixed -= 1U;
+            break;
+        }
+        fixed += (p[i] == '/');
+    }
+
+    // directories whose paths cannot hold a match, the paths under them
+    // come later and are skipped from their parent links alone
+    uint8_t *dead = calloc(((size_t)index->count + 7U) / 8U + 1U, 1);
+    if (dead == NULL) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+
+    int count = 0;
+    uint32_t hi = prefix_bound(index, 0, index->count, p, head, 1);
+    for (uint32_t r = prefix_bound(index, 0, hi, p, head, 0); r < hi; ) {
+        uint32_t e = index->sorted[r];
+        uint32_t pe = index->parent[e];
+        if ((pe != CPIO_INDEX_NONE) && ((dead[pe / 8U] & (1U << (pe % 8U))) != 0)) {
+            r = block_end(index, r + 1U, hi, pe);
+            continue;
+        }
+        const char *path = &index->strings[index->name[e]];
+        size_t len = index->name_len[e];
+        if (len == 0) {
+            // the root directory, which every path is under
+            r ++;
+            continue;
+        }
+        uint32_t k = 1;
+        for (size_t i = 0; i < len; i++) {
+            k += (path[i] == '/');
+        }
+        uint32_t m = (k < fixed) ? k : fixed;
+        int hit = 1;
+        // once the whole pattern and the whole path are in, the result stands
+        int whole = !globstar && (k == fixed);
+        if ((m > 0) && !glob_match(p, components(p, pn, m, 1), path, components(path, len, m, 0))) {
+            // skip the block under the shallowest component that fails
+            uint32_t d = 1;
+            while ((d < m) && glob_match(p, components(p, pn, d, 1), path, components(path, len, d, 0))) {
+                d ++;
+            }
+            if (d < k) {
+                r = skip_block(index, r, hi, k - d, components(path, len, d, 0) + 1U);
+                continue;
+            }
+            hit = 0;
+        } else if (!globstar && (k > fixed)) {
+            // deeper than the pattern, and so is the rest of the block
+            r = skip_block(index, r, hi, k - fixed, components(path, len, fixed, 0) + 1U);
+            continue;
+        }
+        if (!hit || whole) {
+            dead[e / 8U] |= (uint8_t)(1U << (e % 8U));
+        }
+        // the first entry of a duplicated path stands for all of them
+        if (hit && ((index->mode[e] & mask) != 0) &&
+            ((r == 0) || (cpiofs_index_order(index, index->sorted[r - 1U], e) != 0)) &&
+            (whole || glob_match(p, pn, path, len))) {
+            cpio_info_t info;
+            cpiofs_index_info(fs, e, &info);
+            count ++;
+            if (callback(&info, ctx) != 0) {
+                break;
+            }
+        }
+        r ++;
+    }
+    free(dead);
+    return count;
+}
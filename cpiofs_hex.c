@@ -0,0 +1,134 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cpiofs_priv.h"
+
+// Hex decoders for the 8 characters fields of the newc and crc headers.
+// Every field is a big endian number written with 8 hex digits, upper or
+// lower case. All the kernels return 1 on success and 0 as soon as a
+// field holds something that is not a hex digit.
+
+#ifdef CPIO_HEX_X86
+#include <immintrin.h>
+#endif
+
+static inline int hex_nibble(uint8_t c) {
+    if ((uint8_t)(c - '0') < 10U) {
+        return c - '0';
+    }
+    c |= 0x20;
+    if ((uint8_t)(c - 'a') < 6U) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+int cpio_hex_decode_scalar(const char *s, uint32_t *out, unsigned int n) {
+    for (unsigned int f = 0; f < n; f++) {
+        uint32_t v = 0;
+        for (unsigned int i = 0; i < 8U; i++) {
+            int nibble = hex_nibble((uint8_t)s[i]);
+            if (nibble < 0) {
+                return 0;
+            }
+            v = (v << 4) | (uint32_t)nibble;
+        }
+        out[f] = v;
+        s += 8;
+    }
+    return 1;
+}
+
+#ifdef CPIO_HEX_X86
+
+static inline uint32_t be32(const uint8_t *b) {
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+// 16 hex digits, 2 fields per step
+__attribute__((target("sse2")))
+int cpio_hex_decode_sse2(const char *s, uint32_t *out, unsigned int n) {
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i alpha = _mm_set1_epi8('a');
+    const __m128i ten = _mm_set1_epi8(10);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i five = _mm_set1_epi8(5);
+    const __m128i low_byte = _mm_set1_epi16(0x00FF);
+    unsigned int f = 0;
+    for (; f + 2U <= n; f += 2U) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&s[f * 8U]);
+        __m128i digit = _mm_sub_epi8(v, zero);
+        __m128i letter = _mm_sub_epi8(_mm_or_si128(v, lower), alpha);
+        // unsigned range checks: x <= max iff min(x, max) == x
+        __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, nine), digit);
+        __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, five), letter);
+        if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF) {
+            return 0;
+        }
+        __m128i nibble = _mm_or_si128(_mm_and_si128(is_digit, digit),
+                                      _mm_and_si128(is_letter, _mm_add_epi8(letter, ten)));
+        // join the nibble pairs: the first digit of a pair is the high one
+        __m128i bytes = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibble, low_byte), 4),
+                                     _mm_srli_epi16(nibble, 8));
+        uint8_t b[16];
+        _mm_storeu_si128((__m128i*)b, _mm_packus_epi16(bytes, bytes));
+        out[f] = be32(&b[0]);
+        out[f + 1U] = be32(&b[4]);
+    }
+    return cpio_hex_decode_scalar(&s[f * 8U], &out[f], n - f);
+}
+
+// 32 hex digits, 4 fields per step
+__attribute__((target("avx2")))
+int cpio_hex_decode_avx2(const char *s, uint32_t *out, unsigned int n) {
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    const __m256i alpha = _mm256_set1_epi8('a');
+    const __m256i ten = _mm256_set1_epi8(10);
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i five = _mm256_set1_epi8(5);
+    const __m256i low_byte = _mm256_set1_epi16(0x00FF);
+    unsigned int f = 0;
+    for (; f + 4U <= n; f += 4U) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&s[f * 8U]);
+        __m256i digit = _mm256_sub_epi8(v, zero);
+        __m256i letter = _mm256_sub_epi8(_mm256_or_si256(v, lower), alpha);
+        __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, nine), digit);
+        __m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, five), letter);
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != 0xFFFFFFFFU) {
+            return 0;
+        }
+        __m256i nibble = _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                                         _mm256_and_si256(is_letter, _mm256_add_epi8(letter, ten)));
+        __m256i bytes = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(nibble, low_byte), 4),
+                                        _mm256_srli_epi16(nibble, 8));
+        // packus works per 128 bits lane: fields 0-1 land in b[0..7], 2-3 in b[16..23]
+        uint8_t b[32];
+        _mm256_storeu_si256((__m256i*)b, _mm256_packus_epi16(bytes, bytes));
+        out[f] = be32(&b[0]);
+        out[f + 1U] = be32(&b[4]);
+        out[f + 2U] = be32(&b[16]);
+        out[f + 3U] = be32(&b[20]);
+    }
+    return cpio_hex_decode_sse2(&s[f * 8U], &out[f], n - f);
+}
+
+int cpio_hex_decode(const char *s, uint32_t *out, unsigned int n) {
+    if (__builtin_cpu_supports("avx2")) {
+        return cpio_hex_decode_avx2(s, out, n);
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return cpio_hex_decode_sse2(s, out, n);
+    }
+    return cpio_hex_decode_scalar(s, out, n);
+}
+
+#else
+
+int cpio_hex_decode(const char *s, uint32_t *out, unsigned int n) {
+    return cpio_hex_decode_scalar(s, out, n);
+}
+
+#endif
@@ -0,0 +1,769 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+uint32_t cpiofs_index_probe(const cpiofs_index_t *index, const char *path, size_t len, uint32_t h, uint16_t mask) {
+    if (index->pilot != NULL) {
+        uint32_t pilot = index->pilot[cpio_phf_bucket(h, index->nbucket)];
+        uint32_t e = index->phf[cpio_phf_slot(cpio_path_hash2(path, len), pilot, index->nphf)];
+        if ((index->hash[e] != h) || (index->name_len[e] != len) ||
+            (memcmp(&index->strings[index->name[e]], path, len) != 0)) {
+            return CPIO_INDEX_NONE;
+        }
+        // e is the first entry of the path, a later one of another type
+        // is left to the slots
+        if ((index->mode[e] & mask) != 0) {
+            return e;
+        }
+    }
+    for (uint32_t s = h & index->mask; index->slot[s] != 0; s = (s + 1U) & index->mask) {
+        uint32_t e = index->slot[s] - 1U;
+        if ((index->hash[e] == h) && (index->name_len[e] == len) && ((index->mode[e] & mask) != 0) &&
+            (memcmp(&index->strings[index->name[e]], path, len) == 0)) {
+            return e;
+        }
+    }
+    return CPIO_INDEX_NONE;
+}
+
+static uint32_t index_probe(const cpiofs_index_t *index, const char *path, size_t len, uint16_t mask) {
+    return cpiofs_index_probe(index, path, len, cpio_path_hash(path, len), mask);
+}
+
+static void* carve(uint8_t **mem, size_t size) {
+    void *ret = *mem;
+    *mem += size;
+    return ret;
+}
+
+// The tables of an index, writable while they are filled
+struct index_tables {
+    cpio_off_t *entry;
+    cpio_off_t *name;
+    cpio_off_t *data;
+    cpio_size_t *fsize;
+    uint32_t *hash;
+    uint32_t *parent;
+    uint32_t *child;
+    uint32_t *child_first;
+    uint32_t *sorted;
+    uint32_t *slot;
+    uint16_t *name_len;
+    uint16_t *mode;
+};
+
+// Size of the tables, the names excluded
+static size_t index_tables_size(uint32_t count, uint32_t nslot) {
+    return (size_t)count * (3U * sizeof(cpio_off_t) + sizeof(cpio_size_t) +
+                            4U * sizeof(uint32_t) + 2U * sizeof(uint16_t)) +
+           ((size_t)count + 1U + nslot) * sizeof(uint32_t);
+}
+
+// Hash slots for count entries, keeping the load factor at or below 1/2
+static uint32_t index_nslot(uint32_t count) {
+    uint32_t nslot = 2;
+    while (nslot < 2U * count) {
+        nslot <<= 1;
+    }
+    return nslot;
+}
+
+// Lay the tables out in mem, widest types first so that every array
+// stays aligned; returns the end of the tables
+static uint8_t* index_carve(struct index_tables *t, uint8_t *mem, uint32_t count, uint32_t nslot) {
+    t->entry = carve(&mem, count * sizeof(cpio_off_t));
+    t->name = carve(&mem, count * sizeof(cpio_off_t));
+    t->data = carve(&mem, count * sizeof(cpio_off_t));
+    t->fsize = carve(&mem, count * sizeof(cpio_size_t));
+    t->hash = carve(&mem, count * sizeof(uint32_t));
+    t->parent = carve(&mem, count * sizeof(uint32_t));
+    t->child = carve(&mem, count * sizeof(uint32_t));
+    t->child_first = carve(&mem, (count + 1U) * sizeof(uint32_t));
+    t->sorted = carve(&mem, count * sizeof(uint32_t));
+    t->slot = carve(&mem, nslot * sizeof(uint32_t));
+    t->name_len = carve(&mem, count * sizeof(uint16_t));
+    t->mode = carve(&mem, count * sizeof(uint16_t));
+    return mem;
+}
+
+static void index_set(cpiofs_index_t *index, const struct index_tables *t, uint32_t count, uint32_t nslot) {
+    index->count = count;
+    index->mask = nslot - 1U;
+    index->entry = t->entry;
+    index->name = t->name;
+    index->data = t->data;
+    index->fsize = t->fsize;
+    index->name_len = t->name_len;
+    index->mode = t->mode;
+    index->hash = t->hash;
+    index->slot = t->slot;
+    index->parent = t->parent;
+    index->child_first = t->child_first;
+    index->child = t->child;
+    index->sorted = t->sorted;
+}
+
+const struct header_old_cpio* cpiofs_header_at(const cpiofs_t *fs, cpio_off_t off, struct cpio_entry *ent,
+                                               uint8_t *buf) {
+    CPIO_STAT_HEADER();
+    if (fs->store != NULL) {
+        return cpiofs_store_header(fs, off, ent, buf);
+    }
+    const struct header_old_cpio* d = (const struct header_old_cpio*)((const uint8_t*)fs->head + off);
+    return cpio_decode(d, fs->size - off, ent) ? d : NULL;
+}
+
+int cpiofs_is_index_entry(const struct header_old_cpio* d, const struct cpio_entry *ent) {
+    size_t len;
+    const char *path = cpio_name_path((const char*)d + ent->name, ent->namesize, &len);
+    return ((ent->mode & CPIO_TYPE_MASK) == CPIO_FILE_TYPE_MASK) && (len == sizeof(CPIOFS_INDEX_NAME) - 1U) &&
+           (memcmp(path, CPIOFS_INDEX_NAME, len) == 0);
+}
+
+int cpiofs_index_order(const cpiofs_index_t *index, uint32_t a, uint32_t b) {
+    size_t la = index->name_len[a];
+    size_t lb = index->name_len[b];
+    int c = memcmp(&index->strings[index->name[a]], &index->strings[index->name[b]], (la < lb) ? la : lb);
+    return (c != 0) ? c : (la > lb) - (la < lb);
+}
+
+// Sort the entry numbers by path with a bottom up merge sort, so that
+// the entries of a duplicated path keep archive order; tmp holds count
+// numbers too
+static void index_sort(const cpiofs_index_t *index, uint32_t *sorted, uint32_t *tmp) {
+    uint32_t count = index->count;
+    uint32_t *src = sorted;
+    uint32_t *dst = tmp;
+    for (uint32_t e = 0; e < count; e++) {
+        sorted[e] = e;
+    }
+    for (size_t width = 1; width < count; width *= 2U) {
+        for (size_t lo = 0; lo < count; lo += 2U * width) {
+            size_t mid = (lo + width < count) ? lo + width : count;
+            size_t hi = (lo + 2U * width < count) ? lo + 2U * width : count;
+            size_t i = lo;
+            size_t j = mid;
+            size_t k = lo;
+            // archives written in path order merge with a single compare
+            if ((mid < hi) && (cpiofs_index_order(index, src[mid - 1U], src[mid]) <= 0)) {
+                memcpy(&dst[lo], &src[lo], (hi - lo) * sizeof(uint32_t));
+                continue;
+            }
+            while ((i < mid) && (j < hi)) {
+                dst[k++] = (cpiofs_index_order(index, src[j], src[i]) < 0) ? src[j++] : src[i++];
+            }
+            while (i < mid) {
+                dst[k++] = src[i++];
+            }
+            while (j < hi) {
+                dst[k++] = src[j++];
+            }
+        }
+        uint32_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != sorted) {
+        memcpy(sorted, src, count * sizeof(uint32_t));
+    }
+}
+
+// Bytes of the index of count entries: the tables, the names copied
+// from a backing store, and the scratch of the sort when it is carved
+// from an arena too
+static size_t index_need(uint32_t count, size_t names, int arena) {
+    uint32_t nslot = index_nslot(count);
+    if (!arena) {
+        return index_tables_size(count, nslot) + names;
+    }
+    return index_tables_size(count, nslot) + ((names + 3U) & ~(size_t)3U) + (size_t)count * sizeof(uint32_t);
+}
+
+// Count the entries to index and the bytes of their names, returns
+// where the header chain stops
+static cpio_off_t index_count(const cpiofs_t *fs, uint32_t *count, size_t *names) {
+    uint8_t buf[CPIO_ENTRY_BUFFER];
+    struct cpio_entry ent;
+    const struct header_old_cpio* pdata;
+    cpio_off_t off;
+    for (off = 0;
+         ((pdata = cpiofs_header_at(fs, off, &ent, buf)) != NULL) && !cpio_is_trailer(pdata, &ent);
+         off += ent.next) {
+        if (!cpiofs_is_index_entry(pdata, &ent)) {
+            (*count) ++;
+            *names += ent.namesize;
+        }
+    }
+    return off;
+}
+
+// The index goes in arena when it is not NULL, nothing is allocated
+static int index_build(const cpiofs_t *fs, unsigned int nthread, cpiofs_index_t *out, uint8_t *arena,
+                       size_t arena_size) {
+    // first pass: count the entries to size the tables, in store mode
+    // the names are copied too; the chain found by many threads gives
+    // the count right away, the saved index entry included
+    uint32_t count = 0;
+    size_t names = 0;
+    uint8_t buf[CPIO_ENTRY_BUFFER];
+    struct cpio_entry ent;
+    const struct header_old_cpio* pdata;
+    cpio_off_t off;
+    cpio_off_t *chain = NULL;
+    if ((nthread != 1) && ((fs->store != NULL) || (arena != NULL))) {
+        nthread = 1;
+    }
+    if (nthread != 1) {
+        int ret = cpiofs_chain(fs, nthread, &chain, &count);
+        if (ret != CPIO_ERR_OK) {
+            return ret;
+        }
+        off = chain[count];
+    } else {
+        off = index_count(fs, &count, &names);
+    }
+    cpio_off_t trailer = off;
+    if (fs->store == NULL) {
+        names = 0;
+    }
+
+    uint32_t nslot = index_nslot(count);
+    uint8_t *mem = arena;
+    if (arena == NULL) {
+        mem = malloc(index_need(count, names, 0));
+    } else if (index_need(count, names, 1) > arena_size) {
+        mem = NULL;
+    }
+    if (mem == NULL) {
+        free(chain);
+        return (int)CPIO_ERR_NOMEM;
+    }
+    struct index_tables t;
+    char *strings = (char*)index_carve(&t, mem, count, nslot);
+    memset(t.slot, 0, nslot * sizeof(uint32_t));
+    memset(t.child_first, 0, (count + 1U) * sizeof(uint32_t));
+
+    cpiofs_index_t index = {
+        .strings = (fs->store == NULL) ? (const char*)fs->head : strings,
+        .trailer = trailer,
+        .mem = (arena == NULL) ? mem : NULL,
+    };
+
+    // second pass: decode every header once and fill the hash table, the
+    // probe order follows archive order so the first entry of a
+    // duplicated path is always found first
+    uint32_t e = 0;
+    uint32_t c = 0;
+    size_t pool = 0;
+    for (off = (chain != NULL) ? chain[0] : 0; (chain != NULL) ? (c < count) : (e < count);
+         off = (chain != NULL) ? chain[++ c] : off + ent.next) {
+        pdata = cpiofs_header_at(fs, off, &ent, buf);
+        if (pdata == NULL) {
+            // the backing store failed between the two passes
+            free(chain);
+            free(index.mem);
+            return (int)CPIO_ERR_IO;
+        }
+        if (cpiofs_is_index_entry(pdata, &ent)) {
+            continue;
+        }
+        const char *filename = (const char*)pdata + ent.name;
+        size_t len;
+        const char *path = cpio_name_path(filename, ent.namesize, &len);
+        t.entry[e] = off;
+        if (fs->store == NULL) {
+            t.name[e] = (cpio_off_t)(path - index.strings);
+        } else {
+            memcpy(&strings[pool], filename, ent.namesize);
+            t.name[e] = (cpio_off_t)(pool + (size_t)(path - filename));
+            pool += ent.namesize;
+        }
+        t.data[e] = off + ent.data;
+        t.fsize[e] = ent.filesize;
+        t.name_len[e] = (uint16_t)len;
+        t.mode[e] = (uint16_t)ent.mode;
+        t.hash[e] = cpio_path_hash(path, len);
+        uint32_t s = t.hash[e] & (nslot - 1U);
+        while (t.slot[s] != 0) {
+            s = (s + 1U) & (nslot - 1U);
+        }
+        t.slot[s] = e + 1U;
+        e ++;
+    }
+    free(chain);
+    // the saved index entry leaves its row unused at the end of the tables
+    count = e;
+    index_set(&index, &t, count, nslot);
+
+    // link every file and directory to its parent directory and
+    // group the children, keeping archive order inside each group
+    for (e = 0; e < count; e++) {
+        const char *path = &index.strings[t.name[e]];
+        size_t len = t.name_len[e];
+        t.parent[e] = CPIO_INDEX_NONE;
+        if ((len > 0) && ((t.mode[e] & CPIO_FILEDIR_TYPE) != 0)) {
+            size_t plen = len;
+            while ((plen > 0) && (path[plen - 1U] != '/')) {
+                plen --;
+            }
+            if (plen > 0) {
+                plen --;
+            }
+            uint32_t pe = index_probe(&index, path, plen, CPIO_DIR_TYPE_MASK);
+            if ((pe != CPIO_INDEX_NONE) && (pe != e)) {
+                t.parent[e] = pe;
+                t.child_first[pe + 1U] ++;
+            }
+        }
+    }
+    for (e = 0; e < count; e++) {
+        t.child_first[e + 1U] += t.child_first[e];
+    }
+    for (e = 0; e < count; e++) {
+        if (t.parent[e] != CPIO_INDEX_NONE) {
+            t.child[t.child_first[t.parent[e]] ++] = e;
+        }
+    }
+    // the fill loop moved every start to the next group, shift them back
+    for (e = count; e > 0; e--) {
+        t.child_first[e] = t.child_first[e - 1U];
+    }
+    t.child_first[0] = 0;
+
+    // path order for the prefix queries
+    uint32_t *tmp = (arena != NULL) ? (uint32_t*)&strings[(names + 3U) & ~(size_t)3U] : malloc((count ? count : 1U) * sizeof(uint32_t));
+    if (tmp == NULL) {
+        free(index.mem);
+        return (int)CPIO_ERR_NOMEM;
+    }
+    index_sort(&index, t.sorted, tmp);
+    if (arena == NULL) {
+        free(tmp);
+    }
+    *out = index;
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_index_build(const cpiofs_t *fs, unsigned int nthread, cpiofs_index_t *out) {
+    return index_build(fs, nthread, out, NULL, 0);
+}
+
+// Saved index
+//
+// The blob is the tables of the index, as they are in memory, followed
+// by a footer. The tables start lead bytes into the blob, so that they
+// are aligned once the blob is in the archive, and the blob ends on a
+// 8 bytes boundary. Embedded in an archive, the blob is the data of the
+// last entry, CPIOFS_INDEX_NAME, and the trailer header follows it
+// right away: the footer is found from the trailer, which is found
+// from the end of the archive.
+
+#define INDEX_MAGIC         "CPIOFSIX"
+#define INDEX_VERSION       2U
+#define INDEX_ORDER         0x01020304U
+#define INDEX_SIDECAR       (~(uint64_t)0)
+#define INDEX_TRAILER_MAX   65536U      // padding searched after the trailer
+
+struct index_footer {
+    char magic[8];          // INDEX_MAGIC
+    uint32_t order;         // INDEX_ORDER, in the byte order of the writer
+    uint16_t version;
+    uint16_t off_size;      // sizeof(cpio_off_t) of the writer
+    uint32_t count;
+    uint32_t nslot;
+    uint32_t lead;          // tables offset in the blob
+    uint32_t checksum;      // of the tables
+    uint64_t trailer;       // offset of the trailer header
+    uint64_t entry;         // offset of the header holding the blob, INDEX_SIDECAR if none
+    uint64_t size;          // of the whole blob
+    uint8_t reserved[8];
+};
+
+// Fletcher like sum of 32 bits words, size is a multiple of 4
+static uint32_t index_checksum(const uint8_t *p, size_t size) {
+    uint64_t a = 1;
+    uint64_t b = 0;
+    for (size_t i = 0; i < size; i += 4U) {
+        uint32_t w;
+        memcpy(&w, &p[i], sizeof(w));
+        a += w;
+        b += a;
+    }
+    return (uint32_t)(a ^ (a >> 32) ^ b ^ (b >> 32) ^ (b << 7));
+}
+
+int cpiofs_index_save(const cpiofs_t *fs, cpio_off_t at, void **blob, cpio_size_t *size) {
+    if ((fs == NULL) || (blob == NULL) || (size == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    // the names of a store mount are a private copy
+    if (!cpiofs_indexed(fs) || (fs->store != NULL)) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    const cpiofs_index_t *index = &fs->index;
+    uint32_t nslot = index->mask + 1U;
+    size_t tables = index_tables_size(index->count, nslot);
+    size_t lead = (at == 0) ? 0 : (8U - at % 8U) % 8U;
+    size_t total = (lead + tables + sizeof(struct index_footer) + 7U) & ~(size_t)7U;
+    if ((uint64_t)at + total > (cpio_size_t)~(cpio_size_t)0) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    uint8_t *mem = calloc(1, total);
+    if (mem == NULL) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    struct index_tables t;
+    index_carve(&t, &mem[lead], index->count, nslot);
+    memcpy(t.entry, index->entry, index->count * sizeof(cpio_off_t));
+    memcpy(t.name, index->name, index->count * sizeof(cpio_off_t));
+    memcpy(t.data, index->data, index->count * sizeof(cpio_off_t));
+    memcpy(t.fsize, index->fsize, index->count * sizeof(cpio_size_t));
+    memcpy(t.hash, index->hash, index->count * sizeof(uint32_t));
+    memcpy(t.parent, index->parent, index->count * sizeof(uint32_t));
+    memcpy(t.child, index->child, index->count * sizeof(uint32_t));
+    memcpy(t.child_first, index->child_first, (index->count + 1U) * sizeof(uint32_t));
+    memcpy(t.sorted, index->sorted, index->count * sizeof(uint32_t));
+    memcpy(t.slot, index->slot, nslot * sizeof(uint32_t));
+    memcpy(t.name_len, index->name_len, index->count * sizeof(uint16_t));
+    memcpy(t.mode, index->mode, index->count * sizeof(uint16_t));
+
+    struct index_footer footer;
+    memset(&footer, 0, sizeof(footer));
+    memcpy(footer.magic, INDEX_MAGIC, sizeof(footer.magic));
+    footer.order = INDEX_ORDER;
+    footer.version = INDEX_VERSION;
+    footer.off_size = sizeof(cpio_off_t);
+    footer.count = index->count;
+    footer.nslot = nslot;
+    footer.lead = (uint32_t)lead;
+    footer.checksum = index_checksum(&mem[lead], tables);
+    if (at == 0) {
+        footer.trailer = index->trailer;
+        footer.entry = INDEX_SIDECAR;
+    } else {
+        // the entry holding the blob follows the last indexed entry
+        footer.trailer = at + total;
+        footer.entry = 0;
+        if (index->count > 0) {
+            struct cpio_entry ent;
+            uint32_t e = index->count - 1U;
+            if (cpiofs_header_at(fs, index->entry[e], &ent, NULL) == NULL) {
+                free(mem);
+                return (int)CPIO_ERR_UNKNOWN;
+            }
+            footer.entry = index->entry[e] + ent.next;
+        }
+        if (footer.entry >= at) {
+            free(mem);
+            return (int)CPIO_ERR_PARAM;
+        }
+    }
+    footer.size = total;
+    memcpy(&mem[total - sizeof(footer)], &footer, sizeof(footer));
+    *blob = mem;
+    *size = (cpio_size_t)total;
+    return (int)CPIO_ERR_OK;
+}
+
+// Offset of the trailer header, searched backward from the end of the
+// image, CPIO_INDEX_NONE if there is none
+static cpio_off_t find_trailer(const cpiofs_t *fs) {
+    static const char name[] = "TRAILER!!!";
+    static const unsigned long hsizes[] = { 26U, 76U, 110U };
+    const char *p = (const char*)fs->head;
+    cpio_size_t stop = (fs->size > INDEX_TRAILER_MAX) ? fs->size - INDEX_TRAILER_MAX : 0;
+    for (cpio_size_t i = fs->size; i >= stop + sizeof(name); i--) {
+        cpio_size_t n = i - (cpio_size_t)sizeof(name);
+        if ((p[n] != 'T') || (memcmp(&p[n], name, sizeof(name)) != 0)) {
+            continue;
+        }
+        for (unsigned int h = 0; h < sizeof(hsizes) / sizeof(hsizes[0]); h++) {
+            struct cpio_entry ent;
+            if (n < hsizes[h]) {
+                continue;
+            }
+            const struct header_old_cpio* d = (const struct header_old_cpio*)&p[n - hsizes[h]];
+            if (cpio_decode(d, fs->size - (n - hsizes[h]), &ent) && (ent.name == hsizes[h]) &&
+                cpio_is_trailer(d, &ent)) {
+                return n - (cpio_off_t)hsizes[h];
+            }
+        }
+        return CPIO_INDEX_NONE;
+    }
+    return CPIO_INDEX_NONE;
+}
+
+// Check of loaded tables: every entry number, offset and length has to
+// stay in the tables, every entry has to be a header of the image with
+// the name, data and mode the tables give, sorted has to hold every
+// entry once, and a free hash slot has to be left for the probes to
+// stop on
+static int index_tables_valid(const cpiofs_t *fs, const struct index_tables *t, uint32_t count, uint32_t nslot) {
+    uint32_t used = 0;
+    for (uint32_t s = 0; s < nslot; s++) {
+        if (t->slot[s] > count) {
+            return 0;
+        }
+        used += (t->slot[s] != 0);
+    }
+    if ((used > count) || (t->child_first[0] != 0) || (t->child_first[count] > count)) {
+        return 0;
+    }
+    // the entries without a parent leave the end of child unused
+    for (uint32_t c = 0; c < t->child_first[count]; c++) {
+        if (t->child[c] >= count) {
+            return 0;
+        }
+    }
+    uint8_t *seen = calloc(((size_t)count + 7U) / 8U + 1U, 1);
+    if (seen == NULL) {
+        return 0;
+    }
+    int ok = 1;
+    for (uint32_t e = 0; (e < count) && ok; e++) {
+        struct cpio_entry ent;
+        ok = (t->child_first[e] <= t->child_first[e + 1U]) && (t->sorted[e] < count) &&
+             ((seen[t->sorted[e] / 8U] & (1U << (t->sorted[e] % 8U))) == 0) &&
+             ((t->parent[e] < count) || (t->parent[e] == CPIO_INDEX_NONE)) && (t->entry[e] < fs->size) &&
+             cpio_decode((const struct header_old_cpio*)((const uint8_t*)fs->head + t->entry[e]),
+                         fs->size - t->entry[e], &ent);
+        if (ok) {
+            // the path lies in the name field, before its NUL
+            cpio_off_t name = t->entry[e] + ent.name;
+            ok = (t->name[e] >= name) && (t->name[e] + t->name_len[e] < name + ent.namesize) &&
+                 (t->data[e] == t->entry[e] + ent.data) && (t->fsize[e] == ent.filesize) &&
+                 (t->mode[e] == (uint16_t)ent.mode);
+            seen[t->sorted[e] / 8U] |= (uint8_t)(1U << (t->sorted[e] % 8U));
+        }
+    }
+    free(seen);
+    return ok;
+}
+
+// Check a blob against the image and mount it, the checks are cheap
+// enough for every mount: the footer, the checksum of the tables, and
+// every header against them, decoded once without a hash of its name. Unaligned tables are
+// copied, or refused with CPIO_ERR_NOTSUP when inplace is set.
+static int index_load(cpiofs_t *fs, const uint8_t *blob, size_t size, int inplace) {
+    struct index_footer footer;
+    struct cpio_entry ent;
+    if ((size < sizeof(footer)) || ((size % 8U) != 0)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fs->size < sizeof(footer)) {
+        return (int)CPIO_ERR_NEXIST;
+    }
+    memcpy(&footer, &blob[size - sizeof(footer)], sizeof(footer));
+    if ((memcmp(footer.magic, INDEX_MAGIC, sizeof(footer.magic)) != 0) || (footer.order != INDEX_ORDER) ||
+        (footer.version != INDEX_VERSION) || (footer.off_size != sizeof(cpio_off_t)) || (footer.size != size) ||
+        (footer.lead >= 8U) || (footer.nslot < 2U) || ((footer.nslot & (footer.nslot - 1U)) != 0) ||
+        (footer.nslot <= footer.count) || (footer.nslot > size / sizeof(uint32_t))) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    size_t tables = index_tables_size(footer.count, footer.nslot);
+    if (footer.lead + tables + sizeof(footer) > size) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    // stale blob: the trailer and the entry holding the blob moved
+    if ((footer.trailer >= fs->size) || !cpiofs_header_at(fs, (cpio_off_t)footer.trailer, &ent, NULL) ||
+        !cpio_is_trailer((const struct header_old_cpio*)((const uint8_t*)fs->head + footer.trailer), &ent)) {
+        return (int)CPIO_ERR_NEXIST;
+    }
+    cpio_off_t last = (cpio_off_t)footer.trailer;
+    if (footer.entry != INDEX_SIDECAR) {
+        const struct header_old_cpio* d;
+        if ((footer.entry >= footer.trailer) || ((d = cpiofs_header_at(fs, (cpio_off_t)footer.entry, &ent, NULL)) == NULL) ||
+            !cpiofs_is_index_entry(d, &ent) || (footer.entry + ent.data + footer.size != footer.trailer) ||
+            (ent.filesize != footer.size)) {
+            return (int)CPIO_ERR_NEXIST;
+        }
+        last = (cpio_off_t)footer.entry;
+    }
+    if (index_checksum(&blob[footer.lead], tables) != footer.checksum) {
+        return (int)CPIO_ERR_PARAM;
+    }
+
+    // the tables are used in place when they are aligned, copied otherwise
+    const uint8_t *base = &blob[footer.lead];
+    void *mem = NULL;
+    if (((uintptr_t)base % sizeof(uint64_t)) != 0) {
+        if (inplace) {
+            return (int)CPIO_ERR_NOTSUP;
+        }
+        mem = malloc(tables);
+        if (mem == NULL) {
+            return (int)CPIO_ERR_NOMEM;
+        }
+        memcpy(mem, base, tables);
+        base = mem;
+    }
+    cpiofs_index_t index = {
+        .strings = (const char*)fs->head,
+        .trailer = (cpio_off_t)footer.trailer,
+        .mem = mem,
+    };
+    struct index_tables t;
+    index_carve(&t, (uint8_t*)base, footer.count, footer.nslot);
+    index_set(&index, &t, footer.count, footer.nslot);
+
+    // the last entry has to end where the blob starts, with its own name
+    int ok = index_tables_valid(fs, &t, footer.count, footer.nslot) &&
+             ((footer.count == 0) || (t.entry[0] == 0));
+    if (ok && (footer.count > 0)) {
+        uint32_t e = footer.count - 1U;
+        const struct header_old_cpio* d;
+        size_t len;
+        ok = (t.entry[e] < last) && ((d = cpiofs_header_at(fs, t.entry[e], &ent, NULL)) != NULL) &&
+             (t.entry[e] + ent.next == last) && (t.data[e] == t.entry[e] + ent.data) &&
+             (t.name[e] < fs->size) &&
+             (cpio_name_path((const char*)d + ent.name, ent.namesize, &len) == &index.strings[t.name[e]]) &&
+             (len == t.name_len[e]) && (cpio_path_hash(&index.strings[t.name[e]], len) == t.hash[e]);
+    }
+    if (!ok) {
+        free(mem);
+        return (int)CPIO_ERR_NEXIST;
+    }
+    fs->index = index;
+    return (int)CPIO_ERR_OK;
+}
+
+// Mount the blob embedded at the end of the image, if any
+static int index_load_embedded(cpiofs_t *fs, int inplace) {
+    struct index_footer footer;
+    cpio_off_t trailer = find_trailer(fs);
+    if ((trailer == CPIO_INDEX_NONE) || (trailer < sizeof(footer))) {
+        return (int)CPIO_ERR_NEXIST;
+    }
+    const uint8_t *end = (const uint8_t*)fs->head + trailer;
+    memcpy(&footer, end - sizeof(footer), sizeof(footer));
+    if ((memcmp(footer.magic, INDEX_MAGIC, sizeof(footer.magic)) != 0) || (footer.size > trailer)) {
+        return (int)CPIO_ERR_NEXIST;
+    }
+    return index_load(fs, end - footer.size, (size_t)footer.size, inplace);
+}
+
+int cpiofs_mount(cpiofs_t *fs, const void *image, cpio_size_t size) {
+    return cpiofs_mount_threads(fs, image, size, 1);
+}
+
+int cpiofs_mount_threads(cpiofs_t *fs, const void *image, cpio_size_t size, unsigned int nthread) {
+    if ((fs == NULL) || (image == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    memset(fs, 0, sizeof(*fs));
+    fs->head = (const struct header_old_cpio*)image;
+    fs->size = size;
+    // a saved index that does not match the image is ignored
+    int ret = index_load_embedded(fs, 0);
+    if (ret != CPIO_ERR_OK) {
+        ret = cpiofs_index_build(fs, nthread, &fs->index);
+    }
+    if (ret != CPIO_ERR_OK) {
+        memset(fs, 0, sizeof(*fs));
+    }
+    return ret;
+}
+
+int cpiofs_mount_arena_size(const void *image, cpio_size_t size, cpio_size_t *need) {
+    if ((image == NULL) || (need == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    cpiofs_t fs = {
+        .head = (const struct header_old_cpio*)image,
+        .size = size,
+    };
+    // the same steps as the mount, without the writes
+    if (index_load_embedded(&fs, 1) == CPIO_ERR_OK) {
+        *need = 0;
+        return (int)CPIO_ERR_OK;
+    }
+    uint32_t count = 0;
+    size_t names = 0;
+    index_count(&fs, &count, &names);
+    size_t bytes = index_need(count, 0, 1);
+    if ((uint64_t)bytes > (cpio_size_t)~(cpio_size_t)0) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    *need = (cpio_size_t)bytes;
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_mount_arena(cpiofs_t *fs, const void *image, cpio_size_t size, void *arena, cpio_size_t arena_size) {
+    if ((fs == NULL) || (image == NULL) || ((arena == NULL) && (arena_size > 0)) ||
+        (((uintptr_t)arena % sizeof(uint64_t)) != 0)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    memset(fs, 0, sizeof(*fs));
+    fs->head = (const struct header_old_cpio*)image;
+    fs->size = size;
+    int ret = index_load_embedded(fs, 1);
+    if (ret != CPIO_ERR_OK) {
+        // an empty arena still makes a valid pointer for the tables
+        static uint64_t none;
+        ret = index_build(fs, 1, &fs->index, (arena != NULL) ? arena : (void*)&none, arena_size);
+    }
+    if (ret != CPIO_ERR_OK) {
+        memset(fs, 0, sizeof(*fs));
+    }
+    return ret;
+}
+
+int cpiofs_mount_index(cpiofs_t *fs, const void *image, cpio_size_t size, const void *blob, cpio_size_t blob_size) {
+    if ((fs == NULL) || (image == NULL) || (blob == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    memset(fs, 0, sizeof(*fs));
+    fs->head = (const struct header_old_cpio*)image;
+    fs->size = size;
+    int ret = index_load(fs, blob, blob_size, 0);
+    if (ret != CPIO_ERR_OK) {
+        ret = cpiofs_index_build(fs, 1, &fs->index);
+    }
+    if (ret != CPIO_ERR_OK) {
+        memset(fs, 0, sizeof(*fs));
+    }
+    return ret;
+}
+
+int cpiofs_mount_store(cpiofs_t *fs, cpiofs_read_t read, void *ctx, cpio_size_t size,
+                       cpio_size_t block_size, uint32_t nblock) {
+    if (fs == NULL) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    memset(fs, 0, sizeof(*fs));
+    fs->size = size;
+    int ret = cpiofs_store_open(fs, read, ctx, block_size, nblock);
+    if (ret == CPIO_ERR_OK) {
+        ret = cpiofs_index_build(fs, 1, &fs->index);
+    }
+    if (ret != CPIO_ERR_OK) {
+        cpiofs_store_close(fs);
+        memset(fs, 0, sizeof(*fs));
+    }
+    return ret;
+}
+
+int cpiofs_unmount(cpiofs_t *fs) {
+    if (fs == NULL) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (cpiofs_resources(fs) != 0) {
+        return (int)CPIO_ERR_BUSY;
+    }
+    free(fs->index.mem);
+    cpiofs_store_close(fs);
+    cpiofs_map_release(fs);
+    cpiofs_zchunk_release(fs);
+    cpiofs_overlay_release(fs);
+    memset(fs, 0, sizeof(*fs));
+    return (int)CPIO_ERR_OK;
+}
+
+uint32_t cpiofs_index_lookup(const cpiofs_t *fs, const char *path, uint16_t mask) {
+    path = cpio_path_skip_root(path);
+    return index_probe(&fs->index, path, strlen(path), mask);
+}
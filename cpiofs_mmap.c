@@ -0,0 +1,123 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define _DEFAULT_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define CPIO_HAVE_MMAP
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+#ifdef CPIO_HAVE_MMAP
+
+// Sequential or random access advice, through posix_madvise and its
+// own constants where madvise is missing
+static void map_advise(void *map, size_t size, int sequential) {
+#ifdef MADV_NORMAL
+    madvise(map, size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+#else
+    posix_madvise(map, size, sequential ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_RANDOM);
+#endif
+}
+
+int cpiofs_mount_fd(cpiofs_t *fs, int fd, unsigned int flags) {
+    struct stat st;
+    if ((fs == NULL) || (fd < 0)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fstat(fd, &st) != 0) {
+        return (int)CPIO_ERR_IO;
+    }
+    if ((st.st_size <= 0) || ((uint64_t)st.st_size > (cpio_size_t)~(cpio_size_t)0) ||
+        ((uint64_t)st.st_size > SIZE_MAX)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    size_t size = (size_t)st.st_size;
+    int mflags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if ((flags & CPIOFS_MAP_POPULATE) != 0) {
+        mflags |= MAP_POPULATE;
+    }
+#endif
+    void *map = mmap(NULL, size, PROT_READ, mflags, fd, 0);
+    if (map == MAP_FAILED) {
+        return (int)CPIO_ERR_IO;
+    }
+    // the index scan touches every header once, front to back
+    if ((flags & CPIOFS_MAP_ADVISE) != 0) {
+        map_advise(map, size, 1);
+    }
+    int ret = cpiofs_mount(fs, map, (cpio_size_t)size);
+    if (ret != CPIO_ERR_OK) {
+        munmap(map, size);
+        return ret;
+    }
+    // lookups then jump around, readahead would only waste page cache
+    if ((flags & CPIOFS_MAP_ADVISE) != 0) {
+        map_advise(map, size, 0);
+    }
+    fs->map = map;
+    fs->map_size = size;
+    if ((flags & CPIOFS_MAP_KEEP_FD) != 0) {
+        int kept = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (kept < 0) {
+            cpiofs_unmount(fs);
+            return (int)CPIO_ERR_IO;
+        }
+        fs->map_fd = kept + 1;
+    }
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_mount_path(cpiofs_t *fs, const char *path, unsigned int flags) {
+    if ((fs == NULL) || (path == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return (int)CPIO_ERR_NEXIST;
+    }
+    int ret = cpiofs_mount_fd(fs, fd, flags);
+    close(fd);
+    return ret;
+}
+
+void cpiofs_map_release(cpiofs_t *fs) {
+    if (fs->map != NULL) {
+        munmap(fs->map, fs->map_size);
+        fs->map = NULL;
+        fs->map_size = 0;
+    }
+    if (fs->map_fd > 0) {
+        close(fs->map_fd - 1);
+        fs->map_fd = 0;
+    }
+}
+
+#else
+
+int cpiofs_mount_fd(cpiofs_t *fs, int fd, unsigned int flags) {
+    (void)fs;
+    (void)fd;
+    (void)flags;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+int cpiofs_mount_path(cpiofs_t *fs, const char *path, unsigned int flags) {
+    (void)fs;
+    (void)path;
+    (void)flags;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+void cpiofs_map_release(cpiofs_t *fs) {
+    (void)fs;
+}
+
+#endif
@@ -0,0 +1,325 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Overlay mounts
+//
+// The layers are merged from the highest down into one hash table of
+// paths, the way a layer patches the ones below: an entry goes in
+// unless a higher layer already put its path there, put something else
+// than a directory above it, or has a whiteout for it or above it. The
+// whiteouts of every layer are collected before its entries are, in a
+// table of their own that is dropped once the mount is done. Parents
+// and children are then linked as in the index of a single archive.
+
+#define WHITEOUT_PREFIX_LEN     (sizeof(CPIOFS_WHITEOUT_PREFIX) - 1U)
+#define WHITEOUT_OPAQUE_LEN     (sizeof(CPIOFS_WHITEOUT_OPAQUE) - 1U)
+
+// A path hidden by a whiteout of layer: dir/name, or dir itself and
+// what is under it for an opaque one
+struct overlay_mask {
+    const char *dir;
+    const char *name;
+    uint32_t dlen;
+    uint32_t nlen;
+    uint32_t hash;
+    uint32_t layer;
+    int opaque;
+};
+
+struct overlay_masks {
+    struct overlay_mask *mask;
+    uint32_t *slot;             // mask number + 1, 0 if free
+    uint32_t mask_slots;        // number of hash slots - 1
+    uint32_t count;
+};
+
+// cpio_path_hash of a path followed by n more bytes
+static uint32_t hash_more(uint32_t h, const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+// Name of the whiteout entry path, NULL if it is not one
+static const char* whiteout_name(const char *path, size_t len, size_t *dlen) {
+    size_t base = len;
+    while ((base > 0) && (path[base - 1U] != '/')) {
+        base --;
+    }
+    if ((len - base < WHITEOUT_PREFIX_LEN) || (memcmp(&path[base], CPIOFS_WHITEOUT_PREFIX, WHITEOUT_PREFIX_LEN) != 0)) {
+        return NULL;
+    }
+    *dlen = (base > 0) ? base - 1U : 0;
+    return &path[base];
+}
+
+static int mask_is(const struct overlay_mask *k, const char *path, size_t len) {
+    if (k->opaque) {
+        return (len == k->dlen) && (memcmp(path, k->dir, len) == 0);
+    }
+    size_t sep = (k->dlen > 0) ? 1U : 0;
+    return (len == k->dlen + sep + k->nlen) && (memcmp(path, k->dir, k->dlen) == 0) &&
+           ((sep == 0) || (path[k->dlen] == '/')) && (memcmp(&path[k->dlen + sep], k->name, k->nlen) == 0);
+}
+
+// Whether a whiteout of a layer from above up hides path, or what is
+// under path for an opaque one
+static int masked(const struct overlay_masks *wh, const char *path, size_t len, uint32_t h, uint32_t above, int opaque) {
+    if (wh->count == 0) {
+        return 0;
+    }
+    for (uint32_t s = h & wh->mask_slots; wh->slot[s] != 0; s = (s + 1U) & wh->mask_slots) {
+        const struct overlay_mask *k = &wh->mask[wh->slot[s] - 1U];
+        if ((k->hash == h) && (k->layer >= above) && (k->opaque == opaque) && mask_is(k, path, len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Record the whiteouts of layer l
+static void masks_add(struct overlay_masks *wh, const cpiofs_index_t *index, uint32_t l) {
+    for (uint32_t e = 0; e < index->count; e++) {
+        const char *path = &index->strings[index->name[e]];
+        size_t len = index->name_len[e];
+        size_t dlen;
+        const char *base = whiteout_name(path, len, &dlen);
+        if (base == NULL) {
+            continue;
+        }
+        struct overlay_mask *k = &wh->mask[wh->count];
+        size_t blen = len - (size_t)(base - path);
+        k->dir = path;
+        k->dlen = (uint32_t)dlen;
+        k->layer = l;
+        k->opaque = (blen == WHITEOUT_OPAQUE_LEN) && (memcmp(base, CPIOFS_WHITEOUT_OPAQUE, blen) == 0);
+        k->name = &base[WHITEOUT_PREFIX_LEN];
+        k->nlen = k->opaque ? 0 : (uint32_t)(blen - WHITEOUT_PREFIX_LEN);
+        if (!k->opaque && (k->nlen == 0)) {
+            continue;
+        }
+        k->hash = cpio_path_hash(path, dlen);
+        if (!k->opaque) {
+            if (dlen > 0) {
+                k->hash = hash_more(k->hash, "/", 1);
+            }
+            k->hash = hash_more(k->hash, k->name, k->nlen);
+        }
+        uint32_t s = k->hash & wh->mask_slots;
+        while (wh->slot[s] != 0) {
+            s = (s + 1U) & wh->mask_slots;
+        }
+        wh->slot[s] = ++ wh->count;
+    }
+}
+
+// First merged entry of path whose mode matches mask, from a layer from
+// above up
+static uint32_t overlay_probe(const struct cpiofs_overlay *ov, const char *path, size_t len, uint32_t h,
+                              uint16_t mask, uint32_t above) {
+    for (uint32_t s = h & ov->mask; ov->slot[s] != 0; s = (s + 1U) & ov->mask) {
+        uint32_t m = ov->slot[s] - 1U;
+        if ((ov->hash[m] == h) && (ov->name_len[m] == len) && ((ov->mode[m] & mask) != 0) &&
+            (ov->from[m] >= above) && (memcmp(ov->name[m], path, len) == 0)) {
+            return m;
+        }
+    }
+    return CPIO_INDEX_NONE;
+}
+
+// Whether the layers above l hide path: every prefix of the path is
+// checked against the whiteouts and the entries already merged
+static int overlay_hidden(const struct cpiofs_overlay *ov, const struct overlay_masks *wh, uint32_t l,
+                          const char *path, size_t len, uint32_t hash) {
+    if (overlay_probe(ov, path, len, hash, 0xffff, l + 1U) != CPIO_INDEX_NONE) {
+        return 1;
+    }
+    uint32_t h = cpio_path_hash(path, 0);
+    for (size_t i = 0; ; i++) {
+        if ((i == 0) || (i == len) || (path[i] == '/')) {
+            if ((i > 0) && masked(wh, path, i, h, l + 1U, 0)) {
+                return 1;
+            }
+            if ((i < len) && (masked(wh, path, i, h, l + 1U, 1) ||
+                              ((i > 0) && (overlay_probe(ov, path, i, h, CPIO_TYPE_MASK & ~CPIO_DIR_TYPE_MASK,
+                                                         l + 1U) != CPIO_INDEX_NONE)))) {
+                return 1;
+            }
+        }
+        if (i == len) {
+            return 0;
+        }
+        h = hash_more(h, &path[i], 1);
+    }
+}
+
+static void* carve(uint8_t **mem, size_t size) {
+    void *ret = *mem;
+    *mem += size;
+    return ret;
+}
+
+int cpiofs_mount_overlay(cpiofs_t *fs, cpiofs_t *const *layers, uint32_t nlayer) {
+    if ((fs == NULL) || (layers == NULL) || (nlayer == 0)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    size_t total = 0;
+    uint32_t nmask = 0;
+    for (uint32_t l = 0; l < nlayer; l++) {
+        if ((layers[l] == NULL) || !cpiofs_indexed(layers[l])) {
+            return (int)CPIO_ERR_PARAM;
+        }
+        const cpiofs_index_t *index = &layers[l]->index;
+        total += index->count;
+        for (uint32_t e = 0; e < index->count; e++) {
+            size_t dlen;
+            nmask += whiteout_name(&index->strings[index->name[e]], index->name_len[e], &dlen) != NULL;
+        }
+    }
+    if (total >= UINT32_MAX / 2U) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    uint32_t count = (uint32_t)total;
+    uint32_t nslot = 2;
+    while (nslot < 2U * count) {
+        nslot <<= 1;
+    }
+    uint32_t mask_slots = 2;
+    while (mask_slots < 2U * nmask) {
+        mask_slots <<= 1;
+    }
+
+    // the merged tables, widest types first, and the scratch ones
+    uint8_t *mem = malloc(sizeof(struct cpiofs_overlay) + (size_t)nlayer * sizeof(cpiofs_t*) +
+                          (size_t)count * (sizeof(const char*) + 4U * sizeof(uint32_t) + 2U * sizeof(uint16_t)) +
+                          ((size_t)count + 1U + nslot) * sizeof(uint32_t));
+    uint8_t *scratch = malloc((size_t)nmask * sizeof(struct overlay_mask) +
+                              ((size_t)mask_slots + count) * sizeof(uint32_t));
+    if ((mem == NULL) || (scratch == NULL)) {
+        free(mem);
+        free(scratch);
+        return (int)CPIO_ERR_NOMEM;
+    }
+    uint8_t *p = mem;
+    struct cpiofs_overlay *ov = carve(&p, sizeof(struct cpiofs_overlay));
+    ov->layer = carve(&p, nlayer * sizeof(cpiofs_t*));
+    ov->name = carve(&p, count * sizeof(const char*));
+    ov->hash = carve(&p, count * sizeof(uint32_t));
+    ov->from = carve(&p, count * sizeof(uint32_t));
+    ov->entry = carve(&p, count * sizeof(uint32_t));
+    ov->child = carve(&p, count * sizeof(uint32_t));
+    ov->child_first = carve(&p, (count + 1U) * sizeof(uint32_t));
+    ov->slot = carve(&p, nslot * sizeof(uint32_t));
+    ov->name_len = carve(&p, count * sizeof(uint16_t));
+    ov->mode = carve(&p, count * sizeof(uint16_t));
+    ov->nlayer = nlayer;
+    ov->mask = nslot - 1U;
+    memcpy(ov->layer, layers, nlayer * sizeof(cpiofs_t*));
+    memset(ov->slot, 0, nslot * sizeof(uint32_t));
+    memset(ov->child_first, 0, (count + 1U) * sizeof(uint32_t));
+
+    p = scratch;
+    struct overlay_masks wh = {
+        .mask = carve(&p, nmask * sizeof(struct overlay_mask)),
+        .slot = carve(&p, mask_slots * sizeof(uint32_t)),
+        .mask_slots = mask_slots - 1U,
+    };
+    uint32_t *parent = carve(&p, count * sizeof(uint32_t));
+    memset(wh.slot, 0, mask_slots * sizeof(uint32_t));
+
+    // from the highest layer down, archive order inside a layer so that
+    // the first entry of a duplicated path is found first, as in the
+    // layer itself
+    uint32_t m = 0;
+    for (uint32_t l = nlayer; l > 0; l--) {
+        const cpiofs_index_t *index = &layers[l - 1U]->index;
+        masks_add(&wh, index, l - 1U);
+        for (uint32_t e = 0; e < index->count; e++) {
+            const char *path = &index->strings[index->name[e]];
+            size_t len = index->name_len[e];
+            size_t dlen;
+            if ((whiteout_name(path, len, &dlen) != NULL) ||
+                overlay_hidden(ov, &wh, l - 1U, path, len, index->hash[e])) {
+                continue;
+            }
+            ov->name[m] = path;
+            ov->name_len[m] = (uint16_t)len;
+            ov->mode[m] = index->mode[e];
+            ov->hash[m] = index->hash[e];
+            ov->from[m] = l - 1U;
+            ov->entry[m] = e;
+            uint32_t s = ov->hash[m] & ov->mask;
+            while (ov->slot[s] != 0) {
+                s = (s + 1U) & ov->mask;
+            }
+            ov->slot[s] = ++ m;
+        }
+    }
+    ov->count = count = m;
+
+    // link and group the children like the index of an archive does
+    for (m = 0; m < count; m++) {
+        const char *path = ov->name[m];
+        size_t len = ov->name_len[m];
+        parent[m] = CPIO_INDEX_NONE;
+        if ((len > 0) && ((ov->mode[m] & CPIO_FILEDIR_TYPE) != 0)) {
+            size_t plen = len;
+            while ((plen > 0) && (path[plen - 1U] != '/')) {
+                plen --;
+            }
+            if (plen > 0) {
+                plen --;
+            }
+            uint32_t pm = overlay_probe(ov, path, plen, cpio_path_hash(path, plen), CPIO_DIR_TYPE_MASK, 0);
+            if ((pm != CPIO_INDEX_NONE) && (pm != m)) {
+                parent[m] = pm;
+                ov->child_first[pm + 1U] ++;
+            }
+        }
+    }
+    for (m = 0; m < count; m++) {
+        ov->child_first[m + 1U] += ov->child_first[m];
+    }
+    for (m = 0; m < count; m++) {
+        if (parent[m] != CPIO_INDEX_NONE) {
+            ov->child[ov->child_first[parent[m]] ++] = m;
+        }
+    }
+    for (m = count; m > 0; m--) {
+        ov->child_first[m] = ov->child_first[m - 1U];
+    }
+    ov->child_first[0] = 0;
+    free(scratch);
+
+    // the layers stay busy until the overlay is unmounted
+    memset(fs, 0, sizeof(*fs));
+    for (uint32_t l = 0; l < nlayer; l++) {
+        cpiofs_hold(layers[l]);
+    }
+    fs->overlay = ov;
+    return (int)CPIO_ERR_OK;
+}
+
+uint32_t cpiofs_overlay_lookup(const cpiofs_t *fs, const char *path, uint16_t mask) {
+    path = cpio_path_skip_root(path);
+    size_t len = strlen(path);
+    return overlay_probe(fs->overlay, path, len, cpio_path_hash(path, len), mask, 0);
+}
+
+void cpiofs_overlay_release(cpiofs_t *fs) {
+    struct cpiofs_overlay *ov = fs->overlay;
+    if (ov != NULL) {
+        for (uint32_t l = 0; l < ov->nlayer; l++) {
+            cpiofs_release(ov->layer[l]);
+        }
+        free(ov);
+        fs->overlay = NULL;
+    }
+}
@@ -0,0 +1,297 @@
+#ifndef _CPIO_PRIV_H_
+#define _CPIO_PRIV_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "cpiofs.h"
+
+// Library internals shared between the cpiofs translation units.
+
+#if !defined(CPIO_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CPIO_HEX_X86
+#endif
+
+// Benchmark counters, built in with CPIO_STATS only
+#ifdef CPIO_STATS
+extern unsigned long cpio_stat_headers;    // headers visited by scans and mounts
+#define CPIO_STAT_HEADER()  (cpio_stat_headers ++)
+#else
+#define CPIO_STAT_HEADER()
+#endif
+
+// Header formats, detected from the magic of every header
+enum cpio_format {
+    CPIO_FORMAT_NONE = 0,
+    CPIO_FORMAT_BIN,        // old binary, host byte order
+    CPIO_FORMAT_BIN_SWAP,   // old binary, swapped byte order
+    CPIO_FORMAT_ODC,        // portable ASCII, octal fields
+    CPIO_FORMAT_NEWC,       // new ASCII, hex fields
+    CPIO_FORMAT_CRC,        // new ASCII with data checksum
+};
+
+// A header decoded in host byte order
+struct cpio_entry {
+    uint8_t format;
+    uint32_t mode;
+    uint32_t mtime;
+    uint32_t namesize;      // with the terminating NUL
+    uint32_t filesize;
+    uint32_t check;
+    uint64_t dev;           // device and inode, which hard links share,
+    uint32_t ino;           // devices as major << 32 | minor
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t rdev;          // device of a device node
+    uint32_t name;          // name offset from the header
+    uint32_t data;          // data offset from the header
+    cpio_size_t next;       // next header offset from the header
+};
+
+// Largest header, the newc one
+#define CPIO_HEADER_MAX     110U
+
+// Longest name, with the NUL, accepted from a backing store
+#define CPIO_NAME_MAX       4096U
+
+// Header format at d, CPIO_FORMAT_NONE if the magic is unknown
+int cpio_format(const void *d, unsigned long dsize);
+
+// Decode the header at d
+//
+// Returns 1 if the header, the name and the data fit in dsize bytes,
+// 0 otherwise.
+int cpio_decode(const struct header_old_cpio* d, unsigned long dsize, struct cpio_entry *ent);
+
+int cpio_is_trailer(const struct header_old_cpio* d, const struct cpio_entry *ent);
+
+// Whether the entry holds a saved index, which is left out of the index
+int cpiofs_is_index_entry(const struct header_old_cpio* d, const struct cpio_entry *ent);
+
+// Decode n consecutive 8 digits hex fields
+//
+// cpio_hex_decode picks the widest kernel the CPU runs. The kernels
+// are exported for the benchmarks.
+// Returns 0 if a field holds something that is not a hex digit.
+int cpio_hex_decode(const char *s, uint32_t *out, unsigned int n);
+int cpio_hex_decode_scalar(const char *s, uint32_t *out, unsigned int n);
+#ifdef CPIO_HEX_X86
+int cpio_hex_decode_sse2(const char *s, uint32_t *out, unsigned int n);
+int cpio_hex_decode_avx2(const char *s, uint32_t *out, unsigned int n);
+#endif
+
+// Byte sum of n bytes, the data checksum of the crc format
+//
+// Like the hex decoders, cpio_sum picks the widest kernel the CPU runs
+// and the kernels are exported for the benchmarks.
+uint32_t cpio_sum(const uint8_t *p, size_t n);
+uint32_t cpio_sum_scalar(const uint8_t *p, size_t n);
+#ifdef CPIO_HEX_X86
+uint32_t cpio_sum_sse2(const uint8_t *p, size_t n);
+uint32_t cpio_sum_avx2(const uint8_t *p, size_t n);
+#endif
+
+// Skip the "./" or "/" that archivers put in front of a path
+const char* cpio_path_skip_root(const char *path);
+
+// Name of an entry without the root prefix and the terminating NUL
+const char* cpio_entry_path(const struct header_old_cpio* d, size_t *len);
+const char* cpio_name_path(const char *filename, size_t filename_size, size_t *len);
+
+#define CPIO_INDEX_NONE     UINT32_MAX
+
+// Build the path index of the image of fs into index
+//
+// The headers of an in-memory image are found by nthread threads, 0 for
+// one per core, see cpiofs_chain. On success index->mem is to be
+// released with free().
+// Returns a negative error code on failure.
+int cpiofs_index_build(const cpiofs_t *fs, unsigned int nthread, cpiofs_index_t *index);
+
+// Header chain of an in-memory image, found by nthread threads
+//
+// *chain gets the offsets of the *count headers before the trailer, the
+// same as a walk of the chain finds, then the offset where the chain
+// stops; it is to be released with free(). Backing store mounts are not
+// supported.
+// Returns a negative error code on failure.
+int cpiofs_chain(const cpiofs_t *fs, unsigned int nthread, cpio_off_t **chain, uint32_t *count);
+
+// Lookup a path in the mount index
+//
+// Returns the number of the first entry matching path whose mode
+// matches mask, CPIO_INDEX_NONE if there is none.
+uint32_t cpiofs_index_lookup(const cpiofs_t *fs, const char *path, uint16_t mask);
+
+// FNV-1a, good enough for paths and cheap on small cores
+static inline uint32_t cpio_path_hash(const char *path, size_t len) {
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)path[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+// Second path hash, for the perfect hash: two paths with the same
+// cpio_path_hash seldom share this one too. It takes 8 bytes a step,
+// little endian whatever the host, so that cpioembed can hash on the
+// build machine for another target.
+static inline uint32_t cpio_path_hash2(const char *path, size_t len) {
+    const uint8_t *p = (const uint8_t*)path;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+    size_t i = 0;
+    for (; i + 8U <= len; i += 8U) {
+        uint64_t w = (uint64_t)p[i] | ((uint64_t)p[i + 1U] << 8) | ((uint64_t)p[i + 2U] << 16) |
+                     ((uint64_t)p[i + 3U] << 24) | ((uint64_t)p[i + 4U] << 32) | ((uint64_t)p[i + 5U] << 40) |
+                     ((uint64_t)p[i + 6U] << 48) | ((uint64_t)p[i + 7U] << 56);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    uint64_t w = 0;
+    for (unsigned int k = 0; i + k < len; k++) {
+        w |= (uint64_t)p[i + k] << (8U * k);
+    }
+    h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Bucket of the perfect hash, from cpio_path_hash
+static inline uint32_t cpio_phf_bucket(uint32_t h, uint32_t nbucket) {
+    return (uint32_t)(((uint64_t)h * nbucket) >> 32);
+}
+
+// Slot of the perfect hash, from cpio_path_hash2 and the pilot of the bucket
+static inline uint32_t cpio_phf_slot(uint32_t h2, uint32_t pilot, uint32_t nslot) {
+    uint32_t x = h2 ^ (pilot * 0x9e3779b9U);
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return (uint32_t)(((uint64_t)x * nslot) >> 32);
+}
+
+// Minimal perfect hash of the distinct paths of an index
+//
+// *pilot gets the *nbucket pilots followed by the *nphf slots, to be
+// released with free(). Two paths that share both hashes cannot be told
+// apart, which gives CPIO_ERR_NOTSUP: the slots of the index still work.
+// Returns a negative error code on failure.
+int cpiofs_index_phf(const cpiofs_index_t *index, uint32_t **pilot, uint32_t *nbucket, uint32_t *nphf);
+
+// Fill info for entry e of the index
+void cpiofs_index_info(const cpiofs_t *fs, uint32_t e, cpio_info_t *info);
+
+// Compare the paths of entries a and b bytewise, like strcmp
+int cpiofs_index_order(const cpiofs_index_t *index, uint32_t a, uint32_t b);
+
+// Probe the hash table for the path of hash h, with len bytes and
+// no root prefix
+uint32_t cpiofs_index_probe(const cpiofs_index_t *index, const char *path, size_t len, uint32_t h, uint16_t mask);
+
+// Count of open files and directories, updated from any thread: the
+// unmount that sees 0 has to see every close before it
+static inline void cpiofs_hold(cpiofs_t *fs) {
+#ifdef CPIO_HAVE_ATOMICS
+    atomic_fetch_add_explicit(&fs->resource_count, 1U, memory_order_relaxed);
+#else
+    fs->resource_count ++;
+#endif
+}
+
+static inline void cpiofs_release(cpiofs_t *fs) {
+#ifdef CPIO_HAVE_ATOMICS
+    atomic_fetch_sub_explicit(&fs->resource_count, 1U, memory_order_release);
+#else
+    fs->resource_count --;
+#endif
+}
+
+static inline unsigned int cpiofs_resources(const cpiofs_t *fs) {
+#ifdef CPIO_HAVE_ATOMICS
+    return atomic_load_explicit(&fs->resource_count, memory_order_acquire);
+#else
+    return fs->resource_count;
+#endif
+}
+
+static inline int cpiofs_indexed(const cpiofs_t *fs) {
+    return fs->index.slot != NULL;
+}
+
+// Backing store
+
+// Allocate the store and its block cache, and attach them to fs
+int cpiofs_store_open(cpiofs_t *fs, cpiofs_read_t read, void *ctx, cpio_size_t block_size, uint32_t nblock);
+
+// Release the store and its block cache, if any
+void cpiofs_store_close(cpiofs_t *fs);
+
+// Read size bytes at off through the block cache
+//
+// Returns size, or a negative error code on failure.
+cpio_ssize_t cpiofs_store_read(const cpiofs_t *fs, cpio_off_t off, void *buffer, cpio_size_t size);
+
+// Bytes of the buffer that a header and its name are read into
+#define CPIO_ENTRY_BUFFER   (CPIO_HEADER_MAX + CPIO_NAME_MAX)
+
+// Read and decode the header at off together with its name
+//
+// The header is read into buf, CPIO_ENTRY_BUFFER bytes of the caller,
+// so that any number of threads can read headers of the same store.
+// Returns NULL if the header is not valid or the store fails.
+const struct header_old_cpio* cpiofs_store_header(const cpiofs_t *fs, cpio_off_t off, struct cpio_entry *ent,
+                                                  uint8_t *buf);
+
+// Header at off together with its name, straight from the image or
+// copied from the backing store into buf, as for cpiofs_store_header;
+// buf can be NULL for an image in memory
+//
+// Returns NULL if the header is not valid or the store fails.
+const struct header_old_cpio* cpiofs_header_at(const cpiofs_t *fs, cpio_off_t off, struct cpio_entry *ent,
+                                               uint8_t *buf);
+
+// Release the mapping of cpiofs_mount_path/fd, if any
+void cpiofs_map_release(cpiofs_t *fs);
+
+// Release the chunk table of cpiofs_mount_compressed, if any
+void cpiofs_zchunk_release(cpiofs_t *fs);
+
+// Overlay mounts
+
+// Merged index of cpiofs_mount_overlay
+//
+// Entry m is entry entry[m] of layer[from[m]]; the path, mode and hash
+// are copied here so that a probe stays in these tables.
+struct cpiofs_overlay {
+    cpiofs_t **layer;           // the layers, the lowest first
+    uint32_t nlayer;
+    uint32_t count;             // merged entries
+    uint32_t mask;              // number of hash slots - 1
+    const char **name;          // path, without root prefix
+    uint16_t *name_len;
+    uint16_t *mode;
+    uint32_t *hash;
+    uint32_t *from;             // layer of the entry
+    uint32_t *entry;            // entry number in its layer
+    uint32_t *slot;             // hash slots: entry number + 1, 0 if free
+    uint32_t *child_first;      // children of m are child[child_first[m]..child_first[m+1]-1]
+    uint32_t *child;
+};
+
+// Lookup a path in the merged index
+//
+// Returns the number of the first merged entry matching path whose mode
+// matches mask, CPIO_INDEX_NONE if there is none.
+uint32_t cpiofs_overlay_lookup(const cpiofs_t *fs, const char *path, uint16_t mask);
+
+// Release the merged index and the layers, if any
+void cpiofs_overlay_release(cpiofs_t *fs);
+
+static inline const struct header_old_cpio* cpiofs_index_head(const cpiofs_t *fs, uint32_t e) {
+    return (const struct header_old_cpio*)((const uint8_t*)fs->head + fs->index.entry[e]);
+}
+
+#endif
@@ -0,0 +1,209 @@
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#define CPIO_HAVE_SPLICE
+#elif defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// File data to a descriptor without a copy in user space
+//
+// A mount that kept its file sends with sendfile from the data offset
+// in the archive. An image in memory goes to a pipe with vmsplice, the
+// pages being lent to the pipe, and from there with splice to anything
+// else; the pipe is the output itself when it is one. What is left, a
+// backing store or another system, is read and written through a small
+// buffer, and so are the sends too short to pay for the system calls:
+// a single write of SEND_BUFFER bytes beats sendfile, and a private pipe
+// costs a few microseconds to set up.
+
+#define SEND_CHUNK          (64U * 1024U)   // a pipe holds 64 KiB by default
+#define SEND_BUFFER         (16U * 1024U)
+#define SEND_SPLICE_MIN     (64U * 1024U)   // shortest send through a private pipe
+#define SEND_MAX            (1U << 30)      // per sendfile call, Linux stops short of 2 GiB anyway
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// Error of a send that moved nothing, from err, the errno taken right
+// after the call that failed or 0 if it set none
+static cpio_ssize_t send_error(int err) {
+    return ((err == EAGAIN) || (err == EWOULDBLOCK)) ? (cpio_ssize_t)CPIO_ERR_BUSY : (cpio_ssize_t)CPIO_ERR_IO;
+}
+
+static cpio_ssize_t send_copy(const cpio_file_t *file, int out_fd, cpio_size_t count) {
+    uint8_t buffer[SEND_BUFFER];
+    cpio_size_t done = 0;
+    while (done < count) {
+        cpio_size_t n = (count - done < SEND_BUFFER) ? count - done : SEND_BUFFER;
+        cpio_ssize_t got = cpiofs_file_pread(file, buffer, n, file->pos + done);
+        if (got <= 0) {
+            return (done > 0) ? (cpio_ssize_t)done : got;
+        }
+        cpio_size_t put = 0;
+        while (put < (cpio_size_t)got) {
+            ssize_t w = write(out_fd, &buffer[put], (size_t)((cpio_size_t)got - put));
+            if ((w < 0) && (errno == EINTR)) {
+                continue;
+            }
+            if (w <= 0) {
+                // what reached out_fd counts, the rest of the buffer is dropped
+                int err = (w < 0) ? errno : 0;
+                done += put;
+                return (done > 0) ? (cpio_ssize_t)done : send_error(err);
+            }
+            put += (cpio_size_t)w;
+        }
+        done += put;
+    }
+    return (cpio_ssize_t)done;
+}
+
+#ifdef CPIO_HAVE_SPLICE
+
+static cpio_ssize_t send_file(const cpio_file_t *file, int in_fd, int out_fd, cpio_size_t count) {
+    off_t off = (off_t)(file->data + file->pos);
+    cpio_size_t done = 0;
+    while (done < count) {
+        size_t n = (count - done < SEND_MAX) ? (size_t)(count - done) : SEND_MAX;
+        ssize_t w = sendfile(out_fd, in_fd, &off, n);
+        if ((w < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (w <= 0) {
+            int err = (w < 0) ? errno : 0;
+            return (done > 0) ? (cpio_ssize_t)done : (w == 0) ? 0 : send_error(err);
+        }
+        done += (cpio_size_t)w;
+    }
+    return (cpio_ssize_t)done;
+}
+
+// Lend the pages of [p, p + n) to the pipe, returns what it took
+static ssize_t send_lend(int pipe_fd, const uint8_t *p, size_t n) {
+    struct iovec iov = { .iov_base = (void*)p, .iov_len = n };
+    ssize_t w;
+    do {
+        w = vmsplice(pipe_fd, &iov, 1, 0);
+    } while ((w < 0) && (errno == EINTR));
+    return w;
+}
+
+// Move n bytes from a pipe to out_fd, returns what moved; err gets the
+// errno of a failed splice
+static cpio_size_t send_drain(int pipe_fd, int out_fd, size_t n, int *err) {
+    size_t done = 0;
+    *err = 0;
+    while (done < n) {
+        ssize_t w = splice(pipe_fd, NULL, out_fd, NULL, n - done, SPLICE_F_MOVE);
+        if ((w < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (w <= 0) {
+            *err = (w < 0) ? errno : 0;
+            break;
+        }
+        done += (size_t)w;
+    }
+    return done;
+}
+
+static cpio_ssize_t send_map(const cpio_file_t *file, int out_fd, cpio_size_t count) {
+    const uint8_t *p = (const uint8_t*)file->fs->head + file->data + file->pos;
+    struct stat st;
+    int fds[2] = { -1, -1 };
+    int pipe_out = (fstat(out_fd, &st) == 0) && S_ISFIFO(st.st_mode);
+    if (!pipe_out && ((count < SEND_SPLICE_MIN) || (pipe(fds) != 0))) {
+        return send_copy(file, out_fd, count);
+    }
+    cpio_size_t done = 0;
+    cpio_ssize_t ret = 0;
+    while (done < count) {
+        size_t n = (count - done < SEND_CHUNK) ? (size_t)(count - done) : SEND_CHUNK;
+        ssize_t w = send_lend(pipe_out ? out_fd : fds[1], &p[done], n);
+        if (w <= 0) {
+            ret = (w < 0) ? send_error(errno) : 0;
+            break;
+        }
+        if (!pipe_out) {
+            // bytes left in the private pipe are dropped with it, only
+            // what reached out_fd counts
+            int err;
+            cpio_size_t moved = send_drain(fds[0], out_fd, (size_t)w, &err);
+            done += moved;
+            if (moved < (cpio_size_t)w) {
+                ret = send_error(err);
+                break;
+            }
+        } else {
+            done += (cpio_size_t)w;
+        }
+    }
+    if (!pipe_out) {
+        close(fds[0]);
+        close(fds[1]);
+    }
+    return (done > 0) ? (cpio_ssize_t)done : ret;
+}
+
+#endif
+
+cpio_ssize_t cpiofs_file_sendfile(cpio_file_t *file, int out_fd, cpio_size_t count) {
+    if ((file == NULL) || (out_fd < 0)) {
+        return (cpio_ssize_t)CPIO_ERR_PARAM;
+    }
+    if (file->fs == NULL) {
+        return (cpio_ssize_t)CPIO_ERR_NEXIST;
+    }
+    if (file->pos > file->size) {
+        return (cpio_ssize_t)CPIO_ERR_UNKNOWN;
+    }
+    if (count > file->size - file->pos) {
+        count = file->size - file->pos;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    const cpiofs_t *fs = file->fs;
+    cpio_ssize_t ret;
+#ifdef CPIO_HAVE_SPLICE
+    if ((fs->map_fd > 0) && (count > SEND_BUFFER)) {
+        ret = send_file(file, fs->map_fd - 1, out_fd, count);
+    } else if ((fs->store == NULL) && (count > SEND_BUFFER)) {
+        ret = send_map(file, out_fd, count);
+    } else {
+        ret = send_copy(file, out_fd, count);
+    }
+#else
+    (void)fs;
+    ret = send_copy(file, out_fd, count);
+#endif
+    if (ret > 0) {
+        file->pos += (cpio_off_t)ret;
+    }
+    return ret;
+}
+
+#else
+
+cpio_ssize_t cpiofs_file_sendfile(cpio_file_t *file, int out_fd, cpio_size_t count) {
+    (void)file;
+    (void)out_fd;
+    (void)count;
+    return (cpio_ssize_t)CPIO_ERR_NOTSUP;
+}
+
+#endif
@@ -0,0 +1,239 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#define CPIO_HAVE_PREAD
+#define CPIO_HAVE_PTHREAD
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Backing store: the archive is read on demand through a callback and
+// the blocks are kept in a small fully associative LRU cache. The cache
+// is meant to hold tens to a few hundreds of blocks, a lookup is a
+// linear scan of the tags. One lock covers the cache and the read
+// callback, which does not have to be thread safe.
+
+struct cpiofs_store {
+    cpiofs_read_t read;
+    void *ctx;
+    cpio_size_t block_size;
+    uint32_t nblock;
+    uint64_t clock;         // use counter, stamps the blocks for the LRU; 64 bits do not wrap
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t *used;         // last use of each way, 0 if the way is free
+    cpio_off_t *tag;        // archive offset of the block in each way
+    uint8_t *data;          // nblock * block_size bytes
+#ifdef CPIO_HAVE_PTHREAD
+    pthread_mutex_t lock;
+#endif
+};
+
+static inline void store_lock(struct cpiofs_store *store) {
+#ifdef CPIO_HAVE_PTHREAD
+    pthread_mutex_lock(&store->lock);
+#else
+    (void)store;
+#endif
+}
+
+static inline void store_unlock(struct cpiofs_store *store) {
+#ifdef CPIO_HAVE_PTHREAD
+    pthread_mutex_unlock(&store->lock);
+#else
+    (void)store;
+#endif
+}
+
+int cpiofs_store_open(cpiofs_t *fs, cpiofs_read_t read, void *ctx, cpio_size_t block_size, uint32_t nblock) {
+    if ((read == NULL) || (nblock == 0) || (block_size < 64U) || ((block_size & (block_size - 1U)) != 0)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    size_t memsize = sizeof(struct cpiofs_store) +
+                     nblock * (sizeof(uint64_t) + sizeof(cpio_off_t) + (size_t)block_size);
+    uint8_t *mem = malloc(memsize);
+    if (mem == NULL) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    struct cpiofs_store *store = (struct cpiofs_store*)mem;
+    mem += sizeof(struct cpiofs_store);
+    store->read = read;
+    store->ctx = ctx;
+    store->block_size = block_size;
+    store->nblock = nblock;
+    store->clock = 0;
+    store->hits = 0;
+    store->misses = 0;
+    // the widest first, every array stays aligned
+    store->used = (uint64_t*)mem;
+    store->tag = (cpio_off_t*)&store->used[nblock];
+    store->data = (uint8_t*)&store->tag[nblock];
+    memset(store->used, 0, nblock * sizeof(uint64_t));
+#ifdef CPIO_HAVE_PTHREAD
+    if (pthread_mutex_init(&store->lock, NULL) != 0) {
+        free(store);
+        return (int)CPIO_ERR_NOMEM;
+    }
+#endif
+    fs->store = store;
+    return (int)CPIO_ERR_OK;
+}
+
+// Cached copy of the block starting at boff, NULL if the store fails
+static const uint8_t* store_block(const cpiofs_t *fs, cpio_off_t boff) {
+    struct cpiofs_store *store = fs->store;
+    uint32_t victim = 0;
+    store->clock ++;
+    for (uint32_t w = 0; w < store->nblock; w++) {
+        if ((store->used[w] != 0) && (store->tag[w] == boff)) {
+            store->used[w] = store->clock;
+            store->hits ++;
+            return &store->data[(size_t)w * store->block_size];
+        }
+        if (store->used[w] < store->used[victim]) {
+            victim = w;
+        }
+    }
+    store->misses ++;
+    uint8_t *block = &store->data[(size_t)victim * store->block_size];
+    cpio_size_t len = store->block_size;
+    if (len > fs->size - boff) {
+        len = fs->size - boff;
+    }
+    if (store->read(store->ctx, boff, block, len) != (cpio_ssize_t)len) {
+        store->used[victim] = 0;
+        return NULL;
+    }
+    store->tag[victim] = boff;
+    store->used[victim] = store->clock;
+    return block;
+}
+
+static cpio_ssize_t store_read(const cpiofs_t *fs, cpio_off_t off, void *buffer, cpio_size_t size) {
+    struct cpiofs_store *store = fs->store;
+    uint8_t *dst = (uint8_t*)buffer;
+    cpio_size_t mask = store->block_size - 1U;
+    cpio_size_t done = 0;
+    if ((off > fs->size) || (size > fs->size - off)) {
+        return CPIO_ERR_PARAM;
+    }
+    while (done < size) {
+        cpio_off_t pos = off + done;
+        cpio_size_t left = size - done;
+        if (((pos & mask) == 0) && (left >= store->block_size)) {
+            // whole blocks go straight to the caller, streaming a big
+            // file must not flush the headers out of the cache
+            cpio_size_t n = left & ~mask;
+            if (store->read(store->ctx, pos, &dst[done], n) != (cpio_ssize_t)n) {
+                return CPIO_ERR_IO;
+            }
+            done += n;
+            continue;
+        }
+        const uint8_t *block = store_block(fs, pos & ~mask);
+        if (block == NULL) {
+            return CPIO_ERR_IO;
+        }
+        cpio_size_t n = store->block_size - (pos & mask);
+        if (n > left) {
+            n = left;
+        }
+        memcpy(&dst[done], &block[pos & mask], n);
+        done += n;
+    }
+    return (cpio_ssize_t)done;
+}
+
+cpio_ssize_t cpiofs_store_read(const cpiofs_t *fs, cpio_off_t off, void *buffer, cpio_size_t size) {
+    store_lock(fs->store);
+    cpio_ssize_t ret = store_read(fs, off, buffer, size);
+    store_unlock(fs->store);
+    return ret;
+}
+
+const struct header_old_cpio* cpiofs_store_header(const cpiofs_t *fs, cpio_off_t off, struct cpio_entry *ent,
+                                                  uint8_t *buf) {
+    cpio_size_t avail = fs->size - off;
+    cpio_size_t hsize = avail < CPIO_HEADER_MAX ? avail : CPIO_HEADER_MAX;
+    const struct header_old_cpio* d = (const struct header_old_cpio*)buf;
+    if ((hsize == 0) || (cpiofs_store_read(fs, off, buf, hsize) != (cpio_ssize_t)hsize)) {
+        return NULL;
+    }
+    // only the header is in the buffer, but cpio_decode reads
+    // nothing past it and checks the sizes against the whole archive,
+    // as much of it as an unsigned long holds
+#if defined(CPIO_LARGEFILE) && (ULONG_MAX < UINT64_MAX)
+    unsigned long limit = (avail > ULONG_MAX) ? ULONG_MAX : (unsigned long)avail;
+#else
+    unsigned long limit = avail;
+#endif
+    if (!cpio_decode(d, limit, ent) || (ent->namesize > CPIO_NAME_MAX)) {
+        return NULL;
+    }
+    if (cpiofs_store_read(fs, off + ent->name, &buf[ent->name], ent->namesize) != (cpio_ssize_t)ent->namesize) {
+        return NULL;
+    }
+    return d;
+}
+
+void cpiofs_store_close(cpiofs_t *fs) {
+    if (fs->store != NULL) {
+#ifdef CPIO_HAVE_PTHREAD
+        pthread_mutex_destroy(&fs->store->lock);
+#endif
+        free(fs->store);
+        fs->store = NULL;
+    }
+}
+
+int cpiofs_cache_stats(const cpiofs_t *fs, cpiofs_cache_stats_t *stats) {
+    if ((fs == NULL) || (stats == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fs->store == NULL) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    store_lock(fs->store);
+    stats->hits = fs->store->hits;
+    stats->misses = fs->store->misses;
+    store_unlock(fs->store);
+    stats->blocks = fs->store->nblock;
+    stats->block_size = fs->store->block_size;
+    return (int)CPIO_ERR_OK;
+}
+
+cpio_ssize_t cpiofs_read_fd(void *ctx, cpio_off_t off, void *buffer, cpio_size_t size) {
+#ifdef CPIO_HAVE_PREAD
+    int fd = *(const int*)ctx;
+    cpio_size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, (uint8_t*)buffer + done, size - done, (off_t)off + done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return CPIO_ERR_IO;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (cpio_size_t)n;
+    }
+    return (cpio_ssize_t)done;
+#else
+    (void)ctx;
+    (void)off;
+    (void)buffer;
+    (void)size;
+    return CPIO_ERR_NOTSUP;
+#endif
+}
@@ -0,0 +1,222 @@
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Streamed archives
+//
+// The parser moves through the same steps for every entry: the magic,
+// the rest of the header, the name with its padding, then the data and
+// its padding. The first three are gathered in buf, whatever the chunks
+// they come in; the data goes to the callback straight from the chunk,
+// a slice per chunk, and the padding is only counted.
+
+#define STREAM_MAGIC_SIZE   6U      // enough to tell every format apart
+
+enum stream_state {
+    STREAM_MAGIC,       // gathering the magic
+    STREAM_HEADER,      // gathering the header
+    STREAM_NAME,        // gathering the name and its padding
+    STREAM_DATA,        // passing the data on
+    STREAM_PAD,         // skipping the padding of the data
+    STREAM_END,         // past the trailer
+};
+
+struct cpiofs_stream {
+    cpiofs_stream_entry_t entry;
+    cpiofs_stream_data_t data;
+    void *ctx;
+    unsigned int state;
+    uint32_t have;          // bytes gathered in buf
+    uint32_t need;          // bytes to gather before the next step
+    cpio_size_t left;       // bytes of data or padding still to come
+    cpio_off_t off;         // offset in the file of the next data byte
+    uint32_t sum;           // byte sum of the data so far
+    int skip;               // the data of the entry is not wanted
+    int error;              // first error, every later call returns it
+    struct cpio_entry ent;
+    uint8_t buf[CPIO_HEADER_MAX + CPIO_NAME_MAX + 4U];
+};
+
+int cpiofs_stream_open(cpiofs_stream_t **stream, cpiofs_stream_entry_t entry, cpiofs_stream_data_t data, void *ctx) {
+    if ((stream == NULL) || (entry == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    cpiofs_stream_t *s = calloc(1, sizeof(cpiofs_stream_t));
+    if (s == NULL) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    s->entry = entry;
+    s->data = data;
+    s->ctx = ctx;
+    s->state = STREAM_MAGIC;
+    s->need = STREAM_MAGIC_SIZE;
+    *stream = s;
+    return (int)CPIO_ERR_OK;
+}
+
+static void stream_next_entry(cpiofs_stream_t *s) {
+    s->state = STREAM_MAGIC;
+    s->have = 0;
+    s->need = STREAM_MAGIC_SIZE;
+}
+
+// Past the data of the entry, on to its padding
+static void stream_data_end(cpiofs_stream_t *s) {
+    if ((s->ent.format == CPIO_FORMAT_CRC) && (s->sum != s->ent.check)) {
+        s->error = (int)CPIO_ERR_CORRUPT;
+        return;
+    }
+    s->left = s->ent.next - s->ent.data - s->ent.filesize;
+    s->state = STREAM_PAD;
+    if (s->left == 0) {
+        stream_next_entry(s);
+    }
+}
+
+// Report the entry whose header and name are in buf
+static void stream_entry(cpiofs_stream_t *s) {
+    const struct header_old_cpio *d = (const struct header_old_cpio*)s->buf;
+    if (cpio_is_trailer(d, &s->ent)) {
+        s->state = STREAM_END;
+        return;
+    }
+    s->skip = cpiofs_is_index_entry(d, &s->ent) || (s->data == NULL);
+    if (!cpiofs_is_index_entry(d, &s->ent)) {
+        const char *filepath = (const char*)&s->buf[s->ent.name];
+        size_t len;
+        const char *path = cpio_name_path(filepath, s->ent.namesize, &len);
+        cpio_info_t info = {
+            .type = (uint16_t)(s->ent.mode & CPIO_TYPE_MASK),
+            .mode = (uint16_t)(s->ent.mode & CPIO_MODE_MASK),
+            .size = s->ent.filesize,
+            .filepath = filepath,
+            .filepaths = (uint16_t)((size_t)(path - filepath) + len + 1U),
+        };
+        while ((info.filenames < len) && (path[len - info.filenames - 1U] != '/')) {
+            info.filenames ++;
+        }
+        info.filename = &path[len - info.filenames];
+        int ret = s->entry(&info, s->ctx);
+        if (ret < 0) {
+            s->error = ret;
+            return;
+        }
+        s->skip |= (ret == CPIOFS_STREAM_SKIP);
+    }
+    s->left = s->ent.filesize;
+    s->off = 0;
+    s->sum = 0;
+    s->state = STREAM_DATA;
+    if (s->left == 0) {
+        stream_data_end(s);
+    }
+}
+
+// buf holds the need bytes of the current step
+static void stream_gathered(cpiofs_stream_t *s) {
+    switch (s->state) {
+        case STREAM_MAGIC:
+            switch (cpio_format(s->buf, s->have)) {
+                case CPIO_FORMAT_BIN:
+                case CPIO_FORMAT_BIN_SWAP:
+                    s->need = 26U;
+                    break;
+                case CPIO_FORMAT_ODC:
+                    s->need = 76U;
+                    break;
+                case CPIO_FORMAT_NEWC:
+                case CPIO_FORMAT_CRC:
+                    s->need = 110U;
+                    break;
+                default:
+                    s->error = (int)CPIO_ERR_CORRUPT;
+                    return;
+            }
+            s->state = STREAM_HEADER;
+            break;
+        case STREAM_HEADER:
+            // only the header is there, but cpio_decode reads nothing
+            // past it, and the size of a stream is not known
+            if (!cpio_decode((const struct header_old_cpio*)s->buf, ULONG_MAX, &s->ent) ||
+                (s->ent.namesize > CPIO_NAME_MAX) || (s->ent.data > sizeof(s->buf))) {
+                s->error = (int)CPIO_ERR_CORRUPT;
+                return;
+            }
+            s->need = s->ent.data;
+            s->state = STREAM_NAME;
+            break;
+        case STREAM_NAME:
+            stream_entry(s);
+            break;
+        default:
+            break;
+    }
+}
+
+int cpiofs_stream_feed(cpiofs_stream_t *s, const void *chunk, cpio_size_t size) {
+    if ((s == NULL) || ((chunk == NULL) && (size > 0))) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    const uint8_t *p = (const uint8_t*)chunk;
+    while ((size > 0) && (s->error == CPIO_ERR_OK) && (s->state != STREAM_END)) {
+        cpio_size_t n;
+        switch (s->state) {
+            case STREAM_DATA:
+                n = (size < s->left) ? size : s->left;
+                if (s->ent.format == CPIO_FORMAT_CRC) {
+                    s->sum += cpio_sum(p, n);
+                }
+                if (!s->skip) {
+                    int ret = s->data(p, n, s->off, s->ctx);
+                    if (ret < 0) {
+                        s->error = ret;
+                        break;
+                    }
+                }
+                s->off += n;
+                s->left -= n;
+                if (s->left == 0) {
+                    stream_data_end(s);
+                }
+                break;
+            case STREAM_PAD:
+                n = (size < s->left) ? size : s->left;
+                s->left -= n;
+                if (s->left == 0) {
+                    stream_next_entry(s);
+                }
+                break;
+            default:
+                n = s->need - s->have;
+                if (size < n) {
+                    n = size;
+                }
+                memcpy(&s->buf[s->have], p, n);
+                s->have += (uint32_t)n;
+                if (s->have == s->need) {
+                    stream_gathered(s);
+                }
+                break;
+        }
+        p += n;
+        size -= n;
+    }
+    return s->error;
+}
+
+int cpiofs_stream_close(cpiofs_stream_t *s) {
+    if (s == NULL) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    int ret = s->error;
+    if ((ret == CPIO_ERR_OK) && (s->state != STREAM_END)) {
+        ret = (int)CPIO_ERR_CORRUPT;
+    }
+    free(s);
+    return ret;
+}
@@ -0,0 +1,320 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#include <unistd.h>
+#include <pthread.h>
+#define CPIO_HAVE_PTHREAD
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Integrity check of a whole archive
+//
+// The header chain is decoded by the calling thread in one pass, which
+// is cheap; the data checksums are what costs. The data of the crc
+// entries is cut in pieces of at most VERIFY_PIECE bytes that the
+// threads take in turn, so a big file is shared out like many small
+// ones: the byte sum of the crc format adds up piece by piece.
+
+#ifdef CPIO_HEX_X86
+#include <immintrin.h>
+#endif
+
+#define VERIFY_PIECE        (256U * 1024U)
+#define VERIFY_THREADS      64U
+
+#if defined(CPIO_HAVE_PTHREAD) && defined(CPIO_HAVE_ATOMICS)
+#define CPIO_VERIFY_THREADS
+#endif
+
+uint32_t cpio_sum_scalar(const uint8_t *p, size_t n) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+#ifdef CPIO_HEX_X86
+
+// psadbw against zero adds 8 bytes into a 64 bits lane, 32 bytes per step
+__attribute__((target("sse2")))
+uint32_t cpio_sum_sse2(const uint8_t *p, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+    size_t i = 0;
+    for (; i + 32U <= n; i += 32U) {
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)&p[i]), zero));
+        acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)&p[i + 16U]), zero));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(acc0, acc1));
+    return (uint32_t)(lanes[0] + lanes[1]) + cpio_sum_scalar(&p[i], n - i);
+}
+
+// 64 bytes per step
+__attribute__((target("avx2")))
+uint32_t cpio_sum_avx2(const uint8_t *p, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero;
+    __m256i acc1 = zero;
+    size_t i = 0;
+    for (; i + 64U <= n; i += 64U) {
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)&p[i]), zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)&p[i + 32U]), zero));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(acc0, acc1));
+    return (uint32_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) + cpio_sum_sse2(&p[i], n - i);
+}
+
+typedef uint32_t (*sum_t)(const uint8_t *p, size_t n);
+
+static sum_t sum_kernel(void) {
+    if (__builtin_cpu_supports("avx2")) {
+        return cpio_sum_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return cpio_sum_sse2;
+    }
+    return cpio_sum_scalar;
+}
+
+uint32_t cpio_sum(const uint8_t *p, size_t n) {
+    return sum_kernel()(p, n);
+}
+
+#else
+
+typedef uint32_t (*sum_t)(const uint8_t *p, size_t n);
+
+static sum_t sum_kernel(void) {
+    return cpio_sum_scalar;
+}
+
+uint32_t cpio_sum(const uint8_t *p, size_t n) {
+    return cpio_sum_scalar(p, n);
+}
+
+#endif
+
+// A crc entry to check
+struct verify_file {
+    cpio_off_t head;        // header offset, reported if the sum is wrong
+    cpio_off_t data;        // data offset in the archive
+    cpio_size_t size;
+    uint32_t check;
+    uint32_t first;         // first of its pieces
+};
+
+struct verify_piece {
+    cpio_off_t off;         // data offset in the archive
+    cpio_size_t len;
+    uint32_t sum;           // filled by the thread that takes the piece
+};
+
+struct verify {
+    const cpiofs_t *fs;
+    sum_t sum;
+    struct verify_piece *piece;
+    uint32_t count;
+    CPIO_ATOMIC uint32_t next;  // next piece to take
+    CPIO_ATOMIC int error;      // first error of a thread
+};
+
+static uint32_t verify_take(struct verify *v) {
+#ifdef CPIO_HAVE_ATOMICS
+    return atomic_fetch_add_explicit(&v->next, 1U, memory_order_relaxed);
+#else
+    return v->next ++;
+#endif
+}
+
+static void verify_fail(struct verify *v, int error) {
+#ifdef CPIO_HAVE_ATOMICS
+    int ok = CPIO_ERR_OK;
+    atomic_compare_exchange_strong_explicit(&v->error, &ok, error, memory_order_relaxed, memory_order_relaxed);
+#else
+    v->error = error;
+#endif
+}
+
+static void* verify_worker(void *arg) {
+    struct verify *v = arg;
+    uint8_t *buffer = NULL;
+    if ((v->fs->store != NULL) && ((buffer = malloc(VERIFY_PIECE)) == NULL)) {
+        verify_fail(v, (int)CPIO_ERR_NOMEM);
+        return NULL;
+    }
+    for (uint32_t k = verify_take(v); k < v->count; k = verify_take(v)) {
+        struct verify_piece *piece = &v->piece[k];
+        const uint8_t *p = (const uint8_t*)v->fs->head + piece->off;
+        if (buffer != NULL) {
+            if (cpiofs_store_read(v->fs, piece->off, buffer, piece->len) != (cpio_ssize_t)piece->len) {
+                verify_fail(v, (int)CPIO_ERR_IO);
+                break;
+            }
+            p = buffer;
+        }
+        piece->sum = v->sum(p, piece->len);
+    }
+    free(buffer);
+    return NULL;
+}
+
+// Sum every piece with nthread threads, the calling one included
+static int verify_run(struct verify *v, unsigned int nthread) {
+#ifdef CPIO_VERIFY_THREADS
+    pthread_t threads[VERIFY_THREADS];
+    unsigned int started = 0;
+    // a thread that does not start leaves its share to the others
+    while ((started + 1U < nthread) && (pthread_create(&threads[started], NULL, verify_worker, v) == 0)) {
+        started ++;
+    }
+    verify_worker(v);
+    for (unsigned int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+#else
+    (void)nthread;
+    verify_worker(v);
+#endif
+#ifdef CPIO_HAVE_ATOMICS
+    return atomic_load_explicit(&v->error, memory_order_relaxed);
+#else
+    return v->error;
+#endif
+}
+
+static unsigned int verify_threads(const cpiofs_t *fs, unsigned int nthread, uint32_t npiece) {
+#ifdef CPIO_VERIFY_THREADS
+    if (nthread == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        nthread = (cores > 0) ? (unsigned int)cores : 1U;
+    }
+#endif
+    // the reads through a backing store take its lock one at a time
+    if ((fs->store != NULL) || (nthread == 0)) {
+        nthread = 1;
+    }
+    if (nthread > VERIFY_THREADS) {
+        nthread = VERIFY_THREADS;
+    }
+    return (nthread > npiece) ? ((npiece > 0) ? npiece : 1U) : nthread;
+}
+
+int cpiofs_verify(const cpiofs_t *fs, unsigned int nthread, cpio_off_t *bad) {
+    if (fs == NULL) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (fs->overlay != NULL) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+
+    struct verify_file *file = NULL;
+    struct verify_piece *piece = NULL;
+    uint32_t nfile = 0;
+    uint32_t nalloc = 0;
+    uint32_t entries = 0;
+    cpio_off_t fail = 0;
+    int ret = CPIO_ERR_OK;
+    uint8_t buf[CPIO_ENTRY_BUFFER];
+
+    // the header chain, which has to end with a trailer
+    for (cpio_off_t off = 0; ; ) {
+        struct cpio_entry ent;
+        const struct header_old_cpio* d = (off < fs->size) ? cpiofs_header_at(fs, off, &ent, buf) : NULL;
+        if (d == NULL) {
+            ret = CPIO_ERR_CORRUPT;
+            fail = off;
+            goto end;
+        }
+        if (cpio_is_trailer(d, &ent)) {
+            break;
+        }
+        entries ++;
+        if (ent.format == CPIO_FORMAT_CRC) {
+            if (nfile == nalloc) {
+                nalloc = (nalloc != 0) ? nalloc * 2U : 256U;
+                struct verify_file *grown = realloc(file, nalloc * sizeof(*file));
+                if (grown == NULL) {
+                    ret = CPIO_ERR_NOMEM;
+                    goto end;
+                }
+                file = grown;
+            }
+            file[nfile].head = off;
+            file[nfile].data = off + ent.data;
+            file[nfile].size = ent.filesize;
+            file[nfile].check = ent.check;
+            nfile ++;
+        }
+        off += ent.next;
+    }
+
+    // a size near 4 GiB rounds up past 32 bits
+    uint64_t total = 0;
+    for (uint32_t f = 0; f < nfile; f++) {
+        file[f].first = (uint32_t)total;
+        total += ((uint64_t)file[f].size + VERIFY_PIECE - 1U) / VERIFY_PIECE;
+        if (total >= UINT32_MAX) {
+            ret = CPIO_ERR_NOMEM;
+            goto end;
+        }
+    }
+    uint32_t npiece = (uint32_t)total;
+    piece = malloc((npiece + 1U) * sizeof(*piece));
+    if (piece == NULL) {
+        ret = CPIO_ERR_NOMEM;
+        goto end;
+    }
+    for (uint32_t f = 0; f < nfile; f++) {
+        uint32_t last = (f + 1U < nfile) ? file[f + 1U].first : npiece;
+        for (uint32_t k = file[f].first; k < last; k++) {
+            cpio_size_t at = (cpio_size_t)(k - file[f].first) * VERIFY_PIECE;
+            piece[k].off = file[f].data + at;
+            piece[k].len = (file[f].size - at < VERIFY_PIECE) ? file[f].size - at : VERIFY_PIECE;
+        }
+    }
+
+    struct verify v = {
+        .fs = fs,
+        .sum = sum_kernel(),
+        .piece = piece,
+        .count = npiece,
+        .next = 0,
+        .error = CPIO_ERR_OK,
+    };
+    ret = verify_run(&v, verify_threads(fs, nthread, npiece));
+    if (ret != CPIO_ERR_OK) {
+        goto end;
+    }
+
+    // the first file in archive order whose pieces do not add up
+    for (uint32_t f = 0; f < nfile; f++) {
+        uint32_t last = (f + 1U < nfile) ? file[f + 1U].first : npiece;
+        uint32_t sum = 0;
+        for (uint32_t k = file[f].first; k < last; k++) {
+            sum += piece[k].sum;
+        }
+        if (sum != file[f].check) {
+            ret = CPIO_ERR_CORRUPT;
+            fail = file[f].head;
+            break;
+        }
+    }
+
+end:
+    free(piece);
+    free(file);
+    if ((ret == CPIO_ERR_CORRUPT) && (bad != NULL)) {
+        *bad = fail;
+    }
+    return (ret == CPIO_ERR_OK) ? (int)entries : ret;
+}
@@ -0,0 +1,272 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <unistd.h>
+#define CPIO_HAVE_WRITE_FD
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Archives whose file data is aligned
+//
+// The data of an entry follows its header and its name, both padded to
+// the alignment of the format, so its offset is moved by making the
+// name field longer: the name is followed by NULs up to namesize, which
+// every reader skips as they stop at the first one. A name field is at
+// most CPIO_NAME_MAX bytes though, so a gap that does not fit in it is
+// first filled with "." directory entries, themselves padded the same
+// way, and the rest goes in the name, the fillers looking like the root
+// to whoever extracts them. What comes out is a plain cpio archive;
+// only the offsets differ.
+
+#define WRITE_BLOCK         512U    // the archive is padded to whole blocks, like cpio does
+
+// Header size and alignment of the header and the data of a format
+static void write_layout(unsigned int format, cpio_size_t *hsize, cpio_size_t *align) {
+    switch (format) {
+        case CPIOFS_WRITE_BIN:
+            *hsize = 26;
+            *align = 2;
+            break;
+        case CPIOFS_WRITE_ODC:
+            *hsize = 76;
+            *align = 1;
+            break;
+        default:
+            *hsize = 110;
+            *align = 4;
+            break;
+    }
+}
+
+// Device packed the way the old formats store it
+static unsigned int write_old_dev(uint64_t dev) {
+    return (unsigned int)((((dev >> 32) << 8) | (dev & 0xFFU)) & 0xFFFFFFFFU);
+}
+
+// Encode a header, returns its size; meta is NULL for the defaults
+static size_t write_header(uint8_t *b, const cpiofs_writer_t *w, uint32_t mode, uint32_t mtime,
+                           const cpiofs_writer_meta_t *meta, uint32_t namesize, uint32_t size, uint32_t check) {
+    char hdr[128];
+    cpiofs_writer_meta_t m = {
+        .nlink = ((mode & CPIO_TYPE_MASK) == CPIO_DIR_TYPE_MASK) ? 2U : 1U,
+        .ino = w->ino,
+    };
+    if (meta != NULL) {
+        m = *meta;
+    }
+    switch (w->format) {
+        case CPIOFS_WRITE_BIN: {
+            const uint16_t fields[13] = {
+                070707, (uint16_t)write_old_dev(m.dev), (uint16_t)m.ino, (uint16_t)mode, (uint16_t)m.uid,
+                (uint16_t)m.gid, (uint16_t)m.nlink, (uint16_t)write_old_dev(m.rdev),
+                (uint16_t)(mtime >> 16), (uint16_t)mtime, (uint16_t)namesize,
+                (uint16_t)(size >> 16), (uint16_t)size,
+            };
+            memcpy(b, fields, sizeof(fields));
+            return sizeof(fields);
+        }
+        case CPIOFS_WRITE_ODC:
+            snprintf(hdr, sizeof(hdr), "070707%06o%06o%06o%06o%06o%06o%06o%011o%06o%011o",
+                     write_old_dev(m.dev) & 0777777U, (unsigned int)(m.ino & 0777777U), (unsigned int)mode,
+                     (unsigned int)(m.uid & 0777777U), (unsigned int)(m.gid & 0777777U),
+                     (unsigned int)(m.nlink & 0777777U), write_old_dev(m.rdev) & 0777777U,
+                     (unsigned int)mtime, (unsigned int)namesize, (unsigned int)size);
+            memcpy(b, hdr, 76);
+            return 76;
+        default:
+            snprintf(hdr, sizeof(hdr), "%s%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+                     (w->format == CPIOFS_WRITE_CRC) ? "070702" : "070701", (unsigned int)m.ino,
+                     (unsigned int)mode, (unsigned int)m.uid, (unsigned int)m.gid, (unsigned int)m.nlink,
+                     (unsigned int)mtime, (unsigned int)size, (unsigned int)(m.dev >> 32),
+                     (unsigned int)(m.dev & 0xFFFFFFFFU), (unsigned int)(m.rdev >> 32),
+                     (unsigned int)(m.rdev & 0xFFFFFFFFU), (unsigned int)namesize, (unsigned int)check);
+            memcpy(b, hdr, 110);
+            return 110;
+    }
+}
+
+static int write_out(cpiofs_writer_t *w, const void *data, cpio_size_t size) {
+    if (size == 0) {
+        return (int)CPIO_ERR_OK;
+    }
+    cpio_ssize_t n = w->write(w->ctx, data, size);
+    if (n != (cpio_ssize_t)size) {
+        w->error = (n < 0) ? (int)n : (int)CPIO_ERR_IO;
+        return w->error;
+    }
+    w->pos += size;
+    return (int)CPIO_ERR_OK;
+}
+
+// Write a header and its name, the name field being namesize bytes
+static int write_entry(cpiofs_writer_t *w, const char *path, uint32_t mode, uint32_t mtime,
+                       const cpiofs_writer_meta_t *meta, uint32_t namesize, uint32_t size, uint32_t check) {
+    uint8_t b[128 + CPIO_NAME_MAX + 4U];
+    cpio_size_t hsize;
+    cpio_size_t align;
+    write_layout(w->format, &hsize, &align);
+    w->ino ++;
+    size_t at = write_header(b, w, mode, mtime, meta, namesize, size, check);
+    size_t len = strlen(path);
+    memcpy(&b[at], path, len);
+    // the NUL, the padding of the name and the padding of the header
+    size_t end = (at + namesize + align - 1U) & ~(size_t)(align - 1U);
+    memset(&b[at + len], 0, end - at - len);
+    return write_out(w, b, end);
+}
+
+int cpiofs_writer_init(cpiofs_writer_t *w, cpiofs_write_t write, void *ctx, unsigned int format, cpio_size_t align) {
+    if ((w == NULL) || (write == NULL) || (format > CPIOFS_WRITE_BIN) || (align == 0) ||
+        ((align & (align - 1U)) != 0)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    memset(w, 0, sizeof(*w));
+    w->write = write;
+    w->ctx = ctx;
+    w->format = format;
+    w->align = align;
+    w->fill_mode = 0755U;
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_writer_add(cpiofs_writer_t *w, const char *path, uint32_t mode, uint32_t mtime,
+                      const void *data, cpio_size_t size) {
+    return cpiofs_writer_add_meta(w, path, mode, mtime, NULL, data, size);
+}
+
+int cpiofs_writer_add_meta(cpiofs_writer_t *w, const char *path, uint32_t mode, uint32_t mtime,
+                           const cpiofs_writer_meta_t *meta, const void *data, cpio_size_t size) {
+    if ((w == NULL) || (path == NULL) || ((data == NULL) && (size > 0))) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (w->error != CPIO_ERR_OK) {
+        return w->error;
+    }
+    size_t namesize = strlen(path) + 1U;
+    if ((namesize > CPIO_NAME_MAX) || (mode > 0177777U) ||
+        ((namesize == 11U) && (memcmp(path, "TRAILER!!!", 11) == 0))) {
+        return (int)CPIO_ERR_PARAM;
+    }
+#ifdef CPIO_LARGEFILE
+    // the headers hold 32 bits sizes
+    if (size > UINT32_MAX) {
+        return (int)CPIO_ERR_PARAM;
+    }
+#endif
+    cpio_size_t hsize;
+    cpio_size_t step;
+    write_layout(w->format, &hsize, &step);
+    cpio_size_t align = (w->align > step) ? w->align : step;
+
+    // bytes between where the data would be and where it has to be
+    cpio_size_t gap = 0;
+    if (((mode & CPIO_TYPE_MASK) == CPIO_FILE_TYPE_MASK) && (size > 0)) {
+        cpio_size_t at = w->pos + ((hsize + namesize + step - 1U) & ~(step - 1U));
+        gap = (align - at % align) % align;
+    }
+    cpio_size_t pad = CPIO_NAME_MAX - namesize;
+    cpio_size_t fill_min = (hsize + 2U + step - 1U) & ~(step - 1U);
+    cpio_size_t fill_max = (hsize + CPIO_NAME_MAX) & ~(step - 1U);
+    while (gap > pad) {
+        while (gap < fill_min) {
+            gap += align;
+        }
+        cpio_size_t fill = (gap < fill_max) ? gap : fill_max;
+        if (write_entry(w, ".", CPIO_DIR_TYPE_MASK | (w->fill_mode & CPIO_MODE_MASK), w->fill_mtime, NULL,
+                        (uint32_t)(fill - hsize), 0, 0) != CPIO_ERR_OK) {
+            return w->error;
+        }
+        w->fillers ++;
+        gap -= fill;
+    }
+
+    static const uint8_t zero[4] = { 0 };
+    uint32_t check = (w->format == CPIOFS_WRITE_CRC) ? cpio_sum(data, size) : 0U;
+    if ((write_entry(w, path, mode, mtime, meta, (uint32_t)(namesize + gap), (uint32_t)size, check) != CPIO_ERR_OK) ||
+        (write_out(w, data, size) != CPIO_ERR_OK) ||
+        (write_out(w, zero, (step - size % step) % step) != CPIO_ERR_OK)) {
+        return w->error;
+    }
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_writer_finish(cpiofs_writer_t *w) {
+    if (w == NULL) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (w->error != CPIO_ERR_OK) {
+        return w->error;
+    }
+    static const uint8_t zero[WRITE_BLOCK] = { 0 };
+    if (write_entry(w, "TRAILER!!!", 0, 0, NULL, 11, 0, 0) != CPIO_ERR_OK) {
+        return w->error;
+    }
+    write_out(w, zero, (WRITE_BLOCK - w->pos % WRITE_BLOCK) % WRITE_BLOCK);
+    return w->error;
+}
+
+cpio_ssize_t cpiofs_write_fd(void *ctx, const void *data, cpio_size_t size) {
+#ifdef CPIO_HAVE_WRITE_FD
+    int fd = *(const int*)ctx;
+    cpio_size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, (const uint8_t*)data + done, size - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return CPIO_ERR_IO;
+        }
+        done += (cpio_size_t)n;
+    }
+    return (cpio_ssize_t)done;
+#else
+    (void)ctx;
+    (void)data;
+    (void)size;
+    return CPIO_ERR_NOTSUP;
+#endif
+}
+
+cpio_size_t cpiofs_data_align(const cpiofs_t *fs) {
+    if ((fs == NULL) || (fs->overlay != NULL)) {
+        return 0;
+    }
+    if (!cpiofs_indexed(fs)) {
+        cpiofs_t view = {
+            .head = fs->head,
+            .size = fs->size,
+        };
+        if (cpiofs_index_build(&view, 1, &view.index) != CPIO_ERR_OK) {
+            return 0;
+        }
+        cpio_size_t align = cpiofs_data_align(&view);
+        free(view.index.mem);
+        return align;
+    }
+    // the lowest bit set in any offset is the alignment of them all
+    const cpiofs_index_t *index = &fs->index;
+    cpio_size_t bits = 0;
+    int any = 0;
+    for (uint32_t e = 0; e < index->count; e++) {
+        if (((index->mode[e] & CPIO_TYPE_MASK) == CPIO_FILE_TYPE_MASK) && (index->fsize[e] > 0)) {
+            bits |= index->data[e];
+            any = 1;
+        }
+    }
+    if (!any) {
+        return 0;
+    }
+    if (fs->store == NULL) {
+        bits |= (cpio_size_t)(uintptr_t)fs->head;
+    }
+    return bits & (~bits + 1U);
+}
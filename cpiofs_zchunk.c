@@ -0,0 +1,289 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CPIO_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Seekable compressed archives: the plain archive is cut in chunks of
+// chunk_size bytes, every chunk is compressed on its own and a table
+// gives where each one starts, so a read only inflates the chunks it
+// touches. All the fields are little endian:
+//
+//   0   magic "CPIOZCK\n"
+//   8   codec (CPIOFS_CODEC_*)
+//   12  chunk_size, a power of two
+//   16  nchunk
+//   20  reserved, 0
+//   24  size of the plain archive, 64 bits
+//   32  nchunk + 1 chunk offsets in the container, 64 bits each
+//
+// The last offset is the end of the last chunk; the first one follows
+// the table and no chunk is larger than zlib's bound for chunk_size
+// bytes, so a header cannot make the mount allocate more than the
+// container holds. The chunks go through
+// the backing store with one block per chunk, so the block cache is the
+// cache of inflated chunks.
+
+#define ZCHUNK_HEADER   32U
+#define ZCHUNK_MAX      (1U << 24)  // largest chunk_size
+
+struct cpiofs_zchunk {
+    cpiofs_read_t read;
+    void *ctx;
+    uint32_t codec;
+    cpio_size_t chunk_size;
+    uint32_t nchunk;
+    cpio_size_t size;
+    cpio_off_t *table;      // nchunk + 1 offsets in the container
+    uint8_t *zbuf;          // the largest compressed chunk
+    uint8_t *scratch;       // one inflated chunk, for partial reads
+    uint32_t scratch_chunk; // chunk held by scratch, CPIO_INDEX_NONE if none
+};
+
+#ifdef CPIO_HAVE_ZLIB
+
+static const char zchunk_magic[8] = { 'C', 'P', 'I', 'O', 'Z', 'C', 'K', '\n' };
+
+static uint32_t le32(const uint8_t *b) {
+    return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint64_t le64(const uint8_t *b) {
+    return (uint64_t)le32(b) | ((uint64_t)le32(&b[4]) << 32);
+}
+
+static void put_le32(uint8_t *b, uint32_t v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+    b[2] = (uint8_t)(v >> 16);
+    b[3] = (uint8_t)(v >> 24);
+}
+
+static void put_le64(uint8_t *b, uint64_t v) {
+    put_le32(b, (uint32_t)v);
+    put_le32(&b[4], (uint32_t)(v >> 32));
+}
+
+// Inflate chunk c into dst, which holds a whole chunk
+static int zchunk_inflate(struct cpiofs_zchunk *z, uint32_t c, uint8_t *dst) {
+    cpio_size_t zsize = z->table[c + 1U] - z->table[c];
+    cpio_size_t len = z->chunk_size;
+    if (len > z->size - (cpio_size_t)c * z->chunk_size) {
+        len = z->size - (cpio_size_t)c * z->chunk_size;
+    }
+    if (z->read(z->ctx, z->table[c], z->zbuf, zsize) != (cpio_ssize_t)zsize) {
+        return (int)CPIO_ERR_IO;
+    }
+    uLongf dlen = len;
+    if ((uncompress(dst, &dlen, z->zbuf, zsize) != Z_OK) || (dlen != len)) {
+        return (int)CPIO_ERR_IO;
+    }
+    return (int)CPIO_ERR_OK;
+}
+
+// Read callback of the backing store over the plain archive
+static cpio_ssize_t zchunk_read(void *ctx, cpio_off_t off, void *buffer, cpio_size_t size) {
+    struct cpiofs_zchunk *z = ctx;
+    uint8_t *dst = buffer;
+    cpio_size_t done = 0;
+    if ((off > z->size) || (size > z->size - off)) {
+        return CPIO_ERR_PARAM;
+    }
+    while (done < size) {
+        cpio_off_t pos = off + done;
+        uint32_t c = pos / z->chunk_size;
+        cpio_size_t in = pos % z->chunk_size;
+        cpio_size_t n = z->chunk_size - in;
+        if (n > size - done) {
+            n = size - done;
+        }
+        if ((in == 0) && (n == z->chunk_size)) {
+            // whole chunks are inflated in place
+            if (zchunk_inflate(z, c, &dst[done]) != CPIO_ERR_OK) {
+                return CPIO_ERR_IO;
+            }
+        } else {
+            if (z->scratch_chunk != c) {
+                z->scratch_chunk = CPIO_INDEX_NONE;
+                if (zchunk_inflate(z, c, z->scratch) != CPIO_ERR_OK) {
+                    return CPIO_ERR_IO;
+                }
+                z->scratch_chunk = c;
+            }
+            memcpy(&dst[done], &z->scratch[in], n);
+        }
+        done += n;
+    }
+    return (cpio_ssize_t)done;
+}
+
+int cpiofs_mount_compressed(cpiofs_t *fs, cpiofs_read_t read, void *ctx, uint32_t nblock) {
+    uint8_t hdr[ZCHUNK_HEADER];
+    if ((fs == NULL) || (read == NULL)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (read(ctx, 0, hdr, sizeof(hdr)) != (cpio_ssize_t)sizeof(hdr)) {
+        return (int)CPIO_ERR_IO;
+    }
+    uint32_t codec = le32(&hdr[8]);
+    uint32_t chunk_size = le32(&hdr[12]);
+    uint32_t nchunk = le32(&hdr[16]);
+    uint64_t size = le64(&hdr[24]);
+    if (memcmp(hdr, zchunk_magic, sizeof(zchunk_magic)) != 0) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    if (codec != CPIOFS_CODEC_ZLIB) {
+        return (int)CPIO_ERR_NOTSUP;
+    }
+    if ((chunk_size < 64U) || (chunk_size > ZCHUNK_MAX) || ((chunk_size & (chunk_size - 1U)) != 0) ||
+        (size == 0) || (size > (cpio_size_t)~(cpio_size_t)0) || (nchunk != (size + chunk_size - 1U) / chunk_size)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+
+    size_t tsize = ((size_t)nchunk + 1U) * 8U;
+    uint8_t *raw = malloc(tsize);
+    struct cpiofs_zchunk *z = malloc(sizeof(struct cpiofs_zchunk) + ((size_t)nchunk + 1U) * sizeof(cpio_off_t) +
+                                     chunk_size);
+    if ((raw == NULL) || (z == NULL)) {
+        free(raw);
+        free(z);
+        return (int)CPIO_ERR_NOMEM;
+    }
+    z->read = read;
+    z->ctx = ctx;
+    z->codec = codec;
+    z->chunk_size = chunk_size;
+    z->nchunk = nchunk;
+    z->size = (cpio_size_t)size;
+    z->table = (cpio_off_t*)&z[1];
+    z->scratch = (uint8_t*)&z->table[nchunk + 1U];
+    z->scratch_chunk = CPIO_INDEX_NONE;
+    z->zbuf = NULL;
+
+    int ret = (int)CPIO_ERR_OK;
+    cpio_size_t zmax = 0;
+    uint64_t bound = compressBound(chunk_size);
+    if (read(ctx, ZCHUNK_HEADER, raw, (cpio_size_t)tsize) != (cpio_ssize_t)tsize) {
+        ret = (int)CPIO_ERR_IO;
+    }
+    for (uint32_t c = 0; (ret == CPIO_ERR_OK) && (c <= nchunk); c++) {
+        uint64_t v = le64(&raw[(size_t)c * 8U]);
+        if ((v > (cpio_off_t)~(cpio_off_t)0) || ((c == 0) && (v != ZCHUNK_HEADER + tsize)) ||
+            ((c > 0) && ((v <= z->table[c - 1U]) || (v - z->table[c - 1U] > bound)))) {
+            ret = (int)CPIO_ERR_PARAM;
+            break;
+        }
+        z->table[c] = (cpio_off_t)v;
+        if ((c > 0) && (z->table[c] - z->table[c - 1U] > zmax)) {
+            zmax = z->table[c] - z->table[c - 1U];
+        }
+    }
+    free(raw);
+    if (ret == CPIO_ERR_OK) {
+        // the container has to hold the last chunk
+        uint8_t last;
+        if (read(ctx, z->table[nchunk] - 1U, &last, 1) != 1) {
+            ret = (int)CPIO_ERR_IO;
+        }
+    }
+    if (ret == CPIO_ERR_OK) {
+        z->zbuf = malloc(zmax);
+        if (z->zbuf == NULL) {
+            ret = (int)CPIO_ERR_NOMEM;
+        }
+    }
+    if (ret == CPIO_ERR_OK) {
+        ret = cpiofs_mount_store(fs, zchunk_read, z, z->size, chunk_size, nblock);
+    }
+    if (ret != CPIO_ERR_OK) {
+        free(z->zbuf);
+        free(z);
+        return ret;
+    }
+    fs->zchunk = z;
+    return (int)CPIO_ERR_OK;
+}
+
+int cpiofs_pack(const void *image, cpio_size_t size, cpio_size_t chunk_size, int level,
+                void **out, cpio_size_t *out_size) {
+    if ((image == NULL) || (size == 0) || (out == NULL) || (out_size == NULL) ||
+        (chunk_size < 64U) || (chunk_size > ZCHUNK_MAX) || ((chunk_size & (chunk_size - 1U)) != 0)) {
+        return (int)CPIO_ERR_PARAM;
+    }
+    uint32_t nchunk = (uint32_t)(((uint64_t)size + chunk_size - 1U) / chunk_size);
+    size_t table = ZCHUNK_HEADER + ((size_t)nchunk + 1U) * 8U;
+    uLong bound = compressBound(chunk_size);
+    // room for the worst case, shrunk once the chunks are compressed
+    uint8_t *dst = malloc(table + (size_t)nchunk * bound);
+    if (dst == NULL) {
+        return (int)CPIO_ERR_NOMEM;
+    }
+    memcpy(dst, zchunk_magic, sizeof(zchunk_magic));
+    put_le32(&dst[8], CPIOFS_CODEC_ZLIB);
+    put_le32(&dst[12], chunk_size);
+    put_le32(&dst[16], nchunk);
+    put_le32(&dst[20], 0);
+    put_le64(&dst[24], size);
+
+    size_t pos = table;
+    for (uint32_t c = 0; c < nchunk; c++) {
+        const uint8_t *src = (const uint8_t*)image + (size_t)c * chunk_size;
+        cpio_size_t len = size - c * chunk_size;
+        if (len > chunk_size) {
+            len = chunk_size;
+        }
+        uLongf zlen = bound;
+        put_le64(&dst[ZCHUNK_HEADER + (size_t)c * 8U], pos);
+        if (compress2(&dst[pos], &zlen, src, len, level) != Z_OK) {
+            free(dst);
+            return (int)CPIO_ERR_UNKNOWN;
+        }
+        pos += zlen;
+    }
+    put_le64(&dst[ZCHUNK_HEADER + (size_t)nchunk * 8U], pos);
+    if (pos > (cpio_size_t)~(cpio_size_t)0) {
+        free(dst);
+        return (int)CPIO_ERR_PARAM;
+    }
+    uint8_t *shrunk = realloc(dst, pos);
+    *out = (shrunk != NULL) ? shrunk : dst;
+    *out_size = (cpio_size_t)pos;
+    return (int)CPIO_ERR_OK;
+}
+
+#else
+
+int cpiofs_mount_compressed(cpiofs_t *fs, cpiofs_read_t read, void *ctx, uint32_t nblock) {
+    (void)fs;
+    (void)read;
+    (void)ctx;
+    (void)nblock;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+int cpiofs_pack(const void *image, cpio_size_t size, cpio_size_t chunk_size, int level,
+                void **out, cpio_size_t *out_size) {
+    (void)image;
+    (void)size;
+    (void)chunk_size;
+    (void)level;
+    (void)out;
+    (void)out_size;
+    return (int)CPIO_ERR_NOTSUP;
+}
+
+#endif
+
+void cpiofs_zchunk_release(cpiofs_t *fs) {
+    if (fs->zchunk != NULL) {
+        free(fs->zchunk->zbuf);
+        free(fs->zchunk);
+        fs->zchunk = NULL;
+    }
+}
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <math.h>
+
+// Synthetic archive generator for the benchmarks
+//
+// usage: cpiogen [options] -o <archive.cpio>
+//   -n <entries>     total number of entries, directories included (1000)
+//   -d <depth>       depth of the directory tree (3)
+//   -f <fanout>      subdirectories per directory (8)
+//   -l <name len>    length of every name component (12)
+//   -s <sizes>       file sizes: fixed:N, uniform:MIN:MAX or exp:MEAN (exp:4096)
+//   -F <format>      bin, binbe, odc, newc or crc (bin)
+//   -r <seed>        random seed (1)
+//
+// Directories are laid out breadth first, up to a quarter of the
+// entries, the files are then spread round robin over the directories.
+// Every directory is written before its content, like find does.
+
+enum gen_format {
+    GEN_BIN,
+    GEN_BINBE,
+    GEN_ODC,
+    GEN_NEWC,
+    GEN_CRC,
+};
+
+enum gen_size {
+    GEN_SIZE_FIXED,
+    GEN_SIZE_UNIFORM,
+    GEN_SIZE_EXP,
+};
+
+struct gen_dir {
+    uint32_t parent;
+    uint32_t depth;
+    uint32_t nfile;
+    char *path;
+};
+
+static uint64_t rnd_state = 1;
+
+// xorshift64*, reproducible across platforms
+static uint32_t rnd(void) {
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return (uint32_t)((rnd_state * 2685821657736338717ULL) >> 32);
+}
+
+static uint64_t out_size = 0;
+
+static void put(FILE *out, const void *data, size_t size) {
+    fwrite(data, 1, size, out);
+    out_size += size;
+}
+
+static void put_pad(FILE *out, unsigned int align) {
+    static const uint8_t zero[512] = { 0 };
+    size_t pad = (size_t)((align - out_size % align) % align);
+    put(out, zero, pad);
+}
+
+static void put16(FILE *out, uint16_t v, int big_endian) {
+    uint8_t b[2];
+    if (big_endian) {
+        b[0] = (uint8_t)(v >> 8);
+        b[1] = (uint8_t)v;
+    } else {
+        b[0] = (uint8_t)v;
+        b[1] = (uint8_t)(v >> 8);
+    }
+    put(out, b, sizeof(b));
+}
+
+static void put_entry(FILE *out, enum gen_format format, const char *name, uint32_t mode,
+                      const uint8_t *data, uint32_t size, uint32_t ino) {
+    uint32_t namesize = (uint32_t)strlen(name) + 1U;
+    uint32_t mtime = 1589100000U;
+    char hdr[128];
+    switch (format) {
+        case GEN_BIN:
+        case GEN_BINBE: {
+            int be = (format == GEN_BINBE);
+            const uint16_t fields[13] = {
+                070707, 1, (uint16_t)ino, (uint16_t)mode, 0, 0, 1, 0,
+                (uint16_t)(mtime >> 16), (uint16_t)mtime, (uint16_t)namesize,
+                (uint16_t)(size >> 16), (uint16_t)size,
+            };
+            for (unsigned int i = 0; i < 13; i++) {
+                put16(out, fields[i], be);
+            }
+            put(out, name, namesize);
+            put_pad(out, 2);
+            put(out, data, size);
+            put_pad(out, 2);
+            break;
+        }
+        case GEN_ODC:
+            snprintf(hdr, sizeof(hdr), "070707%06o%06o%06o%06o%06o%06o%06o%011o%06o%011o",
+                     1U, ino & 0777777U, mode, 0U, 0U, 1U, 0U, mtime, namesize, size);
+            put(out, hdr, 76);
+            put(out, name, namesize);
+            put(out, data, size);
+            break;
+        case GEN_NEWC:
+        case GEN_CRC: {
+            uint32_t check = 0;
+            if (format == GEN_CRC) {
+                for (uint32_t i = 0; i < size; i++) {
+                    check += data[i];
+                }
+            }
+            snprintf(hdr, sizeof(hdr), "%s%08" PRIX32 "%08" PRIX32 "%08X%08X%08X%08" PRIX32 "%08" PRIX32
+                     "%08X%08X%08X%08X%08" PRIX32 "%08" PRIX32,
+                     format == GEN_CRC ? "070702" : "070701", ino, mode, 0U, 0U, 1U, mtime, size,
+                     8U, 1U, 0U, 0U, namesize, check);
+            put(out, hdr, 110);
+            put(out, name, namesize);
+            put_pad(out, 4);
+            put(out, data, size);
+            put_pad(out, 4);
+            break;
+        }
+    }
+}
+
+static uint32_t file_size(enum gen_size dist, uint32_t a, uint32_t b) {
+    switch (dist) {
+        case GEN_SIZE_UNIFORM:
+            return a + ((b > a) ? rnd() % (b - a + 1U) : 0);
+        case GEN_SIZE_EXP: {
+            // inverse transform sampling, capped at 64 times the mean
+            double u = ((double)rnd() + 1.0) / 4294967297.0;
+            double v = -log(u) * (double)a;
+            return (v < 64.0 * (double)a) ? (uint32_t)v : 64U * a;
+        }
+        default:
+            return a;
+    }
+}
+
+static void make_name(char *dst, char kind, uint32_t id, unsigned int len) {
+    int n = snprintf(dst, len + 1U, "%c%" PRIu32 "_", kind, id);
+    for (unsigned int i = (unsigned int)n; i < len; i++) {
+        dst[i] = (char)('a' + (id + i) % 26U);
+    }
+    dst[len > (unsigned int)n ? len : (unsigned int)n] = '\0';
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-n entries] [-d depth] [-f fanout] [-l name_len] "
+                    "[-s fixed:N|uniform:MIN:MAX|exp:MEAN] [-F bin|binbe|odc|newc|crc] [-r seed] -o out.cpio\n", prog);
+}
+
+int main(int argc, char** argv) {
+    uint32_t entries = 1000;
+    uint32_t depth = 3;
+    uint32_t fanout = 8;
+    unsigned int name_len = 12;
+    enum gen_size dist = GEN_SIZE_EXP;
+    uint32_t size_a = 4096;
+    uint32_t size_b = 0;
+    enum gen_format format = GEN_BIN;
+    const char *output = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if ((argv[i][0] != '-') || (arg == NULL)) {
+            usage(argv[0]);
+            return -1;
+        }
+        switch (argv[i][1]) {
+            case 'n':
+                entries = (uint32_t)strtoul(arg, NULL, 0);
+                break;
+            case 'd':
+                depth = (uint32_t)strtoul(arg, NULL, 0);
+                break;
+            case 'f':
+                fanout = (uint32_t)strtoul(arg, NULL, 0);
+                break;
+            case 'l':
+                name_len = (unsigned int)strtoul(arg, NULL, 0);
+                break;
+            case 's':
+                if (strncmp(arg, "fixed:", 6) == 0) {
+                    dist = GEN_SIZE_FIXED;
+                    size_a = (uint32_t)strtoul(&arg[6], NULL, 0);
+                } else if (strncmp(arg, "uniform:", 8) == 0) {
+                    char *end;
+                    dist = GEN_SIZE_UNIFORM;
+                    size_a = (uint32_t)strtoul(&arg[8], &end, 0);
+                    size_b = (*end == ':') ? (uint32_t)strtoul(end + 1, NULL, 0) : size_a;
+                } else if (strncmp(arg, "exp:", 4) == 0) {
+                    dist = GEN_SIZE_EXP;
+                    size_a = (uint32_t)strtoul(&arg[4], NULL, 0);
+                } else {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'F':
+                if (strcmp(arg, "bin") == 0) {
+                    format = GEN_BIN;
+                } else if (strcmp(arg, "binbe") == 0) {
+                    format = GEN_BINBE;
+                } else if (strcmp(arg, "odc") == 0) {
+                    format = GEN_ODC;
+                } else if (strcmp(arg, "newc") == 0) {
+                    format = GEN_NEWC;
+                } else if (strcmp(arg, "crc") == 0) {
+                    format = GEN_CRC;
+                } else {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'r':
+                rnd_state = strtoull(arg, NULL, 0) | 1U;
+                break;
+            case 'o':
+                output = arg;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+        i++;
+    }
+    if ((output == NULL) || (entries == 0) || (name_len == 0) || (name_len > 200U)) {
+        usage(argv[0]);
+        return -1;
+    }
+    // breadth first directory tree, the root included
+    uint32_t max_dirs = entries / 4U + 1U;
+    struct gen_dir *dirs = calloc(max_dirs, sizeof(struct gen_dir));
+    if (dirs == NULL) {
+        return -2;
+    }
+    uint32_t ndirs = 1;
+    dirs[0].parent = 0;
+    dirs[0].depth = 0;
+    dirs[0].path = malloc(2);
+    if (dirs[0].path == NULL) {
+        return -2;
+    }
+    strcpy(dirs[0].path, ".");
+    for (uint32_t d = 0; (d < ndirs) && (ndirs < max_dirs); d++) {
+        if (dirs[d].depth >= depth) {
+            continue;
+        }
+        for (uint32_t f = 0; (f < fanout) && (ndirs < max_dirs); f++) {
+            char name[256];
+            make_name(name, 'd', ndirs, name_len);
+            size_t len = strlen(dirs[d].path) + strlen(name) + 2U;
+            dirs[ndirs].path = malloc(len);
+            if (dirs[ndirs].path == NULL) {
+                return -2;
+            }
+            snprintf(dirs[ndirs].path, len, "%s/%s", dirs[d].path, name);
+            dirs[ndirs].parent = d;
+            dirs[ndirs].depth = dirs[d].depth + 1U;
+            ndirs ++;
+        }
+    }
+    uint32_t nfiles = entries > ndirs ? entries - ndirs : 0;
+    for (uint32_t f = 0; f < nfiles; f++) {
+        dirs[f % ndirs].nfile ++;
+    }
+
+    FILE *out = fopen(output, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "impossible to write: %s\n", output);
+        return -3;
+    }
+    uint8_t *data = NULL;
+    uint32_t data_max = 0;
+    uint32_t ino = 1;
+    uint32_t file_id = 0;
+    uint64_t payload = 0;
+    for (uint32_t d = 0; d < ndirs; d++) {
+        // "./" for the root, the way find ./ names it
+        put_entry(out, format, d == 0 ? "./" : dirs[d].path, 040755, NULL, 0, ino++);
+        for (uint32_t f = 0; f < dirs[d].nfile; f++) {
+            char name[256];
+            char path[4096];
+            make_name(name, 'f', file_id++, name_len);
+            snprintf(path, sizeof(path), "%s/%s", dirs[d].path, name);
+            uint32_t size = file_size(dist, size_a, size_b);
+            if (size > data_max) {
+                uint8_t *grown = realloc(data, size);
+                if (grown == NULL) {
+                    fclose(out);
+                    return -2;
+                }
+                data = grown;
+                data_max = size;
+            }
+            for (uint32_t i = 0; i < size; i++) {
+                data[i] = (uint8_t)rnd();
+            }
+            put_entry(out, format, path, 0100644, data, size, ino++);
+            payload += size;
+        }
+    }
+    put_entry(out, format, "TRAILER!!!", 0, NULL, 0, 0);
+    put_pad(out, 512);
+    fclose(out);
+
+    fprintf(stderr, "%s: %" PRIu32 " directories, %" PRIu32 " files, %" PRIu64 " bytes of data, %" PRIu64 " bytes\n",
+            output, ndirs, nfiles, payload, out_size);
+    for (uint32_t d = 0; d < ndirs; d++) {
+        free(dirs[d].path);
+    }
+    free(dirs);
+    free(data);
+    return 0;
+}
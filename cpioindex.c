@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include "cpiofs.h"
+#include "cpiofs_priv.h"
+
+// Save the index of an archive, so that mounting it does not scan the
+// headers any more
+//
+// usage: cpioindex [-s] <archive.cpio> <output>
+//   without -s       writes a copy of the archive with the index as its
+//                    last entry, CPIOFS_INDEX_NAME, which cpio extracts
+//                    as a plain file; an index already in the archive
+//                    is replaced
+//   -s               writes the index alone, as a sidecar file for
+//                    cpiofs_mount_index
+//
+// The index is written in the byte order of the host and is only used
+// by hosts with the same byte order and the same cpio_off_t.
+
+static void put16(uint8_t *b, uint16_t v, int swap) {
+    if (swap) {
+        v = (uint16_t)((v << 8) | (v >> 8));
+    }
+    memcpy(b, &v, sizeof(v));
+}
+
+// Encode a header in the format of the archive, returns its size
+static size_t put_header(uint8_t *b, int format, const char *name, uint32_t mode, uint32_t size, uint32_t check) {
+    uint32_t namesize = (uint32_t)strlen(name) + 1U;
+    char hdr[128];
+    switch (format) {
+        case CPIO_FORMAT_BIN:
+        case CPIO_FORMAT_BIN_SWAP: {
+            const uint16_t fields[13] = {
+                070707, 0, 0, (uint16_t)mode, 0, 0, 1, 0, 0, 0, (uint16_t)namesize,
+                (uint16_t)(size >> 16), (uint16_t)size,
+            };
+            for (unsigned int i = 0; i < 13; i++) {
+                put16(&b[i * 2U], fields[i], format == CPIO_FORMAT_BIN_SWAP);
+            }
+            return 26;
+        }
+        case CPIO_FORMAT_ODC:
+            snprintf(hdr, sizeof(hdr), "070707%06o%06o%06o%06o%06o%06o%06o%011o%06o%011o",
+                     0U, 0U, mode, 0U, 0U, 1U, 0U, 0U, namesize, size);
+            memcpy(b, hdr, 76);
+            return 76;
+        default:
+            snprintf(hdr, sizeof(hdr), "%s%08X%08" PRIX32 "%08X%08X%08X%08X%08" PRIX32
+                     "%08X%08X%08X%08X%08" PRIX32 "%08" PRIX32,
+                     format == CPIO_FORMAT_CRC ? "070702" : "070701", 0U, mode, 0U, 0U, 1U, 0U, size,
+                     0U, 0U, 0U, 0U, namesize, check);
+            memcpy(b, hdr, 110);
+            return 110;
+    }
+}
+
+// Write a whole entry, name and padding included
+static int put_entry(FILE *out, uint64_t *pos, int format, const char *name, uint32_t mode,
+                     const uint8_t *data, uint32_t size) {
+    static const uint8_t zero[4] = { 0 };
+    unsigned int align = (format == CPIO_FORMAT_ODC) ? 1U : ((format == CPIO_FORMAT_BIN) ||
+                                                            (format == CPIO_FORMAT_BIN_SWAP)) ? 2U : 4U;
+    uint8_t hdr[CPIO_HEADER_MAX];
+    uint32_t check = 0;
+    if (format == CPIO_FORMAT_CRC) {
+        for (uint32_t i = 0; i < size; i++) {
+            check += data[i];
+        }
+    }
+    size_t hsize = put_header(hdr, format, name, mode, size, check);
+    size_t namesize = strlen(name) + 1U;
+    size_t pad = (align - (hsize + namesize) % align) % align;
+    size_t tail = (align - size % align) % align;
+    if ((fwrite(hdr, 1, hsize, out) != hsize) || (fwrite(name, 1, namesize, out) != namesize) ||
+        (fwrite(zero, 1, pad, out) != pad) || (fwrite(data, 1, size, out) != size) ||
+        (fwrite(zero, 1, tail, out) != tail)) {
+        return -1;
+    }
+    *pos += hsize + namesize + pad + size + tail;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-s] <archive.cpio> <output>\n", prog);
+}
+
+int main(int argc, char** argv) {
+    int result = 0;
+    int sidecar = 0;
+    uint8_t *data = NULL;
+    void *blob = NULL;
+    cpio_size_t blob_size = 0;
+    cpiofs_t fs = { 0 };
+    FILE *out = NULL;
+    int first = 1;
+
+    if ((argc > 1) && (strcmp(argv[1], "-s") == 0)) {
+        sidecar = 1;
+        first ++;
+    }
+    if (first + 2 != argc) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    FILE *fp = fopen(argv[first], "rb");
+    if (NULL == fp) {
+        fprintf(stderr, "impossible to read file: %s\n", argv[first]);
+        return -2;
+    }
+    fseek(fp, 0, SEEK_END);
+    long fsize = ftell(fp);
+    rewind(fp);
+    data = (fsize > 0) ? malloc(fsize) : NULL;
+    if ((NULL == data) || (fread(data, 1, fsize, fp) != (size_t)fsize)) {
+        result = -3;
+        fprintf(stderr, "impossible to load: %s\n", argv[first]);
+        goto end;
+    }
+    if (cpiofs_mount(&fs, data, (cpio_size_t)fsize) != CPIO_ERR_OK) {
+        result = -4;
+        fprintf(stderr, "impossible to mount: %s\n", argv[first]);
+        goto end;
+    }
+
+    out = fopen(argv[first + 1], "wb");
+    if (NULL == out) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+        goto end;
+    }
+
+    if (sidecar) {
+        if (cpiofs_index_save(&fs, 0, &blob, &blob_size) != CPIO_ERR_OK) {
+            result = -6;
+            fprintf(stderr, "impossible to save the index of: %s\n", argv[first]);
+            goto end;
+        }
+        if (fwrite(blob, 1, blob_size, out) != blob_size) {
+            result = -5;
+            fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+        }
+        goto end;
+    }
+
+    // keep the indexed entries as they are, so that their offsets hold,
+    // and replace whatever follows them
+    struct cpio_entry ent;
+    const cpiofs_index_t *index = &fs.index;
+    cpio_off_t cut = 0;
+    if (index->count > 0) {
+        cpio_off_t last = index->entry[index->count - 1U];
+        cpio_decode((const struct header_old_cpio*)&data[last], (unsigned long)fsize - last, &ent);
+        cut = last + ent.next;
+    }
+    if (!cpio_decode((const struct header_old_cpio*)&data[index->trailer], (unsigned long)fsize - index->trailer, &ent)) {
+        result = -4;
+        fprintf(stderr, "no trailer in: %s\n", argv[first]);
+        goto end;
+    }
+    int format = ent.format;
+    uint8_t hdr[CPIO_HEADER_MAX];
+    size_t hsize = put_header(hdr, format, CPIOFS_INDEX_NAME, 0100444, 0, 0);
+    size_t at = hsize + sizeof(CPIOFS_INDEX_NAME);
+    if (format != CPIO_FORMAT_ODC) {
+        unsigned int align = (format == CPIO_FORMAT_BIN) || (format == CPIO_FORMAT_BIN_SWAP) ? 2U : 4U;
+        at = (at + align - 1U) / align * align;
+    }
+    if (cpiofs_index_save(&fs, cut + (cpio_off_t)at, &blob, &blob_size) != CPIO_ERR_OK) {
+        result = -6;
+        fprintf(stderr, "impossible to save the index of: %s\n", argv[first]);
+        goto end;
+    }
+
+    static const uint8_t zero[512] = { 0 };
+    uint64_t pos = cut;
+    if ((fwrite(data, 1, cut, out) != cut) ||
+        (put_entry(out, &pos, format, CPIOFS_INDEX_NAME, 0100444, blob, blob_size) != 0) ||
+        (put_entry(out, &pos, format, "TRAILER!!!", 0, NULL, 0) != 0) ||
+        (fwrite(zero, 1, (512U - pos % 512U) % 512U, out) != (512U - pos % 512U) % 512U)) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+        goto end;
+    }
+    fprintf(stderr, "%s: %" PRIu32 " entries, %" PRIu32 " bytes of index\n", argv[first + 1], index->count,
+            (uint32_t)blob_size);
+
+end:
+    if ((out != NULL) && (fclose(out) != 0) && (result == 0)) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+    }
+    free(blob);
+    cpiofs_unmount(&fs);
+    free(data);
+    fclose(fp);
+    return result;
+}
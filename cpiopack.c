@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "cpiofs.h"
+
+// Pack a plain archive into a seekable compressed one, for
+// cpiofs_mount_compressed
+//
+// usage: cpiopack [-c chunk_size] [-l level] <archive.cpio> <archive.cpz>
+//   -c <chunk size>  bytes per chunk, a power of two up to 16 MiB (65536)
+//   -l <level>       zlib level, 1 to 9 (9)
+//
+// Smaller chunks inflate less for every random read, bigger chunks
+// compress better.
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-c chunk_size] [-l level] <archive.cpio> <archive.cpz>\n", prog);
+}
+
+int main(int argc, char** argv) {
+    int result = 0;
+    cpio_size_t chunk_size = 65536;
+    int level = 9;
+    uint8_t *data = NULL;
+    void *packed = NULL;
+    cpio_size_t packed_size = 0;
+    FILE *out = NULL;
+    int first = 1;
+
+    for (; (first + 1 < argc) && (argv[first][0] == '-'); first += 2) {
+        if (argv[first][1] == 'c') {
+            chunk_size = (cpio_size_t)strtoul(argv[first + 1], NULL, 0);
+        } else if (argv[first][1] == 'l') {
+            level = (int)strtol(argv[first + 1], NULL, 0);
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (first + 2 != argc) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    FILE *fp = fopen(argv[first], "rb");
+    if (NULL == fp) {
+        fprintf(stderr, "impossible to read file: %s\n", argv[first]);
+        return -2;
+    }
+    fseek(fp, 0, SEEK_END);
+    long fsize = ftell(fp);
+    rewind(fp);
+    data = (fsize > 0) ? malloc(fsize) : NULL;
+    if ((NULL == data) || (fread(data, 1, fsize, fp) != (size_t)fsize)) {
+        result = -3;
+        fprintf(stderr, "impossible to load: %s\n", argv[first]);
+        goto end;
+    }
+
+    int ret = cpiofs_pack(data, (cpio_size_t)fsize, chunk_size, level, &packed, &packed_size);
+    if (ret != CPIO_ERR_OK) {
+        result = -4;
+        fprintf(stderr, "impossible to pack: %s (%d)\n", argv[first], ret);
+        goto end;
+    }
+
+    out = fopen(argv[first + 1], "wb");
+    if ((NULL == out) || (fwrite(packed, 1, packed_size, out) != packed_size)) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+        goto end;
+    }
+    fprintf(stderr, "%s: %ld bytes, %" PRIu32 " chunks of %" PRIu32 " bytes, %" PRIu32 " bytes packed\n",
+            argv[first + 1], fsize, (uint32_t)((fsize + chunk_size - 1) / chunk_size), (uint32_t)chunk_size,
+            (uint32_t)packed_size);
+
+end:
+    if ((out != NULL) && (fclose(out) != 0) && (result == 0)) {
+        result = -5;
+        fprintf(stderr, "impossible to write: %s\n", argv[first + 1]);
+    }
+    free(packed);
+    free(data);
+    fclose(fp);
+    return result;
+}
@@ -1,3 +1,4 @@
 #!/bin/sh
+# usage: build.sh [bin|odc|newc|crc]
 cd $(dirname "$0")
-find ./ -depth -print | cpio -ov > ../tree.cpio
+find ./ -depth -print | cpio -ov -H ${1:-bin} > ../tree.cpio
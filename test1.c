@@ -1,10 +1,18 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "cpiofs.h"
+#include "cpiofs_priv.h"
 
 off_t fsize(const char *filename) {
     struct stat st; 
@@ -189,73 +197,2170 @@ int test_cpiofs_dir(cpiofs_t *cpiofs) {
     return 0;
 }
 
-int main(int argc, char** argv) {
-    int result = 0;
-    FILE *fp = NULL;
-    uint8_t *data = NULL;
+static int test_cpio_hex(void) {
+    const char *fields = "0123456789abcdefABCDEF0000000001ffffffff0000000a";
+    const uint32_t expected[6] = { 0x01234567, 0x89abcdef, 0xABCDEF00, 0x00000001, 0xffffffff, 0x0000000a };
+    uint32_t out[6];
+    char bad[49];
 
-    if (argc < 2) {
-        result = -1;
-        fprintf(stderr, "required 1 parameter\n");
+    if (!cpio_hex_decode_scalar(fields, out, 6) || (memcmp(out, expected, sizeof(out)) != 0)) {
+        fprintf(stderr, "scalar hex decode failed\n");
+        return -1;
+    }
+    if (!cpio_hex_decode(fields, out, 6) || (memcmp(out, expected, sizeof(out)) != 0)) {
+        fprintf(stderr, "hex decode failed\n");
+        return -1;
+    }
+    for (unsigned int i = 0; i < 48; i++) {
+        memcpy(bad, fields, sizeof(bad));
+        bad[i] = (i % 2) ? 'g' : '/';
+        if (cpio_hex_decode(bad, out, 6) || cpio_hex_decode_scalar(bad, out, 6)) {
+            fprintf(stderr, "hex decode has to reject position %u\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int test_cpiofs_mount(const uint8_t *data, long size) {
+    cpiofs_t cpiofs;
+    cpio_info_t info;
+    cpio_file_t file;
+
+    if (cpiofs_mount(&cpiofs, data, size) != CPIO_ERR_OK) {
+        fprintf(stderr, "mount failed\n");
+        return -1;
+    }
+    if ((test_cpiofs_stat(&cpiofs) == -1) || (test_cpiofs_dir(&cpiofs) == -1)) {
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    if (cpiofs_stat(&cpiofs, "./dir1/none.txt", &info) != CPIO_ERR_NEXIST) {
+        fprintf(stderr, "./dir1/none.txt has not to exist\n");
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    cpio_dir_t dir;
+    if (cpiofs_dir_open(&cpiofs, &dir, "dir1") != CPIO_ERR_OK) {
+        fprintf(stderr, "dir1 error opendir\n");
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    if ((cpiofs_dir_read(&dir, &info) != 1) || (info.filenames != 9) || 
+        (strncmp(info.filename, "file2.txt", info.filenames) != 0) || (info.size != 10)) {
+        fprintf(stderr, "dir1 has to list file2.txt\n");
+        cpiofs_dir_close(&dir);
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    cpiofs_dir_close(&dir);
+
+    if (cpiofs_file_open(&cpiofs, &file, "dir1") != CPIO_ERR_NEXIST) {
+        fprintf(stderr, "dir1 is not a regular file\n");
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    if (cpiofs_file_open(&cpiofs, &file, "/dir1/file2.txt") != CPIO_ERR_OK) {
+        fprintf(stderr, "/dir1/file2.txt has to be opened\n");
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    const void *view;
+    cpio_size_t view_size;
+    if ((cpiofs_file_view(&file, &view, &view_size) != CPIO_ERR_OK) || (view_size != 10) ||
+        (memcmp(view, "file2.txt\n", 10) != 0)) {
+        fprintf(stderr, "/dir1/file2.txt view has to contain file2.txt\n");
+        cpiofs_file_close(&file);
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    if ((cpiofs_file_seek(&file, 6, CPIO_SEEK_SET) != 6) || 
+        (cpiofs_file_view_read(&file, &view, 16) != 4) || (memcmp(view, "txt\n", 4) != 0) ||
+        (cpiofs_file_view_read(&file, &view, 16) != 0)) {
+        fprintf(stderr, "/dir1/file2.txt view from position 6 has to contain txt\n");
+        cpiofs_file_close(&file);
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    if (cpiofs_unmount(&cpiofs) != CPIO_ERR_BUSY) {
+        fprintf(stderr, "unmount has to fail with open files\n");
+        return -1;
+    }
+    cpiofs_file_close(&file);
+    if (cpiofs_unmount(&cpiofs) != CPIO_ERR_OK) {
+        fprintf(stderr, "unmount failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+struct mem_store {
+    const uint8_t *data;
+    long size;
+    unsigned int reads;
+};
+
+static cpio_ssize_t mem_store_read(void *ctx, cpio_off_t off, void *buffer, cpio_size_t size) {
+    struct mem_store *store = ctx;
+    if ((long)off + (long)size > store->size) {
+        return CPIO_ERR_IO;
+    }
+    store->reads ++;
+    memcpy(buffer, &store->data[off], size);
+    return size;
+}
+
+static int test_cpiofs_store(const uint8_t *data, long size) {
+    struct mem_store store = { data, size, 0 };
+    cpiofs_t cpiofs;
+    cpio_file_t file;
+    cpiofs_cache_stats_t stats;
+    char buffer[16];
+    const void *view;
+    cpio_size_t view_size;
+
+    // two tiny blocks, so that the mount keeps evicting
+    if (cpiofs_mount_store(&cpiofs, mem_store_read, &store, size, 64, 2) != CPIO_ERR_OK) {
+        fprintf(stderr, "store mount failed\n");
+        return -1;
+    }
+    if ((test_cpiofs_stat(&cpiofs) == -1) || (test_cpiofs_dir(&cpiofs) == -1)) {
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    if (cpiofs_file_open(&cpiofs, &file, "./dir1/file2.txt") != CPIO_ERR_OK) {
+        fprintf(stderr, "./dir1/file2.txt has to be opened from the store\n");
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    if ((cpiofs_file_read(&file, buffer, sizeof(buffer)) != 10) || (memcmp(buffer, "file2.txt\n", 10) != 0) ||
+        (cpiofs_file_view(&file, &view, &view_size) != CPIO_ERR_NOTSUP)) {
+        fprintf(stderr, "./dir1/file2.txt has to be read from the store\n");
+        cpiofs_file_close(&file);
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    cpiofs_file_close(&file);
+    if ((cpiofs_cache_stats(&cpiofs, &stats) != CPIO_ERR_OK) || (stats.misses == 0) ||
+        (stats.misses > store.reads)) {
+        fprintf(stderr, "cache stats are wrong\n");
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    return cpiofs_unmount(&cpiofs) == CPIO_ERR_OK ? 0 : -1;
+}
+
+static int test_cpiofs_compressed(const uint8_t *data, long size) {
+    cpiofs_t cpiofs;
+    cpio_file_t file;
+    void *packed = NULL;
+    cpio_size_t packed_size = 0;
+    char buffer[16];
+
+    // chunks smaller than the headers, so that reads cross them
+    int ret = cpiofs_pack(data, size, 64, 6, &packed, &packed_size);
+    if (ret == CPIO_ERR_NOTSUP) {
+        return 0;
+    }
+    if (ret != CPIO_ERR_OK) {
+        fprintf(stderr, "pack failed\n");
+        return -1;
+    }
+    struct mem_store store = { packed, packed_size, 0 };
+    if (cpiofs_mount_compressed(&cpiofs, mem_store_read, &store, 2) != CPIO_ERR_OK) {
+        fprintf(stderr, "compressed mount failed\n");
+        free(packed);
+        return -1;
+    }
+    if ((test_cpiofs_stat(&cpiofs) == -1) || (test_cpiofs_dir(&cpiofs) == -1)) {
+        cpiofs_unmount(&cpiofs);
+        free(packed);
+        return -1;
+    }
+    if (cpiofs_file_open(&cpiofs, &file, "./dir1/file2.txt") != CPIO_ERR_OK) {
+        fprintf(stderr, "./dir1/file2.txt has to be opened from the compressed archive\n");
+        cpiofs_unmount(&cpiofs);
+        free(packed);
+        return -1;
+    }
+    ret = 0;
+    if ((cpiofs_file_seek(&file, 4, CPIO_SEEK_SET) != 4) ||
+        (cpiofs_file_read(&file, buffer, sizeof(buffer)) != 6) || (memcmp(buffer, "2.txt\n", 6) != 0)) {
+        fprintf(stderr, "./dir1/file2.txt has to be read from the compressed archive\n");
+        ret = -1;
+    }
+    cpiofs_file_close(&file);
+    if (cpiofs_unmount(&cpiofs) != CPIO_ERR_OK) {
+        ret = -1;
+    }
+    // a container cut before the end of its last chunk
+    store.size = packed_size - 1;
+    if (cpiofs_mount_compressed(&cpiofs, mem_store_read, &store, 2) == CPIO_ERR_OK) {
+        fprintf(stderr, "a truncated container has not to be mounted\n");
+        cpiofs_unmount(&cpiofs);
+        ret = -1;
+    }
+    // a chunk_size too large to allocate
+    store.size = packed_size;
+    ((uint8_t*)packed)[15] = 0x40;
+    if (cpiofs_mount_compressed(&cpiofs, mem_store_read, &store, 2) == CPIO_ERR_OK) {
+        fprintf(stderr, "a 1 GiB chunk_size has not to be mounted\n");
+        cpiofs_unmount(&cpiofs);
+        ret = -1;
+    }
+    // a plain archive is not a container
+    store.data = data;
+    store.size = size;
+    if (cpiofs_mount_compressed(&cpiofs, mem_store_read, &store, 2) == CPIO_ERR_OK) {
+        fprintf(stderr, "a plain archive has not to be mounted compressed\n");
+        cpiofs_unmount(&cpiofs);
+        ret = -1;
+    }
+    free(packed);
+    return ret;
+}
+
+// A newc header and its name, returns the data offset
+static size_t put_newc_header(uint8_t *b, const char *name, uint32_t mode, uint32_t size) {
+    uint32_t namesize = (uint32_t)strlen(name) + 1U;
+    char hdr[111];
+    snprintf(hdr, sizeof(hdr), "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+             0U, (unsigned int)mode, 0U, 0U, 1U, 0U, (unsigned int)size, 0U, 0U, 0U, 0U, (unsigned int)namesize, 0U);
+    size_t at = (110U + namesize + 3U) & ~(size_t)3U;
+    memset(b, 0, at);
+    memcpy(b, hdr, 110);
+    memcpy(&b[110], name, namesize);
+    return at;
+}
+
+// A newc entry with zero filled data, returns its size
+static size_t put_newc(uint8_t *b, const char *name, uint32_t mode, uint32_t size) {
+    size_t at = put_newc_header(b, name, mode, size);
+    memset(&b[at], 0, (size + 3U) & ~3U);
+    return at + ((size + 3U) & ~3U);
+}
+
+static int test_cpiofs_index_save(const uint8_t *data, long size) {
+    cpiofs_t cpiofs;
+    void *blob = NULL;
+    cpio_size_t blob_size = 0;
+    int ret = 0;
+
+    if (cpiofs_mount(&cpiofs, data, size) != CPIO_ERR_OK) {
+        return -1;
+    }
+    if (cpiofs_index_save(&cpiofs, 0, &blob, &blob_size) != CPIO_ERR_OK) {
+        fprintf(stderr, "index save failed\n");
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    cpiofs_unmount(&cpiofs);
+
+    // the tables are used in place, nothing is allocated
+    if ((cpiofs_mount_index(&cpiofs, data, size, blob, blob_size) != CPIO_ERR_OK) || (cpiofs.index.mem != NULL)) {
+        fprintf(stderr, "saved index not used\n");
+        ret = -1;
+    } else if ((test_cpiofs_stat(&cpiofs) == -1) || (test_cpiofs_dir(&cpiofs) == -1)) {
+        ret = -1;
+    }
+    cpiofs_unmount(&cpiofs);
+
+    // a damaged index is rebuilt from the headers
+    ((uint8_t*)blob)[0] ^= 1;
+    if ((cpiofs_mount_index(&cpiofs, data, size, blob, blob_size) != CPIO_ERR_OK) || (cpiofs.index.mem == NULL)) {
+        fprintf(stderr, "damaged index has to be rebuilt\n");
+        ret = -1;
+    } else if (test_cpiofs_stat(&cpiofs) == -1) {
+        ret = -1;
+    }
+    cpiofs_unmount(&cpiofs);
+    free(blob);
+
+    // the index of another archive whose last entry and trailer are at
+    // the same offsets is rebuilt too
+    uint8_t image[2][512];
+    cpio_size_t image_size = 0;
+    for (unsigned int k = 0; k < 2; k++) {
+        size_t at = put_newc(image[k], (k == 0) ? "x" : "abcdef", 0100644, (k == 0) ? 8 : 0);
+        at += put_newc(&image[k][at], "last", 0100644, 4);
+        at += put_newc(&image[k][at], "TRAILER!!!", 0, 0);
+        image_size = (cpio_size_t)at;
+    }
+    if (cpiofs_mount(&cpiofs, image[0], image_size) != CPIO_ERR_OK) {
+        return -1;
+    }
+    if (cpiofs_index_save(&cpiofs, 0, &blob, &blob_size) != CPIO_ERR_OK) {
+        ret = -1;
+    }
+    cpiofs_unmount(&cpiofs);
+    if (ret == 0) {
+        if ((cpiofs_mount_index(&cpiofs, image[1], image_size, blob, blob_size) != CPIO_ERR_OK) ||
+            (cpiofs.index.mem == NULL)) {
+            fprintf(stderr, "index of another archive has to be rebuilt\n");
+            ret = -1;
+        }
+        cpiofs_unmount(&cpiofs);
+        free(blob);
+    }
+    return ret;
+}
+
+static int test_cpiofs_arena(const uint8_t *data, long size) {
+    cpiofs_t cpiofs;
+    cpio_size_t need = 0;
+    int ret = -1;
+
+    if ((cpiofs_mount_arena_size(data, size, &need) != CPIO_ERR_OK) || (need == 0)) {
+        fprintf(stderr, "arena size has to be known\n");
+        return -1;
+    }
+    // a guard after the arena has to stay untouched
+    uint64_t *arena = malloc(need + 64U);
+    if (arena == NULL) {
+        return -1;
+    }
+    memset(arena, 0xa5, need + 64U);
+    if ((cpiofs_mount_arena(&cpiofs, data, size, arena, need - 8U) != CPIO_ERR_NOMEM) ||
+        (cpiofs_mount_arena(&cpiofs, data, size, (uint8_t*)arena + 4, need) != CPIO_ERR_PARAM)) {
+        fprintf(stderr, "arena has to be refused when short or unaligned\n");
         goto end;
     }
-    
-    fp = fopen(argv[1], "r");
-    if (NULL == fp) {
-        result = -2;
-        fprintf(stderr, "impossible to read file: %s\n", argv[1]);
+    if ((cpiofs_mount_arena(&cpiofs, data, size, arena, need) != CPIO_ERR_OK) || (cpiofs.index.mem != NULL)) {
+        fprintf(stderr, "arena mount failed\n");
         goto end;
     }
-
-    fseek(fp, 0, SEEK_END);
-    long fsize = ftell(fp);
-    rewind(fp);
-    if (fsize <= 0) {
-        result = -3;
-        fprintf(stderr, "impossible to have good filesize for: %s\n", argv[1]);
+    if ((test_cpiofs_stat(&cpiofs) == -1) || (test_cpiofs_dir(&cpiofs) == -1)) {
+        cpiofs_unmount(&cpiofs);
         goto end;
     }
-
-    data = malloc(fsize);
-    if (NULL == data) {
-        result = -4;
-        fprintf(stderr, "impossible to have take memory for: %s\n", argv[1]);
+    if (cpiofs_unmount(&cpiofs) != CPIO_ERR_OK) {
         goto end;
     }
+    for (cpio_size_t i = need; i < need + 64U; i++) {
+        if (((const uint8_t*)arena)[i] != 0xa5) {
+            fprintf(stderr, "arena mount wrote past the size it asked for\n");
+            goto end;
+        }
+    }
+    ret = 0;
+end:
+    free(arena);
+    return ret;
+}
+
+static int test_cpiofs_many(cpiofs_t *cpiofs) {
+    static const char *const paths[] = {
+        "./dir1/file2.txt", "none.txt", "./", "file_empty.txt", "dir1", "/dir1/file2.txt", "./file_empty.txt",
+    };
+    const uint32_t n = sizeof(paths) / sizeof(paths[0]);
+    cpio_info_t infos[sizeof(paths) / sizeof(paths[0])];
+    cpio_file_t files[sizeof(paths) / sizeof(paths[0])];
+    int results[sizeof(paths) / sizeof(paths[0])];
+    int ret = 0;
+
+    if (cpiofs_stat_many(cpiofs, paths, n, infos, results) != (int)n - 1) {
+        fprintf(stderr, "stat_many has to find all but none.txt\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        cpio_info_t info;
+        int expected = cpiofs_stat(cpiofs, paths[i], &info);
+        if ((results[i] != expected) ||
+            ((expected == CPIO_ERR_OK) && ((infos[i].type != info.type) || (infos[i].size != info.size)))) {
+            fprintf(stderr, "stat_many differs from stat for %s\n", paths[i]);
+            return -1;
+        }
+    }
+    // the directories are not opened
+    if (cpiofs_open_many(cpiofs, paths, n, files, results) != 4) {
+        fprintf(stderr, "open_many has to open 4 files\n");
+        ret = -1;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if ((results[i] == CPIO_ERR_OK) != (files[i].fs != NULL)) {
+            ret = -1;
+        }
+        if ((results[i] == CPIO_ERR_OK) &&
+            ((cpiofs_file_size(&files[i]) != ((strstr(paths[i], "file2") != NULL) ? 10 : 0)) ||
+             (cpiofs_file_close(&files[i]) != CPIO_ERR_OK))) {
+            fprintf(stderr, "open_many opened the wrong file for %s\n", paths[i]);
+            ret = -1;
+        }
+    }
+    return ret;
+}
 
-    if (fread(data, 1, fsize, fp) != (size_t)fsize) {
-        result = -4;
-        fprintf(stderr, "impossible to read all data from: %s\n", argv[1]);
-        goto end;
+struct walk_check {
+    unsigned int events[3];
+    unsigned int max_depth;
+    int file2_depth;
+    int post_ok;
+    int prune;
+    unsigned int stop;
+};
+
+static int walk_check_cb(const cpio_info_t *info, unsigned int depth, cpiofs_walk_event_t event, void *ctx) {
+    struct walk_check *check = ctx;
+    int dir1 = (info->filenames == 4) && (memcmp(info->filename, "dir1", 4) == 0);
+    check->events[event] ++;
+    if (depth > check->max_depth) {
+        check->max_depth = depth;
+    }
+    if ((info->filenames == 9) && (memcmp(info->filename, "file2.txt", 9) == 0)) {
+        check->file2_depth = (int)depth;
+    }
+    if (dir1 && (event == CPIOFS_WALK_DIR_POST)) {
+        // the contents come before the directory is left
+        check->post_ok = (check->file2_depth >= 0);
+    }
+    if ((check->stop != 0) && (check->events[CPIOFS_WALK_FILE] + check->events[CPIOFS_WALK_DIR] == check->stop)) {
+        return CPIOFS_WALK_STOP;
+    }
+    return (check->prune && dir1 && (event == CPIOFS_WALK_DIR)) ? CPIOFS_WALK_PRUNE : CPIOFS_WALK_CONTINUE;
+}
+
+static int test_cpiofs_walk(const cpiofs_t *cpiofs) {
+    struct walk_check check = { .file2_depth = -1 };
+    if ((cpiofs_walk(cpiofs, "./", walk_check_cb, &check, CPIOFS_WALK_POSTORDER) != 6) ||
+        (check.events[CPIOFS_WALK_DIR] != 2) || (check.events[CPIOFS_WALK_DIR_POST] != 2) ||
+        (check.file2_depth != 2) || (check.max_depth != 2) || !check.post_ok) {
+        fprintf(stderr, "walk of ./ has to report 6 entries, 2 levels deep\n");
+        return -1;
+    }
+
+    memset(&check, 0, sizeof(check));
+    check.file2_depth = -1;
+    check.prune = 1;
+    if ((cpiofs_walk(cpiofs, "", walk_check_cb, &check, 0) != 5) || (check.file2_depth != -1) ||
+        (check.events[CPIOFS_WALK_DIR_POST] != 0)) {
+        fprintf(stderr, "walk has to skip the pruned dir1\n");
+        return -1;
+    }
+
+    memset(&check, 0, sizeof(check));
+    check.file2_depth = -1;
+    if ((cpiofs_walk(cpiofs, "dir1/", walk_check_cb, &check, 0) != 2) || (check.file2_depth != 1)) {
+        fprintf(stderr, "walk of dir1 has to report dir1 and file2.txt\n");
+        return -1;
+    }
+
+    memset(&check, 0, sizeof(check));
+    check.stop = 3;
+    if ((cpiofs_walk(cpiofs, "/", walk_check_cb, &check, CPIOFS_WALK_POSTORDER) != 3) ||
+        (cpiofs_walk(cpiofs, "none", walk_check_cb, &check, 0) != CPIO_ERR_NEXIST)) {
+        fprintf(stderr, "walk has to stop when asked\n");
+        return -1;
+    }
+    return 0;
+}
+
+struct glob_check {
+    char paths[4][32];
+    int count;
+    int stop;
+};
+
+static int glob_check_cb(const cpio_info_t *info, void *ctx) {
+    struct glob_check *check = ctx;
+    size_t len;
+    const char *path = cpio_name_path(info->filepath, info->filepaths, &len);
+    if ((check->count < 4) && (len < sizeof(check->paths[0]))) {
+        memcpy(check->paths[check->count], path, len);
+        check->paths[check->count][len] = '\0';
+    }
+    check->count ++;
+    return check->count == check->stop;
+}
+
+static int test_cpiofs_glob(const cpiofs_t *cpiofs) {
+    static const struct {
+        const char *pattern;
+        int count;
+        const char *first;
+    } cases[] = {
+        { "*", 4, "build.sh" },
+        { "./**/*.txt", 3, "dir1/file2.txt" },
+        { "*/", 1, "dir1" },
+        { "/file[0-9].txt", 1, "file1.txt" },
+        { "dir1/f?le2.*", 1, "dir1/file2.txt" },
+        { "file[!1]*", 1, "file_empty.txt" },
+        { "dir1/**", 1, "dir1/file2.txt" },
+        { "none*", 0, NULL },
+    };
+    for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        struct glob_check check = { .count = 0 };
+        if ((cpiofs_glob(cpiofs, cases[i].pattern, glob_check_cb, &check) != cases[i].count) ||
+            ((cases[i].first != NULL) && (strcmp(check.paths[0], cases[i].first) != 0))) {
+            fprintf(stderr, "glob %s has to find %d paths\n", cases[i].pattern, cases[i].count);
+            return -1;
+        }
+    }
+    // sorted, not in archive order
+    struct glob_check check = { .stop = 0 };
+    if ((cpiofs_glob(cpiofs, "**/*.txt", glob_check_cb, &check) != 3) || (strcmp(check.paths[1], "file1.txt") != 0) ||
+        (strcmp(check.paths[2], "file_empty.txt") != 0)) {
+        fprintf(stderr, "glob has to report the paths in order\n");
+        return -1;
+    }
+    check.count = 0;
+    check.stop = 2;
+    if (cpiofs_glob(cpiofs, "*", glob_check_cb, &check) != 2) {
+        fprintf(stderr, "glob has to stop when asked\n");
+        return -1;
+    }
+    return 0;
+}
+
+#define PREAD_THREADS   4
+#define PREAD_ROUNDS    2000
+
+static void* pread_worker(void *arg) {
+    const cpio_file_t *file = arg;
+    static const char expected[] = "file2.txt\n";
+    char buffer[16];
+    for (unsigned int i = 0; i < PREAD_ROUNDS; i++) {
+        cpio_off_t off = i % 10U;
+        cpio_ssize_t n = cpiofs_file_pread(file, buffer, sizeof(buffer), off);
+        if ((n != (cpio_ssize_t)(10U - off)) || (memcmp(buffer, &expected[off], n) != 0)) {
+            return (void*)file;
+        }
+    }
+    return NULL;
+}
+
+static int test_cpiofs_pread(const uint8_t *data, long size) {
+    struct mem_store store = { data, size, 0 };
+    cpiofs_t mounted[2];
+    cpio_file_t file;
+    pthread_t threads[PREAD_THREADS];
+    char buffer[4];
+    int ret = 0;
+
+    if ((cpiofs_mount(&mounted[0], data, size) != CPIO_ERR_OK) ||
+        (cpiofs_mount_store(&mounted[1], mem_store_read, &store, size, 64, 2) != CPIO_ERR_OK)) {
+        return -1;
+    }
+    for (unsigned int m = 0; (ret == 0) && (m < 2U); m++) {
+        if (cpiofs_file_open(&mounted[m], &file, "./dir1/file2.txt") != CPIO_ERR_OK) {
+            ret = -1;
+            break;
+        }
+        // the same open file, read from every thread
+        unsigned int started = 0;
+        for (; started < PREAD_THREADS; started++) {
+            if (pthread_create(&threads[started], NULL, pread_worker, &file) != 0) {
+                ret = -1;
+                break;
+            }
+        }
+        for (unsigned int t = 0; t < started; t++) {
+            void *failed = NULL;
+            pthread_join(threads[t], &failed);
+            if (failed != NULL) {
+                fprintf(stderr, "concurrent pread failed\n");
+                ret = -1;
+            }
+        }
+        if ((cpiofs_file_tell(&file) != 0) || (cpiofs_file_pread(&file, buffer, sizeof(buffer), 10) != 0) ||
+            (cpiofs_file_pread(&file, buffer, sizeof(buffer), 11) != CPIO_ERR_SEEK_OUT)) {
+            fprintf(stderr, "pread has to leave the position alone\n");
+            ret = -1;
+        }
+        cpiofs_file_close(&file);
+    }
+    if ((cpiofs_unmount(&mounted[0]) != CPIO_ERR_OK) || (cpiofs_unmount(&mounted[1]) != CPIO_ERR_OK)) {
+        ret = -1;
+    }
+    return ret;
+}
+
+struct verify_worker {
+    cpiofs_t *fs;
+    int count;
+};
+
+static void* verify_worker(void *arg) {
+    struct verify_worker *w = arg;
+    for (unsigned int i = 0; i < 50U; i++) {
+        if (cpiofs_verify(w->fs, 1, NULL) != w->count) {
+            return w;
+        }
     }
+    return NULL;
+}
 
+static int test_cpiofs_verify(const uint8_t *data, long size) {
+    struct mem_store store = { data, size, 0 };
     cpiofs_t cpiofs = {
         .head = (const struct header_old_cpio *)data,
-        .size = fsize,
-        .resource_count = 0,
+        .size = size,
     };
+    cpiofs_t mounted;
+    cpio_file_t file;
+    cpio_off_t bad = 0;
+    uint8_t bytes[1000];
+    int ret = 0;
 
-#if 1
-    {
-        unsigned long ufsize = (unsigned long)fsize;
-        for (const struct header_old_cpio* pdata = cpio_init_iter(data, ufsize); 
-            pdata != NULL; 
-            pdata = cpio_goto_next(pdata, &ufsize)) {
-            print_file(pdata, ufsize);
-            printf("\n+++++++++++++++++++\n");
+    for (unsigned int i = 0; i < sizeof(bytes); i++) {
+        bytes[i] = (uint8_t)(i * 7U + 0x80U);
+    }
+    for (unsigned int n = 0; n <= sizeof(bytes); n += 37U) {
+        if (cpio_sum(&bytes[sizeof(bytes) - n], n) != cpio_sum_scalar(&bytes[sizeof(bytes) - n], n)) {
+            fprintf(stderr, "byte sum of %u bytes failed\n", n);
+            return -1;
         }
     }
-#endif
 
-    if (test_cpiofs_stat(&cpiofs) == -1) {
-        result = -5;
-        fprintf(stderr, "failed test_cpiofs: %s\n", argv[1]);
+    int count = cpiofs_verify(&cpiofs, 0, NULL);
+    if ((count <= 0) || (cpiofs_verify(&cpiofs, 1, NULL) != count) || (cpiofs_verify(&cpiofs, 3, NULL) != count)) {
+        fprintf(stderr, "verify failed: %d\n", count);
+        return -1;
+    }
+    if ((cpiofs_mount_store(&mounted, mem_store_read, &store, size, 64, 2) != CPIO_ERR_OK) ||
+        (cpiofs_verify(&mounted, 0, NULL) != count)) {
+        fprintf(stderr, "verify through a backing store failed\n");
+        return -1;
+    }
+    // the headers of the store are read by every thread at once
+    struct verify_worker worker = { &mounted, count };
+    pthread_t threads[PREAD_THREADS];
+    unsigned int started = 0;
+    for (; (started < PREAD_THREADS) &&
+           (pthread_create(&threads[started], NULL, verify_worker, &worker) == 0); started++) {
+    }
+    for (unsigned int t = 0; t < started; t++) {
+        void *failed = NULL;
+        pthread_join(threads[t], &failed);
+        ret |= (failed != NULL) ? -1 : 0;
+    }
+    if ((started < PREAD_THREADS) || (ret != 0) || (cpiofs_unmount(&mounted) != CPIO_ERR_OK)) {
+        fprintf(stderr, "concurrent verify through a backing store failed\n");
+        return -1;
+    }
+
+    uint8_t *copy = malloc(size);
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, data, size);
+    if (cpiofs_mount(&mounted, copy, size) != CPIO_ERR_OK) {
+        free(copy);
+        return -1;
+    }
+    cpio_off_t trailer = mounted.index.trailer;
+    if (cpiofs_file_open(&mounted, &file, "./dir1/file2.txt") != CPIO_ERR_OK) {
+        cpiofs_unmount(&mounted);
+        free(copy);
+        return -1;
+    }
+    cpio_off_t head = (cpio_off_t)((const uint8_t*)file.head - copy);
+    copy[file.data] ^= 0x01;
+    cpiofs_file_close(&file);
+
+    // only the crc format has a checksum to catch the change
+    int crc = (cpio_get_magic(mounted.head) == 070702);
+    ret = cpiofs_verify(&mounted, 0, &bad);
+    if ((crc && ((ret != CPIO_ERR_CORRUPT) || (bad != head))) || (!crc && (ret != count))) {
+        fprintf(stderr, "verify of changed data returned %d at %u\n", ret, (unsigned int)bad);
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+    cpiofs_unmount(&mounted);
+
+    // an archive cut before its trailer
+    cpiofs.head = (const struct header_old_cpio *)copy;
+    cpiofs.size = trailer;
+    if ((cpiofs_verify(&cpiofs, 0, &bad) != CPIO_ERR_CORRUPT) || (bad != trailer)) {
+        fprintf(stderr, "verify has to catch the missing trailer\n");
+        ret = -1;
+    }
+    free(copy);
+    return ret;
+}
+
+
+// A name longer than the 16 bits path lengths of the index is refused
+// like any bad header, instead of being cut to its low bits
+static int test_cpiofs_long_name(void) {
+    const size_t len = 0x10000U + 40U;
+    uint8_t *image = malloc(len + 1024U);
+    char *name = malloc(len + 1U);
+    cpiofs_t cpiofs;
+    cpio_info_t info;
+    int ret = -1;
+    if ((image == NULL) || (name == NULL)) {
+        goto end;
+    }
+    memset(name, 'n', len);
+    name[len] = '\0';
+    size_t at = put_newc(image, "a", 0100644, 1);
+    at += put_newc(&image[at], name, 0100644, 0);
+    at += put_newc(&image[at], "TRAILER!!!", 0, 0);
+    if (cpiofs_mount(&cpiofs, image, (cpio_size_t)at) != CPIO_ERR_OK) {
         goto end;
     }
+    // the chain stops at the long name, a is all there is
+    if ((cpiofs.index.count != 1U) || (cpiofs_stat(&cpiofs, "a", &info) != CPIO_ERR_OK)) {
+        fprintf(stderr, "a name of %zu bytes has not to be cut\n", len);
+    } else {
+        ret = 0;
+    }
+    cpiofs_unmount(&cpiofs);
+end:
+    free(name);
+    free(image);
+    return ret;
+}
 
-    if (test_cpiofs_dir(&cpiofs) == -1) {
-        result = -5;
-        fprintf(stderr, "failed test_cpiofs_dir: %s\n", argv[1]);
+struct send_sink {
+    int fd;
+    uint8_t *buffer;
+    size_t size;
+    size_t got;
+};
+
+// Reads what is sent until the other end is closed
+static void* send_sink_read(void *arg) {
+    struct send_sink *sink = arg;
+    for (;;) {
+        uint8_t scratch[256];
+        uint8_t *to = (sink->got < sink->size) ? &sink->buffer[sink->got] : scratch;
+        size_t room = (sink->got < sink->size) ? sink->size - sink->got : sizeof(scratch);
+        ssize_t r = read(sink->fd, to, room);
+        if (r <= 0) {
+            break;
+        }
+        sink->got += (size_t)r;
+    }
+    return NULL;
+}
+
+// Send path in two parts to a pipe, or to a socket on its way to the
+// pipe, and compare with what has to arrive
+static int sendfile_check(cpiofs_t *cpiofs, int socket, const char *path, const uint8_t *expect, size_t size) {
+    cpio_file_t file;
+    int fds[2];
+    struct send_sink sink = { .size = size };
+    pthread_t reader;
+    int ret = -1;
+
+    if (socket ? (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) : (pipe(fds) != 0)) {
+        return -1;
+    }
+    sink.fd = fds[0];
+    sink.buffer = malloc(size + 1U);
+    if ((sink.buffer == NULL) || (pthread_create(&reader, NULL, send_sink_read, &sink) != 0)) {
+        free(sink.buffer);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    cpio_size_t part = (cpio_size_t)size / 3U;
+    if ((cpiofs_file_open(cpiofs, &file, path) == CPIO_ERR_OK) &&
+        (cpiofs_file_sendfile(&file, fds[1], part) == (cpio_ssize_t)part) && (file.pos == part) &&
+        (cpiofs_file_sendfile(&file, fds[1], (cpio_size_t)size) == (cpio_ssize_t)(size - part)) &&
+        (file.pos == size) && (cpiofs_file_sendfile(&file, fds[1], 100) == 0)) {
+        ret = 0;
+    }
+    if (file.fs != NULL) {
+        cpiofs_file_close(&file);
+    }
+    close(fds[1]);
+    pthread_join(reader, NULL);
+    close(fds[0]);
+    if ((ret != 0) || (sink.got != size) || (memcmp(sink.buffer, expect, size) != 0)) {
+        fprintf(stderr, "sendfile of %s has to deliver it in two parts\n", path);
+        ret = -1;
+    }
+    free(sink.buffer);
+    return ret;
+}
+
+static int sendfile_all(cpiofs_t *cpiofs, const char *path, const uint8_t *expect, size_t size) {
+    return (sendfile_check(cpiofs, 0, path, expect, size) == -1) ||
+           (sendfile_check(cpiofs, 1, path, expect, size) == -1) ? -1 : 0;
+}
+
+// Mount path kept for sendfile, mapped, then image in memory
+static int sendfile_mounts(const char *archive, const uint8_t *data, long size, const char *path,
+                           const uint8_t *expect, size_t esize) {
+    static const unsigned int flags[] = { CPIOFS_MAP_KEEP_FD, 0 };
+    cpiofs_t cpiofs;
+    int ret = 0;
+    for (unsigned int k = 0; (k < 2) && (ret == 0); k++) {
+        if (cpiofs_mount_path(&cpiofs, archive, flags[k]) != CPIO_ERR_OK) {
+            return -1;
+        }
+        if (((flags[k] != 0) != (cpiofs.map_fd > 0)) || (sendfile_all(&cpiofs, path, expect, esize) == -1)) {
+            fprintf(stderr, "sendfile failed with map flags %u\n", flags[k]);
+            ret = -1;
+        }
+        cpiofs_unmount(&cpiofs);
+    }
+    if ((ret == 0) && (cpiofs_mount(&cpiofs, data, size) == CPIO_ERR_OK)) {
+        ret = sendfile_all(&cpiofs, path, expect, esize);
+        cpiofs_unmount(&cpiofs);
+    }
+    return ret;
+}
+
+static int test_cpiofs_sendfile(const char *archive, const uint8_t *data, long size) {
+    cpiofs_t cpiofs;
+    const uint8_t *small = (const uint8_t*)"file2.txt\n";
+    if (sendfile_mounts(archive, data, size, "./dir1/file2.txt", small, 10) == -1) {
+        return -1;
+    }
+    // through a buffer from a backing store
+    int fd = open(archive, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int ret = -1;
+    if (cpiofs_mount_store(&cpiofs, cpiofs_read_fd, &fd, (cpio_size_t)size, 512, 4) == CPIO_ERR_OK) {
+        ret = sendfile_all(&cpiofs, "./dir1/file2.txt", small, 10);
+        cpiofs_unmount(&cpiofs);
+    }
+    close(fd);
+    if (ret == -1) {
+        return -1;
+    }
+
+    // a file big enough for sendfile and splice, in an archive of its own
+    const uint32_t big = 300001;
+    uint8_t *image = calloc(1, big + 1024U);
+    char tmp[64];
+    int tfd = -1;
+    ret = -1;
+    if (image == NULL) {
+        return -1;
+    }
+    size_t head = put_newc_header(image, "big.bin", 0100644, big);
+    for (uint32_t i = 0; i < big; i++) {
+        image[head + i] = (uint8_t)(i * 7U + (i >> 8));
+    }
+    size_t at = head + ((big + 3U) & ~3U);
+    at += put_newc(&image[at], "TRAILER!!!", 0, 0);
+    snprintf(tmp, sizeof(tmp), "/tmp/cpiofs_send%ld", (long)getpid());
+    if (((tfd = open(tmp, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0) && (write(tfd, image, at) == (ssize_t)at)) {
+        ret = sendfile_mounts(tmp, image, (long)at, "big.bin", &image[head], big);
+    }
+    if (tfd >= 0) {
+        close(tfd);
+        unlink(tmp);
+    }
+    free(image);
+    return ret;
+}
+
+// Remove what cpiofs_extract made of fs under root, the deepest first
+static void extract_clean(const cpiofs_t *fs, const char *root) {
+    const cpiofs_index_t *index = &fs->index;
+    char path[512];
+    for (uint32_t r = 0; r < index->count; r++) {
+        uint32_t e = index->sorted[r];
+        snprintf(path, sizeof(path), "%s/%.*s", root, (int)index->name_len[e], &index->strings[index->name[e]]);
+        chmod(path, 0700);
+    }
+    for (uint32_t r = index->count; r > 0; r--) {
+        uint32_t e = index->sorted[r - 1U];
+        snprintf(path, sizeof(path), "%s/%.*s", root, (int)index->name_len[e], &index->strings[index->name[e]]);
+        remove(path);
+    }
+    rmdir(root);
+}
+
+// Compare the file at root/path with what it has to hold
+static int extract_check(const char *root, const char *path, const char *expect, size_t size, mode_t mode) {
+    char full[512];
+    char got[64];
+    struct stat st;
+    snprintf(full, sizeof(full), "%s/%s", root, path);
+    FILE *fp = fopen(full, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "cpiofs_extract did not write %s\n", path);
+        return -1;
+    }
+    size_t n = fread(got, 1, sizeof(got), fp);
+    fclose(fp);
+    if ((n != size) || (memcmp(got, expect, size) != 0) || (stat(full, &st) != 0) ||
+        ((st.st_mode & 07777) != mode) || (st.st_mtime != 0)) {
+        fprintf(stderr, "cpiofs_extract wrote %s wrong\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int test_cpiofs_extract(const char *archive, const uint8_t *data, long size) {
+    static const unsigned int flags[] = { 0, CPIOFS_EXTRACT_WRITE };
+    char root[64];
+    cpiofs_t cpiofs;
+    cpiofs_extract_stats_t stats;
+    snprintf(root, sizeof(root), "/tmp/cpiofs_extract%ld", (long)getpid());
+
+    // the test archive from its kept file, then from memory over it
+    for (unsigned int k = 0; k < 2; k++) {
+        if (cpiofs_mount_path(&cpiofs, archive, CPIOFS_MAP_KEEP_FD) != CPIO_ERR_OK) {
+            return -1;
+        }
+        cpiofs_t *fs = &cpiofs;
+        cpiofs_t memory;
+        if ((k == 1) && (cpiofs_mount(&memory, data, size) == CPIO_ERR_OK)) {
+            fs = &memory;
+        }
+        int ret = cpiofs_extract(fs, root, 2, flags[k], &stats);
+        cpio_info_t info;
+        cpiofs_stat(fs, "./dir1/file2.txt", &info);
+        char full[512];
+        struct stat st;
+        snprintf(full, sizeof(full), "%s/dir1/file2.txt", root);
+        if ((ret != CPIO_ERR_OK) || (stats.files < 1U) || (stats.dirs < 1U) || (stat(full, &st) != 0) ||
+            (st.st_size != 10) || ((st.st_mode & 07777) != (info.mode & 07777))) {
+            fprintf(stderr, "cpiofs_extract of %s with flags %u failed: %d\n", archive, flags[k], ret);
+            ret = -1;
+        }
+        if ((k == 1) || (ret == -1)) {
+            extract_clean(&cpiofs, root);
+        }
+        if (fs != &cpiofs) {
+            cpiofs_unmount(fs);
+        }
+        cpiofs_unmount(&cpiofs);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+
+    // a root, a path twice, one out of the destination, a directory left
+    // out, a link, a read only directory with a file in it and a pipe
+    static const struct {
+        const char *name;
+        uint32_t mode;
+        const char *data;
+    } entries[] = {
+        { "/", 040755, "" },
+        { "f", 0100644, "one" },
+        { "../evil", 0100644, "x" },
+        { "f", 0100640, "two!" },
+        { "deep/er/x", 0100600, "deeper" },
+        { "l", 0120777, "deep" },
+        { "ro", 040555, "" },
+        { "ro/y", 0100444, "y" },
+        { "p", 010644, "" },
+        { "TRAILER!!!", 0, "" },
+    };
+    uint8_t image[4096];
+    size_t at = 0;
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+        uint32_t n = (uint32_t)strlen(entries[i].data);
+        at += put_newc_header(&image[at], entries[i].name, entries[i].mode, n);
+        memset(&image[at], 0, (n + 3U) & ~3U);
+        memcpy(&image[at], entries[i].data, n);
+        at += (n + 3U) & ~3U;
+    }
+    if (cpiofs_mount(&cpiofs, image, (cpio_size_t)at) != CPIO_ERR_OK) {
+        return -1;
+    }
+    char link[16] = { 0 };
+    char full[512];
+    struct stat st;
+    snprintf(full, sizeof(full), "%s/l", root);
+    int ret = cpiofs_extract(&cpiofs, root, 0, 0, &stats);
+    if ((ret != CPIO_ERR_OK) || (stats.files != 3U) || (stats.dirs != 1U) || (stats.links != 1U) ||
+        (stats.skipped != 2U) || (stats.bytes != 11U) ||
+        (extract_check(root, "f", "two!", 4, 0640) == -1) ||
+        (extract_check(root, "deep/er/x", "deeper", 6, 0600) == -1) ||
+        (extract_check(root, "ro/y", "y", 1, 0444) == -1) ||
+        (readlink(full, link, sizeof(link) - 1U) != 4) || (strcmp(link, "deep") != 0) ||
+        (lstat(full, &st) != 0) || (st.st_mtime != 0)) {
+        fprintf(stderr, "cpiofs_extract of a made up archive failed: %d\n", ret);
+        ret = -1;
+    }
+    snprintf(full, sizeof(full), "%s/ro", root);
+    if ((ret == 0) && ((stat(full, &st) != 0) || ((st.st_mode & 07777) != 0555) || (st.st_mtime != 0))) {
+        fprintf(stderr, "cpiofs_extract left the directory mode or time wrong\n");
+        ret = -1;
+    }
+    snprintf(full, sizeof(full), "%s/../evil", root);
+    if ((ret == 0) && (stat(full, &st) == 0)) {
+        fprintf(stderr, "cpiofs_extract wrote out of the destination\n");
+        unlink(full);
+        ret = -1;
+    }
+    extract_clean(&cpiofs, root);
+    cpiofs_unmount(&cpiofs);
+    if (ret == -1) {
+        return -1;
+    }
+
+    // two hard links of a newc file, the data on the last one only
+    at = 0;
+    for (unsigned int i = 0; i < 2; i++) {
+        size_t head = put_newc_header(&image[at], (i == 0) ? "a" : "sub/b", 0100640, (i == 0) ? 0U : 5U);
+        memcpy(&image[at + 6U], "00000007", 8);
+        memcpy(&image[at + 6U + 8U * 4U], "00000002", 8);
+        at += head;
+    }
+    memcpy(&image[at], "link\n\0\0\0", 8);
+    at += 8U;
+    at += put_newc(&image[at], "TRAILER!!!", 0, 0);
+    if (cpiofs_mount(&cpiofs, image, (cpio_size_t)at) != CPIO_ERR_OK) {
+        return -1;
+    }
+    struct stat sb;
+    char other[512];
+    snprintf(full, sizeof(full), "%s/a", root);
+    snprintf(other, sizeof(other), "%s/sub/b", root);
+    ret = cpiofs_extract(&cpiofs, root, 2, 0, &stats);
+    if ((ret != CPIO_ERR_OK) || (stats.files != 2U) || (stats.bytes != 5U) ||
+        (extract_check(root, "a", "link\n", 5, 0640) == -1) ||
+        (extract_check(root, "sub/b", "link\n", 5, 0640) == -1) ||
+        (stat(full, &st) != 0) || (stat(other, &sb) != 0) || (st.st_ino != sb.st_ino)) {
+        fprintf(stderr, "cpiofs_extract of hard links failed: %d\n", ret);
+        ret = -1;
+    }
+    unlink(full);
+    unlink(other);
+    snprintf(other, sizeof(other), "%s/sub", root);
+    rmdir(other);
+    rmdir(root);
+    cpiofs_unmount(&cpiofs);
+    return ret;
+}
+
+struct write_sink {
+    uint8_t *bytes;
+    size_t size;
+    size_t room;
+};
+
+static cpio_ssize_t write_sink_put(void *ctx, const void *data, cpio_size_t size) {
+    struct write_sink *sink = ctx;
+    if (sink->size + size > sink->room) {
+        size_t room = (sink->room > 0) ? sink->room : 4096U;
+        while (room < sink->size + size) {
+            room *= 2U;
+        }
+        uint8_t *grown = realloc(sink->bytes, room);
+        if (grown == NULL) {
+            return CPIO_ERR_NOMEM;
+        }
+        sink->bytes = grown;
+        sink->room = room;
+    }
+    memcpy(&sink->bytes[sink->size], data, size);
+    sink->size += size;
+    return (cpio_ssize_t)size;
+}
+
+// Check the files written by test_cpiofs_writer, n bytes of the
+// pattern each
+static int writer_check(cpiofs_t *cpiofs, const char *const *paths, const uint32_t *sizes, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        cpio_file_t file;
+        const void *view;
+        cpio_size_t got;
+        if ((cpiofs_file_open(cpiofs, &file, paths[i]) != CPIO_ERR_OK) ||
+            (cpiofs_file_view(&file, &view, &got) != CPIO_ERR_OK)) {
+            fprintf(stderr, "cpiofs_writer lost %s\n", paths[i]);
+            return -1;
+        }
+        int ret = (got == sizes[i]) ? 0 : -1;
+        for (uint32_t j = 0; (j < got) && (ret == 0); j++) {
+            ret = (((const uint8_t*)view)[j] == (uint8_t)(j * 13U + i)) ? 0 : -1;
+        }
+        cpiofs_file_close(&file);
+        if (ret == -1) {
+            fprintf(stderr, "cpiofs_writer wrote %s wrong\n", paths[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// A newc archive with two hard links, the data on the last one, and a
+// device node of another owner, copied with cpiofs_writer_add_meta the
+// way cpioalign does, has to come out with the same headers
+static int writer_copy_links(void) {
+    static const struct {
+        const char *name;
+        uint32_t mode;
+        const char *ino;
+        const char *nlink;
+        const char *data;
+    } entries[] = {
+        { "a", 0100640, "00000007", "00000002", "" },
+        { "sub/b", 0100640, "00000007", "00000002", "link\n" },
+        { "null", 020666, "00000008", "00000001", "" },
+    };
+    uint8_t image[1024];
+    size_t at = 0;
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+        uint32_t n = (uint32_t)strlen(entries[i].data);
+        size_t head = put_newc_header(&image[at], entries[i].name, entries[i].mode, n);
+        memcpy(&image[at + 6U], entries[i].ino, 8);
+        memcpy(&image[at + 6U + 8U * 2U], "000003E8", 8);             // uid
+        memcpy(&image[at + 6U + 8U * 4U], entries[i].nlink, 8);
+        memcpy(&image[at + 6U + 8U * 8U], "00000011", 8);             // dev minor
+        memcpy(&image[at + 6U + 8U * 9U], (i == 2) ? "00000001" : "00000000", 8);
+        memcpy(&image[at + 6U + 8U * 10U], (i == 2) ? "00000003" : "00000000", 8);
+        at += head;
+        memset(&image[at], 0, (n + 3U) & ~3U);
+        memcpy(&image[at], entries[i].data, n);
+        at += (n + 3U) & ~3U;
+    }
+    at += put_newc(&image[at], "TRAILER!!!", 0, 0);
+
+    cpiofs_t src;
+    cpiofs_t out;
+    cpiofs_writer_t w;
+    struct write_sink sink = { 0 };
+    int ret = -1;
+    if (cpiofs_mount(&src, image, (cpio_size_t)at) != CPIO_ERR_OK) {
+        return -1;
+    }
+    cpiofs_writer_init(&w, write_sink_put, &sink, CPIOFS_WRITE_NEWC, 4096);
+    for (uint32_t e = 0; e < src.index.count; e++) {
+        struct cpio_entry ent;
+        const struct header_old_cpio *d = cpiofs_header_at(&src, src.index.entry[e], &ent, NULL);
+        const cpiofs_writer_meta_t meta = {
+            .uid = ent.uid,
+            .gid = ent.gid,
+            .nlink = ent.nlink,
+            .ino = ent.ino,
+            .dev = ent.dev,
+            .rdev = ent.rdev,
+        };
+        cpiofs_writer_add_meta(&w, (const char*)d + ent.name, ent.mode, ent.mtime, &meta,
+                               (const uint8_t*)src.head + src.index.data[e], src.index.fsize[e]);
+    }
+    if ((cpiofs_writer_finish(&w) == CPIO_ERR_OK) &&
+        (cpiofs_mount(&out, sink.bytes, (cpio_size_t)sink.size) == CPIO_ERR_OK)) {
+        ret = (out.index.count == src.index.count) ? 0 : -1;
+        for (uint32_t e = 0; (e < out.index.count) && (ret == 0); e++) {
+            struct cpio_entry a;
+            struct cpio_entry b;
+            cpiofs_header_at(&src, src.index.entry[e], &a, NULL);
+            cpiofs_header_at(&out, out.index.entry[e], &b, NULL);
+            if ((a.mode != b.mode) || (a.filesize != b.filesize) || (a.ino != b.ino) || (a.nlink != b.nlink) ||
+                (a.dev != b.dev) || (a.rdev != b.rdev) || (a.uid != b.uid) || (a.gid != b.gid) ||
+                (memcmp((const uint8_t*)src.head + src.index.data[e], (const uint8_t*)out.head + out.index.data[e],
+                        a.filesize) != 0)) {
+                fprintf(stderr, "cpiofs_writer_add_meta changed entry %u\n", (unsigned int)e);
+                ret = -1;
+            }
+        }
+        cpiofs_unmount(&out);
+    }
+    cpiofs_unmount(&src);
+    free(sink.bytes);
+    return ret;
+}
+
+static int test_cpiofs_writer(void) {
+    static const cpio_size_t aligns[] = { 1, 64, 4096, 65536 };
+    char deep[2100] = "dir/";
+    memset(&deep[4], 'x', 2000);
+    const char *const paths[] = { "./dir/a", "dir/b", deep, "dir/c" };
+    const uint32_t sizes[] = { 5, 0, 100, 70000 };
+    uint8_t *data = malloc(70000);
+    cpiofs_writer_t w;
+    int ret = 0;
+
+    if ((data == NULL) || (cpiofs_writer_init(&w, write_sink_put, NULL, CPIOFS_WRITE_NEWC, 48) != CPIO_ERR_PARAM)) {
+        free(data);
+        return -1;
+    }
+    for (unsigned int format = CPIOFS_WRITE_NEWC; (format <= CPIOFS_WRITE_BIN) && (ret == 0); format++) {
+        for (unsigned int a = 0; (a < sizeof(aligns) / sizeof(aligns[0])) && (ret == 0); a++) {
+            struct write_sink sink = { 0 };
+            cpiofs_writer_init(&w, write_sink_put, &sink, format, aligns[a]);
+            w.fill_mode = 0750;
+            w.fill_mtime = 7;
+            cpiofs_writer_add(&w, ".", 040750, 7, NULL, 0);
+            cpiofs_writer_add(&w, "./dir", 040700, 7, NULL, 0);
+            for (unsigned int i = 0; i < 4; i++) {
+                for (uint32_t j = 0; j < sizes[i]; j++) {
+                    data[j] = (uint8_t)(j * 13U + i);
+                }
+                cpiofs_writer_add(&w, paths[i], 0100640, 1000000U + i, data, sizes[i]);
+            }
+            cpiofs_writer_add(&w, "l", 0120777, 7, "dir/a", 5);
+            if ((cpiofs_writer_finish(&w) != CPIO_ERR_OK) || (sink.size != w.pos) || (sink.size % 512U != 0) ||
+                ((aligns[a] == 65536U) && (w.fillers == 0))) {
+                fprintf(stderr, "cpiofs_writer failed in format %u\n", format);
+                free(sink.bytes);
+                ret = -1;
+                break;
+            }
+            // mounted from an image aligned as much as its data
+            size_t room = (sink.size + 65535U) & ~(size_t)65535U;
+            uint8_t *image = aligned_alloc(65536, room);
+            cpiofs_t cpiofs;
+            ret = -1;
+            if ((image != NULL) && (memcpy(image, sink.bytes, sink.size) != NULL) &&
+                (cpiofs_mount(&cpiofs, image, (cpio_size_t)sink.size) == CPIO_ERR_OK)) {
+                cpio_size_t got = cpiofs_data_align(&cpiofs);
+                cpio_info_t info;
+                // the fillers look like the root
+                uint32_t roots = 0;
+                for (uint32_t e = 0; e < cpiofs.index.count; e++) {
+                    struct cpio_entry ent;
+                    if ((cpiofs.index.name_len[e] == 1U) && (cpiofs.index.strings[cpiofs.index.name[e]] == '.') &&
+                        (cpiofs_header_at(&cpiofs, cpiofs.index.entry[e], &ent, NULL) != NULL) &&
+                        (ent.mode == 040750) && (ent.mtime == 7)) {
+                        roots ++;
+                    }
+                }
+                if ((got >= aligns[a]) && (got % aligns[a] == 0) && (roots == w.fillers + 1U) &&
+                    (writer_check(&cpiofs, paths, sizes, 4) == 0) &&
+                    (cpiofs_stat(&cpiofs, "dir/c", &info) == CPIO_ERR_OK) && (info.mode == 0640) &&
+                    ((format != CPIOFS_WRITE_CRC) || (cpiofs_verify(&cpiofs, 1, NULL) > 0))) {
+                    ret = 0;
+                } else {
+                    fprintf(stderr, "cpiofs_writer archive in format %u aligned to %u is wrong (%u)\n", format,
+                            (unsigned int)aligns[a], (unsigned int)got);
+                }
+                cpiofs_unmount(&cpiofs);
+            }
+            // the padded names read the same without the index
+            cpiofs_t raw = {
+                .head = (const struct header_old_cpio*)image,
+                .size = (cpio_size_t)sink.size,
+            };
+            cpio_dir_t dir;
+            cpio_info_t info;
+            if ((ret == 0) && ((writer_check(&raw, paths, sizes, 4) == -1) ||
+                               (cpiofs_dir_open(&raw, &dir, "dir") != CPIO_ERR_OK))) {
+                ret = -1;
+            }
+            if (ret == 0) {
+                if ((cpiofs_dir_read(&dir, &info) != 1) || (info.filenames != 1U) || (info.filename[0] != 'a')) {
+                    fprintf(stderr, "cpiofs_writer names read wrong without the index\n");
+                    ret = -1;
+                }
+                cpiofs_dir_close(&dir);
+            }
+            free(image);
+            free(sink.bytes);
+        }
+    }
+    free(data);
+    if (ret == -1) {
+        return -1;
+    }
+    return writer_copy_links();
+}
+
+// An archive of the entries, each one "path", mode and data
+static int overlay_layer(cpiofs_t *fs, struct write_sink *sink, const char *const *entries, unsigned int n) {
+    cpiofs_writer_t w;
+    cpiofs_writer_init(&w, write_sink_put, sink, CPIOFS_WRITE_NEWC, 4);
+    for (unsigned int i = 0; i < n; i++) {
+        const char *data = entries[3 * i + 2];
+        cpiofs_writer_add(&w, entries[3 * i], (uint32_t)strtoul(entries[3 * i + 1], NULL, 8), 0, data,
+                          (cpio_size_t)strlen(data));
+    }
+    if (cpiofs_writer_finish(&w) != CPIO_ERR_OK) {
+        return -1;
+    }
+    return cpiofs_mount(fs, sink->bytes, (cpio_size_t)sink->size);
+}
+
+static int count_walk(const cpio_info_t *info, unsigned int depth, cpiofs_walk_event_t event, void *ctx) {
+    (void)info;
+    (void)depth;
+    (void)event;
+    (*(int*)ctx) ++;
+    return CPIOFS_WALK_CONTINUE;
+}
+
+static int test_cpiofs_overlay(void) {
+    static const char *const base[] = {
+        "./", "40755", "",
+        "etc", "40755", "",
+        "etc/a", "100644", "base-a",
+        "etc/b", "100644", "base-b",
+        "etc/sub", "40755", "",
+        "etc/sub/x", "100644", "x",
+        "lib", "40755", "",
+        "lib/old", "100644", "old",
+        "var", "40755", "",
+        "var/y", "100644", "y",
+    };
+    static const char *const patch[] = {
+        "./", "40755", "",
+        "etc", "40700", "",
+        "etc/a", "100644", "patch-a",
+        "etc/.wh.b", "100644", "",
+        "lib", "100644", "now a file",
+        "new", "100644", "new",
+    };
+    static const char *const opaque[] = {
+        "var", "40755", "",
+        "var/.wh..wh..opq", "100644", "",
+        "var/z", "100644", "z",
+    };
+    static const char *const gone[] = { "etc/b", "etc/.wh.b", "lib/old", "var/y", "var/.wh..wh..opq" };
+    struct write_sink sinks[3] = { { 0 } };
+    cpiofs_t layers[3];
+    cpiofs_t *order[3] = { &layers[0], &layers[1], &layers[2] };
+    cpiofs_t cpiofs;
+    cpio_info_t info;
+    cpio_file_t file;
+    cpio_dir_t dir;
+    char buffer[16];
+    int ret = -1;
+
+    memset(layers, 0, sizeof(layers));
+    if ((overlay_layer(&layers[0], &sinks[0], base, 10) != CPIO_ERR_OK) ||
+        (overlay_layer(&layers[1], &sinks[1], patch, 6) != CPIO_ERR_OK) ||
+        (overlay_layer(&layers[2], &sinks[2], opaque, 3) != CPIO_ERR_OK)) {
+        fprintf(stderr, "cpiofs_mount_overlay layers not mounted\n");
+        goto end;
+    }
+    if (cpiofs_mount_overlay(&cpiofs, order, 3) != CPIO_ERR_OK) {
+        fprintf(stderr, "cpiofs_mount_overlay failed\n");
+        goto end;
+    }
+    if (cpiofs_unmount(&layers[0]) != CPIO_ERR_BUSY) {
+        fprintf(stderr, "a layer has to stay mounted under the overlay\n");
+        goto unmount;
+    }
+    // the upper layers win, whiteouts and files hide what is below
+    if ((cpiofs_stat(&cpiofs, "./etc", &info) != CPIO_ERR_OK) || (info.mode != 0700) ||
+        (cpiofs_stat(&cpiofs, "lib", &info) != CPIO_ERR_OK) || (info.type != CPIO_FILE_TYPE_MASK) ||
+        (cpiofs_stat(&cpiofs, "/etc/sub/x", &info) != CPIO_ERR_OK) ||
+        (cpiofs_stat(&cpiofs, "var/z", &info) != CPIO_ERR_OK) || (info.size != 1)) {
+        fprintf(stderr, "cpiofs_mount_overlay merged wrong\n");
+        goto unmount;
+    }
+    for (unsigned int i = 0; i < sizeof(gone) / sizeof(gone[0]); i++) {
+        if (cpiofs_stat(&cpiofs, gone[i], &info) != CPIO_ERR_NEXIST) {
+            fprintf(stderr, "cpiofs_mount_overlay shows %s\n", gone[i]);
+            goto unmount;
+        }
+    }
+    if ((cpiofs_file_open(&cpiofs, &file, "etc/a") != CPIO_ERR_OK) ||
+        (cpiofs_file_read(&file, buffer, sizeof(buffer)) != 7) || (memcmp(buffer, "patch-a", 7) != 0) ||
+        (file.fs != &layers[1])) {
+        fprintf(stderr, "etc/a has to be read from the patch\n");
+        cpiofs_file_close(&file);
+        goto unmount;
+    }
+    cpiofs_file_close(&file);
+
+    static const char *const listings[][5] = {
+        { "etc", "a", "sub", NULL },
+        { "", "etc", "lib", "new", "var" },
+        { "var", "z", NULL },
+    };
+    for (unsigned int i = 0; i < 3; i++) {
+        if (cpiofs_dir_open(&cpiofs, &dir, listings[i][0]) != CPIO_ERR_OK) {
+            fprintf(stderr, "cpiofs_mount_overlay lost directory %s\n", listings[i][0]);
+            goto unmount;
+        }
+        // any order, every name once
+        unsigned int seen = 0;
+        unsigned int n = 0;
+        while (cpiofs_dir_read(&dir, &info) == 1) {
+            for (unsigned int j = 1; (j < 5) && (listings[i][j] != NULL); j++) {
+                if ((strlen(listings[i][j]) == info.filenames) &&
+                    (memcmp(listings[i][j], info.filename, info.filenames) == 0)) {
+                    seen |= 1U << j;
+                }
+            }
+            n ++;
+        }
+        cpiofs_dir_close(&dir);
+        unsigned int want = 0;
+        for (unsigned int j = 1; (j < 5) && (listings[i][j] != NULL); j++) {
+            want |= 1U << j;
+        }
+        if ((seen != want) || (n != (unsigned int)__builtin_popcount(want))) {
+            fprintf(stderr, "cpiofs_mount_overlay lists %s wrong\n", listings[i][0]);
+            goto unmount;
+        }
+    }
+    int walked = 0;
+    if (cpiofs_walk(&cpiofs, "", count_walk, &walked, 0) != CPIO_ERR_NOTSUP) {
+        fprintf(stderr, "cpiofs_walk has to refuse an overlay\n");
+        goto unmount;
+    }
+    ret = 0;
+
+unmount:
+    cpiofs_unmount(&cpiofs);
+end:
+    for (unsigned int i = 0; i < 3; i++) {
+        if (sinks[i].bytes != NULL) {
+            cpiofs_unmount(&layers[i]);
+        }
+        free(sinks[i].bytes);
+    }
+    return ret;
+}
+
+struct stream_check {
+    cpiofs_t *fs;
+    cpio_file_t file;   // the entry being streamed, from the mount
+    uint32_t entries;
+    int ret;
+};
+
+static int stream_check_entry(const cpio_info_t *info, void *ctx) {
+    struct stream_check *check = ctx;
+    cpio_info_t want;
+    char path[256];
+    snprintf(path, sizeof(path), "%.*s", (int)info->filepaths, info->filepath);
+    check->entries ++;
+    cpiofs_file_close(&check->file);
+    if ((cpiofs_stat(check->fs, path, &want) != CPIO_ERR_OK) || (want.type != info->type) ||
+        (want.size != info->size)) {
+        fprintf(stderr, "cpiofs_stream reported %s wrong\n", path);
+        check->ret = -1;
+        return CPIO_ERR_UNKNOWN;
+    }
+    if (info->type != CPIO_FILE_TYPE_MASK) {
+        return CPIOFS_STREAM_SKIP;
+    }
+    return cpiofs_file_open(check->fs, &check->file, path);
+}
+
+static int stream_check_data(const void *data, cpio_size_t size, cpio_off_t off, void *ctx) {
+    struct stream_check *check = ctx;
+    const void *view;
+    cpio_size_t got;
+    if ((cpiofs_file_view(&check->file, &view, &got) != CPIO_ERR_OK) || (off + size > got) ||
+        (memcmp((const uint8_t*)view + off, data, size) != 0)) {
+        fprintf(stderr, "cpiofs_stream passed wrong data at %u\n", (unsigned int)off);
+        check->ret = -1;
+        return CPIO_ERR_UNKNOWN;
+    }
+    return CPIO_ERR_OK;
+}
+
+// Stream image in chunks of chunk bytes, every entry is checked against
+// the mount of the same image
+static int stream_chunks(const uint8_t *image, cpio_size_t size, cpio_size_t chunk, uint32_t *entries) {
+    struct stream_check check = { 0 };
+    cpiofs_t cpiofs;
+    cpiofs_stream_t *stream;
+    if (cpiofs_mount(&cpiofs, image, size) != CPIO_ERR_OK) {
+        return -1;
+    }
+    check.fs = &cpiofs;
+    int ret = cpiofs_stream_open(&stream, stream_check_entry, stream_check_data, &check);
+    for (cpio_size_t at = 0; (at < size) && (ret == CPIO_ERR_OK); at += chunk) {
+        ret = cpiofs_stream_feed(stream, &image[at], (size - at < chunk) ? size - at : chunk);
+    }
+    if (ret == CPIO_ERR_OK) {
+        ret = cpiofs_stream_close(stream);
+    } else {
+        cpiofs_stream_close(stream);
+    }
+    cpiofs_file_close(&check.file);
+    *entries = check.entries;
+    if ((check.entries != cpiofs.index.count) || (check.ret != 0)) {
+        ret = -1;
+    }
+    cpiofs_unmount(&cpiofs);
+    return ret;
+}
+
+static int count_entry(const cpio_info_t *info, void *ctx) {
+    (void)info;
+    (*(uint32_t*)ctx) ++;
+    return CPIO_ERR_OK;
+}
+
+static int test_cpiofs_stream(const uint8_t *data, long size) {
+    static const cpio_size_t chunks[] = { 1, 7, 110, 4096, 1U << 20 };
+    uint32_t entries;
+    for (unsigned int i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        if (stream_chunks(data, (cpio_size_t)size, chunks[i], &entries) != CPIO_ERR_OK) {
+            fprintf(stderr, "cpiofs_stream failed in chunks of %u bytes\n", (unsigned int)chunks[i]);
+            return -1;
+        }
+    }
+
+    // a crc archive with aligned names, then broken in a few ways
+    struct write_sink sink = { 0 };
+    cpiofs_writer_t w;
+    uint8_t blob[3000];
+    for (unsigned int i = 0; i < sizeof(blob); i++) {
+        blob[i] = (uint8_t)(i * 7U);
+    }
+    cpiofs_writer_init(&w, write_sink_put, &sink, CPIOFS_WRITE_CRC, 64);
+    cpiofs_writer_add(&w, "./", 040755, 0, NULL, 0);
+    cpiofs_writer_add(&w, "a", 0100644, 0, blob, sizeof(blob));
+    cpiofs_writer_add(&w, "b/../c", 0100644, 0, blob, 5);
+    if ((cpiofs_writer_finish(&w) != CPIO_ERR_OK) ||
+        (stream_chunks(sink.bytes, (cpio_size_t)sink.size, 3, &entries) != CPIO_ERR_OK) || (entries != 3)) {
+        fprintf(stderr, "cpiofs_stream failed on a crc archive\n");
+        free(sink.bytes);
+        return -1;
+    }
+    int ret = 0;
+    cpiofs_stream_t *stream;
+    entries = 0;
+    cpiofs_stream_open(&stream, count_entry, NULL, &entries);
+    if ((cpiofs_stream_feed(stream, sink.bytes, (cpio_size_t)sink.size / 4U) != CPIO_ERR_OK) ||
+        (cpiofs_stream_close(stream) != CPIO_ERR_CORRUPT)) {
+        fprintf(stderr, "cpiofs_stream has to see a truncated archive\n");
+        ret = -1;
+    }
+    // flip a data byte of a
+    const void *view;
+    cpio_size_t got;
+    cpio_file_t file;
+    cpiofs_t cpiofs;
+    if ((ret == 0) && (cpiofs_mount(&cpiofs, sink.bytes, (cpio_size_t)sink.size) == CPIO_ERR_OK)) {
+        if ((cpiofs_file_open(&cpiofs, &file, "a") == CPIO_ERR_OK) &&
+            (cpiofs_file_view(&file, &view, &got) == CPIO_ERR_OK)) {
+            sink.bytes[(const uint8_t*)view - sink.bytes + 100] ^= 1U;
+            cpiofs_file_close(&file);
+        }
+        cpiofs_unmount(&cpiofs);
+        cpiofs_stream_open(&stream, count_entry, NULL, &entries);
+        if ((cpiofs_stream_feed(stream, sink.bytes, (cpio_size_t)sink.size) != CPIO_ERR_CORRUPT) ||
+            (cpiofs_stream_feed(stream, "", 1) != CPIO_ERR_CORRUPT) ||
+            (cpiofs_stream_close(stream) != CPIO_ERR_CORRUPT)) {
+            fprintf(stderr, "cpiofs_stream has to check the crc\n");
+            ret = -1;
+        }
+    }
+    free(sink.bytes);
+    return ret;
+}
+
+// Headers of the chain of fs, one at a time, and where it stops
+static uint32_t chain_serial(const cpiofs_t *fs, cpio_off_t *chain) {
+    uint8_t buf[CPIO_ENTRY_BUFFER];
+    struct cpio_entry ent;
+    const struct header_old_cpio* d;
+    cpio_off_t off = 0;
+    uint32_t n = 0;
+    for (; ((d = cpiofs_header_at(fs, off, &ent, buf)) != NULL) && !cpio_is_trailer(d, &ent); off += ent.next) {
+        chain[n ++] = off;
+    }
+    chain[n] = off;
+    return n;
+}
+
+static int chain_check(const cpiofs_t *fs, const cpio_off_t *expected, uint32_t count) {
+    for (unsigned int nthread = 0; nthread <= 7U; nthread++) {
+        cpio_off_t *chain = NULL;
+        uint32_t n = 0;
+        if ((cpiofs_chain(fs, nthread, &chain, &n) != CPIO_ERR_OK) || (n != count) ||
+            (memcmp(chain, expected, (count + 1U) * sizeof(cpio_off_t)) != 0)) {
+            fprintf(stderr, "chain with %u threads: %u headers instead of %u\n", nthread, n, count);
+            free(chain);
+            return -1;
+        }
+        free(chain);
+    }
+    return 0;
+}
+
+#define CHAIN_IMAGE     (5U << 20)
+#define CHAIN_FILES     3000U
+
+static int test_cpiofs_chain(const uint8_t *data, long size) {
+    cpiofs_t cpiofs = {
+        .head = (const struct header_old_cpio *)data,
+        .size = size,
+    };
+    cpiofs_t mounted[2];
+    int ret = 0;
+
+    cpio_off_t *expected = malloc((CHAIN_FILES + 8U) * sizeof(cpio_off_t));
+    uint8_t *image = malloc(CHAIN_IMAGE);
+    if ((expected == NULL) || (image == NULL)) {
+        free(expected);
+        free(image);
+        return -1;
+    }
+    if (chain_check(&cpiofs, expected, chain_serial(&cpiofs, expected)) == -1) {
+        ret = -1;
+        goto end;
+    }
+
+    // a few MB: small files around a big one whose data is full of
+    // headers, which the threads that start inside it take for true ones
+    size_t off = put_newc(image, "d", 040755, 0);
+    char name[32];
+    for (uint32_t i = 0; i < CHAIN_FILES; i++) {
+        snprintf(name, sizeof(name), "d/f%u", (unsigned int)i);
+        off += put_newc(&image[off], name, 0100644, (i * 37U) % 1500U);
+        if (i == CHAIN_FILES / 3U) {
+            size_t big = put_newc(&image[off], "d/big", 0100644, 2U << 20);
+            for (size_t at = 512; at + 4096U < big; at += 4096U) {
+                snprintf(name, sizeof(name), "d/decoy%u", (unsigned int)at);
+                put_newc(&image[off + at], name, 0100644, 3000U + (uint32_t)(at % 8192U));
+            }
+            off += big;
+        }
+    }
+    off += put_newc(&image[off], "TRAILER!!!", 0, 0);
+    memset(&image[off], 0, CHAIN_IMAGE - off);
+    cpiofs.head = (const struct header_old_cpio *)image;
+    cpiofs.size = CHAIN_IMAGE;
+    uint32_t count = chain_serial(&cpiofs, expected);
+    if ((count != CHAIN_FILES + 2U) || (chain_check(&cpiofs, expected, count) == -1)) {
+        fprintf(stderr, "chain of the decoy archive failed\n");
+        ret = -1;
+        goto end;
+    }
+    // an archive cut in the middle stops where a walk stops
+    cpiofs.size = (cpio_size_t)(expected[count / 2U] + 50U);
+    count = chain_serial(&cpiofs, expected);
+    if (chain_check(&cpiofs, expected, count) == -1) {
+        fprintf(stderr, "chain of the cut archive failed\n");
+        ret = -1;
+        goto end;
+    }
+
+    if ((cpiofs_mount(&mounted[0], image, CHAIN_IMAGE) != CPIO_ERR_OK) ||
+        (cpiofs_mount_threads(&mounted[1], image, CHAIN_IMAGE, 4) != CPIO_ERR_OK)) {
+        ret = -1;
+        goto end;
+    }
+    const cpiofs_index_t *a = &mounted[0].index;
+    const cpiofs_index_t *b = &mounted[1].index;
+    if ((a->count != b->count) || (a->trailer != b->trailer) ||
+        (memcmp(a->entry, b->entry, a->count * sizeof(cpio_off_t)) != 0) ||
+        (memcmp(a->sorted, b->sorted, a->count * sizeof(uint32_t)) != 0)) {
+        fprintf(stderr, "threaded mount has to build the same index\n");
+        ret = -1;
+    }
+    cpiofs_unmount(&mounted[0]);
+    cpiofs_unmount(&mounted[1]);
+
+end:
+    free(expected);
+    free(image);
+    return ret;
+}
+
+#ifdef CPIO_LARGEFILE
+
+// An archive past 4 GB made up by a read callback: the headers and a
+// few data bytes, zeros everywhere else
+struct large_part {
+    cpio_off_t off;
+    uint8_t bytes[160];
+    size_t len;
+};
+
+struct large_archive {
+    struct large_part part[8];
+    unsigned int nparts;
+    cpio_size_t size;
+};
+
+static cpio_ssize_t large_read(void *ctx, cpio_off_t off, void *buffer, cpio_size_t size) {
+    const struct large_archive *a = ctx;
+    if ((off > a->size) || (size > a->size - off)) {
+        return CPIO_ERR_IO;
+    }
+    memset(buffer, 0, size);
+    for (unsigned int i = 0; i < a->nparts; i++) {
+        const struct large_part *p = &a->part[i];
+        cpio_off_t lo = (p->off > off) ? p->off : off;
+        cpio_off_t hi = ((p->off + p->len) < (off + size)) ? p->off + p->len : off + size;
+        if (lo < hi) {
+            memcpy((uint8_t*)buffer + (lo - off), &p->bytes[lo - p->off], hi - lo);
+        }
+    }
+    return (cpio_ssize_t)size;
+}
+
+static void large_entry(struct large_archive *a, const char *name, uint32_t size, const char *data) {
+    struct large_part *p = &a->part[a->nparts ++];
+    size_t at = put_newc_header(p->bytes, name, 0100644, size);
+    p->off = a->size;
+    p->len = at;
+    if (data != NULL) {
+        memcpy(&p->bytes[at], data, size);
+        p->len += size;
+    }
+    a->size += at + ((size + 3U) & ~(cpio_size_t)3U);
+}
+
+static int test_cpiofs_large(void) {
+    struct large_archive a = { .nparts = 0, .size = 0 };
+    cpiofs_t cpiofs;
+    cpio_info_t info;
+    cpio_file_t file;
+    char buffer[8];
+    int ret = 0;
+
+    large_entry(&a, "big0", 0xC0000000U, NULL);
+    large_entry(&a, "big1", 0xFFFFFFFCU, NULL);
+    large_entry(&a, "big2", 0x80000000U, NULL);
+    large_entry(&a, "last.txt", 4, "tail");
+    large_entry(&a, "TRAILER!!!", 0, NULL);
+    if (cpiofs_mount_store(&cpiofs, large_read, &a, a.size, 4096, 4) != CPIO_ERR_OK) {
+        fprintf(stderr, "mount of a %llu bytes archive failed\n", (unsigned long long)a.size);
+        return -1;
+    }
+    if ((cpiofs_stat(&cpiofs, "big1", &info) != CPIO_ERR_OK) || (info.size != 0xFFFFFFFCU)) {
+        fprintf(stderr, "stat of a 4 GB file failed\n");
+        ret = -1;
+    }
+    // seeks past 2 GB
+    if ((ret == 0) && (cpiofs_file_open(&cpiofs, &file, "big1") == CPIO_ERR_OK)) {
+        if ((cpiofs_file_size(&file) != (cpio_soff_t)0xFFFFFFFCU) ||
+            (cpiofs_file_seek(&file, -4, CPIO_SEEK_CUR) != (cpio_soff_t)0xFFFFFFF8U) ||
+            (cpiofs_file_read(&file, buffer, sizeof(buffer)) != 4) || (cpiofs_file_read(&file, buffer, 1) != 0)) {
+            fprintf(stderr, "seek in a 4 GB file failed\n");
+            ret = -1;
+        }
+        cpiofs_file_close(&file);
+    } else {
+        ret = -1;
+    }
+    // data past 8 GB
+    if ((ret == 0) && (cpiofs_file_open(&cpiofs, &file, "last.txt") == CPIO_ERR_OK)) {
+        if ((file.data <= (cpio_off_t)UINT32_MAX * 2U) || (cpiofs_file_read(&file, buffer, sizeof(buffer)) != 4) ||
+            (memcmp(buffer, "tail", 4) != 0)) {
+            fprintf(stderr, "read past 8 GB failed\n");
+            ret = -1;
+        }
+        cpiofs_file_close(&file);
+    } else {
+        ret = -1;
+    }
+    if (cpiofs_unmount(&cpiofs) != CPIO_ERR_OK) {
+        ret = -1;
+    }
+    return ret;
+}
+
+#endif
+
+struct aio_result {
+    cpio_ssize_t result;
+    int calls;
+};
+
+static void aio_done(cpio_ssize_t result, void *ctx) {
+    struct aio_result *r = ctx;
+    r->result = result;
+    r->calls ++;
+}
+
+// Reads through both backends must match cpiofs_file_pread
+static int test_cpiofs_aio_backend(cpiofs_t *cpiofs, int fd, unsigned int flags) {
+    cpiofs_aio_t *aio = NULL;
+    cpio_file_t file = { .fs = NULL };
+    char buffer[3][16];
+    struct aio_result res[3] = { { 0, 0 } };
+    static const cpio_off_t offs[3] = { 0, 3, 10 };
+    int ret = -1;
+
+    if (cpiofs_aio_open(&aio, cpiofs, fd, 4, flags) != CPIO_ERR_OK) {
+        fprintf(stderr, "aio open has to succeed with flags %u\n", flags);
+        return -1;
+    }
+    if (((flags & CPIOFS_AIO_THREADS) != 0) && cpiofs_aio_uring(aio)) {
+        fprintf(stderr, "aio has to run on threads when asked\n");
+        goto end;
+    }
+    if (cpiofs_file_open_async(aio, &file, "./dir1/file2.txt", 4096) != CPIO_ERR_OK) {
+        fprintf(stderr, "./dir1/file2.txt has to be opened async\n");
+        goto end;
+    }
+    for (int k = 0; k < 3; k++) {
+        if (cpiofs_file_read_async(aio, &file, buffer[k], sizeof(buffer[k]), offs[k], aio_done, &res[k]) !=
+            CPIO_ERR_OK) {
+            fprintf(stderr, "async read %d has to be queued\n", k);
+            goto end;
+        }
+    }
+    // the readahead and the three reads take the four slots
+    if ((cpiofs_file_read_async(aio, &file, buffer[0], 1, 0, aio_done, &res[0]) != CPIO_ERR_BUSY) ||
+        (cpiofs_file_read_async(aio, &file, buffer[0], 1, 11, aio_done, &res[0]) != CPIO_ERR_SEEK_OUT)) {
+        fprintf(stderr, "async read has to be busy or out of the file\n");
+        goto end;
+    }
+    int count = 0;
+    while (count < 3) {
+        int n = cpiofs_aio_poll(aio, 3U - (unsigned int)count);
+        if (n <= 0) {
+            fprintf(stderr, "aio poll failed %d\n", n);
+            goto end;
+        }
+        count += n;
+    }
+    for (int k = 0; k < 3; k++) {
+        char expect[16];
+        cpio_ssize_t n = cpiofs_file_pread(&file, expect, sizeof(expect), offs[k]);
+        if ((res[k].calls != 1) || (res[k].result != n) || (memcmp(buffer[k], expect, (size_t)n) != 0)) {
+            fprintf(stderr, "async read %d differs from pread\n", k);
+            goto end;
+        }
+    }
+    ret = 0;
+end:
+    if ((cpiofs_aio_close(aio) != CPIO_ERR_OK) || ((file.fs != NULL) && (cpiofs_file_close(&file) != CPIO_ERR_OK))) {
+        ret = -1;
+    }
+    return ret;
+}
+
+static int test_cpiofs_aio(const char *path) {
+    cpiofs_t cpiofs;
+    int ret = -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "open of %s failed\n", path);
+        return -1;
+    }
+    if (cpiofs_mount_fd(&cpiofs, fd, 0) != CPIO_ERR_OK) {
+        fprintf(stderr, "mount of %s failed\n", path);
+        close(fd);
+        return -1;
+    }
+    if ((test_cpiofs_aio_backend(&cpiofs, fd, 0) == 0) &&
+        (test_cpiofs_aio_backend(&cpiofs, fd, CPIOFS_AIO_THREADS) == 0)) {
+        ret = 0;
+    }
+    if (cpiofs_unmount(&cpiofs) != CPIO_ERR_OK) {
+        ret = -1;
+    }
+    close(fd);
+    if (ret == -1) {
+        return -1;
+    }
+
+    // the files of an overlay are read from the file kept by their layer
+    cpiofs_t layer;
+    cpiofs_t *layers[1] = { &layer };
+    if (cpiofs_mount_path(&layer, path, CPIOFS_MAP_KEEP_FD) != CPIO_ERR_OK) {
+        return -1;
+    }
+    if (cpiofs_mount_overlay(&cpiofs, layers, 1) != CPIO_ERR_OK) {
+        cpiofs_unmount(&layer);
+        return -1;
+    }
+    if ((test_cpiofs_aio_backend(&cpiofs, -1, 0) == -1) ||
+        (test_cpiofs_aio_backend(&cpiofs, -1, CPIOFS_AIO_THREADS) == -1)) {
+        fprintf(stderr, "aio has to read the files of an overlay\n");
+        ret = -1;
+    }
+    cpiofs_unmount(&cpiofs);
+    cpiofs_unmount(&layer);
+    return ret;
+}
+
+// Archive compiled in by cpioembed, see meson.build
+extern const cpiofs_embedded_t test_embed;
+
+// Every path found through the perfect hash has to be the one a scan of
+// the image finds, for a runtime hash of the archive and the compiled one
+static int check_phf(cpiofs_t *indexed, const void *image, cpio_size_t size) {
+    cpiofs_t raw = {
+        .head = (const struct header_old_cpio *)image,
+        .size = size,
+    };
+    const cpiofs_index_t *index = &indexed->index;
+    char path[CPIO_NAME_MAX + 1];
+    for (uint32_t e = 0; e < index->count; e++) {
+        cpio_info_t a;
+        cpio_info_t b;
+        memcpy(path, &index->strings[index->name[e]], index->name_len[e]);
+        path[index->name_len[e]] = '\0';
+        int ra = cpiofs_stat(indexed, path, &a);
+        int rb = cpiofs_stat(&raw, path, &b);
+        if ((ra != rb) || ((ra == CPIO_ERR_OK) && ((a.type != b.type) || (a.size != b.size)))) {
+            fprintf(stderr, "perfect hash lookup of %s differs from a scan\n", path);
+            return -1;
+        }
+    }
+    cpio_info_t info;
+    if ((cpiofs_stat(indexed, "./none/of/these", &info) != CPIO_ERR_NEXIST) ||
+        (cpiofs_stat(indexed, "", &info) != cpiofs_stat(&raw, "", &info))) {
+        fprintf(stderr, "perfect hash has to miss like a scan\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int test_cpiofs_embedded(const uint8_t *data, long fsize) {
+    cpiofs_t cpiofs;
+    if (cpiofs_mount_embedded(&cpiofs, &test_embed) != CPIO_ERR_OK) {
+        fprintf(stderr, "embedded archive has to mount\n");
+        return -1;
+    }
+    if ((cpiofs.index.pilot == NULL) || (cpiofs.index.mem != NULL) || (cpiofs.index.count < 3000U) ||
+        (check_phf(&cpiofs, test_embed.image, test_embed.size) == -1) || (cpiofs_unmount(&cpiofs) != CPIO_ERR_OK)) {
+        fprintf(stderr, "embedded archive has to be found through its perfect hash\n");
+        return -1;
+    }
+    cpiofs_embedded_t other = test_embed;
+    other.image = data;
+    if (cpiofs_mount_embedded(&cpiofs, &other) != CPIO_ERR_PARAM) {
+        fprintf(stderr, "embedded tables of another image have to be refused\n");
+        return -1;
+    }
+
+    // the same hash built at runtime over the archive of the test
+    uint32_t *pilot = NULL;
+    int ret = -1;
+    if (cpiofs_mount(&cpiofs, data, fsize) != CPIO_ERR_OK) {
+        return -1;
+    }
+    cpiofs_index_t slots = cpiofs.index;
+    if (cpiofs_index_phf(&cpiofs.index, &pilot, &cpiofs.index.nbucket, &cpiofs.index.nphf) != CPIO_ERR_OK) {
+        fprintf(stderr, "perfect hash of the archive has to build\n");
+        goto end;
+    }
+    cpiofs.index.pilot = pilot;
+    cpiofs.index.phf = &pilot[cpiofs.index.nbucket];
+    for (uint32_t k = 0; k < cpiofs.index.nphf; k++) {
+        uint32_t e = cpiofs.index.phf[k];
+        if (cpiofs_index_probe(&slots, &slots.strings[slots.name[e]], slots.name_len[e], slots.hash[e],
+                               0xffffU) != e) {
+            fprintf(stderr, "perfect hash slot %" PRIu32 " has not the first entry of its path\n", k);
+            goto end;
+        }
+    }
+    ret = check_phf(&cpiofs, data, fsize);
+end:
+    free(pilot);
+    cpiofs.index.pilot = NULL;
+    cpiofs_unmount(&cpiofs);
+    return ret;
+}
+
+static int test_cpiofs_mount_path(const char *path) {
+    cpiofs_t cpiofs;
+
+    if (cpiofs_mount_path(&cpiofs, path, CPIOFS_MAP_POPULATE | CPIOFS_MAP_ADVISE) != CPIO_ERR_OK) {
+        fprintf(stderr, "mount of %s failed\n", path);
+        return -1;
+    }
+    if ((test_cpiofs_stat(&cpiofs) == -1) || (test_cpiofs_dir(&cpiofs) == -1)) {
+        cpiofs_unmount(&cpiofs);
+        return -1;
+    }
+    if (cpiofs_unmount(&cpiofs) != CPIO_ERR_OK) {
+        fprintf(stderr, "unmount of %s failed\n", path);
+        return -1;
+    }
+    if (cpiofs_mount_path(&cpiofs, "./none.cpio", 0) != CPIO_ERR_NEXIST) {
+        fprintf(stderr, "./none.cpio has not to be mounted\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int result = 0;
+    FILE *fp = NULL;
+    uint8_t *data = NULL;
+
+    if (argc < 2) {
+        result = -1;
+        fprintf(stderr, "required 1 parameter\n");
+        goto end;
+    }
+    
+    fp = fopen(argv[1], "r");
+    if (NULL == fp) {
+        result = -2;
+        fprintf(stderr, "impossible to read file: %s\n", argv[1]);
+        goto end;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long fsize = ftell(fp);
+    rewind(fp);
+    if (fsize <= 0) {
+        result = -3;
+        fprintf(stderr, "impossible to have good filesize for: %s\n", argv[1]);
+        goto end;
+    }
+
+    data = malloc(fsize);
+    if (NULL == data) {
+        result = -4;
+        fprintf(stderr, "impossible to have take memory for: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (fread(data, 1, fsize, fp) != (size_t)fsize) {
+        result = -4;
+        fprintf(stderr, "impossible to read all data from: %s\n", argv[1]);
+        goto end;
+    }
+
+    cpiofs_t cpiofs = {
+        .head = (const struct header_old_cpio *)data,
+        .size = fsize,
+        .resource_count = 0,
+    };
+
+#if 1
+    {
+        unsigned long ufsize = (unsigned long)fsize;
+        for (const struct header_old_cpio* pdata = cpio_init_iter(data, ufsize); 
+            pdata != NULL; 
+            pdata = cpio_goto_next(pdata, &ufsize)) {
+            print_file(pdata, ufsize);
+            printf("\n+++++++++++++++++++\n");
+        }
+    }
+#endif
+
+    if (test_cpiofs_stat(&cpiofs) == -1) {
+        result = -5;
+        fprintf(stderr, "failed test_cpiofs: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_dir(&cpiofs) == -1) {
+        result = -5;
+        fprintf(stderr, "failed test_cpiofs_dir: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpio_hex() == -1) {
+        result = -6;
+        fprintf(stderr, "failed test_cpio_hex\n");
+        goto end;
+    }
+
+    if (test_cpiofs_mount(data, fsize) == -1) {
+        result = -6;
+        fprintf(stderr, "failed test_cpiofs_mount: %s\n", argv[1]);
+        goto end;
+    }
+    if (test_cpiofs_long_name() == -1) {
+        result = -6;
+        fprintf(stderr, "failed test_cpiofs_long_name\n");
+        goto end;
+    }
+
+    if (test_cpiofs_store(data, fsize) == -1) {
+        result = -7;
+        fprintf(stderr, "failed test_cpiofs_store: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_compressed(data, fsize) == -1) {
+        result = -9;
+        fprintf(stderr, "failed test_cpiofs_compressed: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_index_save(data, fsize) == -1) {
+        result = -10;
+        fprintf(stderr, "failed test_cpiofs_index_save: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_arena(data, fsize) == -1) {
+        result = -20;
+        fprintf(stderr, "failed test_cpiofs_arena: %s\n", argv[1]);
+        goto end;
+    }
+
+    cpiofs_t mounted;
+    if ((test_cpiofs_many(&cpiofs) == -1) || (cpiofs_mount(&mounted, data, fsize) != CPIO_ERR_OK) ||
+        (test_cpiofs_many(&mounted) == -1) || (cpiofs_unmount(&mounted) != CPIO_ERR_OK)) {
+        result = -12;
+        fprintf(stderr, "failed test_cpiofs_many: %s\n", argv[1]);
+        goto end;
+    }
+
+    if ((test_cpiofs_walk(&cpiofs) == -1) || (cpiofs_mount(&mounted, data, fsize) != CPIO_ERR_OK) ||
+        (test_cpiofs_walk(&mounted) == -1) || (cpiofs_unmount(&mounted) != CPIO_ERR_OK)) {
+        result = -13;
+        fprintf(stderr, "failed test_cpiofs_walk: %s\n", argv[1]);
+        goto end;
+    }
+
+    if ((test_cpiofs_glob(&cpiofs) == -1) || (cpiofs_mount(&mounted, data, fsize) != CPIO_ERR_OK) ||
+        (test_cpiofs_glob(&mounted) == -1) || (cpiofs_unmount(&mounted) != CPIO_ERR_OK)) {
+        result = -14;
+        fprintf(stderr, "failed test_cpiofs_glob: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_pread(data, fsize) == -1) {
+        result = -11;
+        fprintf(stderr, "failed test_cpiofs_pread: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_verify(data, fsize) == -1) {
+        result = -15;
+        fprintf(stderr, "failed test_cpiofs_verify: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_chain(data, fsize) == -1) {
+        result = -16;
+        fprintf(stderr, "failed test_cpiofs_chain: %s\n", argv[1]);
+        goto end;
+    }
+
+#ifdef CPIO_LARGEFILE
+    if (test_cpiofs_large() == -1) {
+        result = -17;
+        fprintf(stderr, "failed test_cpiofs_large\n");
+        goto end;
+    }
+#endif
+
+    if (test_cpiofs_aio(argv[1]) == -1) {
+        result = -18;
+        fprintf(stderr, "failed test_cpiofs_aio: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_embedded(data, fsize) == -1) {
+        result = -19;
+        fprintf(stderr, "failed test_cpiofs_embedded: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_sendfile(argv[1], data, fsize) == -1) {
+        result = -21;
+        fprintf(stderr, "failed test_cpiofs_sendfile: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_extract(argv[1], data, fsize) == -1) {
+        result = -22;
+        fprintf(stderr, "failed test_cpiofs_extract: %s\n", argv[1]);
+        goto end;
+    }
+
+    if (test_cpiofs_writer() == -1) {
+        result = -23;
+        fprintf(stderr, "failed test_cpiofs_writer\n");
+        goto end;
+    }
+
+    if (test_cpiofs_overlay() == -1) {
+        result = -24;
+        fprintf(stderr, "failed test_cpiofs_overlay\n");
+        goto end;
+    }
+
+    if (test_cpiofs_stream(data, fsize) == -1) {
+        result = -25;
+        fprintf(stderr, "failed test_cpiofs_stream\n");
+        goto end;
+    }
+
+    if (test_cpiofs_mount_path(argv[1]) == -1) {
+        result = -8;
+        fprintf(stderr, "failed test_cpiofs_mount_path: %s\n", argv[1]);
         goto end;
     }
 